@@ -0,0 +1,357 @@
+//
+//  LineBufferTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "LineBlock.h"
+#import "LineBuffer.h"
+#import "LineBufferHelpers.h"
+
+static const int kLineBufferTestWidth = 80;
+
+@interface LineBufferTest : XCTestCase<LineBufferDelegate>
+@end
+
+@implementation LineBufferTest {
+    // Line numbers kept up to date by -lineBuffer:didMoveLinesFrom:by:width:.
+    NSMutableArray<NSNumber *> *_trackedLines;
+}
+
+// Appends |count| lines that look like colorized compiler output: a few runs per line drawn from a
+// small palette.
+- (void)appendStyledLines:(int)count toLineBuffer:(LineBuffer *)lineBuffer {
+    screen_char_t line[kLineBufferTestWidth];
+    screen_char_t continuation = { 0 };
+    continuation.code = EOL_HARD;
+    for (int i = 0; i < count; i++) {
+        memset(line, 0, sizeof(line));
+        for (int x = 0; x < kLineBufferTestWidth; x++) {
+            line[x].code = 'a' + (i + x) % 26;
+            line[x].foregroundColorMode = ColorModeNormal;
+            line[x].foregroundColor = (x / 20 + i) % 8;
+            line[x].bold = (x < 10);
+            if (i % 7 == 0) {
+                line[x].foregroundColorMode = ColorMode24bit;
+                line[x].foregroundColor = 255;
+                line[x].fgGreen = 128;
+                line[x].fgBlue = x / 40;
+            }
+        }
+        [lineBuffer appendLine:line
+                        length:kLineBufferTestWidth
+                       partial:NO
+                         width:kLineBufferTestWidth
+                     timestamp:0
+                  continuation:continuation];
+    }
+}
+
+- (LineBuffer *)lineBufferWithCompaction:(BOOL)compact lines:(int)lines {
+    LineBuffer *lineBuffer = [[[LineBuffer alloc] initWithBlockSize:8192] autorelease];
+    lineBuffer.compactsFullBlocks = compact;
+    lineBuffer.compressesColdBlocks = NO;
+    [self appendStyledLines:lines toLineBuffer:lineBuffer];
+    return lineBuffer;
+}
+
+// Appends |count| lines of assorted lengths, some longer than the screen.
+- (LineBuffer *)lineBufferWithLinesOfAssortedLengths:(int)count {
+    LineBuffer *lineBuffer = [[[LineBuffer alloc] initWithBlockSize:8192] autorelease];
+    lineBuffer.compressesColdBlocks = NO;
+    const int maximumLength = kLineBufferTestWidth * 2;
+    screen_char_t line[maximumLength];
+    screen_char_t continuation = { 0 };
+    continuation.code = EOL_HARD;
+    memset(line, 0, sizeof(line));
+    for (int x = 0; x < maximumLength; x++) {
+        line[x].code = 'a' + x % 26;
+    }
+    for (int i = 0; i < count; i++) {
+        [lineBuffer appendLine:line
+                        length:(i * 37) % maximumLength
+                       partial:NO
+                         width:kLineBufferTestWidth
+                     timestamp:0
+                  continuation:continuation];
+    }
+    return lineBuffer;
+}
+
+- (void)assertLine:(int)lineNumber ofLineBuffer:(LineBuffer *)actual
+  equalsLine:(int)expectedLineNumber ofLineBuffer:(LineBuffer *)expected
+       width:(int)width {
+    screen_char_t expectedChars[kLineBufferTestWidth] = { 0 };
+    screen_char_t actualChars[kLineBufferTestWidth] = { 0 };
+    const int expectedEOL = [expected copyLineToBuffer:expectedChars
+                                                 width:width
+                                               lineNum:expectedLineNumber
+                                          continuation:NULL];
+    const int actualEOL = [actual copyLineToBuffer:actualChars
+                                             width:width
+                                           lineNum:lineNumber
+                                      continuation:NULL];
+    XCTAssertEqual(expectedEOL, actualEOL);
+    XCTAssertEqual(memcmp(expectedChars, actualChars, sizeof(expectedChars)), 0,
+                   @"Line %d differs from line %d", lineNumber, expectedLineNumber);
+}
+
+// Compares the first |lines| lines of two buffers at the test width.
+- (void)assertLineBuffer:(LineBuffer *)actual matchesLineBuffer:(LineBuffer *)expected lines:(int)lines {
+    for (int i = 0; i < lines; i++) {
+        [self assertLine:i ofLineBuffer:actual equalsLine:i ofLineBuffer:expected width:kLineBufferTestWidth];
+    }
+}
+
+- (void)testLazyReflowSettlesToExactLineCounts {
+    const int lines = 20000;
+    const int newWidth = 53;
+    LineBuffer *exact = [self lineBufferWithLinesOfAssortedLengths:lines];
+    LineBuffer *lazy = [self lineBufferWithLinesOfAssortedLengths:lines];
+    const int expectedCount = [exact numLinesWithWidth:newWidth];
+
+    // While resizing, the most recent lines are exact even if the count is not.
+    lazy.reflowsLazily = YES;
+    [lazy beginResizing];
+    const int approximateCount = [lazy numLinesWithWidth:newWidth];
+    for (int i = 1; i <= 200; i++) {
+        [self assertLine:approximateCount - i ofLineBuffer:lazy
+              equalsLine:expectedCount - i ofLineBuffer:exact
+                   width:newWidth];
+    }
+    [lazy endResizing];
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while ([lazy numLinesWithWidth:newWidth] != expectedCount && deadline.timeIntervalSinceNow > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    XCTAssertEqual([lazy numLinesWithWidth:newWidth], expectedCount);
+    for (int i = 0; i < expectedCount; i += 101) {
+        [self assertLine:i ofLineBuffer:lazy equalsLine:i ofLineBuffer:exact width:newWidth];
+    }
+}
+
+- (void)testLazyReflowReportsHowLinesMoved {
+    const int lines = 20000;
+    const int newWidth = 53;
+    LineBuffer *exact = [self lineBufferWithLinesOfAssortedLengths:lines];
+    LineBuffer *lazy = [self lineBufferWithLinesOfAssortedLengths:lines];
+    const int expectedCount = [exact numLinesWithWidth:newWidth];
+    lazy.reflowsLazily = YES;
+    lazy.delegate = self;
+    [lazy beginResizing];
+    [lazy numLinesWithWidth:newWidth];
+    [lazy endResizing];
+
+    // Take line numbers throughout history while most line counts are still estimates.
+    NSMutableArray<LineBufferPosition *> *positions = [NSMutableArray array];
+    _trackedLines = [[NSMutableArray alloc] init];
+    for (int i = 0; i < expectedCount; i += 997) {
+        LineBufferPosition *position = [exact positionForCoordinate:VT100GridCoordMake(0, i)
+                                                              width:newWidth
+                                                             offset:0];
+        BOOL ok = NO;
+        const VT100GridCoord coord = [lazy coordinateForPosition:position width:newWidth ok:&ok];
+        XCTAssertTrue(ok);
+        [positions addObject:position];
+        [_trackedLines addObject:@(coord.y)];
+    }
+
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while ([lazy numLinesWithWidth:newWidth] != expectedCount && deadline.timeIntervalSinceNow > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    for (NSInteger i = 0; i < positions.count; i++) {
+        const VT100GridCoord expected = [exact coordinateForPosition:positions[i] width:newWidth ok:NULL];
+        XCTAssertEqual(_trackedLines[i].intValue, expected.y);
+    }
+    lazy.delegate = nil;
+    [_trackedLines release];
+    _trackedLines = nil;
+}
+
+- (void)lineBuffer:(LineBuffer *)lineBuffer
+  didMoveLinesFrom:(int)lineNumber
+                by:(int)delta
+             width:(int)width {
+    for (NSInteger i = 0; i < _trackedLines.count; i++) {
+        if (_trackedLines[i].intValue >= lineNumber) {
+            _trackedLines[i] = @(_trackedLines[i].intValue + delta);
+        }
+    }
+}
+
+- (void)testLineBlockRemembersLineCountsAtSeveralWidths {
+    LineBlock *block = [[[LineBlock alloc] initWithRawBufferSize:8192] autorelease];
+    screen_char_t line[kLineBufferTestWidth * 2] = { 0 };
+    screen_char_t continuation = { 0 };
+    continuation.code = EOL_HARD;
+    for (int i = 0; i < 50; i++) {
+        XCTAssertTrue([block appendLine:line
+                                 length:(i * 37) % (kLineBufferTestWidth * 2)
+                                partial:NO
+                                  width:kLineBufferTestWidth
+                              timestamp:0
+                           continuation:continuation]);
+    }
+    const int widths[] = { 40, 53, kLineBufferTestWidth, 132 };
+    int expected[4];
+    for (int i = 0; i < 4; i++) {
+        expected[i] = [block getNumLinesWithWrapWidth:widths[i]];
+    }
+
+    // Switching among them doesn't count the lines again.
+    const LineBlockWidthCacheStatistics before = [LineBlock widthCacheStatistics];
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 4; i++) {
+            XCTAssertEqual([block getNumLinesWithWrapWidth:widths[i]], expected[i]);
+        }
+    }
+    const LineBlockWidthCacheStatistics after = [LineBlock widthCacheStatistics];
+    XCTAssertEqual(after.numLinesMisses, before.numLinesMisses);
+    XCTAssertEqual(after.numLinesHits - before.numLinesHits, 12);
+
+    // Appending keeps every cached width up to date.
+    XCTAssertTrue([block appendLine:line
+                             length:kLineBufferTestWidth * 2
+                            partial:NO
+                              width:kLineBufferTestWidth
+                          timestamp:0
+                       continuation:continuation]);
+    LineBlock *copy = [[block copy] autorelease];
+    for (int i = 0; i < 4; i++) {
+        XCTAssertTrue([copy hasCachedNumLinesForWidth:widths[i]]);
+        XCTAssertEqual([copy getNumLinesWithWrapWidth:widths[i]],
+                       expected[i] + (kLineBufferTestWidth * 2 - 1) / widths[i] + 1);
+    }
+}
+
+- (void)testCompactBlocksPreserveContents {
+    const int lines = 2000;
+    LineBuffer *expanded = [self lineBufferWithCompaction:NO lines:lines];
+    LineBuffer *compact = [self lineBufferWithCompaction:YES lines:lines];
+
+    XCTAssertEqual([expanded numLinesWithWidth:kLineBufferTestWidth],
+                   [compact numLinesWithWidth:kLineBufferTestWidth]);
+    [self assertLineBuffer:compact matchesLineBuffer:expanded lines:lines];
+}
+
+- (void)testCompactBlocksMemoryUsage {
+    const int lines = 100000;
+    LineBuffer *expanded = [self lineBufferWithCompaction:NO lines:lines];
+    LineBuffer *compact = [self lineBufferWithCompaction:YES lines:lines];
+
+    XCTAssertLessThan((double)compact.memoryUsage / (double)expanded.memoryUsage, 0.6);
+
+    // Reading scattered lines expands blocks; the number kept expanded is bounded.
+    screen_char_t buffer[kLineBufferTestWidth];
+    for (int i = 0; i < lines; i += 997) {
+        [compact copyLineToBuffer:buffer
+                            width:kLineBufferTestWidth
+                          lineNum:i
+                     continuation:NULL];
+    }
+    XCTAssertLessThan((double)compact.memoryUsage / (double)expanded.memoryUsage, 0.6);
+}
+
+- (void)testCompressedBlocksPreserveContents {
+    const int lines = 2000;
+    LineBuffer *expanded = [self lineBufferWithCompaction:NO lines:lines];
+    const LineBlockCompressionStatistics before = [LineBlock compressionStatistics];
+    LineBuffer *compressed = [[[LineBuffer alloc] initWithBlockSize:8192] autorelease];
+    compressed.compactsFullBlocks = YES;
+    compressed.compressesColdBlocks = YES;
+    compressed.uncompressedBlocks = 2;
+    [self appendStyledLines:lines toLineBuffer:compressed];
+
+    // 2000 lines fill about 20 blocks. Wait for the cold ones to be compressed.
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    while ([LineBlock compressionStatistics].compressedBlocks - before.compressedBlocks < 15 &&
+           [deadline timeIntervalSinceNow] > 0) {
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    const LineBlockCompressionStatistics after = [LineBlock compressionStatistics];
+    const NSInteger uncompressedBytes = after.uncompressedBytes - before.uncompressedBytes;
+    const NSInteger compressedBytes = after.compressedBytes - before.compressedBytes;
+    XCTAssertGreaterThanOrEqual(after.compressedBlocks - before.compressedBlocks, 15);
+    XCTAssertLessThan((double)compressedBytes / (double)uncompressedBytes, 0.2);
+
+    [self assertLineBuffer:compressed matchesLineBuffer:expanded lines:lines];
+    const LineBlockCompressionStatistics read = [LineBlock compressionStatistics];
+    XCTAssertGreaterThan(read.decompressions, after.decompressions);
+}
+
+- (void)testSpilledBlocksPreserveContents {
+    const int lines = 2000;
+    LineBuffer *expanded = [self lineBufferWithCompaction:NO lines:lines];
+    const LineBlockCompressionStatistics before = [LineBlock compressionStatistics];
+    LineBuffer *spilled = [[[LineBuffer alloc] initWithBlockSize:8192] autorelease];
+    spilled.compressesColdBlocks = NO;
+    spilled.spillsColdBlocks = YES;
+    spilled.residentMemoryBudget = 64 * 1024;
+    [self appendStyledLines:lines toLineBuffer:spilled];
+
+    const LineBlockCompressionStatistics after = [LineBlock compressionStatistics];
+    XCTAssertGreaterThanOrEqual(after.spilledBlocks - before.spilledBlocks, 15);
+    XCTAssertLessThan((double)spilled.memoryUsage / (double)expanded.memoryUsage, 0.25);
+
+    [self assertLineBuffer:spilled matchesLineBuffer:expanded lines:lines];
+}
+
+- (void)testBlockUncoveredByPoppingIsSpilledAgain {
+    LineBuffer *spilled = [[[LineBuffer alloc] initWithBlockSize:8192] autorelease];
+    spilled.compressesColdBlocks = NO;
+    spilled.spillsColdBlocks = YES;
+    spilled.residentMemoryBudget = 64 * 1024;
+    [self appendStyledLines:1000 toLineBuffer:spilled];
+    const NSInteger before = spilled.memoryUsage;
+
+    // Popping past the start of the last block makes the spilled block before it the last block,
+    // and modifying it brings its cells back into memory.
+    screen_char_t buffer[kLineBufferTestWidth];
+    for (int i = 0; i < 150; i++) {
+        int eol;
+        XCTAssertTrue([spilled popAndCopyLastLineInto:buffer
+                                                width:kLineBufferTestWidth
+                                    includesEndOfLine:&eol
+                                            timestamp:NULL
+                                         continuation:NULL]);
+    }
+    [self appendStyledLines:400 toLineBuffer:spilled];
+
+    // Once it filled up again it should have been spilled, leaving about as much resident as before.
+    XCTAssertLessThan(spilled.memoryUsage - before, 8192 * (NSInteger)sizeof(screen_char_t) / 2);
+}
+
+// Searches all of |lineBuffer| backwards from the end, as find-all does.
+- (NSArray<NSNumber *> *)positionsOfAllResultsFor:(NSString *)needle inLineBuffer:(LineBuffer *)lineBuffer {
+    FindContext *context = [[[FindContext alloc] init] autorelease];
+    [lineBuffer prepareToSearchFor:needle
+                        startingAt:[[lineBuffer lastPosition] predecessor]
+                           options:FindOptBackwards | FindMultipleResults
+                              mode:iTermFindModeCaseInsensitiveSubstring
+                       withContext:context];
+    NSMutableArray<NSNumber *> *positions = [NSMutableArray array];
+    LineBufferPosition *stopAt = [lineBuffer firstPosition];
+    while (context.status != NotFound) {
+        [lineBuffer findSubstring:context stopAt:stopAt];
+        for (ResultRange *range in context.results) {
+            [positions addObject:@(range->position)];
+        }
+        [context.results removeAllObjects];
+    }
+    return positions;
+}
+
+- (void)testConcurrentFindAllMatchesSequentialFindAll {
+    LineBuffer *lineBuffer = [self lineBufferWithCompaction:YES lines:5000];
+    lineBuffer.searchesConcurrently = NO;
+    NSArray<NSNumber *> *expected = [self positionsOfAllResultsFor:@"XYZA" inLineBuffer:lineBuffer];
+    XCTAssertGreaterThan(expected.count, 0);
+
+    lineBuffer.searchesConcurrently = YES;
+    NSArray<NSNumber *> *actual = [self positionsOfAllResultsFor:@"XYZA" inLineBuffer:lineBuffer];
+    XCTAssertEqualObjects(actual, expected);
+}
+
+@end
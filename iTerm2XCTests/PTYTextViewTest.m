@@ -128,6 +128,10 @@ static NSString *const kDiffScriptPath = @"/tmp/diffs";
     return VT100GridRangeMake(0, 0);
 }
 
+- (BOOL)getDirtyLineMask:(uint64_t *)mask capacity:(int)capacity {
+    return NO;
+}
+
 - (PTYScroller *)textViewVerticalScroller {
     return nil;
 }
@@ -2487,6 +2491,23 @@ static NSString *const kDiffScriptPath = @"/tmp/diffs";
     return _buffer;
 }
 
+#pragma mark - Test dirty rects
+
+// The dirty line mask is sized by the data source's height, but during a synchronized update the
+// text view queries the saved grid, which may have a different height.
+- (void)testUpdateDirtyRectsAfterResizingTallerDuringSynchronizedUpdate {
+    PTYSession *session = [self sessionWithProfileOverrides:@{} size:VT100GridSizeMake(10, 2)];
+    [session synchronousReadTask:@"\eP=1s\e\\abc"];
+    [session setSize:VT100GridSizeMake(10, 200)];
+    [session synchronousReadTask:@"def\r\nghi"];
+    [session.textview refresh];
+
+    [session synchronousReadTask:@"\eP=2s\e\\"];
+    [session.textview refresh];
+    XCTAssertEqual(session.screen.height, 200);
+    XCTAssertTrue([[session.screen compactLineDump] hasPrefix:@"abcdef....\nghi......\n"]);
+}
+
 #pragma mark - Test selection
 
 - (void)testSelectedTextVeryBasic {
@@ -376,4 +376,59 @@
     }
 }
 
+- (void)testColonTurnsLaterParametersIntoSubparameters {
+    VT100Token *token = [self tokenForDataWithFormat:@"%c[38:2:10;20m", VT100CC_ESC];
+    XCTAssert(token->type == VT100CSI_SGR);
+    XCTAssert(token.csi->count == 1);
+    XCTAssert(token.csi->p[0] == 38);
+    XCTAssert(iTermParserGetNumberOfCSISubparameters(token.csi, 0) == 3);
+}
+
+- (void)testControlCharactersInsideSequence {
+    VT100Token *token = [self tokenForDataWithFormat:@"%c[1%c2%cA", VT100CC_ESC, VT100CC_CR, VT100CC_NULL];
+    XCTAssert(token->type == VT100CSI_CUU);
+    XCTAssert(token.csi->p[0] == 12);
+    XCTAssert(CVectorCount(&_incidentals) == 1);
+    for (int i = 0; i < CVectorCount(&_incidentals); i++) {
+        [CVectorGetObject(&_incidentals, i) release];
+    }
+    _incidentals.count = 0;
+
+    token = [self tokenForDataWithFormat:@"%c[12%cA", VT100CC_ESC, VT100CC_CAN];
+    XCTAssert(token->type == VT100_UNKNOWNCHAR);
+    XCTAssert(_context.rmlen == 4);
+}
+
+#pragma mark - Performance
+
+// SGR- and cursor-movement-heavy output, like a colorized compiler log or a curses app repainting.
+- (void)testPerformanceOfSGRAndCursorMovementCorpus {
+    NSArray<NSString *> *sequences = @[ @"0m", @"1;31m", @"38;2;10;20;30m", @"48;5;123m",
+                                        @"38:2:1:2:3m", @"12;40H", @"K", @"?25h", @"3A", @"2J",
+                                        @"?1049l", @"10C", @"1;24r", @"4 q" ];
+    const int count = 100000;
+    NSMutableData *corpus = [NSMutableData data];
+    NSMutableData *offsets = [NSMutableData dataWithLength:sizeof(int) * (count + 1)];
+    int *offsetArray = offsets.mutableBytes;
+    for (int i = 0; i < count; i++) {
+        offsetArray[i] = (int)corpus.length;
+        NSString *sequence = [NSString stringWithFormat:@"%c[%@", VT100CC_ESC, sequences[i % sequences.count]];
+        [corpus appendData:[sequence dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    offsetArray[count] = (int)corpus.length;
+
+    VT100Token *token = [[[VT100Token alloc] init] autorelease];
+    [self measureBlock:^{
+        unsigned char *bytes = (unsigned char *)corpus.bytes;
+        for (int i = 0; i < count; i++) {
+            iTermParserContext context = iTermParserContextMake(bytes + offsetArray[i],
+                                                                offsetArray[i + 1] - offsetArray[i]);
+            [VT100CSIParser decodeFromContext:&context
+                 support8BitControlCharacters:NO
+                                  incidentals:&_incidentals
+                                        token:token];
+        }
+    }];
+}
+
 @end
@@ -198,6 +198,33 @@ do { \
     XCTAssert(![grid isAnyCharDirty]);
 }
 
+- (void)testDirtyLineMask {
+    VT100Grid *grid = [self largeGrid];
+    uint64_t mask = ~0ULL;
+    XCTAssert(![grid getDirtyLineMask:&mask capacity:1]);
+    XCTAssertEqual(mask, 0ULL);
+
+    [grid markCharDirty:YES at:VT100GridCoordMake(2, 1) updateTimestamp:NO];
+    [grid markCharsDirty:YES inRectFrom:VT100GridCoordMake(0, 6) to:VT100GridCoordMake(7, 7)];
+    XCTAssert([grid getDirtyLineMask:&mask capacity:1]);
+    XCTAssertEqual(mask, (1ULL << 1) | (1ULL << 6) | (1ULL << 7));
+
+    // Scrolling moves the first line, so the mask must follow it.
+    LineBuffer *lineBuffer = [[[LineBuffer alloc] initWithBlockSize:1000] autorelease];
+    [grid scrollUpIntoLineBuffer:lineBuffer
+             unlimitedScrollback:NO
+         useScrollbackWithRegion:YES
+                       softBreak:NO];
+    [grid markAllCharsDirty:NO];
+    [grid markCharDirty:YES at:VT100GridCoordMake(0, 0) updateTimestamp:NO];
+    XCTAssert([grid getDirtyLineMask:&mask capacity:1]);
+    XCTAssertEqual(mask, 1ULL);
+
+    [grid markAllCharsDirty:NO];
+    XCTAssert(![grid getDirtyLineMask:&mask capacity:1]);
+    XCTAssert(![grid isAnyCharDirty]);
+}
+
 - (void)testMarkAndClearDirty {
     // This test assumes that underlying implementation of dirty chars is a range per line.
     VT100Grid *grid = [self largeGrid];
@@ -2043,6 +2070,44 @@ do { \
                                       expectCursor:(VT100GridCoord)expectedCursor
                                   expectLineBuffer:(NSString *)expectedLineBuffer
                                      expectDropped:(int)expectedNumLinesDropped {
+    [self doAppendCharsAtCursorTestWithInitialBuffer:initialBuffer
+                                        scrollRegion:scrollRect
+                             useScrollbackWithRegion:useScrollbackWithRegion
+                                 unlimitedScrollback:unlimitedScrollback
+                                           appending:stringToAppend
+                                                  at:initialCursor
+                                              expect:expectedLines
+                                        expectCursor:expectedCursor
+                                    expectLineBuffer:expectedLineBuffer
+                                       expectDropped:expectedNumLinesDropped
+                                         singleWidth:NO];
+    if ([stringToAppend rangeOfString:@"-"].location == NSNotFound) {
+        // No double-width chars, so the fast path must produce the same result.
+        [self doAppendCharsAtCursorTestWithInitialBuffer:initialBuffer
+                                            scrollRegion:scrollRect
+                                 useScrollbackWithRegion:useScrollbackWithRegion
+                                     unlimitedScrollback:unlimitedScrollback
+                                               appending:stringToAppend
+                                                      at:initialCursor
+                                                  expect:expectedLines
+                                            expectCursor:expectedCursor
+                                        expectLineBuffer:expectedLineBuffer
+                                           expectDropped:expectedNumLinesDropped
+                                             singleWidth:YES];
+    }
+}
+
+- (void)doAppendCharsAtCursorTestWithInitialBuffer:(NSString *)initialBuffer
+                                      scrollRegion:(VT100GridRect)scrollRect
+                           useScrollbackWithRegion:(BOOL)useScrollbackWithRegion
+                               unlimitedScrollback:(BOOL)unlimitedScrollback
+                                         appending:(NSString *)stringToAppend
+                                                at:(VT100GridCoord)initialCursor
+                                            expect:(NSString *)expectedLines
+                                      expectCursor:(VT100GridCoord)expectedCursor
+                                  expectLineBuffer:(NSString *)expectedLineBuffer
+                                     expectDropped:(int)expectedNumLinesDropped
+                                       singleWidth:(BOOL)singleWidth {
     VT100Grid *grid = [self gridFromCompactLinesWithContinuationMarks:initialBuffer];
     LineBuffer *lineBuffer = [[[LineBuffer alloc] initWithBlockSize:1000] autorelease];
     if (scrollRect.size.width >= 0) {
@@ -2054,7 +2119,18 @@ do { \
     }
     screen_char_t *line = [self screenCharLineForString:stringToAppend];
     grid.cursor = initialCursor;
-    int numLinesDropped = [grid appendCharsAtCursor:line
+    int numLinesDropped;
+    if (singleWidth) {
+        numLinesDropped = [grid appendSingleWidthCharsAtCursor:line
+                                                        length:[stringToAppend length]
+                                       scrollingIntoLineBuffer:lineBuffer
+                                           unlimitedScrollback:unlimitedScrollback
+                                       useScrollbackWithRegion:useScrollbackWithRegion
+                                                    wraparound:wraparoundMode_
+                                                          ansi:isAnsi_
+                                                        insert:insertMode_];
+    } else {
+        numLinesDropped = [grid appendCharsAtCursor:line
                                              length:[stringToAppend length]
                             scrollingIntoLineBuffer:lineBuffer
                                 unlimitedScrollback:unlimitedScrollback
@@ -2062,6 +2138,7 @@ do { \
                                          wraparound:wraparoundMode_
                                                ansi:isAnsi_
                                              insert:insertMode_];
+    }
     XCTAssert([[grid compactLineDumpWithContinuationMarks] isEqualToString:expectedLines]);
     XCTAssert([[lineBuffer debugString] isEqualToString:expectedLineBuffer]);
     XCTAssert(numLinesDropped == expectedNumLinesDropped);
@@ -14,6 +14,7 @@
 #import "SearchResult.h"
 #import "TmuxStateParser.h"
 #import "VT100Screen.h"
+#import "VT100ScreenMark.h"
 #import "iTermSelection.h"
 
 static const NSInteger kUnicodeVersion = 9;
@@ -37,8 +38,10 @@ NSLog(@"Known bug: %s should be true, but %s is.", #expressionThatShouldBeTrue,
 
 @implementation VT100Screen (UnitTest)
 - (void)setLineBuffer:(LineBuffer *)lineBuffer {
+    linebuffer_.delegate = nil;
     [linebuffer_ release];
     linebuffer_ = [lineBuffer retain];
+    linebuffer_.delegate = (id<LineBufferDelegate>)self;
 }
 @end
 
@@ -588,6 +591,9 @@ NSLog(@"Known bug: %s should be true, but %s is.", #expressionThatShouldBeTrue,
     highlightsCleared_ = YES;
 }
 
+- (void)screenDidMoveLinesFrom:(int)lineNumber by:(int)delta {
+}
+
 - (BOOL)screenShouldTreatAmbiguousCharsAsDoubleWidth {
     return ambiguousIsDoubleWidth_;
 }
@@ -1876,6 +1882,52 @@ NSLog(@"Known bug: %s should be true, but %s is.", #expressionThatShouldBeTrue,
     }
 }
 
+- (void)testSimpleCharactersMatchGeneralConversion {
+    screen_char_t fg = { 0 };
+    screen_char_t bg = { 0 };
+    fg.foregroundColor = 5;
+    fg.foregroundColorMode = ColorModeNormal;
+    fg.bold = YES;
+    bg.backgroundColor = 6;
+    bg.backgroundColorMode = ColorModeNormal;
+    NSArray<NSString *> *simpleStrings = @[ @"Hello world", @"中文 and ｗｉｄｅ", @"\u00a1\u0142\u0410" ];
+    for (NSString *string in simpleStrings) {
+        for (int ambiguousIsDoubleWidth = 0; ambiguousIsDoubleWidth < 2; ambiguousIsDoubleWidth++) {
+            const int length = string.length;
+            unichar chars[length];
+            [string getCharacters:chars range:NSMakeRange(0, length)];
+            screen_char_t expected[length * 3];
+            screen_char_t actual[length * 2];
+            memset(expected, 0, sizeof(expected));
+            memset(actual, 0, sizeof(actual));
+            int expectedLength = 0;
+            int actualLength = 0;
+            BOOL expectedDwc = NO;
+            BOOL actualDwc = NO;
+            StringToScreenChars(string, expected, fg, bg, &expectedLength, ambiguousIsDoubleWidth, NULL,
+                                &expectedDwc, iTermUnicodeNormalizationNone, 9);
+            XCTAssertTrue(SimpleCharactersToScreenChars(chars, length, actual, fg, bg, &actualLength,
+                                                        ambiguousIsDoubleWidth, &actualDwc,
+                                                        iTermUnicodeNormalizationNone, 9));
+            XCTAssertEqual(expectedLength, actualLength);
+            XCTAssertEqual(expectedDwc, actualDwc);
+            XCTAssertEqual(memcmp(expected, actual, sizeof(screen_char_t) * actualLength), 0, @"%@", string);
+        }
+    }
+
+    // These need grapheme handling.
+    NSArray<NSString *> *complexStrings = @[ @"e\u0301", @"\U0001F600", @"\u200bx", @"\u1100\u1161" ];
+    for (NSString *string in complexStrings) {
+        const int length = string.length;
+        unichar chars[length];
+        [string getCharacters:chars range:NSMakeRange(0, length)];
+        screen_char_t buffer[length * 2];
+        int bufferLength = 0;
+        XCTAssertFalse(SimpleCharactersToScreenChars(chars, length, buffer, fg, bg, &bufferLength, NO,
+                                                     NULL, iTermUnicodeNormalizationNone, 9), @"%@", string);
+    }
+}
+
 - (void)testAppendStringAtCursorNonAscii {
     // Make sure colors and attrs are set properly
     VT100Screen *screen = [self screenWithWidth:20 height:2];
@@ -4079,6 +4131,93 @@ NSLog(@"Known bug: %s should be true, but %s is.", #expressionThatShouldBeTrue,
     XCTAssert(range.end.y == 6);
 }
 
+// Returns the first line whose text starts with |prefix|, or -1.
+- (int)lineStartingWith:(NSString *)prefix inScreen:(VT100Screen *)screen {
+    for (int y = 0; y < [screen numberOfLines]; y++) {
+        NSString *s = ScreenCharArrayToStringDebug([screen getLineAtIndex:y], [screen width]);
+        if ([s hasPrefix:prefix]) {
+            return y;
+        }
+    }
+    return -1;
+}
+
+- (VT100Screen *)screenWithLazilyReflowedHistory {
+    VT100Screen *screen = [self screen];
+    LineBuffer *lineBuffer = [[[LineBuffer alloc] init] autorelease];
+    lineBuffer.reflowsLazily = YES;
+    [screen setLineBuffer:lineBuffer];
+    [screen destructivelySetScreenWidth:80 height:24];
+    screen.unlimitedScrollback = YES;
+
+    // Lines of assorted lengths, so estimated line counts at a new width are off.
+    NSMutableArray *lines = [NSMutableArray array];
+    for (int i = 0; i < 5000; i++) {
+        NSString *line = [NSString stringWithFormat:@"line %d ", i];
+        [lines addObject:[line stringByPaddingToLength:line.length + (i * 37) % 160
+                                            withString:@"x"
+                                       startingAtIndex:0]];
+    }
+    [self appendLines:lines toScreen:screen];
+    return screen;
+}
+
+// Lets line counts estimated while resizing settle until they stop changing.
+- (void)waitForLineCountsToSettleInScreen:(VT100Screen *)screen {
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:10];
+    int numberOfLines;
+    do {
+        numberOfLines = [screen numberOfLines];
+        [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    } while (numberOfLines != [screen numberOfLines] && deadline.timeIntervalSinceNow > 0);
+}
+
+- (void)testResizeWithLazyReflowKeepsMarkInHistoryOnItsLine {
+    VT100Screen *screen = [self screenWithLazilyReflowedHistory];
+    const int y = [self lineStartingWith:@"line 100 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(y, 0);
+    id<iTermMark> mark = [screen addMarkStartingAtAbsoluteLine:[screen totalScrollbackOverflow] + y
+                                                        oneLine:YES
+                                                        ofClass:[VT100ScreenMark class]];
+    [screen setSize:VT100GridSizeMake(53, 24)];
+    [self waitForLineCountsToSettleInScreen:screen];
+
+    const int expectedY = [self lineStartingWith:@"line 100 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(expectedY, 0);
+    XCTAssertEqual([screen coordRangeForInterval:mark.entry.interval].start.y, expectedY);
+}
+
+- (void)testResizeWithLazyReflowKeepsSelectionInHistoryOnItsLine {
+    VT100Screen *screen = [self screenWithLazilyReflowedHistory];
+    const int y = [self lineStartingWith:@"line 2000 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(y, 0);
+    [self setSelectionRange:VT100GridCoordRangeMake(0, y, 9, y) width:screen.width];
+    [screen setSize:VT100GridSizeMake(53, 24)];
+    [self waitForLineCountsToSettleInScreen:screen];
+
+    const int expectedY = [self lineStartingWith:@"line 2000 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(expectedY, 0);
+    XCTAssertEqual([selection_ firstRange].coordRange.start.y, expectedY);
+    XCTAssertEqualObjects([self selectedStringInScreen:screen], @"line 2000");
+}
+
+- (void)testMarkAddedBeforeLazyReflowSettlesStaysOnItsLine {
+    VT100Screen *screen = [self screenWithLazilyReflowedHistory];
+    [screen setSize:VT100GridSizeMake(53, 24)];
+
+    // Finding the line settles the blocks before it, but not the ones after.
+    const int y = [self lineStartingWith:@"line 3000 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(y, 0);
+    id<iTermMark> mark = [screen addMarkStartingAtAbsoluteLine:[screen totalScrollbackOverflow] + y
+                                                        oneLine:YES
+                                                        ofClass:[VT100ScreenMark class]];
+    [self waitForLineCountsToSettleInScreen:screen];
+
+    const int expectedY = [self lineStartingWith:@"line 3000 " inScreen:screen];
+    XCTAssertGreaterThanOrEqual(expectedY, 0);
+    XCTAssertEqual([screen coordRangeForInterval:mark.entry.interval].start.y, expectedY);
+}
+
 - (void)testEmptyLineRestoresBackgroundColor {
     LineBuffer *lineBuffer = [[[LineBuffer alloc] init] autorelease];
     screen_char_t line[1];
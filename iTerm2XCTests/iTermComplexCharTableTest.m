@@ -0,0 +1,61 @@
+//
+//  iTermComplexCharTableTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermComplexCharTable.h"
+
+@interface iTermComplexCharTableTest : XCTestCase
+@end
+
+@implementation iTermComplexCharTableTest
+
+// Interns |count| distinct three-unichar strings, which is enough to force reclamation when it
+// exceeds the number of codes.
+- (void)internDistinctStrings:(int)count salt:(unichar)salt {
+    for (int i = 0; i < count; i++) {
+        const unichar chars[] = { salt, (unichar)i, (unichar)(i >> 16) };
+        const int code = iTermComplexCharTableIntern(chars, 3, NO, NULL);
+        XCTAssertGreaterThan(code, 0);
+        XCTAssertLessThan(code, iTermComplexCharTableMaximumCode);
+    }
+}
+
+- (void)testInternIsIdempotent {
+    const unichar chars[] = { 'e', 0x301 };
+    BOOL added = NO;
+    const int code = iTermComplexCharTableIntern(chars, 2, NO, &added);
+    XCTAssertGreaterThan(code, 0);
+    XCTAssertEqual(iTermComplexCharTableIntern(chars, 2, NO, &added), code);
+    XCTAssertFalse(added);
+    XCTAssertEqual(iTermComplexCharTableLookup(chars, 2), code);
+    XCTAssertEqualObjects(iTermComplexCharTableString(code), @"é");
+}
+
+- (void)testRetainedCodesSurviveReclamation {
+    const unichar chars[] = { 0xd83d, 0xde00, 0xfe0f };
+    const int code = iTermComplexCharTableIntern(chars, 3, NO, NULL);
+    iTermComplexCharTableRetain(code);
+
+    // Far more strings than there are codes, so dead ones must be recycled.
+    [self internDistinctStrings:iTermComplexCharTableMaximumCode * 2 salt:0xd83c];
+
+    XCTAssertEqual(iTermComplexCharTableLookup(chars, 3), code);
+    XCTAssertEqualObjects(iTermComplexCharTableString(code), [NSString stringWithCharacters:chars length:3]);
+    iTermComplexCharTableRelease(code);
+}
+
+- (void)testReservedCodesHaveNoString {
+    const int code = iTermComplexCharTableReserveCode();
+    XCTAssertGreaterThan(code, 0);
+    XCTAssertNil(iTermComplexCharTableString(code));
+    [self internDistinctStrings:iTermComplexCharTableMaximumCode * 2 salt:0xd83e];
+    XCTAssertNil(iTermComplexCharTableString(code));
+    const int otherCode = iTermComplexCharTableReserveCode();
+    XCTAssertNotEqual(otherCode, code);
+    iTermComplexCharTableFreeReservedCode(code);
+    iTermComplexCharTableFreeReservedCode(otherCode);
+}
+
+@end
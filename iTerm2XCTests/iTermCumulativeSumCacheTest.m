@@ -0,0 +1,84 @@
+//
+//  iTermCumulativeSumCacheTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermCumulativeSumCache.h"
+
+@interface iTermCumulativeSumCacheTest : XCTestCase
+@end
+
+@implementation iTermCumulativeSumCacheTest
+
+- (void)assertCache:(iTermCumulativeSumCache *)cache matchesValues:(NSArray<NSNumber *> *)values {
+    XCTAssertEqual(cache.count, values.count);
+    NSInteger sum = 0;
+    for (NSInteger i = 0; i < values.count; i++) {
+        XCTAssertEqual([cache valueAtIndex:i], values[i].integerValue);
+        sum += values[i].integerValue;
+        XCTAssertEqual([cache sumOfValuesInRange:NSMakeRange(0, i + 1)], sum);
+    }
+    XCTAssertEqual(cache.sumOfAllValues, sum);
+
+    // Each value belongs to the first nonempty bucket whose range includes it.
+    NSInteger end = 0;
+    NSInteger index = 0;
+    for (NSInteger value = 0; value < sum; value++) {
+        while (value >= end) {
+            end += values[index++].integerValue;
+        }
+        XCTAssertEqual([cache indexContainingValue:value], index - 1);
+    }
+    XCTAssertEqual([cache indexContainingValue:sum], NSNotFound);
+}
+
+- (void)testRandomOperationsMatchArray {
+    iTermCumulativeSumCache *cache = [[[iTermCumulativeSumCache alloc] init] autorelease];
+    NSMutableArray<NSNumber *> *values = [NSMutableArray array];
+    srandom(1);
+    for (int i = 0; i < 5000; i++) {
+        const long op = random() % 10;
+        const NSInteger value = random() % 5;
+        if (op < 4 || values.count < 2) {
+            [cache appendValue:value];
+            [values addObject:@(value)];
+        } else if (op < 6) {
+            [cache removeFirstValue];
+            [values removeObjectAtIndex:0];
+        } else if (op < 7) {
+            [cache removeLastValue];
+            [values removeLastObject];
+        } else if (op < 8) {
+            [cache setLastValue:value];
+            values[values.count - 1] = @(value);
+        } else {
+            const NSInteger index = random() % values.count;
+            [cache setValuesInRange:NSMakeRange(index, 1) withBlock:^NSInteger(NSInteger i) {
+                return value;
+            }];
+            values[index] = @(value);
+        }
+        if (i % 97 == 0) {
+            [self assertCache:cache matchesValues:values];
+            [self assertCache:[[cache copy] autorelease] matchesValues:values];
+        }
+    }
+    [self assertCache:cache matchesValues:values];
+}
+
+- (void)testManyRemovalsFromFront {
+    iTermCumulativeSumCache *cache = [[[iTermCumulativeSumCache alloc] init] autorelease];
+    NSMutableArray<NSNumber *> *values = [NSMutableArray array];
+    for (int i = 0; i < 10000; i++) {
+        [cache appendValue:i % 7];
+        [values addObject:@(i % 7)];
+        if (values.count > 100) {
+            [cache removeFirstValue];
+            [values removeObjectAtIndex:0];
+        }
+    }
+    [self assertCache:cache matchesValues:values];
+}
+
+@end
@@ -0,0 +1,70 @@
+//
+//  iTermEmulationBenchmark.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+@class iTermPTYRecording;
+
+// Measurements for one corpus replayed through the emulator.
+@interface iTermEmulationBenchmarkResult : NSObject
+
+@property(nonatomic, copy) NSString *name;
+@property(nonatomic, assign) long long bytes;
+@property(nonatomic, assign) long long tokens;
+@property(nonatomic, assign) long long linesScrolled;
+@property(nonatomic, assign) NSTimeInterval seconds;
+
+// High-water mark of the process's resident set size, in bytes, when the corpus finished. This is
+// process-wide and never goes down, so only an increase between runs is meaningful.
+@property(nonatomic, assign) long long peakResidentSetSize;
+
+@property(nonatomic, readonly) double megabytesPerSecond;
+@property(nonatomic, readonly) double tokensPerSecond;
+@property(nonatomic, readonly) double linesScrolledPerSecond;
+
+// A JSON-compatible dictionary of all the values above.
+- (NSDictionary *)dictionaryValue;
+
+@end
+
+// Replays byte streams through VT100Parser -> VT100Terminal -> VT100Screen with no session, view,
+// or renderer attached. Input is fed in PTYTask-sized chunks and each chunk's tokens are executed
+// and recycled the way PTYSession does it, so the numbers reflect the emulation pipeline alone.
+@interface iTermEmulationBenchmark : NSObject
+
+// Screen size. Defaults to 80x25.
+@property(nonatomic, assign) int width;
+@property(nonatomic, assign) int height;
+
+// Number of bytes handed to the parser at a time. Defaults to 4096, the most PTYTask reads
+// before dispatching to the parser.
+@property(nonatomic, assign) int chunkSize;
+
+// Defaults to 1000, so long runs exercise dropping lines from the line buffer.
+@property(nonatomic, assign) unsigned int maxScrollbackLines;
+
+// The corpus is replayed as many times as needed to process at least this many bytes, so tiny
+// corpora still take long enough to time. Defaults to 0.
+@property(nonatomic, assign) long long minimumBytes;
+
+// Equivalent to `spam [lines]` (or `spam [lines] cm` when |combiningMarks| is set) from
+// tests/spam.cc: lines of random letters, or of Thai characters each followed by a combining
+// grave accent. The same seed always gives the same corpus.
++ (NSData *)spamCorpusWithLines:(int)lines
+                 combiningMarks:(BOOL)combiningMarks
+                           seed:(unsigned int)seed;
+
+// Serializes results as a JSON array of -dictionaryValue's.
++ (NSData *)JSONDataForResults:(NSArray<iTermEmulationBenchmarkResult *> *)results;
+
+// Runs |data| through a fresh terminal and screen.
+- (iTermEmulationBenchmarkResult *)resultForCorpus:(NSData *)data name:(NSString *)name;
+
+// Replays a recording made by PTYTask as fast as possible, one original read at a time, applying
+// its size changes. |minimumBytes| and |chunkSize| are ignored.
+- (iTermEmulationBenchmarkResult *)resultForRecording:(iTermPTYRecording *)recording
+                                                 name:(NSString *)name;
+
+@end
@@ -0,0 +1,213 @@
+//
+//  iTermEmulationBenchmark.m
+//  iTerm2
+//
+
+#import "iTermEmulationBenchmark.h"
+
+#import "CVector.h"
+#import "VT100Parser.h"
+#import "VT100Screen.h"
+#import "VT100Terminal.h"
+#import "VT100TokenPool.h"
+#import "iTermPTYRecording.h"
+
+#include <sys/resource.h>
+
+static long long iTermEmulationBenchmarkPeakResidentSetSize(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        return 0;
+    }
+    // ru_maxrss is in bytes on macOS.
+    return usage.ru_maxrss;
+}
+
+@implementation iTermEmulationBenchmarkResult
+
+- (void)dealloc {
+    [_name release];
+    [super dealloc];
+}
+
+- (double)megabytesPerSecond {
+    return _seconds > 0 ? _bytes / (1024.0 * 1024.0) / _seconds : 0;
+}
+
+- (double)tokensPerSecond {
+    return _seconds > 0 ? _tokens / _seconds : 0;
+}
+
+- (double)linesScrolledPerSecond {
+    return _seconds > 0 ? _linesScrolled / _seconds : 0;
+}
+
+- (NSDictionary *)dictionaryValue {
+    return @{ @"name": _name ?: @"",
+              @"bytes": @(_bytes),
+              @"tokens": @(_tokens),
+              @"lines_scrolled": @(_linesScrolled),
+              @"seconds": @(_seconds),
+              @"mb_per_second": @(self.megabytesPerSecond),
+              @"tokens_per_second": @(self.tokensPerSecond),
+              @"lines_scrolled_per_second": @(self.linesScrolledPerSecond),
+              @"peak_rss_bytes": @(_peakResidentSetSize) };
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p %@ %.2f MB/s, %.0f tokens/s, %.0f lines/s, peak RSS %lld>",
+            NSStringFromClass([self class]), self, _name, self.megabytesPerSecond,
+            self.tokensPerSecond, self.linesScrolledPerSecond, _peakResidentSetSize];
+}
+
+@end
+
+@implementation iTermEmulationBenchmark
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _width = 80;
+        _height = 25;
+        _chunkSize = 4096;
+        _maxScrollbackLines = 1000;
+    }
+    return self;
+}
+
++ (NSData *)spamCorpusWithLines:(int)lines
+                 combiningMarks:(BOOL)combiningMarks
+                           seed:(unsigned int)seed {
+    // Same shape as tests/spam.cc, but bounded so no line exceeds its buffer.
+    const int kMaxLineLength = 9999;
+    NSMutableData *data = [NSMutableData data];
+    unsigned char line[kMaxLineLength + 1];
+    for (int i = 0; i < lines; i++) {
+        const int length = rand_r(&seed) % kMaxLineLength;
+        int j = 0;
+        if (combiningMarks) {
+            // U+0E01...U+0E1E followed by U+0300 COMBINING GRAVE ACCENT.
+            while (j + 5 <= length) {
+                line[j++] = 0xe0;
+                line[j++] = 0xb8;
+                line[j++] = 0x80 | (rand_r(&seed) % 30 + 1);
+                line[j++] = 0xcc;
+                line[j++] = 0x80;
+            }
+        } else {
+            while (j < length) {
+                line[j++] = 'A' + (rand_r(&seed) % 60);
+            }
+        }
+        line[j++] = '\n';
+        [data appendBytes:line length:j];
+    }
+    return data;
+}
+
++ (NSData *)JSONDataForResults:(NSArray<iTermEmulationBenchmarkResult *> *)results {
+    NSMutableArray *array = [NSMutableArray array];
+    for (iTermEmulationBenchmarkResult *result in results) {
+        [array addObject:[result dictionaryValue]];
+    }
+    return [NSJSONSerialization dataWithJSONObject:array
+                                           options:NSJSONWritingPrettyPrinted
+                                             error:NULL];
+}
+
+- (iTermEmulationBenchmarkResult *)resultForCorpus:(NSData *)data name:(NSString *)name {
+    VT100Screen *screen = [self headlessScreen];
+    const char *bytes = data.bytes;
+    const int length = (int)data.length;
+    return [self resultForScreen:screen name:name replay:^long long(long long *tokens) {
+        long long totalBytes = 0;
+        do {
+            for (int offset = 0; offset < length; offset += _chunkSize) {
+                const int n = MIN(_chunkSize, length - offset);
+                *tokens += [self executeBytes:bytes + offset length:n onScreen:screen];
+                totalBytes += n;
+            }
+        } while (length > 0 && totalBytes < _minimumBytes);
+        return totalBytes;
+    }];
+}
+
+- (iTermEmulationBenchmarkResult *)resultForRecording:(iTermPTYRecording *)recording
+                                                 name:(NSString *)name {
+    VT100Screen *screen = [self headlessScreen];
+    return [self resultForScreen:screen name:name replay:^long long(long long *tokens) {
+        __block long long totalBytes = 0;
+        [recording enumerateEventsUsingBlock:^(iTermPTYRecordingEventType type,
+                                               NSTimeInterval timestamp,
+                                               NSData *output,
+                                               VT100GridSize size,
+                                               BOOL *stop) {
+            switch (type) {
+                case iTermPTYRecordingEventTypeOutput:
+                    *tokens += [self executeBytes:output.bytes length:(int)output.length onScreen:screen];
+                    totalBytes += output.length;
+                    break;
+                case iTermPTYRecordingEventTypeSize:
+                    if (size.width > 0 && size.height > 0) {
+                        screen.size = size;
+                    }
+                    break;
+            }
+        }];
+        return totalBytes;
+    }];
+}
+
+#pragma mark - Private
+
+- (VT100Screen *)headlessScreen {
+    VT100Terminal *terminal = [[[VT100Terminal alloc] init] autorelease];
+    terminal.encoding = NSUTF8StringEncoding;
+    VT100Screen *screen = [[[VT100Screen alloc] initWithTerminal:terminal] autorelease];
+    terminal.delegate = screen;
+    [screen destructivelySetScreenWidth:_width height:_height];
+    screen.maxScrollbackLines = _maxScrollbackLines;
+    return screen;
+}
+
+// Parses and executes one read's worth of input, recycling the tokens as PTYSession does. Returns
+// the number of tokens.
+- (int)executeBytes:(const char *)bytes length:(int)length onScreen:(VT100Screen *)screen {
+    @autoreleasepool {
+        VT100Terminal *terminal = screen.terminal;
+        VT100Parser *parser = terminal.parser;
+        [parser putStreamData:bytes length:length];
+        CVector vector;
+        CVectorCreate(&vector, 100);
+        [parser addParsedTokensToVector:&vector];
+        const int count = CVectorCount(&vector);
+        for (int i = 0; i < count; i++) {
+            [terminal executeToken:CVectorGetObject(&vector, i)];
+        }
+        [parser.tokenPool recycleTokensInVector:&vector];
+        return count;
+    }
+}
+
+// |replay| feeds input to |screen|, adds the number of tokens executed to *tokens, and returns the
+// number of bytes processed.
+- (iTermEmulationBenchmarkResult *)resultForScreen:(VT100Screen *)screen
+                                              name:(NSString *)name
+                                            replay:(long long (^)(long long *tokens))replay {
+    long long tokens = 0;
+    const long long linesBefore = [screen totalScrollbackOverflow] + [screen numberOfScrollbackLines];
+    const NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+    const long long bytes = replay(&tokens);
+    const NSTimeInterval end = [NSDate timeIntervalSinceReferenceDate];
+
+    iTermEmulationBenchmarkResult *result = [[[iTermEmulationBenchmarkResult alloc] init] autorelease];
+    result.name = name;
+    result.bytes = bytes;
+    result.tokens = tokens;
+    result.linesScrolled = [screen totalScrollbackOverflow] + [screen numberOfScrollbackLines] - linesBefore;
+    result.seconds = end - start;
+    result.peakResidentSetSize = iTermEmulationBenchmarkPeakResidentSetSize();
+    return result;
+}
+
+@end
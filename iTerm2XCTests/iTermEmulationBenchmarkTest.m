@@ -0,0 +1,118 @@
+//
+//  iTermEmulationBenchmarkTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermEmulationBenchmark.h"
+#import "iTermPTYRecording.h"
+
+#define STRINGIFY(s) #s
+#define STRINGIFY_MACRO(m) STRINGIFY(m)
+
+// The throughput benchmark takes a while, so it runs only when this environment variable is set,
+// for example in the test action of a scheme made for benchmarking.
+static NSString *const kEmulationBenchmarkRunEnvironmentVariable = @"ITERM_RUN_EMULATION_BENCHMARK";
+
+// Set this environment variable to a path to save the results as JSON. Otherwise they go to
+// iTermEmulationBenchmark.json in the temporary directory.
+static NSString *const kEmulationBenchmarkOutputEnvironmentVariable = @"ITERM_EMULATION_BENCHMARK_OUTPUT";
+
+// Set this environment variable to the path of a PTY recording (see the ptyRecordingDirectory
+// advanced setting) to include it in the results.
+static NSString *const kEmulationBenchmarkRecordingEnvironmentVariable = @"ITERM_EMULATION_BENCHMARK_RECORDING";
+
+@interface iTermEmulationBenchmarkTest : XCTestCase
+@end
+
+@implementation iTermEmulationBenchmarkTest
+
+- (NSString *)pathForCorpus:(NSString *)name {
+    NSString *sourceFolder = [NSString stringWithUTF8String:STRINGIFY_MACRO(PROJECT_DIR)];
+    return [[sourceFolder stringByAppendingPathComponent:@"tests"] stringByAppendingPathComponent:name];
+}
+
+- (void)testSpamCorpusIsDeterministic {
+    NSData *first = [iTermEmulationBenchmark spamCorpusWithLines:10 combiningMarks:YES seed:1];
+    NSData *second = [iTermEmulationBenchmark spamCorpusWithLines:10 combiningMarks:YES seed:1];
+    XCTAssertEqualObjects(first, second);
+    XCTAssertNotNil([[[NSString alloc] initWithData:first encoding:NSUTF8StringEncoding] autorelease]);
+}
+
+- (void)testResultCountsLinesScrolled {
+    iTermEmulationBenchmark *benchmark = [[[iTermEmulationBenchmark alloc] init] autorelease];
+    benchmark.maxScrollbackLines = 10;
+    NSMutableString *corpus = [NSMutableString string];
+    for (int i = 0; i < 100; i++) {
+        [corpus appendFormat:@"line %d\r\n", i];
+    }
+    NSData *data = [corpus dataUsingEncoding:NSUTF8StringEncoding];
+    iTermEmulationBenchmarkResult *result = [benchmark resultForCorpus:data name:@"lines"];
+    // Twenty-four of the hundred linefeeds move the cursor down to the bottom of the 25-line
+    // screen; the rest scroll.
+    XCTAssertEqual(result.linesScrolled, 100 - 24);
+    XCTAssertEqual(result.bytes, (long long)data.length);
+    XCTAssertGreaterThan(result.tokens, 0);
+}
+
+// Replays each corpus and saves machine-readable results so runs can be compared for regressions.
+- (void)testEmulationThroughput {
+    NSDictionary<NSString *, NSString *> *environment = [[NSProcessInfo processInfo] environment];
+    if (!environment[kEmulationBenchmarkRunEnvironmentVariable]) {
+        return;
+    }
+    NSMutableArray<NSString *> *names = [NSMutableArray array];
+    NSMutableArray<NSData *> *corpora = [NSMutableArray array];
+
+    [names addObject:@"spam"];
+    [corpora addObject:[iTermEmulationBenchmark spamCorpusWithLines:2000 combiningMarks:NO seed:1]];
+    [names addObject:@"spam-combining-marks"];
+    [corpora addObject:[iTermEmulationBenchmark spamCorpusWithLines:2000 combiningMarks:YES seed:1]];
+
+    for (NSString *file in @[ @"perf3.txt",
+                              @"long_cjk.txt",
+                              @"chinese.txt",
+                              @"combiningmark.txt",
+                              @"slow_24bit_colors.txt",
+                              @"emoji.txt",
+                              @"UTF-8-demo.txt" ]) {
+        NSData *data = [NSData dataWithContentsOfFile:[self pathForCorpus:file]];
+        XCTAssertNotNil(data, @"Missing corpus %@", file);
+        if (data) {
+            [names addObject:file];
+            [corpora addObject:data];
+        }
+    }
+
+    iTermEmulationBenchmark *benchmark = [[[iTermEmulationBenchmark alloc] init] autorelease];
+    benchmark.minimumBytes = 4 * 1024 * 1024;
+    NSMutableArray<iTermEmulationBenchmarkResult *> *results = [NSMutableArray array];
+    for (NSInteger i = 0; i < names.count; i++) {
+        iTermEmulationBenchmarkResult *result = [benchmark resultForCorpus:corpora[i] name:names[i]];
+        XCTAssertGreaterThanOrEqual(result.bytes, benchmark.minimumBytes);
+        XCTAssertGreaterThan(result.tokens, 0);
+        [results addObject:result];
+    }
+
+    NSString *recordingPath = environment[kEmulationBenchmarkRecordingEnvironmentVariable];
+    if (recordingPath) {
+        iTermPTYRecording *recording = [iTermPTYRecording recordingWithContentsOfFile:recordingPath];
+        XCTAssertNotNil(recording, @"Can't read recording %@", recordingPath);
+        if (recording) {
+            iTermEmulationBenchmarkResult *result = [benchmark resultForRecording:recording
+                                                                             name:recordingPath.lastPathComponent];
+            XCTAssertEqual(result.bytes, recording.outputLength);
+            [results addObject:result];
+        }
+    }
+
+    NSString *path = environment[kEmulationBenchmarkOutputEnvironmentVariable];
+    if (!path) {
+        path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"iTermEmulationBenchmark.json"];
+    }
+    NSData *json = [iTermEmulationBenchmark JSONDataForResults:results];
+    XCTAssertNotNil(json);
+    XCTAssertTrue([json writeToFile:path atomically:NO], @"Can't write results to %@", path);
+}
+
+@end
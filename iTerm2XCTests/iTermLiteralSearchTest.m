@@ -0,0 +1,66 @@
+//
+//  iTermLiteralSearchTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermLiteralSearch.h"
+
+@interface iTermLiteralSearchTest : XCTestCase
+@end
+
+@implementation iTermLiteralSearchTest {
+    screen_char_t _cells[128];
+    unsigned char _haystack[128];
+    int _length;
+}
+
+- (BOOL)copyHaystack:(NSString *)string needle:(const iTermLiteralSearchNeedle *)needle {
+    _length = string.length;
+    memset(_cells, 0, sizeof(_cells));
+    for (int i = 0; i < _length; i++) {
+        _cells[i].code = [string characterAtIndex:i];
+    }
+    return iTermLiteralSearchCopyHaystack(_haystack, _cells, _length, needle);
+}
+
+- (void)testForwardAndBackward {
+    iTermLiteralSearchNeedle needle;
+    XCTAssertTrue(iTermLiteralSearchNeedleInit(&needle, @"abab", iTermFindModeCaseSensitiveSubstring));
+    // Long enough that the vectorized loops run, with matches on both sides of a 16-cell boundary.
+    XCTAssertTrue([self copyHaystack:@"xxababab xxxxxxxxxxxxxxxxxxxxxxxx ababx" needle:&needle]);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 0), 2);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 3), 4);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 5), 34);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 35), -1);
+    XCTAssertEqual(iTermLiteralSearchBackward(&needle, _haystack, _length), 34);
+    XCTAssertEqual(iTermLiteralSearchBackward(&needle, _haystack, 37), 4);
+    XCTAssertEqual(iTermLiteralSearchBackward(&needle, _haystack, 7), 2);
+    XCTAssertEqual(iTermLiteralSearchBackward(&needle, _haystack, 5), -1);
+}
+
+- (void)testCaseFolding {
+    iTermLiteralSearchNeedle needle;
+    XCTAssertTrue(iTermLiteralSearchNeedleInit(&needle, @"Lazy", iTermFindModeCaseInsensitiveSubstring));
+    XCTAssertTrue([self copyHaystack:@"The quick brown fox jumps over the LAZY dog" needle:&needle]);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 0), 35);
+
+    // Smart case is sensitive once the search string has an uppercase letter.
+    XCTAssertTrue(iTermLiteralSearchNeedleInit(&needle, @"Lazy", iTermFindModeSmartCaseSensitivity));
+    XCTAssertTrue([self copyHaystack:@"The quick brown fox jumps over the LAZY dog" needle:&needle]);
+    XCTAssertEqual(iTermLiteralSearchForward(&needle, _haystack, _length, 0), -1);
+}
+
+- (void)testUnsupportedNeedlesAndLines {
+    iTermLiteralSearchNeedle needle;
+    XCTAssertFalse(iTermLiteralSearchNeedleInit(&needle, @"a.*b", iTermFindModeCaseSensitiveRegex));
+    XCTAssertFalse(iTermLiteralSearchNeedleInit(&needle, @"naïve", iTermFindModeCaseSensitiveSubstring));
+    XCTAssertFalse(iTermLiteralSearchNeedleInit(&needle, @"", iTermFindModeCaseSensitiveSubstring));
+
+    XCTAssertTrue(iTermLiteralSearchNeedleInit(&needle, @"cafe", iTermFindModeCaseInsensitiveSubstring));
+    XCTAssertFalse([self copyHaystack:@"café" needle:&needle]);
+    NSString *dwc = [NSString stringWithFormat:@"ab%Ccd", (unichar)DWC_RIGHT];
+    XCTAssertFalse([self copyHaystack:dwc needle:&needle]);
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  iTermPTYRecordingTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermPTYRecording.h"
+
+@interface iTermPTYRecordingTest : XCTestCase
+@end
+
+@implementation iTermPTYRecordingTest {
+    NSString *_path;
+}
+
+- (void)setUp {
+    _path = [[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]] retain];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:_path error:nil];
+    [_path release];
+}
+
+- (void)testRoundTrip {
+    iTermPTYRecorder *recorder = [[[iTermPTYRecorder alloc] initWithPath:_path] autorelease];
+    XCTAssertNotNil(recorder);
+    [recorder recordSize:VT100GridSizeMake(80, 25)];
+    [recorder recordOutput:"hello" length:5];
+    [recorder recordSize:VT100GridSizeMake(132, 50)];
+
+    // Bigger than the recorder's buffer, so it's written directly.
+    NSMutableData *big = [NSMutableData dataWithLength:100000];
+    memset(big.mutableBytes, 'x', big.length);
+    [recorder recordOutput:big.bytes length:(int)big.length];
+    [recorder close];
+
+    iTermPTYRecording *recording = [iTermPTYRecording recordingWithContentsOfFile:_path];
+    XCTAssertNotNil(recording);
+    XCTAssertEqual(recording.outputLength, 5 + (long long)big.length);
+
+    NSMutableArray *events = [NSMutableArray array];
+    __block NSTimeInterval lastTimestamp = 0;
+    [recording enumerateEventsUsingBlock:^(iTermPTYRecordingEventType type,
+                                           NSTimeInterval timestamp,
+                                           NSData *output,
+                                           VT100GridSize size,
+                                           BOOL *stop) {
+        XCTAssertGreaterThanOrEqual(timestamp, lastTimestamp);
+        lastTimestamp = timestamp;
+        if (type == iTermPTYRecordingEventTypeOutput) {
+            [events addObject:[[output copy] autorelease]];
+        } else {
+            [events addObject:[NSValue valueWithGridSize:size]];
+        }
+    }];
+    NSArray *expected = @[ [NSValue valueWithGridSize:VT100GridSizeMake(80, 25)],
+                           [@"hello" dataUsingEncoding:NSUTF8StringEncoding],
+                           [NSValue valueWithGridSize:VT100GridSizeMake(132, 50)],
+                           big ];
+    XCTAssertEqualObjects(events, expected);
+}
+
+- (void)testTruncatedRecordIsIgnored {
+    iTermPTYRecorder *recorder = [[[iTermPTYRecorder alloc] initWithPath:_path] autorelease];
+    [recorder recordOutput:"first" length:5];
+    [recorder recordOutput:"second" length:6];
+    [recorder close];
+
+    NSData *data = [NSData dataWithContentsOfFile:_path];
+    NSData *truncated = [data subdataWithRange:NSMakeRange(0, data.length - 2)];
+    iTermPTYRecording *recording = [[[iTermPTYRecording alloc] initWithData:truncated] autorelease];
+    XCTAssertEqual(recording.outputLength, 5);
+}
+
+- (void)testRejectsOtherFiles {
+    NSData *data = [@"not a recording" dataUsingEncoding:NSUTF8StringEncoding];
+    XCTAssertNil([[[iTermPTYRecording alloc] initWithData:data] autorelease]);
+}
+
+@end
@@ -0,0 +1,101 @@
+//
+//  iTermReadinessMonitorTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermReadinessMonitor.h"
+
+@interface iTermReadinessMonitorTest : XCTestCase
+@end
+
+@implementation iTermReadinessMonitorTest {
+    int _quiet[2];
+    int _noisy[2];
+}
+
+- (void)setUp {
+    [super setUp];
+    XCTAssertEqual(pipe(_quiet), 0);
+    XCTAssertEqual(pipe(_noisy), 0);
+    XCTAssertEqual(write(_noisy[1], "x", 1), 1);
+}
+
+- (void)tearDown {
+    for (int i = 0; i < 2; i++) {
+        close(_quiet[i]);
+        close(_noisy[i]);
+    }
+    [super tearDown];
+}
+
+- (NSArray<iTermReadinessMonitor *> *)monitors {
+    return @[ [iTermReadinessMonitor bestAvailableMonitor], [iTermReadinessMonitor selectMonitor] ];
+}
+
+- (void)testOnlyReadyDescriptorsAreReported {
+    for (iTermReadinessMonitor *monitor in self.monitors) {
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_quiet[0]]);
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_noisy[0]]);
+        iTermReadinessEvent events[4];
+        const int count = [monitor waitForEvents:events capacity:4];
+        XCTAssertEqual(count, 1, @"%@", monitor);
+        XCTAssertEqual(events[0].fd, _noisy[0]);
+        XCTAssertTrue(events[0].events & iTermReadinessEventsRead);
+    }
+}
+
+- (void)testInterestPersistsAcrossWaits {
+    for (iTermReadinessMonitor *monitor in self.monitors) {
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_noisy[0]]);
+        iTermReadinessEvent events[4];
+        XCTAssertEqual([monitor waitForEvents:events capacity:4], 1, @"%@", monitor);
+        // Level-triggered: still readable because nothing was read.
+        XCTAssertEqual([monitor waitForEvents:events capacity:4], 1, @"%@", monitor);
+        XCTAssertEqual([monitor interestForFileDescriptor:_noisy[0]], iTermReadinessEventsRead);
+    }
+}
+
+- (void)testChangingInterest {
+    for (iTermReadinessMonitor *monitor in self.monitors) {
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_noisy[0]]);
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsWrite forFileDescriptor:_quiet[1]]);
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsNone forFileDescriptor:_noisy[0]]);
+        iTermReadinessEvent events[4];
+        XCTAssertEqual([monitor waitForEvents:events capacity:4], 1, @"%@", monitor);
+        XCTAssertEqual(events[0].fd, _quiet[1]);
+        XCTAssertTrue(events[0].events & iTermReadinessEventsWrite);
+
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_noisy[0]]);
+        [monitor forgetFileDescriptor:_quiet[1]];
+        XCTAssertEqual([monitor waitForEvents:events capacity:4], 1, @"%@", monitor);
+        XCTAssertEqual(events[0].fd, _noisy[0]);
+    }
+}
+
+- (void)testHangupIsReported {
+    close(_quiet[1]);
+    _quiet[1] = -1;
+    for (iTermReadinessMonitor *monitor in self.monitors) {
+        XCTAssertTrue([monitor setInterest:iTermReadinessEventsRead forFileDescriptor:_quiet[0]]);
+        iTermReadinessEvent events[4];
+        XCTAssertEqual([monitor waitForEvents:events capacity:4], 1, @"%@", monitor);
+        XCTAssertEqual(events[0].fd, _quiet[0]);
+        XCTAssertTrue(events[0].events & iTermReadinessEventsRead);
+    }
+}
+
+- (void)testAdoptInterests {
+    iTermReadinessMonitor *best = [iTermReadinessMonitor bestAvailableMonitor];
+    XCTAssertTrue([best setInterest:iTermReadinessEventsRead forFileDescriptor:_quiet[0]]);
+    XCTAssertTrue([best setInterest:iTermReadinessEventsRead forFileDescriptor:_noisy[0]]);
+
+    iTermReadinessMonitor *monitor = [iTermReadinessMonitor selectMonitor];
+    XCTAssertTrue([monitor adoptInterestsFromMonitor:best]);
+    XCTAssertEqual([monitor interestForFileDescriptor:_quiet[0]], iTermReadinessEventsRead);
+    iTermReadinessEvent events[4];
+    XCTAssertEqual([monitor waitForEvents:events capacity:4], 1);
+    XCTAssertEqual(events[0].fd, _noisy[0]);
+}
+
+@end
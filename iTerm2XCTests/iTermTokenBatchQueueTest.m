@@ -0,0 +1,112 @@
+//
+//  iTermTokenBatchQueueTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermTokenBatchQueue.h"
+
+@interface iTermTokenBatchQueueTest : XCTestCase
+@end
+
+@implementation iTermTokenBatchQueueTest
+
+- (BOOL)enqueueEmptyBatchOfLength:(int)length
+                          inQueue:(iTermTokenBatchQueue *)queue
+                     wakeConsumer:(BOOL *)wakeConsumer {
+    CVector vector;
+    CVectorCreate(&vector, 1);
+    if ([queue enqueueTokens:&vector length:length wakeConsumer:wakeConsumer]) {
+        return YES;
+    }
+    CVectorDestroy(&vector);
+    return NO;
+}
+
+- (void)testFIFOAndBackpressure {
+    iTermTokenBatchQueue *queue = [[[iTermTokenBatchQueue alloc] initWithCapacity:3] autorelease];
+    BOOL wake;
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:1 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertTrue(wake);
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:2 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertFalse(wake);
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:3 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertTrue(queue.isFull);
+    XCTAssertFalse([self enqueueEmptyBatchOfLength:4 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertEqual(queue.maximumDepth, 3);
+
+    NSMutableArray *lengths = [NSMutableArray array];
+    const BOOL wasFull = [queue drainUsingBlock:^(CVector *vector, int length) {
+        [lengths addObject:@(length)];
+        CVectorDestroy(vector);
+    }];
+    XCTAssertTrue(wasFull);
+    XCTAssertEqualObjects(lengths, (@[ @1, @2, @3 ]));
+    XCTAssertEqual(queue.depth, 0);
+    XCTAssertEqual(queue.numberOfBatchesDequeued, 3);
+
+    // Draining rearms the wakeup.
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:5 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertTrue(wake);
+}
+
+- (void)testOverflowKeepsOrderWhenDrainedReentrantly {
+    iTermTokenBatchQueue *queue = [[[iTermTokenBatchQueue alloc] initWithCapacity:2] autorelease];
+    BOOL wake;
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:1 inQueue:queue wakeConsumer:&wake]);
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:2 inQueue:queue wakeConsumer:&wake]);
+    for (int length = 3; length <= 4; length++) {
+        // Later batches may not overtake the overflow.
+        XCTAssertFalse([self enqueueEmptyBatchOfLength:length inQueue:queue wakeConsumer:&wake]);
+        CVector vector;
+        CVectorCreate(&vector, 1);
+        [queue enqueueOverflowTokens:&vector length:length wakeConsumer:&wake];
+    }
+    XCTAssertTrue(queue.isFull);
+    XCTAssertEqual(queue.depth, 4);
+
+    // Executing the first batch drains the rest, as a nested run loop would.
+    NSMutableArray *lengths = [NSMutableArray array];
+    __block void (^drain)(CVector *, int) = ^(CVector *vector, int length) {
+        [lengths addObject:@(length)];
+        CVectorDestroy(vector);
+        if (length == 1) {
+            [queue drainUsingBlock:drain];
+        }
+    };
+    XCTAssertTrue([queue drainUsingBlock:drain]);
+    XCTAssertEqualObjects(lengths, (@[ @1, @2, @3, @4 ]));
+    XCTAssertEqual(queue.depth, 0);
+    XCTAssertTrue([self enqueueEmptyBatchOfLength:5 inQueue:queue wakeConsumer:&wake]);
+}
+
+- (void)testConcurrentProducerAndConsumer {
+    iTermTokenBatchQueue *queue = [[[iTermTokenBatchQueue alloc] initWithCapacity:4] autorelease];
+    const int count = 100000;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        for (int i = 0; i < count; ) {
+            BOOL wake;
+            if ([self enqueueEmptyBatchOfLength:i inQueue:queue wakeConsumer:&wake]) {
+                i++;
+            }
+        }
+        dispatch_semaphore_signal(done);
+    });
+
+    __block int expected = 0;
+    __block BOOL inOrder = YES;
+    while (expected < count) {
+        [queue drainUsingBlock:^(CVector *vector, int length) {
+            inOrder = inOrder && (length == expected);
+            expected++;
+            CVectorDestroy(vector);
+        }];
+    }
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    dispatch_release(done);
+    XCTAssertTrue(inOrder);
+    XCTAssertEqual(queue.numberOfBatchesDequeued, count);
+}
+
+@end
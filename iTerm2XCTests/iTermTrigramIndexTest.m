@@ -0,0 +1,72 @@
+//
+//  iTermTrigramIndexTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermTrigramIndex.h"
+
+@interface iTermTrigramIndexTest : XCTestCase
+@end
+
+@implementation iTermTrigramIndexTest {
+    iTermTrigramLineFilter _lineFilter;
+    iTermTrigramBlockFilter _blockFilter;
+}
+
+- (void)setUp {
+    memset(&_lineFilter, 0, sizeof(_lineFilter));
+    memset(&_blockFilter, 0, sizeof(_blockFilter));
+}
+
+// Adds |string| in pieces of |pieceLength| cells, as a long line is appended a row at a time.
+- (BOOL)addString:(NSString *)string pieceLength:(int)pieceLength {
+    const int length = string.length;
+    screen_char_t *cells = calloc(length, sizeof(screen_char_t));
+    for (int i = 0; i < length; i++) {
+        cells[i].code = [string characterAtIndex:i];
+    }
+    BOOL indexed = YES;
+    for (int start = 0; start < length; start += pieceLength) {
+        indexed = iTermTrigramFiltersAddCells(cells, start, MIN(length, start + pieceLength), &_lineFilter, &_blockFilter) && indexed;
+    }
+    free(cells);
+    return indexed;
+}
+
+- (BOOL)filtersMayMatch:(NSString *)needle mode:(iTermFindMode)mode {
+    iTermTrigramQuery query;
+    XCTAssertTrue(iTermTrigramQueryInit(&query, needle, mode));
+    const BOOL lineMayMatch = iTermTrigramLineFilterMayMatch(&_lineFilter, &query);
+    XCTAssertEqual(lineMayMatch, iTermTrigramBlockFilterMayMatch(&_blockFilter, &query));
+    return lineMayMatch;
+}
+
+- (void)testTrigramsSpanPieces {
+    XCTAssertTrue([self addString:@"The quick brown fox jumps over the lazy dog" pieceLength:4]);
+    XCTAssertTrue([self filtersMayMatch:@"brown fox" mode:iTermFindModeCaseSensitiveSubstring]);
+    XCTAssertTrue([self filtersMayMatch:@"LAZY" mode:iTermFindModeCaseInsensitiveSubstring]);
+    XCTAssertFalse([self filtersMayMatch:@"zebra" mode:iTermFindModeSmartCaseSensitivity]);
+}
+
+- (void)testPrivateCodesAreSkipped {
+    NSString *string = [NSString stringWithFormat:@"ab%Ccd", (unichar)DWC_RIGHT];
+    XCTAssertTrue([self addString:string pieceLength:2]);
+    XCTAssertTrue([self filtersMayMatch:@"abcd" mode:iTermFindModeCaseInsensitiveSubstring]);
+}
+
+- (void)testNonASCIIMakesLineUnindexable {
+    XCTAssertFalse([self addString:@"café au lait" pieceLength:80]);
+    iTermTrigramQuery query;
+    XCTAssertTrue(iTermTrigramQueryInit(&query, @"cafe", iTermFindModeCaseInsensitiveSubstring));
+    XCTAssertTrue(iTermTrigramLineFilterMayMatch(&_lineFilter, &query));
+}
+
+- (void)testUnsupportedQueries {
+    iTermTrigramQuery query;
+    XCTAssertFalse(iTermTrigramQueryInit(&query, @"ab", iTermFindModeCaseSensitiveSubstring));
+    XCTAssertFalse(iTermTrigramQueryInit(&query, @"a.*b", iTermFindModeCaseSensitiveRegex));
+    XCTAssertFalse(iTermTrigramQueryInit(&query, @"naïve", iTermFindModeCaseSensitiveSubstring));
+}
+
+@end
@@ -0,0 +1,87 @@
+//
+//  iTermUTF8TranscoderTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermUTF8Transcoder.h"
+#import "NSStringITerm.h"
+
+@interface iTermUTF8TranscoderTest : XCTestCase
+@end
+
+@implementation iTermUTF8TranscoderTest
+
+- (NSString *)transcode:(NSData *)data
+               consumed:(int *)consumed
+                   stop:(iTermUTF8TranscoderStop *)stop
+          invalidLength:(int *)invalidLength {
+    unichar buffer[data.length + 1];
+    int length = 0;
+    *consumed = iTermUTF8TranscodeToUTF16(data.bytes,
+                                          (int)data.length,
+                                          buffer,
+                                          &length,
+                                          stop,
+                                          invalidLength);
+    return [NSString stringWithCharacters:buffer length:length];
+}
+
+- (void)testLongCJKRunUsesBlocksAndStopsAtASCII {
+    NSString *cjk = @"中文字符测试中文字符测试中文字符测试";
+    NSData *data = [[cjk stringByAppendingString:@"x"] dataUsingEncoding:NSUTF8StringEncoding];
+    int consumed;
+    iTermUTF8TranscoderStop stop;
+    int invalidLength;
+    NSString *actual = [self transcode:data consumed:&consumed stop:&stop invalidLength:&invalidLength];
+    XCTAssertEqualObjects(actual, cjk);
+    XCTAssertEqual(consumed, (int)data.length - 1);
+    XCTAssertEqual(stop, iTermUTF8TranscoderStopASCII);
+}
+
+- (void)testTwoByteRunAndAstralPlane {
+    NSString *expected = @"ЖЖЖЖЖЖЖЖЖЖЖЖЖЖЖЖЖЖ😀";
+    NSData *data = [expected dataUsingEncoding:NSUTF8StringEncoding];
+    int consumed;
+    iTermUTF8TranscoderStop stop;
+    int invalidLength;
+    NSString *actual = [self transcode:data consumed:&consumed stop:&stop invalidLength:&invalidLength];
+    XCTAssertEqualObjects(actual, expected);
+    XCTAssertEqual(consumed, (int)data.length);
+    XCTAssertEqual(stop, iTermUTF8TranscoderStopEndOfInput);
+}
+
+- (void)testTruncatedSequenceReportsOffset {
+    NSMutableData *data = [[[@"中文字符测试中文字符测试" dataUsingEncoding:NSUTF8StringEncoding] mutableCopy] autorelease];
+    const int expectedConsumed = (int)data.length;
+    const unsigned char partial[] = { 0xe4, 0xb8 };
+    [data appendBytes:partial length:sizeof(partial)];
+    int consumed;
+    iTermUTF8TranscoderStop stop;
+    int invalidLength;
+    [self transcode:data consumed:&consumed stop:&stop invalidLength:&invalidLength];
+    XCTAssertEqual(consumed, expectedConsumed);
+    XCTAssertEqual(stop, iTermUTF8TranscoderStopTruncated);
+}
+
+- (void)testInvalidSequenceMatchesDecodeUTF8Char {
+    // Five CJK characters whose block contains a surrogate encoding (ED A0 80), which the block
+    // fast path must reject.
+    const unsigned char bytes[] = {
+        0xe4, 0xb8, 0xad, 0xe4, 0xb8, 0xad, 0xed, 0xa0, 0x80, 0xe4, 0xb8, 0xad,
+        0xe4, 0xb8, 0xad, 0xe4
+    };
+    NSData *data = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+    int consumed;
+    iTermUTF8TranscoderStop stop;
+    int invalidLength;
+    NSString *actual = [self transcode:data consumed:&consumed stop:&stop invalidLength:&invalidLength];
+    XCTAssertEqualObjects(actual, @"中中");
+    XCTAssertEqual(consumed, 6);
+    XCTAssertEqual(stop, iTermUTF8TranscoderStopInvalid);
+
+    int theChar;
+    XCTAssertEqual(invalidLength, -decode_utf8_char(bytes + 6, sizeof(bytes) - 6, &theChar));
+}
+
+@end
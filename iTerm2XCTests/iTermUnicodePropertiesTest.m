@@ -0,0 +1,43 @@
+//
+//  iTermUnicodePropertiesTest.m
+//  iTerm2XCTests
+//
+
+#import <XCTest/XCTest.h>
+#import "iTermUnicodeProperties.h"
+#import "NSCharacterSet+iTerm.h"
+
+@interface iTermUnicodePropertiesTest : XCTestCase
+@end
+
+@implementation iTermUnicodePropertiesTest
+
+- (void)assertTableMatchesCharacterSetsForVersion:(NSInteger)version {
+    const iTermUnicodePropertyTable *table = iTermUnicodePropertyTableForVersion(version);
+    NSCharacterSet *fullWidth = [NSCharacterSet fullWidthCharacterSetForUnicodeVersion:version];
+    NSCharacterSet *ambiguousWidth = [NSCharacterSet ambiguousWidthCharacterSetForUnicodeVersion:version];
+    NSCharacterSet *zeroWidthSpaces = [NSCharacterSet zeroWidthSpaceCharacterSetForUnicodeVersion:version];
+    NSCharacterSet *spacingCombiningMarks = [NSCharacterSet allSpacingCombiningMarksForUnicodeVersion:12];
+    for (UTF32Char c = 0; c < 0x110000; c++) {
+        const iTermUnicodeProperty properties = iTermUnicodePropertiesOfCodePoint(table, c);
+        const BOOL ok = (!!(properties & iTermUnicodePropertyFullWidth) == [fullWidth longCharacterIsMember:c] &&
+                         !!(properties & iTermUnicodePropertyAmbiguousWidth) == [ambiguousWidth longCharacterIsMember:c] &&
+                         !!(properties & iTermUnicodePropertyZeroWidthSpace) == [zeroWidthSpaces longCharacterIsMember:c] &&
+                         !!(properties & iTermUnicodePropertySpacingCombiningMark) == [spacingCombiningMarks longCharacterIsMember:c]);
+        if (!ok) {
+            XCTFail(@"Properties of U+%04X are wrong for unicode %@", (unsigned int)c, @(version));
+            return;
+        }
+    }
+}
+
+- (void)testTableMatchesCharacterSets {
+    [self assertTableMatchesCharacterSetsForVersion:8];
+    [self assertTableMatchesCharacterSetsForVersion:9];
+}
+
+- (void)testOutOfRangeCodePointsHaveNoProperties {
+    XCTAssertEqual(iTermUnicodePropertiesOfCodePoint(iTermUnicodePropertyTableForVersion(9), 0x110000), 0);
+}
+
+@end
@@ -51,6 +51,12 @@ NS_INLINE void CVectorAppend(CVector *vector, void *value) {
     vector->elements[vector->count++] = value;
 }
 
+// Removes and returns the last element. The vector must not be empty.
+NS_INLINE void *CVectorRemoveLast(CVector *vector) {
+    assert(vector->count > 0);
+    return vector->elements[--vector->count];
+}
+
 NS_INLINE id CVectorLastObject(const CVector *vector) {
     if (vector->count == 0) {
         return nil;
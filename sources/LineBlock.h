@@ -9,6 +9,9 @@
 #import <Foundation/Foundation.h>
 #import "iTermFindViewController.h"
 #import "ScreenChar.h"
+#import "iTermTrigramIndex.h"
+
+typedef struct LineBlockDoubleWidthCharacterCache LineBlockDoubleWidthCharacterCache;
 
 typedef struct {
     NSTimeInterval timestamp;
@@ -17,17 +20,47 @@ typedef struct {
     int width_for_number_of_wrapped_lines;
 
     // Remembers the offsets at which double-width characters that are wrapped
-    // to the next line occur for a pane of width
-    // width_for_double_width_characters_cache.
-    NSMutableIndexSet *double_width_characters;
-    int width_for_double_width_characters_cache;
+    // to the next line occur for the few most recently used widths. NULL until
+    // needed.
+    LineBlockDoubleWidthCharacterCache *double_width_characters;
     NSInteger generation;
 } LineBlockMetadata;
 
+// Hits and misses of the caches that LineBlock keeps for its recently used widths, summed over
+// all blocks.
+typedef struct {
+    NSInteger numLinesHits;
+    NSInteger numLinesMisses;
+    NSInteger doubleWidthCharacterHits;
+    NSInteger doubleWidthCharacterMisses;
+} LineBlockWidthCacheStatistics;
+
+// Blocks that are currently compressed and how long decompressing them has taken, summed over all
+// blocks.
+typedef struct {
+    NSInteger compressedBlocks;
+    // What the compressed blocks would take as screen_char_t's.
+    NSInteger uncompressedBytes;
+    NSInteger compressedBytes;
+    NSInteger decompressions;
+    NSTimeInterval totalDecompressionTime;
+    NSTimeInterval maximumDecompressionTime;
+    // Blocks whose cells are in a spill file, and the bytes they take in it.
+    NSInteger spilledBlocks;
+    NSInteger spilledBytes;
+} LineBlockCompressionStatistics;
+
 @class LineBlock;
+@class iTermScrollbackSpillFile;
 
 @protocol iTermLineBlockObserver<NSObject>
 - (void)lineBlockDidChange:(LineBlock *)lineBlock;
+
+// A compact block expanded its cells because something needed them.
+- (void)lineBlockDidExpand:(LineBlock *)lineBlock;
+
+// The block's memoryUsage changed by |delta| bytes since it was last reported.
+- (void)lineBlock:(LineBlock *)lineBlock memoryUsageDidChangeBy:(NSInteger)delta;
 @end
 
 // LineBlock represents an ordered collection of lines of text. It stores them contiguously
@@ -41,7 +74,22 @@ typedef struct {
 @property(nonatomic, assign) BOOL mayHaveDoubleWidthCharacter;
 @property(nonatomic, readonly) int numberOfCharacters;
 
+// A compact block stores each cell as its code plus an index into a table of the distinct styles
+// (colors and attributes) in the block. Reading cells expands them back into screen_char_t's, which
+// are kept until -discardExpandedCells. Modifying a compact block makes it no longer compact.
+@property(nonatomic, readonly) BOOL isCompact;
+
+// A compressed block is a compact block whose cells are also encoded with iTermCompactCellsEncode.
+// Expanding it decodes them.
+@property(nonatomic, readonly) BOOL isCompressed;
+
+// A spilled block is a compact block whose encoded cells are in a file rather than in memory.
+// Expanding it maps them back.
+@property(nonatomic, readonly) BOOL isSpilled;
+
 + (instancetype)blockWithDictionary:(NSDictionary *)dictionary;
++ (LineBlockWidthCacheStatistics)widthCacheStatistics;
++ (LineBlockCompressionStatistics)compressionStatistics;
 
 - (instancetype)initWithRawBufferSize:(int)size;
 
@@ -79,6 +127,11 @@ typedef struct {
 // Returns whether getNumLinesWithWrapWidth will be fast.
 - (BOOL)hasCachedNumLinesForWidth:(int)width;
 
+// Guesses the number of lines at a given screen width in constant time, without looking at the
+// lines. Exact if the number is cached or all lines have the same length. Never less than the
+// number of raw lines.
+- (int)estimatedNumLinesWithWrapWidth:(int)width;
+
 // Returns true if the last line is incomplete.
 - (BOOL)hasPartial;
 
@@ -114,6 +167,29 @@ typedef struct {
 // Remove extra space from the end of the buffer. Future appends will fail.
 - (void)shrinkToFit;
 
+// Converts the block to compact form, freeing the expanded cells. Returns NO if the block has too
+// many distinct styles to be compacted.
+- (BOOL)compact;
+
+// Frees the expanded cells of a compact block. Pointers previously returned by this block become
+// invalid.
+- (void)discardExpandedCells;
+
+// Compacts the block and then compresses it on a background queue. The block becomes compressed
+// some time later on the main thread unless it's modified first. Call only on the main thread.
+- (void)compressInBackground;
+
+// Compacts the block and moves its encoded cells to |file|. Returns NO if the block can't be
+// compacted or the file can't be written. Call only on the main thread.
+- (BOOL)spillToFile:(iTermScrollbackSpillFile *)file;
+
+// Approximate number of bytes of memory used by cells and per-line metadata.
+- (NSInteger)memoryUsage;
+
+// The value of memoryUsage as of the last lineBlock:memoryUsageDidChangeBy: sent to observers.
+// Observers that keep a total add this when they start observing and subtract it when they stop.
+@property(nonatomic, readonly) NSInteger reportedMemoryUsage;
+
 // Return a raw line
 - (screen_char_t *)rawLine:(int)linenum;
 
@@ -141,6 +217,22 @@ typedef struct {
               results:(NSMutableArray*)results
       multipleResults:(BOOL)multipleResults;
 
+// Like the above, but lines and blocks that |query| rules out are skipped. |query| may be NULL.
+- (void)findSubstring:(NSString*)substring
+              options:(int)options
+                 mode:(iTermFindMode)mode
+             atOffset:(int)offset
+              results:(NSMutableArray*)results
+      multipleResults:(BOOL)multipleResults
+         trigramQuery:(const iTermTrigramQuery *)query;
+
+// Returns NO if no line in the block can contain a match for |query|.
+- (BOOL)mayContainMatchForTrigramQuery:(const iTermTrigramQuery *)query;
+
+// Expands a compact block so that other threads may search it. The block must not be modified and
+// its expanded cells must not be discarded until they finish. Call only on the main thread.
+- (void)prepareForConcurrentReading;
+
 // Tries to convert a byte offset into the block to an x,y coordinate relative to the first char
 // in the block. Returns YES on success, NO if the position is out of range.
 - (BOOL)convertPosition:(int)position
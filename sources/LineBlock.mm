@@ -11,17 +11,185 @@ extern "C" {
 
 #import "DebugLogging.h"
 #import "FindContext.h"
+#import "iTermCompactCellCodec.h"
+#import "iTermLiteralSearch.h"
 #import "iTermMalloc.h"
+#import "iTermScrollbackSpillFile.h"
+#import "iTermTrigramIndex.h"
 #import "LineBufferHelpers.h"
 #import "NSBundle+iTerm.h"
 #import "RegexKitLite.h"
 #import "iTermAdvancedSettingsModel.h"
 }
+#include <atomic>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+static const int iTermLineBlockMaxStyles = UINT16_MAX + 1;
+
+struct iTermStyleHasher {
+    std::size_t operator()(const screen_char_t &c) const {
+        // FNV-1a
+        const unsigned char *bytes = (const unsigned char *)&c;
+        std::size_t hash = 14695981039346656037ULL;
+        for (size_t i = 0; i < sizeof(c); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+struct iTermStyleEqual {
+    bool operator()(const screen_char_t &a, const screen_char_t &b) const {
+        return !memcmp(&a, &b, sizeof(a));
+    }
+};
+
 static BOOL gEnableDoubleWidthCharacterLineCache = NO;
 static BOOL gUseCachingNumberOfLines = NO;
+static BOOL gIndexTrigrams = NO;
+
+// Split panes, tmux, and readers of history at other widths can all use one block at several
+// widths. This many widths are cached per block before the least recently used is forgotten.
+static const int kLineBlockWidthCacheCapacity = 4;
+
+static std::atomic<NSInteger> gNumLinesCacheHits;
+static std::atomic<NSInteger> gNumLinesCacheMisses;
+static std::atomic<NSInteger> gDoubleWidthCharacterCacheHits;
+static std::atomic<NSInteger> gDoubleWidthCharacterCacheMisses;
+
+static std::atomic<NSInteger> gCompressedBlocks;
+static std::atomic<NSInteger> gCompressedBlocksUncompressedBytes;
+static std::atomic<NSInteger> gCompressedBlocksCompressedBytes;
+static std::atomic<NSInteger> gDecompressions;
+// In microseconds.
+static std::atomic<NSInteger> gTotalDecompressionTime;
+static std::atomic<NSInteger> gMaximumDecompressionTime;
+static std::atomic<NSInteger> gSpilledBlocks;
+static std::atomic<NSInteger> gSpilledBytes;
+
+// The number of wrapped lines in a block for its most recently used widths, most recent first.
+struct iTermNumLinesCache {
+    struct Entry {
+        int width;
+        int numLines;
+    };
+    Entry entries[kLineBlockWidthCacheCapacity];
+    int count;
+
+    iTermNumLinesCache() : count(0) { }
+
+    // Returns the entry for |width| or NULL. A found entry becomes the most recent.
+    Entry *find(int width) {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].width == width) {
+                const Entry entry = entries[i];
+                memmove(entries + 1, entries, sizeof(Entry) * i);
+                entries[0] = entry;
+                return &entries[0];
+            }
+        }
+        return NULL;
+    }
+
+    // Like find() but doesn't count as a use.
+    const Entry *peek(int width) const {
+        for (int i = 0; i < count; i++) {
+            if (entries[i].width == width) {
+                return &entries[i];
+            }
+        }
+        return NULL;
+    }
+
+    void set(int width, int numLines) {
+        Entry *entry = find(width);
+        if (!entry) {
+            count = MIN(count + 1, kLineBlockWidthCacheCapacity);
+            memmove(entries + 1, entries, sizeof(Entry) * (count - 1));
+            entry = &entries[0];
+            entry->width = width;
+        }
+        entry->numLines = numLines;
+    }
+
+    // Removes entries for which |keep| returns false.
+    template<typename Function>
+    void filter(Function keep) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            if (keep(entries[i])) {
+                entries[n++] = entries[i];
+            }
+        }
+        count = n;
+    }
+
+    void clear() {
+        count = 0;
+    }
+};
+
+// Per raw line, most recently used width first.
+struct LineBlockDoubleWidthCharacterCache {
+    struct Entry {
+        int width;
+        NSMutableIndexSet *indexes;
+    };
+    Entry entries[kLineBlockWidthCacheCapacity];
+    int count;
+};
+
+static void LineBlockMetadataFreeDoubleWidthCharacterCache(LineBlockMetadata *metadata) {
+    LineBlockDoubleWidthCharacterCache *cache = metadata->double_width_characters;
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < cache->count; i++) {
+        [cache->entries[i].indexes release];
+    }
+    free(cache);
+    metadata->double_width_characters = NULL;
+}
+
+// Returns the cached offsets for |width| or nil. Found offsets become the most recent.
+static NSMutableIndexSet *LineBlockMetadataDoubleWidthCharacters(LineBlockMetadata *metadata,
+                                                                 int width) {
+    LineBlockDoubleWidthCharacterCache *cache = metadata->double_width_characters;
+    if (!cache) {
+        return nil;
+    }
+    for (int i = 0; i < cache->count; i++) {
+        if (cache->entries[i].width == width) {
+            const LineBlockDoubleWidthCharacterCache::Entry entry = cache->entries[i];
+            memmove(cache->entries + 1, cache->entries, sizeof(entry) * i);
+            cache->entries[0] = entry;
+            return entry.indexes;
+        }
+    }
+    return nil;
+}
+
+// Takes ownership of |indexes|.
+static void LineBlockMetadataAddDoubleWidthCharacters(LineBlockMetadata *metadata,
+                                                      int width,
+                                                      NSMutableIndexSet *indexes) {
+    if (!metadata->double_width_characters) {
+        metadata->double_width_characters =
+            (LineBlockDoubleWidthCharacterCache *)calloc(1, sizeof(LineBlockDoubleWidthCharacterCache));
+    }
+    LineBlockDoubleWidthCharacterCache *cache = metadata->double_width_characters;
+    if (cache->count == kLineBlockWidthCacheCapacity) {
+        [cache->entries[cache->count - 1].indexes release];
+        cache->count--;
+    }
+    memmove(cache->entries + 1, cache->entries, sizeof(LineBlockDoubleWidthCharacterCache::Entry) * cache->count);
+    cache->entries[0].width = width;
+    cache->entries[0].indexes = indexes;
+    cache->count++;
+}
 
 NSString *const kLineBlockRawBufferKey = @"Raw Buffer";
 NSString *const kLineBlockBufferStartOffsetKey = @"Buffer Start Offset";
@@ -98,17 +266,48 @@ struct iTermNumFullLinesCacheKeyHasher {
     // If true, then the last raw line does not include a logical newline at its terminus.
     BOOL is_partial;
 
-    // The number of wrapped lines if width==cached_numlines_width.
-    int cached_numlines;
-
-    // This is -1 if the cache is invalid; otherwise it specifies the width for which
-    // cached_numlines is correct.
-    int cached_numlines_width;
+    // The number of wrapped lines at recently used widths.
+    iTermNumLinesCache _numLinesCache;
 
     // Keys are (offset from raw_buffer, length to examine, width).
     std::unordered_map<iTermNumFullLinesCacheKey, int, iTermNumFullLinesCacheKeyHasher> _numberOfFullLinesCache;
 
     std::vector<void *> _observers;
+
+    // When compact, the cells in [0, _compactLength) are kept here and raw_buffer is NULL until
+    // something reads them.
+    iTermCompactCell *_compactCells;
+    int _compactLength;
+    screen_char_t *_styles;
+    int _numberOfStyles;
+
+    // Cold compact blocks replace _compactCells with their encoding, made on a background queue.
+    // _compactLength and the style table are kept.
+    NSData *_compressedCells;
+    BOOL _compressing;
+    // Incremented when the block stops being compact, so a compression that finishes after the
+    // block was modified is thrown away.
+    NSInteger _compactGeneration;
+
+    // Cold blocks may move their encoded cells to a file, leaving only this handle and the style
+    // table in memory.
+    iTermScrollbackSpillFile *_spillFile;
+    long long _spillOffset;
+    NSUInteger _spillLength;
+
+    // Trigram filters for literal search, one per entry in cumulative_line_lengths and one for
+    // the whole block. NULL if the block isn't indexed, in which case every line is searched.
+    iTermTrigramLineFilter *_lineFilters;
+    iTermTrigramBlockFilter *_blockFilter;
+    // Lines with characters that aren't indexed don't add to _blockFilter.
+    BOOL _hasUnindexedLines;
+
+    // Complex char codes this block holds a reference to. Codes stay referenced until dealloc even
+    // if the lines holding them are dropped.
+    std::unordered_set<unichar> _complexCharCodes;
+
+    // memoryUsage as of the last time observers were told about it.
+    NSInteger _reportedMemoryUsage;
 }
 
 NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock) {
@@ -118,6 +317,272 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
     }
 }
 
+// Call after anything that allocates or frees storage so observers can keep a running total
+// without asking every block for its memoryUsage.
+NS_INLINE void iTermLineBlockMemoryUsageMayHaveChanged(__unsafe_unretained LineBlock *lineBlock) {
+    const NSInteger usage = [lineBlock memoryUsage];
+    const NSInteger delta = usage - lineBlock->_reportedMemoryUsage;
+    if (delta == 0) {
+        return;
+    }
+    lineBlock->_reportedMemoryUsage = usage;
+    for (auto &observer : lineBlock->_observers) {
+        __unsafe_unretained id<iTermLineBlockObserver> obj = static_cast<id<iTermLineBlockObserver> >(observer);
+        [obj lineBlock:lineBlock memoryUsageDidChangeBy:delta];
+    }
+}
+
+// Takes a reference on complex chars in |cells| that the block doesn't have one for yet.
+NS_INLINE void iTermLineBlockRetainComplexChars(__unsafe_unretained LineBlock *lineBlock,
+                                                const screen_char_t *cells,
+                                                int length) {
+    for (int i = 0; i < length; i++) {
+        if (cells[i].complexChar && !cells[i].image && lineBlock->_complexCharCodes.insert(cells[i].code).second) {
+            ComplexCharRetain(cells[i].code);
+        }
+    }
+}
+
+#pragma mark - Compact Storage
+
+NS_INLINE BOOL iTermLineBlockIsCompact(__unsafe_unretained LineBlock *lineBlock) {
+    return (lineBlock->_compactCells != NULL ||
+            lineBlock->_compressedCells != nil ||
+            lineBlock->_spillFile != nil);
+}
+
+- (BOOL)isCompact {
+    return iTermLineBlockIsCompact(self);
+}
+
+- (BOOL)isCompressed {
+    return _compressedCells != nil;
+}
+
+- (BOOL)isSpilled {
+    return _spillFile != nil;
+}
+
+- (BOOL)compact {
+    if (iTermLineBlockIsCompact(self)) {
+        [self discardExpandedCells];
+        return YES;
+    }
+    const int length = [self rawSpaceUsed];
+    std::unordered_map<screen_char_t, uint16_t, iTermStyleHasher, iTermStyleEqual> indexes;
+    std::vector<screen_char_t> styles;
+    iTermCompactCell *cells = (iTermCompactCell *)iTermMalloc(MAX(1, length) * sizeof(iTermCompactCell));
+    screen_char_t previousStyle = { 0 };
+    uint16_t previousIndex = 0;
+    for (int i = 0; i < length; i++) {
+        screen_char_t style = raw_buffer[i];
+        style.code = 0;
+        // Runs of the same style are the common case so avoid hashing them.
+        if (i == 0 || memcmp(&style, &previousStyle, sizeof(style))) {
+            auto result = indexes.insert(std::make_pair(style, (uint16_t)styles.size()));
+            if (result.second) {
+                if (styles.size() == iTermLineBlockMaxStyles) {
+                    free(cells);
+                    return NO;
+                }
+                styles.push_back(style);
+            }
+            previousStyle = style;
+            previousIndex = result.first->second;
+        }
+        cells[i].code = raw_buffer[i].code;
+        cells[i].style = previousIndex;
+    }
+
+    _compactCells = cells;
+    _compactLength = length;
+    _numberOfStyles = styles.size();
+    _styles = (screen_char_t *)iTermMalloc(MAX(1, _numberOfStyles) * sizeof(screen_char_t));
+    memcpy(_styles, styles.data(), _numberOfStyles * sizeof(screen_char_t));
+    [self discardExpandedCells];
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+    return YES;
+}
+
+- (void)discardExpandedCells {
+    if (!iTermLineBlockIsCompact(self) || !raw_buffer) {
+        return;
+    }
+    free(raw_buffer);
+    raw_buffer = NULL;
+    buffer_start = NULL;
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+}
+
+- (void)expandCompactCells {
+    raw_buffer = (screen_char_t *)iTermMalloc(MAX(1, buffer_size) * sizeof(screen_char_t));
+    if (_compressedCells || _spillFile) {
+        [self decompressCells];
+    } else {
+        const iTermCompactCell *cells = _compactCells;
+        const screen_char_t *styles = _styles;
+        for (int i = 0; i < _compactLength; i++) {
+            raw_buffer[i] = styles[cells[i].style];
+            raw_buffer[i].code = cells[i].code;
+        }
+    }
+    buffer_start = raw_buffer + start_offset;
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+    for (auto &observer : _observers) {
+        __unsafe_unretained id<iTermLineBlockObserver> obj = static_cast<id<iTermLineBlockObserver> >(observer);
+        [obj lineBlockDidExpand:self];
+    }
+}
+
+- (void)decompressCells {
+    const NSTimeInterval start = [NSDate timeIntervalSinceReferenceDate];
+    NSData *data = _compressedCells ?: [_spillFile mappedDataAtOffset:_spillOffset length:_spillLength];
+    if (!iTermCompactCellsDecode(data, _styles, _numberOfStyles, raw_buffer, _compactLength)) {
+        // Can't happen unless memory was corrupted. Blank cells beat garbage.
+        ELog(@"Failed to decode %@ compressed cells of %@", @(_compactLength), self);
+        memset(raw_buffer, 0, sizeof(screen_char_t) * _compactLength);
+    }
+    const NSInteger microseconds = ([NSDate timeIntervalSinceReferenceDate] - start) * 1000000;
+    gDecompressions++;
+    gTotalDecompressionTime += microseconds;
+    NSInteger maximum = gMaximumDecompressionTime;
+    while (microseconds > maximum && !gMaximumDecompressionTime.compare_exchange_weak(maximum, microseconds)) { }
+    DLog(@"Decompressed %@ cells in %@us", @(_compactLength), @(microseconds));
+}
+
+// Encodes the compact cells on a background queue and then frees them. The block must not be the
+// one being appended to, but it may be read or modified in the meantime.
+- (void)compressInBackground {
+    if (_compressedCells || _spillFile || _compressing) {
+        return;
+    }
+    if (!_compactCells && ![self compact]) {
+        return;
+    }
+    _compressing = YES;
+    // The background queue gets its own copy because the block may stop being compact before the
+    // encoding finishes.
+    NSData *cells = [NSData dataWithBytes:_compactCells length:sizeof(iTermCompactCell) * _compactLength];
+    const int length = _compactLength;
+    const NSInteger generation = _compactGeneration;
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSData *compressed = iTermCompactCellsEncode((const iTermCompactCell *)cells.bytes, length);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self didCompressCells:compressed generation:generation];
+        });
+    });
+}
+
+- (void)didCompressCells:(NSData *)compressed generation:(NSInteger)generation {
+    _compressing = NO;
+    if (generation != _compactGeneration || !_compactCells) {
+        return;
+    }
+    if (compressed.length >= sizeof(iTermCompactCell) * _compactLength) {
+        // Incompressible. Stay compact.
+        return;
+    }
+    _compressedCells = [compressed retain];
+    free(_compactCells);
+    _compactCells = NULL;
+    gCompressedBlocks++;
+    gCompressedBlocksUncompressedBytes += sizeof(screen_char_t) * _compactLength;
+    gCompressedBlocksCompressedBytes += _compressedCells.length;
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+}
+
+- (BOOL)spillToFile:(iTermScrollbackSpillFile *)file {
+    if (_spillFile) {
+        return YES;
+    }
+    if (!iTermLineBlockIsCompact(self) && ![self compact]) {
+        return NO;
+    }
+    NSData *encoded = _compressedCells ?: iTermCompactCellsEncode(_compactCells, _compactLength);
+    const long long offset = [file appendData:encoded];
+    if (offset < 0) {
+        return NO;
+    }
+    _spillFile = [file retain];
+    _spillOffset = offset;
+    _spillLength = encoded.length;
+    gSpilledBlocks++;
+    gSpilledBytes += _spillLength;
+
+    // A compression still in progress is thrown away because _compactCells is gone.
+    [self freeCompressedCells];
+    free(_compactCells);
+    _compactCells = NULL;
+    [self discardExpandedCells];
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+    return YES;
+}
+
+- (void)freeSpilledCells {
+    if (!_spillFile) {
+        return;
+    }
+    gSpilledBlocks--;
+    gSpilledBytes -= _spillLength;
+    [_spillFile freeDataAtOffset:_spillOffset length:_spillLength];
+    [_spillFile release];
+    _spillFile = nil;
+}
+
+- (void)freeCompressedCells {
+    if (!_compressedCells) {
+        return;
+    }
+    gCompressedBlocks--;
+    gCompressedBlocksUncompressedBytes -= sizeof(screen_char_t) * _compactLength;
+    gCompressedBlocksCompressedBytes -= _compressedCells.length;
+    [_compressedCells release];
+    _compressedCells = nil;
+}
+
+NS_INLINE void iTermLineBlockExpandIfNeeded(__unsafe_unretained LineBlock *lineBlock) {
+    if (__builtin_expect(iTermLineBlockIsCompact(lineBlock) && lineBlock->raw_buffer == NULL, 0)) {
+        [lineBlock expandCompactCells];
+    }
+}
+
+// Call before modifying the cells. The block stops being compact.
+- (void)freeCompactCells {
+    iTermLineBlockExpandIfNeeded(self);
+    [self freeCompressedCells];
+    [self freeSpilledCells];
+    free(_compactCells);
+    free(_styles);
+    _compactGeneration++;
+    _compactCells = NULL;
+    _styles = NULL;
+    _compactLength = 0;
+    _numberOfStyles = 0;
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
+}
+
+- (NSInteger)memoryUsage {
+    NSInteger bytes = sizeof(int) * cll_capacity + sizeof(LineBlockMetadata) * cll_capacity;
+    if (raw_buffer) {
+        bytes += sizeof(screen_char_t) * buffer_size;
+    }
+    if (_compactCells) {
+        bytes += sizeof(iTermCompactCell) * _compactLength;
+    }
+    if (_compressedCells) {
+        bytes += _compressedCells.length;
+    }
+    if (iTermLineBlockIsCompact(self)) {
+        bytes += sizeof(screen_char_t) * _numberOfStyles;
+    }
+    if (_lineFilters) {
+        bytes += sizeof(iTermTrigramLineFilter) * cll_capacity + sizeof(iTermTrigramBlockFilter);
+    }
+    return bytes;
+}
+
+#pragma mark - Initialization
+
 - (instancetype)init {
     self = [super init];
     if (self) {
@@ -137,6 +602,11 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
         cll_capacity = 1 + size/80;
         cumulative_line_lengths = (int*)iTermMalloc(sizeof(int) * cll_capacity);
         [self commonInit];
+        if (gIndexTrigrams) {
+            _lineFilters = (iTermTrigramLineFilter *)calloc(cll_capacity, sizeof(iTermTrigramLineFilter));
+            _blockFilter = (iTermTrigramBlockFilter *)calloc(1, sizeof(iTermTrigramBlockFilter));
+        }
+        _reportedMemoryUsage = [self memoryUsage];
     }
     return self;
 }
@@ -148,9 +618,9 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
             gEnableDoubleWidthCharacterLineCache = YES;
             gUseCachingNumberOfLines = YES;
         }
+        gIndexTrigrams = [iTermAdvancedSettingsModel indexScrollbackForFind];
     });
 
-    cached_numlines_width = -1;
     if (cll_capacity > 0) {
         metadata_ = (LineBlockMetadata *)calloc(sizeof(LineBlockMetadata), cll_capacity);
     }
@@ -160,6 +630,28 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
     return [[[self alloc] initWithDictionary:dictionary] autorelease];
 }
 
++ (LineBlockWidthCacheStatistics)widthCacheStatistics {
+    LineBlockWidthCacheStatistics statistics;
+    statistics.numLinesHits = gNumLinesCacheHits;
+    statistics.numLinesMisses = gNumLinesCacheMisses;
+    statistics.doubleWidthCharacterHits = gDoubleWidthCharacterCacheHits;
+    statistics.doubleWidthCharacterMisses = gDoubleWidthCharacterCacheMisses;
+    return statistics;
+}
+
++ (LineBlockCompressionStatistics)compressionStatistics {
+    LineBlockCompressionStatistics statistics;
+    statistics.compressedBlocks = gCompressedBlocks;
+    statistics.uncompressedBytes = gCompressedBlocksUncompressedBytes;
+    statistics.compressedBytes = gCompressedBlocksCompressedBytes;
+    statistics.decompressions = gDecompressions;
+    statistics.totalDecompressionTime = gTotalDecompressionTime / 1000000.0;
+    statistics.maximumDecompressionTime = gMaximumDecompressionTime / 1000000.0;
+    statistics.spilledBlocks = gSpilledBlocks;
+    statistics.spilledBytes = gSpilledBytes;
+    return statistics;
+}
+
 - (instancetype)initWithDictionary:(NSDictionary *)dictionary {
     self = [super init];
     if (self) {
@@ -182,6 +674,7 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
         buffer_size = [dictionary[kLineBlockBufferSizeKey] intValue];
         raw_buffer = (screen_char_t *)iTermMalloc(buffer_size * sizeof(screen_char_t));
         memmove(raw_buffer, data.bytes, data.length);
+        iTermLineBlockRetainComplexChars(self, raw_buffer, MIN(buffer_size, (int)(data.length / sizeof(screen_char_t))));
         buffer_start = raw_buffer + [dictionary[kLineBlockBufferStartOffsetKey] intValue];
         start_offset = [dictionary[kLineBlockStartOffsetKey] intValue];
         first_entry = [dictionary[kLineBlockFirstEntryKey] intValue];
@@ -205,31 +698,54 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
             metadata_[i].timestamp = [components[j++] doubleValue];
             metadata_[i].number_of_wrapped_lines = 0;
             metadata_[i].generation = LineBlockNextGeneration--;
-            if (gEnableDoubleWidthCharacterLineCache) {
-                metadata_[i].double_width_characters = nil;
-            }
+            metadata_[i].double_width_characters = NULL;
         }
 
         cll_entries = cll_capacity;
         is_partial = [dictionary[kLineBlockIsPartialKey] boolValue];
         _mayHaveDoubleWidthCharacter = [dictionary[kLineBlockMayHaveDWCKey] boolValue];
+        if (gIndexTrigrams) {
+            [self buildTrigramFilters];
+        }
+        _reportedMemoryUsage = [self memoryUsage];
     }
     return self;
 }
 
+- (void)buildTrigramFilters {
+    _lineFilters = (iTermTrigramLineFilter *)calloc(MAX(1, cll_capacity), sizeof(iTermTrigramLineFilter));
+    _blockFilter = (iTermTrigramBlockFilter *)calloc(1, sizeof(iTermTrigramBlockFilter));
+    for (int i = first_entry; i < cll_entries; i++) {
+        if (!iTermTrigramFiltersAddCells(raw_buffer + [self _lineRawOffset:i],
+                                         0,
+                                         [self _lineLength:i],
+                                         &_lineFilters[i],
+                                         _blockFilter)) {
+            _hasUnindexedLines = YES;
+        }
+    }
+}
+
 - (void)dealloc
 {
+    for (unichar code : _complexCharCodes) {
+        ComplexCharRelease(code);
+    }
     if (raw_buffer) {
         free(raw_buffer);
     }
+    [self freeCompressedCells];
+    [self freeSpilledCells];
+    free(_compactCells);
+    free(_styles);
     if (cumulative_line_lengths) {
         free(cumulative_line_lengths);
     }
+    free(_lineFilters);
+    free(_blockFilter);
     if (metadata_) {
-        if (gEnableDoubleWidthCharacterLineCache) {
-            for (int i = 0; i < cll_capacity; i++) {
-                [metadata_[i].double_width_characters release];
-            }
+        for (int i = 0; i < cll_capacity; i++) {
+            LineBlockMetadataFreeDoubleWidthCharacterCache(&metadata_[i]);
         }
         free(metadata_);
     }
@@ -237,6 +753,7 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
 }
 
 - (LineBlock *)copyWithZone:(NSZone *)zone {
+    iTermLineBlockExpandIfNeeded(self);
     LineBlock *theCopy = [[LineBlock alloc] init];
     theCopy->raw_buffer = (screen_char_t*)iTermMalloc(sizeof(screen_char_t) * buffer_size);
     memmove(theCopy->raw_buffer, raw_buffer, sizeof(screen_char_t) * buffer_size);
@@ -253,15 +770,24 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
     for (int i = 0; i < cll_capacity; i++) {
         theCopy->metadata_[i].width_for_number_of_wrapped_lines = 0;
         theCopy->metadata_[i].number_of_wrapped_lines = 0;
-        if (gEnableDoubleWidthCharacterLineCache) {
-            theCopy->metadata_[i].double_width_characters = nil;
-        }
+        theCopy->metadata_[i].double_width_characters = NULL;
     }
     theCopy->cll_capacity = cll_capacity;
     theCopy->cll_entries = cll_entries;
     theCopy->is_partial = is_partial;
-    theCopy->cached_numlines = cached_numlines;
-    theCopy->cached_numlines_width = cached_numlines_width;
+    theCopy->_numLinesCache = _numLinesCache;
+    if (_lineFilters) {
+        theCopy->_lineFilters = (iTermTrigramLineFilter *)iTermMalloc(MAX(1, cll_capacity) * sizeof(iTermTrigramLineFilter));
+        memmove(theCopy->_lineFilters, _lineFilters, cll_capacity * sizeof(iTermTrigramLineFilter));
+        theCopy->_blockFilter = (iTermTrigramBlockFilter *)iTermMalloc(sizeof(iTermTrigramBlockFilter));
+        memmove(theCopy->_blockFilter, _blockFilter, sizeof(iTermTrigramBlockFilter));
+        theCopy->_hasUnindexedLines = _hasUnindexedLines;
+    }
+    theCopy->_complexCharCodes = _complexCharCodes;
+    for (unichar code : _complexCharCodes) {
+        ComplexCharRetain(code);
+    }
+    theCopy->_reportedMemoryUsage = [theCopy memoryUsage];
 
     return theCopy;
 }
@@ -283,11 +809,16 @@ NS_INLINE void iTermLineBlockDidChange(__unsafe_unretained LineBlock *lineBlock)
         cll_capacity = MAX(1, cll_capacity);
         cumulative_line_lengths = (int*) realloc((void*) cumulative_line_lengths, cll_capacity * sizeof(int));
         metadata_ = (LineBlockMetadata *)realloc((void *)metadata_, cll_capacity * sizeof(LineBlockMetadata));
-        if (gEnableDoubleWidthCharacterLineCache) {
-            memset(metadata_ + cll_entries,
-                   0,
-                   sizeof(LineBlockMetadata) * (cll_capacity - cll_entries));
+        memset(metadata_ + cll_entries,
+               0,
+               sizeof(LineBlockMetadata) * (cll_capacity - cll_entries));
+        if (_lineFilters) {
+            _lineFilters = (iTermTrigramLineFilter *)realloc((void *)_lineFilters, cll_capacity * sizeof(iTermTrigramLineFilter));
         }
+        iTermLineBlockMemoryUsageMayHaveChanged(self);
+    }
+    if (_lineFilters) {
+        memset(&_lineFilters[cll_entries], 0, sizeof(iTermTrigramLineFilter));
     }
     cumulative_line_lengths[cll_entries] = cumulativeLength;
     metadata_[cll_entries].timestamp = timestamp;
@@ -311,6 +842,7 @@ static char* formatsct(screen_char_t* src, int len, char* dest) {
 
 - (void)appendToDebugString:(NSMutableString *)s
 {
+    iTermLineBlockExpandIfNeeded(self);
     char temp[1000];
     int i;
     int prev;
@@ -337,6 +869,7 @@ static char* formatsct(screen_char_t* src, int len, char* dest) {
     } else {
         NSLog(@"numRawLines=%@", @([self numRawLines]));
     }
+    iTermLineBlockExpandIfNeeded(self);
     char temp[1000];
     int i;
     int prev;
@@ -367,6 +900,10 @@ static char* formatsct(screen_char_t* src, int len, char* dest) {
     auto it = insertResult.first;
     auto wasInserted = insertResult.second;
     if (wasInserted) {
+        if (_mayHaveDoubleWidthCharacter) {
+            // Only needs to look at the cells when there might be double-width characters.
+            iTermLineBlockExpandIfNeeded(self);
+        }
         result = iTermLineBlockNumberOfFullLinesImpl(raw_buffer + offset,
                                                      length,
                                                      width,
@@ -408,9 +945,10 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
 #ifdef TEST_LINEBUFFER_SANITY
 - (void) checkAndResetCachedNumlines: (char *) methodName width: (int) width
 {
-    int old_cached = cached_numlines;
-    Boolean was_valid = cached_numlines_width != -1;
-    cached_numlines_width = -1;
+    const iTermNumLinesCache::Entry *entry = _numLinesCache.peek(width);
+    int old_cached = entry ? entry->numLines : 0;
+    Boolean was_valid = entry != NULL;
+    _numLinesCache.clear();
     int new_cached = [self getNumLinesWithWrapWidth: width];
     if (was_valid && old_cached != new_cached) {
         NSLog(@"%s: cached_numlines updated to %d, but should be %d!", methodName, old_cached, new_cached);
@@ -424,6 +962,9 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
              width:(int)width
          timestamp:(NSTimeInterval)timestamp
       continuation:(screen_char_t)continuation {
+    if (iTermLineBlockIsCompact(self)) {
+        [self freeCompactCells];
+    }
     _numberOfFullLinesCache.clear();
     const int space_used = [self rawSpaceUsed];
     const int free_space = buffer_size - space_used - start_offset;
@@ -437,6 +978,7 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
         return NO;
     }
     memcpy(raw_buffer + space_used, buffer, sizeof(screen_char_t) * length);
+    iTermLineBlockRetainComplexChars(self, buffer, length);
     // There's an edge case here. In the else clause, the line buffer looks like this originally:
     //   |xxxx| EOL_SOFT
     // Then append an empty line with EOL_HARD. The desired result is
@@ -451,19 +993,18 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
         // append to an existing line
         NSAssert(cll_entries > 0, @"is_partial but has no entries");
         // update the numlines cache with the new number of full lines that the updated line has.
-        if (width != cached_numlines_width) {
-            cached_numlines_width = -1;
-        } else {
-            int prev_cll = cll_entries > first_entry + 1 ? cumulative_line_lengths[cll_entries - 2] - start_offset : 0;
-            int cll = cumulative_line_lengths[cll_entries - 1] - start_offset;
-            int old_length = cll - prev_cll;
-            int oldnum = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev_cll
+        int prev_cll = cll_entries > first_entry + 1 ? cumulative_line_lengths[cll_entries - 2] - start_offset : 0;
+        int cll = cumulative_line_lengths[cll_entries - 1] - start_offset;
+        int old_length = cll - prev_cll;
+        for (int i = 0; i < _numLinesCache.count; i++) {
+            iTermNumLinesCache::Entry &entry = _numLinesCache.entries[i];
+            int oldnum = [self numberOfFullLinesFromOffset:start_offset + prev_cll
                                                     length:old_length
-                                                     width:width];
-            int newnum = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev_cll
+                                                     width:entry.width];
+            int newnum = [self numberOfFullLinesFromOffset:start_offset + prev_cll
                                                     length:old_length + length
-                                                     width:width];
-            cached_numlines += newnum - oldnum;
+                                                     width:entry.width];
+            entry.numLines += newnum - oldnum;
         }
 
         cumulative_line_lengths[cll_entries - 1] += length;
@@ -471,11 +1012,7 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
         metadata_[cll_entries - 1].continuation = continuation;
         metadata_[cll_entries - 1].number_of_wrapped_lines = 0;
         metadata_[cll_entries - 1].generation = LineBlockNextGeneration--;
-        if (gEnableDoubleWidthCharacterLineCache) {
-            // TODO: Would be nice to add on to the index set instead of deleting it.
-            [metadata_[cll_entries - 1].double_width_characters release];
-            metadata_[cll_entries - 1].double_width_characters = nil;
-        }
+        LineBlockMetadataFreeDoubleWidthCharacterCache(&metadata_[cll_entries - 1]);
 #ifdef TEST_LINEBUFFER_SANITY
         [self checkAndResetCachedNumlines:@"appendLine partial case" width: width];
 #endif
@@ -484,13 +1021,12 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
         [self _appendCumulativeLineLength:(space_used + length)
                                 timestamp:timestamp
                              continuation:continuation];
-        if (width != cached_numlines_width) {
-            cached_numlines_width = -1;
-        } else {
+        for (int i = 0; i < _numLinesCache.count; i++) {
+            iTermNumLinesCache::Entry &entry = _numLinesCache.entries[i];
             const int marginalLines = [self numberOfFullLinesFromOffset:space_used
                                                                  length:length
-                                                                  width:width] + 1;
-            cached_numlines += marginalLines;
+                                                                  width:entry.width] + 1;
+            entry.numLines += marginalLines;
         }
 #ifdef TEST_LINEBUFFER_SANITY
         [self checkAndResetCachedNumlines:"appendLine normal case" width: width];
@@ -498,6 +1034,17 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
     }
     is_partial = partial;
 
+    if (_lineFilters) {
+        const int lineOffset = [self _lineRawOffset:cll_entries - 1];
+        if (!iTermTrigramFiltersAddCells(raw_buffer + lineOffset,
+                                         space_used - lineOffset,
+                                         space_used + length - lineOffset,
+                                         &_lineFilters[cll_entries - 1],
+                                         _blockFilter)) {
+            _hasUnindexedLines = YES;
+        }
+    }
+
     iTermLineBlockDidChange(self);
     return YES;
 }
@@ -508,6 +1055,7 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
                  yOffset:(int *)yOffsetPtr
                  extends:(BOOL *)extendsPtr
 {
+    iTermLineBlockExpandIfNeeded(self);
     int length;
     int eol;
     screen_char_t* p = [self getWrappedLineWithWrapWidth:width
@@ -529,17 +1077,24 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
     }
 }
 
-- (void)populateDoubleWidthCharacterCacheInMetadata:(LineBlockMetadata *)metadata
-                                             buffer:(screen_char_t *)p
-                                             length:(int)length
-                                              width:(int)width {
+// Returns the indexes of wrapped lines that start early to avoid splitting a double-width
+// character, computing them if they aren't cached for |width|.
+- (NSIndexSet *)doubleWidthCharactersInMetadata:(LineBlockMetadata *)metadata
+                                         buffer:(screen_char_t *)p
+                                         length:(int)length
+                                          width:(int)width {
     assert(gEnableDoubleWidthCharacterLineCache);
-    [metadata->double_width_characters release];
-    metadata->double_width_characters = [[NSMutableIndexSet alloc] init];
-    metadata->width_for_double_width_characters_cache = width;
+    NSIndexSet *cached = LineBlockMetadataDoubleWidthCharacters(metadata, width);
+    if (cached) {
+        gDoubleWidthCharacterCacheHits++;
+        return cached;
+    }
+    gDoubleWidthCharacterCacheMisses++;
+    NSMutableIndexSet *indexes = [[NSMutableIndexSet alloc] init];
+    LineBlockMetadataAddDoubleWidthCharacters(metadata, width, indexes);
 
     if (width < 2) {
-        return;
+        return indexes;
     }
     int lines = 0;
     int i = 0;
@@ -552,9 +1107,10 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
             // character. Wrap the last character of the previous line on to
             // this line.
             i--;
-            [metadata->double_width_characters addIndex:lines];
+            [indexes addIndex:lines];
         }
     }
+    return indexes;
 }
 
 - (int)offsetOfWrappedLineInBuffer:(screen_char_t *)p
@@ -565,17 +1121,17 @@ extern "C" int iTermLineBlockNumberOfFullLinesImpl(screen_char_t *buffer,
     assert(gEnableDoubleWidthCharacterLineCache);
     ITBetaAssert(n >= 0, @"Negative lines to offsetOfWrappedLineInBuffer");
     if (_mayHaveDoubleWidthCharacter) {
-        if (!metadata->double_width_characters ||
-            metadata->width_for_double_width_characters_cache != width) {
-            [self populateDoubleWidthCharacterCacheInMetadata:metadata buffer:p length:length width:width];
-        }
+        NSIndexSet *doubleWidthCharacters = [self doubleWidthCharactersInMetadata:metadata
+                                                                           buffer:p
+                                                                           length:length
+                                                                            width:width];
 
         __block int lines = 0;
         __block int i = 0;
         __block NSUInteger lastIndex = 0;
-        [metadata->double_width_characters enumerateIndexesInRange:NSMakeRange(0, MAX(0, n + 1))
-                                                           options:0
-                                                        usingBlock:^(NSUInteger indexOfLineThatWouldStartWithRightHalf, BOOL * _Nonnull stop) {
+        [doubleWidthCharacters enumerateIndexesInRange:NSMakeRange(0, MAX(0, n + 1))
+                                               options:0
+                                            usingBlock:^(NSUInteger indexOfLineThatWouldStartWithRightHalf, BOOL * _Nonnull stop) {
             int numberOfLines = indexOfLineThatWouldStartWithRightHalf - lastIndex;
             lines += numberOfLines;
             i += width * numberOfLines;
@@ -622,7 +1178,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
     for (i = first_entry; i < cll_entries; ++i) {
         int cll = cumulative_line_lengths[i] - start_offset;
         length = cll - prev;
-        const int spans = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+        const int spans = [self numberOfFullLinesFromOffset:start_offset + prev
                                                      length:length
                                                       width:width];
         if (lineNum > spans) {
@@ -644,7 +1200,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
     for (i = first_entry; i < cll_entries; ++i) {
         int cll = cumulative_line_lengths[i] - start_offset;
         length = cll - prev;
-        const int spans = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+        const int spans = [self numberOfFullLinesFromOffset:start_offset + prev
                                                      length:length
                                                       width:width];
         if (lineNum > spans) {
@@ -681,6 +1237,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
                                  continuation:(screen_char_t *)continuationPtr
 {
     ITBetaAssert(*lineNum >= 0, @"Negative lines to getWrappedLineWithWrapWidth");
+    iTermLineBlockExpandIfNeeded(self);
     int prev = 0;
     int numEmptyLines = 0;
     for (int i = first_entry; i < cll_entries; ++i) {
@@ -700,14 +1257,14 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
                 metadata->number_of_wrapped_lines > 0) {
                 spans = metadata->number_of_wrapped_lines;
             } else {
-                spans = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+                spans = [self numberOfFullLinesFromOffset:start_offset + prev
                                                    length:length
                                                     width:width];
                 metadata->number_of_wrapped_lines = spans;
                 metadata->width_for_number_of_wrapped_lines = width;
              }
         } else {
-            spans = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+            spans = [self numberOfFullLinesFromOffset:start_offset + prev
                                                length:length
                                                 width:width];
         }
@@ -775,9 +1332,12 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
 - (int)getNumLinesWithWrapWidth:(int)width {
     ITBetaAssert(width > 0, @"Bogus value of width: %d", width);
 
-    if (width == cached_numlines_width) {
-        return cached_numlines;
+    const iTermNumLinesCache::Entry *entry = _numLinesCache.find(width);
+    if (entry) {
+        gNumLinesCacheHits++;
+        return entry->numLines;
     }
+    gNumLinesCacheMisses++;
 
     int count = 0;
     int prev = 0;
@@ -787,7 +1347,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
     for (i = first_entry; i < cll_entries; ++i) {
         int cll = cumulative_line_lengths[i] - start_offset;
         int length = cll - prev;
-        const int marginalLines = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+        const int marginalLines = [self numberOfFullLinesFromOffset:start_offset + prev
                                                              length:length
                                                               width:width] + 1;
         count += marginalLines;
@@ -796,15 +1356,29 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
 
     // Save the result so it doesn't have to be recalculated until some relatively rare operation
     // occurs that invalidates the cache.
-    cached_numlines_width = width;
-    cached_numlines = count;
+    _numLinesCache.set(width, count);
 
     return count;
 }
 
 - (BOOL) hasCachedNumLinesForWidth: (int) width
 {
-    return cached_numlines_width == width;
+    return _numLinesCache.peek(width) != NULL;
+}
+
+- (int)estimatedNumLinesWithWrapWidth:(int)width {
+    const iTermNumLinesCache::Entry *entry = _numLinesCache.peek(width);
+    if (entry) {
+        return entry->numLines;
+    }
+    const int numRawLines = cll_entries - first_entry;
+    if (numRawLines == 0) {
+        return 0;
+    }
+    // Pretend every raw line has the average length.
+    const int numberOfCharacters = cumulative_line_lengths[cll_entries - 1] - start_offset;
+    const int averageLength = numberOfCharacters / numRawLines;
+    return numRawLines * (MAX(0, averageLength - 1) / width + 1);
 }
 
 - (BOOL)popLastLineInto:(screen_char_t**)ptr
@@ -816,6 +1390,9 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
         // There is no last line to pop.
         return NO;
     }
+    if (iTermLineBlockIsCompact(self)) {
+        [self freeCompactCells];
+    }
     _numberOfFullLinesCache.clear();
     int start;
     if (cll_entries == first_entry + 1) {
@@ -837,7 +1414,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
         // If the width is four and the last line is "0123456789" then return "89". It would
         // wrap as: 0123/4567/89. If there are double-width characters, this ensures they are
         // not split across lines when computing the wrapping.
-        const int numLines = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + start
+        const int numLines = [self numberOfFullLinesFromOffset:start_offset + start
                                                         length:available_len
                                                          width:width];
         int offset_from_start = OffsetOfWrappedLine(buffer_start + start,
@@ -849,10 +1426,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
         *ptr = buffer_start + start + offset_from_start;
         cumulative_line_lengths[cll_entries - 1] -= *length;
         metadata_[cll_entries - 1].number_of_wrapped_lines = 0;
-        if (gEnableDoubleWidthCharacterLineCache) {
-            [metadata_[cll_entries - 1].double_width_characters release];
-            metadata_[cll_entries - 1].double_width_characters = nil;
-        }
+        LineBlockMetadataFreeDoubleWidthCharacterCache(&metadata_[cll_entries - 1]);
 
         is_partial = YES;
     } else {
@@ -871,7 +1445,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
         cll_entries = 0;
     }
     // refresh cache
-    cached_numlines_width = -1;
+    _numLinesCache.clear();
     iTermLineBlockDidChange(self);
     return YES;
 }
@@ -910,6 +1484,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
 
 - (screen_char_t*)rawLine:(int)linenum
 {
+    iTermLineBlockExpandIfNeeded(self);
     int start;
     if (linenum == 0) {
         start = 0;
@@ -921,11 +1496,15 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
 
 - (void)changeBufferSize:(int)capacity {
     NSAssert(capacity >= [self rawSpaceUsed], @"Truncating used space");
+    if (iTermLineBlockIsCompact(self)) {
+        [self freeCompactCells];
+    }
     capacity = MAX(1, capacity);
     raw_buffer = (screen_char_t*) realloc((void*) raw_buffer, sizeof(screen_char_t) * capacity);
     buffer_start = raw_buffer + start_offset;
     buffer_size = capacity;
-    cached_numlines_width = -1;
+    _numLinesCache.clear();
+    iTermLineBlockMemoryUsageMayHaveChanged(self);
 }
 
 - (int)rawBufferSize
@@ -950,6 +1529,9 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
     int i;
     *charsDropped = 0;
     int initialOffset = start_offset;
+    if (iTermLineBlockIsCompact(self)) {
+        [self freeCompactCells];
+    }
     _numberOfFullLinesCache.clear();
     for (i = first_entry; i < cll_entries; ++i) {
         int cll = cumulative_line_lengths[i] - start_offset;
@@ -958,7 +1540,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
         // Get the number of full-length wrapped lines in this raw line. If there
         // were only single-width characters the formula would be:
         //     (length - 1) / width;
-        int spans = [self numberOfFullLinesFromOffset:(buffer_start - raw_buffer) + prev
+        int spans = [self numberOfFullLinesFromOffset:start_offset + prev
                                                length:length
                                                 width:width];
         if (n > spans) {
@@ -974,19 +1556,19 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
                                              length,
                                              width,
                                              _mayHaveDoubleWidthCharacter);
-            if (width != cached_numlines_width) {
-                cached_numlines_width = -1;
-            } else {
-                cached_numlines -= orig_n;
-            }
+            // Lines were counted at |width|, so other widths can't be updated.
+            _numLinesCache.filter([width, orig_n](iTermNumLinesCache::Entry &entry) {
+                if (entry.width != width) {
+                    return false;
+                }
+                entry.numLines -= orig_n;
+                return true;
+            });
             buffer_start += prev + offset;
             start_offset = buffer_start - raw_buffer;
             first_entry = i;
             metadata->number_of_wrapped_lines = 0;
-            if (gEnableDoubleWidthCharacterLineCache) {
-                [metadata_[i].double_width_characters release];
-                metadata_[i].double_width_characters = nil;
-            }
+            LineBlockMetadataFreeDoubleWidthCharacterCache(&metadata_[i]);
 
             *charsDropped = start_offset - initialOffset;
 
@@ -1000,7 +1582,7 @@ int OffsetOfWrappedLine(screen_char_t* p, int n, int length, int width, BOOL may
     }
 
     // Consumed the whole buffer.
-    cached_numlines_width = -1;
+    _numLinesCache.clear();
     cll_entries = 0;
     buffer_start = raw_buffer;
     start_offset = 0;
@@ -1244,14 +1826,69 @@ static int Search(NSString* needle,
     return result;
 }
 
+// Finds |needle| in an all-ASCII line without making an NSString of it. Produces the same results
+// as the search loops in _findInRawLine. Returns NO without adding results if the line isn't
+// all ASCII.
+static BOOL FindLiteral(const iTermLiteralSearchNeedle *needle,
+                        screen_char_t *rawline,
+                        int raw_line_length,
+                        int skip,
+                        int options,
+                        BOOL multipleResults,
+                        NSMutableArray *results) {
+    unsigned char stackHaystack[1024];
+    unsigned char *haystack = stackHaystack;
+    if (raw_line_length > (int)sizeof(stackHaystack)) {
+        haystack = (unsigned char *)iTermMalloc(raw_line_length);
+    }
+    const BOOL ok = iTermLiteralSearchCopyHaystack(haystack, rawline, raw_line_length, needle);
+    if (ok && (options & FindOptBackwards)) {
+        int limit = raw_line_length;
+        int position;
+        do {
+            position = iTermLiteralSearchBackward(needle, haystack, limit);
+            if (position != -1) {
+                limit = position + needle->length - 1;
+                if (position <= skip) {
+                    ResultRange *r = [[[ResultRange alloc] init] autorelease];
+                    r->position = position;
+                    r->length = needle->length;
+                    [results addObject:r];
+                }
+            }
+        } while (position != -1 && (multipleResults || position > skip));
+    } else if (ok) {
+        while (skip < raw_line_length) {
+            const int position = iTermLiteralSearchForward(needle, haystack, raw_line_length, skip);
+            if (position == -1) {
+                break;
+            }
+            ResultRange *r = [[[ResultRange alloc] init] autorelease];
+            r->position = position;
+            r->length = needle->length;
+            [results addObject:r];
+            if (!multipleResults) {
+                break;
+            }
+            skip = position + 1;
+        }
+    }
+    if (haystack != stackHaystack) {
+        free(haystack);
+    }
+    return ok;
+}
+
 - (void)_findInRawLine:(int)entry
                 needle:(NSString*)needle
+         literalNeedle:(const iTermLiteralSearchNeedle *)literalNeedle
                options:(int)options
                   mode:(iTermFindMode)mode
                   skip:(int)skip
                 length:(int)raw_line_length
        multipleResults:(BOOL)multipleResults
                results:(NSMutableArray *)results {
+    iTermLineBlockExpandIfNeeded(self);
     screen_char_t* rawline = raw_buffer + [self _lineRawOffset:entry];
     if (skip > raw_line_length) {
         skip = raw_line_length;
@@ -1259,6 +1896,10 @@ static int Search(NSString* needle,
     if (skip < 0) {
         skip = 0;
     }
+    if (literalNeedle &&
+        FindLiteral(literalNeedle, rawline, raw_line_length, skip, options, multipleResults, results)) {
+        return;
+    }
     if (options & FindOptBackwards) {
         // This algorithm is wacky and slow but stay with me here:
         // When you search backward, the most common case is that you are
@@ -1400,6 +2041,41 @@ static int Search(NSString* needle,
              atOffset:(int)offset
               results:(NSMutableArray *)results
       multipleResults:(BOOL)multipleResults {
+    [self findSubstring:substring
+                options:options
+                   mode:mode
+               atOffset:offset
+                results:results
+        multipleResults:multipleResults
+           trigramQuery:NULL];
+}
+
+- (void)prepareForConcurrentReading {
+    iTermLineBlockExpandIfNeeded(self);
+}
+
+- (BOOL)mayContainMatchForTrigramQuery:(const iTermTrigramQuery *)query {
+    if (!_blockFilter || _hasUnindexedLines) {
+        return YES;
+    }
+    return iTermTrigramBlockFilterMayMatch(_blockFilter, query);
+}
+
+- (void)findSubstring:(NSString*)substring
+              options:(int)options
+                 mode:(iTermFindMode)mode
+             atOffset:(int)offset
+              results:(NSMutableArray *)results
+      multipleResults:(BOOL)multipleResults
+         trigramQuery:(const iTermTrigramQuery *)query {
+    if (query && ![self mayContainMatchForTrigramQuery:query]) {
+        return;
+    }
+    if (!_lineFilters) {
+        query = NULL;
+    }
+    iTermLiteralSearchNeedle literalNeedle;
+    const BOOL literal = iTermLiteralSearchNeedleInit(&literalNeedle, substring, mode);
     if (offset == -1) {
         offset = [self rawSpaceUsed] - 1;
     }
@@ -1420,6 +2096,10 @@ static int Search(NSString* needle,
         dir = 1;
     }
     while (entry != limit) {
+        if (query && !iTermTrigramLineFilterMayMatch(&_lineFilters[entry], query)) {
+            entry += dir;
+            continue;
+        }
         int line_raw_offset = [self _lineRawOffset:entry];
         int skipped = offset - line_raw_offset;
         if (skipped < 0) {
@@ -1432,6 +2112,7 @@ static int Search(NSString* needle,
         static const int MAX_SEARCHABLE_LINE_LENGTH = 500000;
         [self _findInRawLine:entry
                       needle:substring
+               literalNeedle:literal ? &literalNeedle : NULL
                      options:options
                         mode:mode
                         skip:skipped
@@ -1457,6 +2138,7 @@ static int Search(NSString* needle,
     if (width <= 0) {
         return NO;
     }
+    iTermLineBlockExpandIfNeeded(self);
     int i;
     *x = 0;
     *y = 0;
@@ -1537,6 +2219,7 @@ static int Search(NSString* needle,
 }
 
 - (NSDictionary *)dictionary {
+    iTermLineBlockExpandIfNeeded(self);
     NSData *rawBufferData = [NSData dataWithBytes:raw_buffer
                                            length:[self rawSpaceUsed] * sizeof(screen_char_t)];
     return @{ kLineBlockRawBufferKey: rawBufferData,
@@ -1574,6 +2257,10 @@ static int Search(NSString* needle,
     return count;
 }
 
+- (NSInteger)reportedMemoryUsage {
+    return _reportedMemoryUsage;
+}
+
 - (void)addObserver:(id<iTermLineBlockObserver>)observer {
     _observers.push_back((void *)observer);
 }
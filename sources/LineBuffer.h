@@ -34,6 +34,19 @@
 #import "LineBufferHelpers.h"
 #import "VT100GridTypes.h"
 
+@class LineBuffer;
+
+@protocol LineBufferDelegate <NSObject>
+// Settling line counts estimated while resizing moved the lines at |width| from |lineNumber| on by
+// |delta| lines. Moves are reported in order as soon as the lookup or pass that made them is done
+// with the blocks, but never while resizing. This may be called in the middle of a lookup, so it
+// must not use the line buffer.
+- (void)lineBuffer:(LineBuffer *)lineBuffer
+  didMoveLinesFrom:(int)lineNumber
+                by:(int)delta
+             width:(int)width;
+@end
+
 // A LineBuffer represents an ordered collection of strings of screen_char_t. Each string forms a
 // logical line of text plus color information. Logic is provided for the following major functions:
 //   - If the lines are wrapped onto a screen of some width, find the Nth wrapped line
@@ -45,11 +58,40 @@
 // block caches some information to speed up repeated lookups with the same screen width.
 @interface LineBuffer : NSObject <NSCopying>
 
+// Copies don't have a delegate.
+@property(nonatomic, assign) id<LineBufferDelegate> delegate;
 @property(nonatomic, assign) BOOL mayHaveDoubleWidthCharacter;
 
 // Absolute block number of last block.
 @property(nonatomic, readonly) int largestAbsoluteBlockNumber;
 
+// If set, blocks are compacted (see LineBlock) once they fill up. Defaults to the
+// compactScrollbackStyles advanced setting.
+@property(nonatomic, assign) BOOL compactsFullBlocks;
+
+// If set along with compactsFullBlocks, full blocks more than uncompressedBlocks from the end are
+// compressed on a background queue (see LineBlock). Default to the compressScrollback and
+// uncompressedScrollbackBlocks advanced settings.
+@property(nonatomic, assign) BOOL compressesColdBlocks;
+@property(nonatomic, assign) int uncompressedBlocks;
+
+// If set and there is no limit on the number of lines, the oldest blocks are written to a
+// temporary file once the blocks in memory take more than residentMemoryBudget bytes (see
+// LineBlock). Default to the spillScrollbackToDisk and scrollbackMemoryBudget advanced settings.
+@property(nonatomic, assign) BOOL spillsColdBlocks;
+@property(nonatomic, assign) NSInteger residentMemoryBudget;
+
+// If set, searches for all results search several blocks at a time on all cores. Defaults to the
+// findAllUsesMultipleCores advanced setting.
+@property(nonatomic, assign) BOOL searchesConcurrently;
+
+// If set, line counts at a new width may be estimated while resizing (see -beginResizing). Defaults
+// to the reflowHistoryLazily advanced setting.
+@property(nonatomic, assign) BOOL reflowsLazily;
+
+// Approximate number of bytes used to store the history.
+@property(nonatomic, readonly) NSInteger memoryUsage;
+
 - (LineBuffer*)initWithBlockSize:(int)bs;
 - (LineBuffer *)initWithDictionary:(NSDictionary *)dictionary;
 
@@ -118,7 +160,8 @@
                      timestamp:(NSTimeInterval *)timestampPtr
                   continuation:(screen_char_t *)continuationPtr;
 
-// Get the number of buffer lines at a given width.
+// Get the number of buffer lines at a given width. After resizing with a long history this is
+// approximate until the line counts of older blocks have been settled in the background.
 - (int)numLinesWithWidth:(int)width;
 
 // Save the cursor position. Call this just before appending the line the cursor is in.
@@ -184,7 +227,14 @@
 
 - (int)numberOfWrappedLinesWithWidth:(int)width;
 
+// Between these, line counts at a new width may be estimated for all but the most recent lines
+// if reflowsLazily is set. They are settled in passes after -endResizing. Each pass moves the lines
+// after the blocks it settles and tells the delegate how far. Line numbers taken while resizing are
+// recomputed by the caller, so moves made then aren't reported.
 - (void)beginResizing;
 - (void)endResizing;
 
+// Replaces all estimated line counts with exact ones now and tells the delegate how lines moved.
+- (void)settleEstimatedLineCounts;
+
 @end
@@ -34,6 +34,7 @@
 #import "iTermAdvancedSettingsModel.h"
 #import "iTermLineBlockArray.h"
 #import "iTermMalloc.h"
+#import "iTermScrollbackSpillFile.h"
 #import "LineBlock.h"
 #import "RegexKitLite.h"
 
@@ -51,6 +52,12 @@ static NSString *const kLineBufferMayHaveDWCKey = @"May Have Double Width Charac
 static const int kLineBufferVersion = 1;
 static const NSInteger kUnicodeVersion = 9;
 
+// How many blocks' estimated line counts to settle in each pass after resizing.
+static const NSInteger kLineBufferBlocksToSettlePerPass = 64;
+
+// Searching for all results goes through this many blocks per core at a time.
+static const NSInteger kLineBufferBlocksPerCoreToSearchConcurrently = 4;
+
 @implementation LineBuffer {
     // An array of LineBlock*s.
     iTermLineBlockArray *_lineBlocks;
@@ -77,6 +84,21 @@ static const NSInteger kUnicodeVersion = 9;
 
     // Number of char that have been dropped
     long long droppedChars;
+
+    // Is a pass to settle estimated line counts pending?
+    BOOL _settlePending;
+
+    // Where spilled blocks go. Created when the first block is spilled and shared with copies.
+    iTermScrollbackSpillFile *_spillFile;
+    // Absolute block number of the oldest block that -spillColdBlocks hasn't spilled yet.
+    NSInteger _firstUnspilledBlock;
+
+    // The trigrams of the string most recently searched for, which lets blocks skip lines that
+    // can't match. Rebuilt when the search string or mode changes.
+    iTermTrigramQuery *_trigramQuery;
+    NSString *_trigramQueryNeedle;
+    iTermFindMode _trigramQueryMode;
+    BOOL _trigramQueryIsUsable;
 }
 
 // Append a block
@@ -104,6 +126,45 @@ static const NSInteger kUnicodeVersion = 9;
     max_lines = -1;
     num_wrapped_lines_width = -1;
     num_dropped_blocks = 0;
+    _compactsFullBlocks = [iTermAdvancedSettingsModel compactScrollbackStyles];
+    _compressesColdBlocks = [iTermAdvancedSettingsModel compressScrollback];
+    _uncompressedBlocks = [iTermAdvancedSettingsModel uncompressedScrollbackBlocks];
+    _spillsColdBlocks = [iTermAdvancedSettingsModel spillScrollbackToDisk];
+    _residentMemoryBudget = (NSInteger)[iTermAdvancedSettingsModel scrollbackMemoryBudget] * 1024 * 1024;
+    _searchesConcurrently = [iTermAdvancedSettingsModel findAllUsesMultipleCores];
+    _reflowsLazily = [iTermAdvancedSettingsModel reflowHistoryLazily];
+}
+
+// Compresses the block that just went cold because a block was added after it.
+- (void)compressColdBlock {
+    const NSInteger index = (NSInteger)_lineBlocks.count - 1 - MAX(1, _uncompressedBlocks);
+    if (index < 0) {
+        return;
+    }
+    [_lineBlocks[index] compressInBackground];
+}
+
+// Spills the oldest resident blocks until the rest fit in the memory budget. Blocks are spilled
+// in order, so the walk resumes where the last one stopped.
+- (void)spillColdBlocks {
+    // Never spill the block being appended to.
+    const NSInteger limit = (NSInteger)_lineBlocks.count - 1;
+    NSInteger index = MAX(0, _firstUnspilledBlock - num_dropped_blocks);
+    while (_lineBlocks.memoryUsage > _residentMemoryBudget && index < limit) {
+        if (!_spillFile) {
+            _spillFile = [[iTermScrollbackSpillFile alloc] init];
+            if (!_spillFile) {
+                _spillsColdBlocks = NO;
+                return;
+            }
+        }
+        LineBlock *block = _lineBlocks[index];
+        if (![block spillToFile:_spillFile]) {
+            DLog(@"Failed to spill block %@", block);
+        }
+        index++;
+    }
+    _firstUnspilledBlock = index + num_dropped_blocks;
 }
 
 // The designated initializer. We prefer not to expose the notion of block sizes to
@@ -148,6 +209,9 @@ static const NSInteger kUnicodeVersion = 9;
 
 - (void)dealloc {
     [_lineBlocks release];
+    [_spillFile release];
+    free(_trigramQuery);
+    [_trigramQueryNeedle release];
     [super dealloc];
 }
 
@@ -166,6 +230,10 @@ static int RawNumLines(LineBuffer* buffer, int width) {
 
     int count;
     count = [buffer->_lineBlocks numberOfWrappedLinesForWidth:width];
+    if (buffer->_lineBlocks.hasEstimatedLineCounts) {
+        // Looking up lines settles estimates, which changes the count.
+        return count;
+    }
 
     buffer->num_wrapped_lines_width = width;
     buffer->num_wrapped_lines_cache = count;
@@ -360,11 +428,20 @@ static int RawNumLines(LineBuffer* buffer, int width) {
             // The existing buffer can't hold this line, but it has preceding line(s). Shrink it and
             // allocate a new buffer that is large enough to hold this line.
             [block shrinkToFit];
+            if (_compactsFullBlocks) {
+                [block compact];
+            }
             if (length + prefix_len > block_size) {
                 block = [self _addBlockOfSize:length + prefix_len];
             } else {
                 block = [self _addBlockOfSize:block_size];
             }
+            if (_compactsFullBlocks && _compressesColdBlocks) {
+                [self compressColdBlock];
+            }
+            if (_spillsColdBlocks && max_lines == -1) {
+                [self spillColdBlocks];
+            }
         }
 
         // Append the prefix if there is one (the prefix was a partial line that we're
@@ -406,6 +483,7 @@ static int RawNumLines(LineBuffer* buffer, int width) {
     LineBlock *block = [_lineBlocks blockContainingLineNumber:lineNum
                                                         width:width
                                                     remainder:&remainder];
+    [self reportLineMoves];
     return [block generationForLineNumber:remainder width:width];
 }
 
@@ -414,6 +492,7 @@ static int RawNumLines(LineBuffer* buffer, int width) {
     LineBlock *block = [_lineBlocks blockContainingLineNumber:lineNumber
                                                         width:width
                                                     remainder:&remainder];
+    [self reportLineMoves];
     return [block timestampForLineNumber:remainder width:width];
 }
 
@@ -427,6 +506,7 @@ static int RawNumLines(LineBuffer* buffer, int width) {
     ITBetaAssert(lineNum >= 0, @"Negative lineNum to copyLineToBuffer");
     int remainder = 0;
     LineBlock *block = [_lineBlocks blockContainingLineNumber:lineNum width:width remainder:&remainder];
+    [self reportLineMoves];
     ITBetaAssert(remainder >= 0, @"Negative lineNum BEFORE consuming block_lines");
     if (!block) {
         NSLog(@"Couldn't find line %d", lineNum);
@@ -488,6 +568,7 @@ static int RawNumLines(LineBuffer* buffer, int width) {
                            continuation:(screen_char_t *)continuation {
     int remainder = 0;
     LineBlock *block = [_lineBlocks blockContainingLineNumber:lineNum width:width remainder:&remainder];
+    [self reportLineMoves];
     if (!block) {
         ITAssertWithMessage(NO, @"Failed to find line %@ with width %@", @(lineNum), @(width));
         return nil;
@@ -529,6 +610,7 @@ static int RawNumLines(LineBuffer* buffer, int width) {
          lineResult.eol = eol;
          [arrays addObject:lineResult];
      }];
+    [self reportLineMoves];
     return arrays;
 }
 
@@ -581,6 +663,10 @@ static int RawNumLines(LineBuffer* buffer, int width) {
     // to this function would not work correctly.
     if ([block isEmpty]) {
         [_lineBlocks removeLastBlock];
+        // The new last block gets modified, which brings it back into memory, so it must be
+        // considered for spilling again once it's no longer last.
+        _firstUnspilledBlock = MIN(_firstUnspilledBlock,
+                                   num_dropped_blocks + MAX(0, (NSInteger)_lineBlocks.count - 1));
     }
 
 #ifdef LOG_MUTATIONS
@@ -680,6 +766,20 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
     context.results = [NSMutableArray array];
 }
 
+// Returns NULL if the search can't use trigram filters.
+- (const iTermTrigramQuery *)trigramQueryForFindContext:(FindContext *)context {
+    if (![_trigramQueryNeedle isEqualToString:context.substring] || _trigramQueryMode != context.mode) {
+        [_trigramQueryNeedle release];
+        _trigramQueryNeedle = [context.substring copy];
+        _trigramQueryMode = context.mode;
+        if (!_trigramQuery) {
+            _trigramQuery = (iTermTrigramQuery *)iTermMalloc(sizeof(iTermTrigramQuery));
+        }
+        _trigramQueryIsUsable = iTermTrigramQueryInit(_trigramQuery, context.substring, context.mode);
+    }
+    return _trigramQueryIsUsable ? _trigramQuery : NULL;
+}
+
 - (void)findSubstring:(FindContext*)context stopAt:(LineBufferPosition *)stopPosition {
     NSInteger blockIndex = context.absBlockNum - num_dropped_blocks;
     const NSInteger numBlocks = _lineBlocks.count;  // This avoids involving unsigned integers in comparisons
@@ -718,6 +818,10 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
 
     assert(blockIndex >= 0);
     assert(blockIndex < numBlocks);
+    if (_searchesConcurrently && (context.options & FindMultipleResults)) {
+        [self findSubstringConcurrently:context startingInBlock:blockIndex stopAt:stopPosition];
+        return;
+    }
     LineBlock* block = _lineBlocks[blockIndex];
 
     if (blockIndex == 0 &&
@@ -742,7 +846,8 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
                     mode:context.mode
                 atOffset:context.offset
                  results:context.results
-         multipleResults:((context.options & FindMultipleResults) != 0)];
+         multipleResults:((context.options & FindMultipleResults) != 0)
+            trigramQuery:[self trigramQueryForFindContext:context]];
     NSMutableArray* filtered = [NSMutableArray arrayWithCapacity:[context.results count]];
     BOOL haveOutOfRangeResults = NO;
     int blockPosition = [self _blockPosition:context.absBlockNum - num_dropped_blocks];
@@ -773,11 +878,105 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
     context.absBlockNum = context.absBlockNum + context.dir;
 }
 
+// Searches a batch of blocks starting at |firstIndex| on all cores and reports their results in
+// search order, as searching them one at a time would.
+- (void)findSubstringConcurrently:(FindContext *)context
+                  startingInBlock:(NSInteger)firstIndex
+                           stopAt:(LineBufferPosition *)stopPosition {
+    const NSInteger numBlocks = _lineBlocks.count;
+    const NSInteger batchSize = [[NSProcessInfo processInfo] activeProcessorCount] * kLineBufferBlocksPerCoreToSearchConcurrently;
+    const NSInteger available = context.dir > 0 ? numBlocks - firstIndex : firstIndex + 1;
+    const iTermTrigramQuery *query = [self trigramQueryForFindContext:context];
+
+    NSMutableArray<LineBlock *> *blocks = [NSMutableArray array];
+    NSMutableArray<NSMutableArray<ResultRange *> *> *resultsPerBlock = [NSMutableArray array];
+    int *offsets = iTermMalloc(sizeof(int) * MAX(1, MIN(batchSize, available)));
+    for (NSInteger i = 0; i < MIN(batchSize, available); i++) {
+        const NSInteger index = firstIndex + i * context.dir;
+        LineBlock *block = _lineBlocks[index];
+        int offset = i == 0 ? context.offset : (context.dir > 0 ? 0 : -1);
+        if (index == 0 && offset != -1 && offset < [block startOffset]) {
+            if (context.dir < 0) {
+                // This block has scrolled off. Stop before it.
+                break;
+            }
+            // Part of the first block has been dropped. Skip ahead to its current beginning.
+            offset = [block startOffset];
+        }
+        offsets[i] = offset;
+        [blocks addObject:block];
+        [resultsPerBlock addObject:[NSMutableArray array]];
+    }
+    if (blocks.count == 0) {
+        free(offsets);
+        context.status = NotFound;
+        return;
+    }
+
+    // Blocks stay expanded and unmodified while other threads search them because this thread
+    // waits for them.
+    _lineBlocks.compactionDeferred = YES;
+    for (LineBlock *block in blocks) {
+        if (!query || [block mayContainMatchForTrigramQuery:query]) {
+            [block prepareForConcurrentReading];
+        }
+    }
+    NSString *substring = context.substring;
+    const FindOptions options = context.options;
+    const iTermFindMode mode = context.mode;
+    dispatch_apply(blocks.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+        @autoreleasepool {
+            [blocks[i] findSubstring:substring
+                             options:options
+                                mode:mode
+                            atOffset:offsets[i]
+                             results:resultsPerBlock[i]
+                     multipleResults:YES
+                        trigramQuery:query];
+        }
+    });
+    _lineBlocks.compactionDeferred = NO;
+    free(offsets);
+
+    NSMutableArray *filtered = [NSMutableArray array];
+    BOOL haveOutOfRangeResults = NO;
+    const int stopAt = stopPosition.absolutePosition - droppedChars;
+    for (NSInteger i = 0; i < blocks.count; i++) {
+        const int blockPosition = [self _blockPosition:firstIndex + i * context.dir];
+        for (ResultRange *range in resultsPerBlock[i]) {
+            range->position += blockPosition;
+            if (context.dir * (range->position - stopAt) > 0 ||
+                context.dir * (range->position + context.matchLength - stopAt) > 0) {
+                // result was outside the range to be searched
+                haveOutOfRangeResults = YES;
+            } else {
+                context.status = Matched;
+                [filtered addObject:range];
+            }
+        }
+    }
+    context.results = filtered;
+    if ([filtered count] == 0 && haveOutOfRangeResults) {
+        context.status = NotFound;
+    }
+
+    // Prepare to continue searching after the batch.
+    if (context.dir < 0) {
+        context.offset = -1;
+    } else {
+        context.offset = 0;
+    }
+    context.absBlockNum = context.absBlockNum + context.dir * (int)blocks.count;
+}
+
 // Returns an array of XRange values
 - (NSArray*)convertPositions:(NSArray*)resultRanges withWidth:(int)width {
     if (width <= 0) {
         return nil;
     }
+    // The walk below counts lines exactly, so line numbers must not be estimates.
+    [self settleEstimatedLineCounts];
+
     // Create sorted array of all positions to convert.
     NSMutableArray* unsortedPositions = [NSMutableArray arrayWithCapacity:[resultRanges count] * 2];
     for (ResultRange* rr in resultRanges) {
@@ -861,6 +1060,7 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
 
     int line = y;
     NSInteger index = [_lineBlocks indexOfBlockContainingLineNumber:y width:width remainder:&line];
+    [self reportLineMoves];
     if (index == NSNotFound) {
         return nil;
     }
@@ -934,6 +1134,7 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
                                                   remainder:&p
                                                 blockOffset:&yoffset
                                                       index:NULL];
+    [self reportLineMoves];
     if (!block) {
         if (ok) {
             *ok = NO;
@@ -1048,6 +1249,15 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
     theCopy->num_wrapped_lines_cache = num_wrapped_lines_cache;
     theCopy->num_wrapped_lines_width = num_wrapped_lines_width;
     theCopy->droppedChars = droppedChars;
+    theCopy->_compactsFullBlocks = _compactsFullBlocks;
+    theCopy->_compressesColdBlocks = _compressesColdBlocks;
+    theCopy->_uncompressedBlocks = _uncompressedBlocks;
+    theCopy->_spillsColdBlocks = _spillsColdBlocks;
+    theCopy->_residentMemoryBudget = _residentMemoryBudget;
+    theCopy->_spillFile = [_spillFile retain];
+    theCopy->_firstUnspilledBlock = _firstUnspilledBlock;
+    theCopy->_searchesConcurrently = _searchesConcurrently;
+    theCopy->_reflowsLazily = _reflowsLazily;
     theCopy.mayHaveDoubleWidthCharacter = _mayHaveDoubleWidthCharacter;
 
     return theCopy;
@@ -1143,6 +1353,15 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
     theCopy->num_wrapped_lines_cache = num_wrapped_lines_cache;
     theCopy->num_wrapped_lines_width = num_wrapped_lines_width;
     theCopy->droppedChars = droppedChars;
+    theCopy->_compactsFullBlocks = _compactsFullBlocks;
+    theCopy->_compressesColdBlocks = _compressesColdBlocks;
+    theCopy->_uncompressedBlocks = _uncompressedBlocks;
+    theCopy->_spillsColdBlocks = _spillsColdBlocks;
+    theCopy->_residentMemoryBudget = _residentMemoryBudget;
+    theCopy->_spillFile = [_spillFile retain];
+    theCopy->_firstUnspilledBlock = _firstUnspilledBlock;
+    theCopy->_searchesConcurrently = _searchesConcurrently;
+    theCopy->_reflowsLazily = _reflowsLazily;
 
     return theCopy;
 }
@@ -1160,6 +1379,10 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
     return numBlocks;
 }
 
+- (NSInteger)memoryUsage {
+    return _lineBlocks.memoryUsage;
+}
+
 - (long long)numCharsInRangeOfBlocks:(NSRange)range {
     long long n = 0;
     for (int i = 0; i < range.length; i++) {
@@ -1195,7 +1418,11 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
 
 - (void)beginResizing {
     assert(!_lineBlocks.resizing);
+    // The caller converts line numbers to the new width from here on, so bring them up to date.
+    [self reportLineMoves];
+    _lineBlocks.estimatesLineCountsWhileResizing = _reflowsLazily;
     _lineBlocks.resizing = YES;
+    num_wrapped_lines_width = -1;
 
     // Just a sanity check, not a real limitation.
     dispatch_async(dispatch_get_main_queue(), ^{
@@ -1206,6 +1433,53 @@ NS_INLINE int TotalNumberOfRawLines(LineBuffer *self) {
 - (void)endResizing {
     assert(_lineBlocks.resizing);
     _lineBlocks.resizing = NO;
+    // Line numbers were just converted to the new width by position, so they already reflect
+    // anything settled while resizing.
+    [_lineBlocks removeLineMovesUsingBlock:^(int width, int lineNumber, int delta) {}];
+    if (_lineBlocks.hasEstimatedLineCounts) {
+        [self settleLineCountsLater];
+    }
+}
+
+- (void)settleEstimatedLineCounts {
+    [_lineBlocks settleEstimatedLineCountsInBlocks:NSIntegerMax];
+    num_wrapped_lines_width = -1;
+    [self reportLineMoves];
+}
+
+// Looking up a line settles the estimate of the block it's in, so this is called after lookups
+// before anything that depends on the new line numbers is returned. While resizing, the caller
+// converts line numbers to the new width itself.
+- (void)reportLineMoves {
+    if (!_lineBlocks.hasLineMoves || _lineBlocks.resizing) {
+        return;
+    }
+    [_lineBlocks removeLineMovesUsingBlock:^(int width, int lineNumber, int delta) {
+        [_delegate lineBuffer:self didMoveLinesFrom:lineNumber by:delta width:width];
+    }];
+}
+
+// Replaces the line counts estimated while resizing with exact ones a little at a time so the main
+// thread stays responsive. Line numbers shift a bit as this happens, and the delegate is told by
+// how much after each pass.
+- (void)settleLineCountsLater {
+    if (_settlePending) {
+        return;
+    }
+    _settlePending = YES;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        _settlePending = NO;
+        if (_lineBlocks.resizing) {
+            // -endResizing will try again.
+            return;
+        }
+        const BOOL settled = [_lineBlocks settleEstimatedLineCountsInBlocks:kLineBufferBlocksToSettlePerPass];
+        num_wrapped_lines_width = -1;
+        [self reportLineMoves];
+        if (!settled) {
+            [self settleLineCountsLater];
+        }
+    });
 }
 
 @end
@@ -21,7 +21,9 @@
 // Zero-width spaces.
 + (instancetype)zeroWidthSpaceCharacterSetForUnicodeVersion:(NSInteger)version;
 
+// Empty unless aggressiveBaseCharacterDetection is on.
 + (instancetype)spacingCombiningMarksForUnicodeVersion:(int)version;
++ (instancetype)allSpacingCombiningMarksForUnicodeVersion:(int)version;
 
 + (instancetype)codePointsWithOwnCell;
 
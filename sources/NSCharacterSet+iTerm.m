@@ -1881,9 +1881,17 @@
     return characterSet;
 }
 
++ (instancetype)spacingCombiningMarksForUnicodeVersion:(int)version {
+    if ([iTermAdvancedSettingsModel aggressiveBaseCharacterDetection]) {
+        return [self allSpacingCombiningMarksForUnicodeVersion:version];
+    } else {
+        return [NSCharacterSet characterSetWithRange:NSMakeRange(0, 0)];
+    }
+}
+
 // Assumes unicode 12
 // csvgrep -d ";" -c gc -r '^Mc$' tests/UnicodeData.txt | csvcut -c code | tail -n +2 | tools/list_to_range.py
-+ (instancetype)spacingCombiningMarksForUnicodeVersion:(int)version {
++ (instancetype)allSpacingCombiningMarksForUnicodeVersion:(int)version {
     assert(version == 12);
     static NSCharacterSet *characterSet;
     static dispatch_once_t onceToken;
@@ -2059,11 +2067,7 @@
         [set addCharactersInRange:NSMakeRange(0x1d16d, 6)];
         characterSet = set;
     });
-    if ([iTermAdvancedSettingsModel aggressiveBaseCharacterDetection]) {
-        return characterSet;
-    } else {
-        return [NSCharacterSet characterSetWithRange:NSMakeRange(0, 0)];
-    }
+    return characterSet;
 }
 
 // csvgrep -d ";" -c gc -r '^Lm$' tests/UnicodeData.txt | csvcut -c code | tail -n +2 | tools/list_to_range.py
@@ -30,6 +30,7 @@
 #import "iTermMalloc.h"
 #import "iTermSwiftyStringParser.h"
 #import "iTermTuple.h"
+#import "iTermUnicodeProperties.h"
 #import "iTermVariableScope.h"
 #import "NSArray+iTerm.h"
 #import "NSData+iTerm.h"
@@ -60,14 +61,9 @@
         return NO;
     }
 
-    if ([[NSCharacterSet fullWidthCharacterSetForUnicodeVersion:version] longCharacterIsMember:unicode]) {
-        return YES;
-    }
-    if (ambiguousIsDoubleWidth &&
-        [[NSCharacterSet ambiguousWidthCharacterSetForUnicodeVersion:version] longCharacterIsMember:unicode]) {
-        return YES;
-    }
-    return NO;
+    const iTermUnicodeProperty properties =
+        iTermUnicodePropertiesOfCodePoint(iTermUnicodePropertyTableForVersion(version), unicode);
+    return iTermUnicodePropertiesAreDoubleWidth(properties, ambiguousIsDoubleWidth);
 }
 
 + (NSString *)stringWithLongCharacter:(UTF32Char)longCharacter {
@@ -43,6 +43,7 @@ extern NSString *const iTermSessionWillTerminateNotification;
 @class iTermAction;
 @class iTermAnnouncementViewController;
 @class iTermEchoProbe;
+@class iTermPTYRecording;
 @class iTermScriptHistoryEntry;
 @class iTermStatusBarViewController;
 @class iTermSwiftyStringGraph;
@@ -809,6 +810,9 @@ typedef enum {
 - (void)executeTokens:(const CVector *)vector bytesHandled:(int)length;
 - (void)injectData:(NSData *)data;
 
+// Feeds a recording made by PTYTask through the terminal as if the job had written it.
+- (void)replayPTYRecording:(iTermPTYRecording *)recording atOriginalSpeed:(BOOL)originalSpeed;
+
 // Call this when a session moves to a different tab or window to update the session ID.
 - (void)didMoveSession;
 - (void)triggerDidChangeNameTo:(NSString *)newName;
@@ -60,6 +60,7 @@
 #import "iTermProcessCache.h"
 #import "iTermProfilePreferences.h"
 #import "iTermPromptOnCloseReason.h"
+#import "iTermPTYRecording.h"
 #import "iTermRecentDirectoryMO.h"
 #import "iTermRestorableSession.h"
 #import "iTermRule.h"
@@ -84,6 +85,7 @@
 #import "iTermTextExtractor.h"
 #import "iTermTheme.h"
 #import "iTermThroughputEstimator.h"
+#import "iTermTokenBatchQueue.h"
 #import "iTermTmuxStatusBarMonitor.h"
 #import "iTermTmuxOptionMonitor.h"
 #import "iTermUpdateCadenceController.h"
@@ -125,6 +127,7 @@
 #import "SCPPath.h"
 #import "SearchResult.h"
 #import "SessionView.h"
+#import "TaskNotifier.h"
 #import "TerminalFile.h"
 #import "TmuxController.h"
 #import "TmuxControllerRegistry.h"
@@ -398,7 +401,8 @@ static const NSUInteger kMaxHosts = 100;
 
     NSTimeInterval _timeOfLastScheduling;
 
-    dispatch_semaphore_t _executionSemaphore;
+    // Parsed tokens on their way from the TaskNotifier thread to the main thread.
+    iTermTokenBatchQueue *_tokenQueue;
 
     // Previous updateDisplay timer's timeout period (not the actual duration,
     // but the kXXXTimerIntervalSec value).
@@ -600,10 +604,10 @@ static const NSUInteger kMaxHosts = 100;
         _copyModeHandler = [[iTermCopyModeHandler alloc] init];
         _copyModeHandler.delegate = self;
 
-        // Experimentally, this is enough to keep the queue primed but not overwhelmed.
-        // TODO: How do slower machines fare?
-        static const int kMaxOutstandingExecuteCalls = 4;
-        _executionSemaphore = dispatch_semaphore_create(kMaxOutstandingExecuteCalls);
+        // Enough batches to keep the main thread busy while the job is producing output. Once
+        // it's full, TaskNotifier stops reading until the main thread catches up.
+        static const int kMaxQueuedTokenBatches = 16;
+        _tokenQueue = [[iTermTokenBatchQueue alloc] initWithCapacity:kMaxQueuedTokenBatches];
 
         _lastOutputIgnoringOutputAfterResizing = _lastInput;
         _lastUpdate = _lastInput;
@@ -779,7 +783,7 @@ ITERM_WEAKLY_REFERENCEABLE
     [_nameController release];
     [self stopTailFind];  // This frees the substring in the tail find context, if needed.
     _shell.delegate = nil;
-    dispatch_release(_executionSemaphore);
+    [_tokenQueue release];
     [_colorMap release];
     [_triggers release];
     [_pasteboard release];
@@ -2529,7 +2533,20 @@ ITERM_WEAKLY_REFERENCEABLE
 - (void)threadedReadTask:(char *)buffer length:(int)length {
     // Pass the input stream to the parser.
     [_terminal.parser putStreamData:buffer length:length];
+    [self threadedParseStreamDataOfLength:length];
+}
+
+// This is run in PTYTask's thread. The task reads straight into the parser's stream, saving a copy.
+- (void)threadedReadTaskWithMinimumCapacity:(int)minimumCapacity
+                                     reader:(int (^)(char *buffer, int capacity))reader {
+    const int length = [_terminal.parser appendStreamDataWithMinimumCapacity:minimumCapacity
+                                                                        block:reader];
+    [self threadedParseStreamDataOfLength:length];
+}
 
+// Parses whatever is in the parser's stream and dispatches the tokens to the main thread. |length|
+// is the number of bytes just added to the stream.
+- (void)threadedParseStreamDataOfLength:(int)length {
     // Parse the input stream into an array of tokens.
     CVector vector;
     CVectorCreate(&vector, 100);
@@ -2544,24 +2561,49 @@ ITERM_WEAKLY_REFERENCEABLE
         [_echoProbe updateEchoProbeStateWithTokenCVector:&vector];
     }
 
-    // This limits the number of outstanding execution blocks to prevent the main thread from
-    // getting bogged down.
-    dispatch_semaphore_wait(_executionSemaphore, DISPATCH_TIME_FOREVER);
+    BOOL wakeConsumer = NO;
+    if (![_tokenQueue enqueueTokens:&vector length:length wakeConsumer:&wakeConsumer]) {
+        // TaskNotifier checks -threadedTaskCanAcceptOutput before reading so this shouldn't happen,
+        // but never drop output or run it out of order.
+        DLog(@"Token queue unexpectedly full");
+        [_tokenQueue enqueueOverflowTokens:&vector length:length wakeConsumer:&wakeConsumer];
+    }
+    if (wakeConsumer) {
+        // One block drains everything queued by the time it runs, so a busy session costs the
+        // main thread one dispatch per burst rather than one per read.
+        [self retain];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self executeQueuedTokens];
+            [self release];
+        });
+    }
+}
 
-    [self retain];
-    dispatch_retain(_executionSemaphore);
-    dispatch_async(dispatch_get_main_queue(), ^{
-        if (_useAdaptiveFrameRate) {
-            [_throughputEstimator addByteCount:length];
-        }
-        [self executeTokens:&vector bytesHandled:length];
+// Runs in TaskNotifier's thread.
+- (BOOL)threadedTaskCanAcceptOutput {
+    return !_tokenQueue.isFull;
+}
 
-        // Unblock the background thread; if it's ready, it can send the main thread more tokens
-        // now.
-        dispatch_semaphore_signal(_executionSemaphore);
-        dispatch_release(_executionSemaphore);
-        [self release];
-    });
+// Executes all the batches the TaskNotifier thread has parsed so far.
+- (void)executeQueuedTokens {
+    const BOOL wasFull = [_tokenQueue drainUsingBlock:^(CVector *vector, int length) {
+        [self executeTokenBatch:vector length:length];
+    }];
+    if (wasFull) {
+        // TaskNotifier stopped reading from this session's fd. Let it reconsider.
+        DLog(@"Token queue drained after filling up. depth=%@ max depth=%@ avg latency=%@ max latency=%@ bytes/read=%@ reads/sec=%@",
+             @(_tokenQueue.depth), @(_tokenQueue.maximumDepth),
+             @(_tokenQueue.averageLatency), @(_tokenQueue.maximumLatency),
+             @(_shell.bytesPerRead), @(_shell.readsPerSecond));
+        [[TaskNotifier sharedInstance] taskStateDidChange:_shell];
+    }
+}
+
+- (void)executeTokenBatch:(const CVector *)vector length:(int)length {
+    if (_useAdaptiveFrameRate) {
+        [_throughputEstimator addByteCount:length];
+    }
+    [self executeTokens:vector bytesHandled:length];
 }
 
 - (void)synchronousReadTask:(NSString *)string {
@@ -2605,7 +2647,9 @@ ITERM_WEAKLY_REFERENCEABLE
         // Session was closed or is not accepting new tokens because it's in copy mode. These can
         // be handled later (unclose or exit copy mode), so queue them up.
         for (int i = 0; i < n; i++) {
-            [_queuedTokens addObject:CVectorGetObject(vector, i)];
+            VT100Token *token = CVectorGetObject(vector, i);
+            token.retainedOutsideBatch = YES;
+            [_queuedTokens addObject:token];
         }
         CVectorDestroy(vector);
         return;
@@ -2632,15 +2676,12 @@ ITERM_WEAKLY_REFERENCEABLE
 
     [self finishedHandlingNewOutputOfLength:length];
 
-    // When busy, we spend a lot of time performing recycleObject, so farm it
+    // When busy, we spend a lot of time resetting tokens for reuse, so farm it
     // off to a background thread.
     CVector temp = *vector;
+    VT100TokenPool *tokenPool = _terminal.parser.tokenPool;
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
-        for (int i = 0; i < n; i++) {
-            VT100Token *token = CVectorGetObject(&temp, i);
-            [token release];
-        }
-        CVectorDestroy(&temp);
+        [tokenPool recycleTokensInVector:&temp];
     })
     STOPWATCH_LAP(executing);
 }
@@ -8921,6 +8962,10 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
     [_textview clearHighlights:NO];
 }
 
+- (void)screenDidMoveLinesFrom:(int)lineNumber by:(int)delta {
+    [_textview handleLinesMovedFrom:lineNumber by:delta];
+}
+
 - (void)screenMouseModeDidChange {
     [_textview updateCursor:nil];
     [_textview updateTrackingAreas];
@@ -9476,6 +9521,10 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
 - (void)injectData:(NSData *)data {
     VT100Parser *parser = [[[VT100Parser alloc] init] autorelease];
     parser.encoding = self.terminal.encoding;
+    [self executeData:data withParser:parser];
+}
+
+- (void)executeData:(NSData *)data withParser:(VT100Parser *)parser {
     [parser putStreamData:data.bytes length:data.length];
     CVector vector;
     CVectorCreate(&vector, 100);
@@ -9487,6 +9536,24 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
     [self executeTokens:&vector bytesHandled:data.length];
 }
 
+- (void)replayPTYRecording:(iTermPTYRecording *)recording atOriginalSpeed:(BOOL)originalSpeed {
+    // Use a separate parser so a sequence split between the recording and the live job can't
+    // corrupt either.
+    VT100Parser *parser = [[[VT100Parser alloc] init] autorelease];
+    parser.encoding = self.terminal.encoding;
+    iTermPTYRecordingPlayer *player = [[[iTermPTYRecordingPlayer alloc] initWithRecording:recording] autorelease];
+    player.outputHandler = ^(NSData *output) {
+        [self executeData:output withParser:parser];
+    };
+    player.sizeHandler = ^(VT100GridSize size) {
+        if ([self screenShouldInitiateWindowResize]) {
+            [self screenResizeToWidth:size.width height:size.height];
+        }
+    };
+    DLog(@"Replay %@ bytes of PTY output over %@ seconds", @(recording.outputLength), @(recording.duration));
+    [player playAtOriginalSpeed:originalSpeed];
+}
+
 - (iTermColorMap *)screenColorMap {
     return _colorMap;
 }
@@ -11008,6 +11075,8 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
 #pragma mark - iTermUpdateCadenceController
 
 - (void)updateCadenceControllerUpdateDisplay:(iTermUpdateCadenceController *)controller {
+    // Make sure the frame includes everything that has been parsed so far.
+    [self executeQueuedTokens];
     [self updateDisplayBecause:nil];
 }
 
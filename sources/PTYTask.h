@@ -16,6 +16,16 @@ extern NSString *kCoprocessStatusChangeNotification;
 // thread before kicking off a possibly async task in the main thread.
 - (void)threadedReadTask:(char *)buffer length:(int)length;
 
+// Runs in a background thread. Like -threadedReadTask:length: but lets the task read() straight
+// into the delegate's input buffer. |reader| is called synchronously with a destination of at
+// least |minimumCapacity| bytes and returns the number of bytes it placed there.
+- (void)threadedReadTaskWithMinimumCapacity:(int)minimumCapacity
+                                     reader:(int (^)(char *buffer, int capacity))reader;
+
+// Runs in TaskNotifier's thread. Return NO to stop reading until the delegate has caught up with
+// the output it already has. Call -[TaskNotifier taskStateDidChange:] once it can accept more.
+- (BOOL)threadedTaskCanAcceptOutput;
+
 // Runs in the same background task as -threadedReadTask:length:.
 - (void)threadedTaskBrokenPipe;
 - (void)brokenPipe;  // Called in main thread
@@ -62,6 +72,11 @@ extern NSString *kCoprocessStatusChangeNotification;
 @property(nonatomic) unichar pendingHighSurrogate;
 @property(nonatomic, copy) NSNumber *tmuxClientProcessID;
 
+// Read statistics over the most recent interval of about a second with output. A "read" is one
+// read() syscall, including ones that come back empty.
+@property(atomic, readonly) double bytesPerRead;
+@property(atomic, readonly) double readsPerSecond;
+
 - (instancetype)init;
 
 - (BOOL)hasBrokenPipe;
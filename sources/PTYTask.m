@@ -14,6 +14,7 @@
 #import "iTermLSOF.h"
 #import "iTermOpenDirectory.h"
 #import "iTermOrphanServerAdopter.h"
+#import "iTermPTYRecording.h"
 #import "NSDictionary+iTerm.h"
 
 #include "iTermFileDescriptorClient.h"
@@ -36,6 +37,12 @@
 
 #define CTRLKEY(c) ((c)-'A'+1)
 
+// Bounds for the number of bytes processRead asks for. It starts at the minimum, doubles each time a
+// read fills it, and halves when output slows down, so bulk output is read in few syscalls while
+// interactive output doesn't wait behind a big buffer.
+static const int kMinimumReadSize = MAXRW * 4;
+static const int kMaximumReadSize = 256 * 1024;
+
 NSString *kCoprocessStatusChangeNotification = @"kCoprocessStatusChangeNotification";
 
 static void
@@ -102,6 +109,7 @@ static void HandleSigChld(int n) {
 @property(atomic, assign) BOOL coprocessOnlyTaskIsDead;
 @property(atomic, retain) NSFileHandle *logHandle;
 @property(nonatomic, copy) NSString *logPath;
+@property(atomic, retain) iTermPTYRecorder *recorder;
 @end
 
 @implementation PTYTask {
@@ -132,6 +140,15 @@ static void HandleSigChld(int n) {
     NSTimeInterval _timeOfLastSizeChange;
     BOOL _rateLimitedSetSizeToDesiredSizePending;
     BOOL _haveBumpedProcessCache;
+
+    // Adaptive read size and the counters behind the read statistics. Only used on TaskNotifier's
+    // thread except for the published statistics, which are synchronized(self).
+    int _readSize;
+    NSTimeInterval _readIntervalStart;
+    long long _readsInInterval;
+    long long _bytesReadInInterval;
+    double _bytesPerRead;
+    double _readsPerSecond;
 }
 
 - (instancetype)init {
@@ -144,6 +161,7 @@ static void HandleSigChld(int n) {
         _serverChildPid = -1;
         writeBuffer = [[NSMutableData alloc] init];
         writeLock = [[NSLock alloc] init];
+        _readSize = kMinimumReadSize;
     }
     return self;
 }
@@ -170,6 +188,7 @@ static void HandleSigChld(int n) {
 
     [self closeFileDescriptor];
     [_logHandle closeFile];
+    [_recorder close];
 
     @synchronized (self) {
         [[self coprocess] mainProcessDidTerminate];
@@ -193,8 +212,8 @@ static void HandleSigChld(int n) {
     @synchronized(self) {
         _paused = paused;
     }
-    // Start/stop selecting on our FD
-    [[TaskNotifier sharedInstance] unblock];
+    // Start/stop reading from our FD
+    [[TaskNotifier sharedInstance] taskStateDidChange:self];
 }
 
 - (BOOL)pidIsChild {
@@ -251,7 +270,7 @@ static void HandleSigChld(int n) {
         coprocess_ = coprocess;
         self.hasMuteCoprocess = coprocess_.mute;
     }
-    [[TaskNotifier sharedInstance] unblock];
+    [[TaskNotifier sharedInstance] taskStateDidChange:self];
 }
 
 - (BOOL)writeBufferHasRoom {
@@ -399,7 +418,7 @@ static void HandleSigChld(int n) {
         // Lock to protect the writeBuffer from the IO thread
         [writeLock lock];
         [writeBuffer appendData:data];
-        [[TaskNotifier sharedInstance] unblock];
+        [[TaskNotifier sharedInstance] taskStateDidChange:self];
         [writeLock unlock];
     }
 }
@@ -433,6 +452,7 @@ static void HandleSigChld(int n) {
 - (void)stop {
     self.paused = NO;
     [self stopLogging];
+    [self stopRecording];
     [self sendSignal:SIGHUP toServer:NO];
     [self killServerIfRunning];
 
@@ -460,6 +480,7 @@ static void HandleSigChld(int n) {
     }
     if (self.isCoprocessOnly) {
         self.coprocessOnlyTaskIsDead = YES;
+        [[TaskNotifier sharedInstance] taskStateDidChange:self];
     }
 }
 
@@ -492,46 +513,147 @@ static void HandleSigChld(int n) {
     }
 }
 
+- (void)startRecordingIfEnabledWithSize:(VT100GridSize)size {
+    NSString *directory = [iTermAdvancedSettingsModel ptyRecordingDirectory];
+    if (!directory.length) {
+        return;
+    }
+    directory = [directory stringByStandardizingPath];
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory
+                              withIntermediateDirectories:YES
+                                               attributes:nil
+                                                    error:nil];
+    NSDateFormatter *dateFormatter = [[NSDateFormatter alloc] init];
+    dateFormatter.dateFormat = @"yyyyMMdd_HHmmss";
+    NSString *filename = [NSString stringWithFormat:@"%@_%@.%@",
+                          [dateFormatter stringFromDate:[NSDate date]],
+                          [[NSUUID UUID] UUIDString],
+                          iTermPTYRecordingPathExtension];
+    iTermPTYRecorder *recorder = [[iTermPTYRecorder alloc] initWithPath:[directory stringByAppendingPathComponent:filename]];
+    [recorder recordSize:size];
+    DLog(@"Recording PTY output to %@", recorder.path);
+    self.recorder = recorder;
+}
+
+- (void)stopRecording {
+    [self.recorder close];
+    self.recorder = nil;
+}
+
 - (void)brokenPipe {
     brokenPipe_ = YES;
     [[TaskNotifier sharedInstance] deregisterTask:self];
     [self.delegate threadedTaskBrokenPipe];
 }
 
-- (void)processRead {
-    int iterations = 4;
+// Reads up to |capacity| bytes from the fd into |buffer|, continuing until it's full or the fd
+// looks drained. Sets *brokenPipe on a serious error.
+- (int)readIntoBuffer:(char *)buffer capacity:(int)capacity brokenPipe:(BOOL *)brokenPipe {
     int bytesRead = 0;
-
-    char buffer[MAXRW * iterations];
-    for (int i = 0; i < iterations; ++i) {
-        // Only read up to MAXRW*iterations bytes, then release control
-        ssize_t n = read(fd, buffer + bytesRead, MAXRW);
+    int numberOfReads = 0;
+    while (bytesRead < capacity) {
+        ssize_t n = read(fd, buffer + bytesRead, capacity - bytesRead);
+        numberOfReads++;
         if (n < 0) {
             // There was a read error.
             if (errno != EAGAIN && errno != EINTR) {
                 // It was a serious error.
-                [self brokenPipe];
-                return;
-            } else {
-                // We could read again in the case of EINTR but it would
-                // complicate the code with little advantage. Just bail out.
-                n = 0;
+                *brokenPipe = YES;
             }
+            // We could read again in the case of EINTR but it would
+            // complicate the code with little advantage. Just bail out.
+            break;
         }
         bytesRead += n;
         if (n < MAXRW) {
-            // If we read fewer bytes than expected, return. For some apparently
-            // undocumented reason, read() never returns more than 1024 bytes
-            // (at least on OS 10.6), so that's what MAXRW is set to. If that
-            // ever goes down this'll break.
+            // Some versions of macOS return at most MAXRW bytes from a pty per read(), so only a
+            // shorter read says the fd is drained. Stopping here saves an extra read() that would
+            // fail with EAGAIN.
             break;
         }
     }
+    [self didPerformReads:numberOfReads bytesRead:bytesRead capacity:capacity];
+    return bytesRead;
+}
+
+// Grows the read size while reads fill it and shrinks it when they come back mostly empty, then
+// updates the statistics.
+- (void)didPerformReads:(int)numberOfReads bytesRead:(int)bytesRead capacity:(int)capacity {
+    if (capacity == _readSize) {
+        int readSize = _readSize;
+        if (bytesRead == capacity) {
+            readSize = MIN(kMaximumReadSize, readSize * 2);
+        } else if (bytesRead < capacity / 4) {
+            readSize = MAX(kMinimumReadSize, readSize / 2);
+        }
+        if (readSize != _readSize) {
+            DLog(@"Read size for %@ changes from %@ to %@", self, @(_readSize), @(readSize));
+            _readSize = readSize;
+        }
+    }
+
+    _readsInInterval += numberOfReads;
+    _bytesReadInInterval += bytesRead;
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    const NSTimeInterval elapsed = now - _readIntervalStart;
+    if (elapsed >= 1) {
+        @synchronized(self) {
+            _readsPerSecond = _readIntervalStart > 0 ? _readsInInterval / elapsed : 0;
+            _bytesPerRead = (double)_bytesReadInInterval / _readsInInterval;
+        }
+        _readIntervalStart = now;
+        _readsInInterval = 0;
+        _bytesReadInInterval = 0;
+    }
+}
+
+- (double)bytesPerRead {
+    @synchronized(self) {
+        return _bytesPerRead;
+    }
+}
 
-    hasOutput = YES;
+- (double)readsPerSecond {
+    @synchronized(self) {
+        return _readsPerSecond;
+    }
+}
 
-    // Send data to the terminal
-    [self readTask:buffer length:bytesRead];
+- (void)processRead {
+    id<PTYTaskDelegate> delegate = self.delegate;
+    if (!delegate) {
+        // Stay with a small buffer on the stack since there's no parser to read into.
+        const int capacity = kMinimumReadSize;
+        char buffer[capacity];
+        BOOL broken = NO;
+        const int bytesRead = [self readIntoBuffer:buffer capacity:capacity brokenPipe:&broken];
+        if (broken) {
+            [self brokenPipe];
+            return;
+        }
+        hasOutput = YES;
+        [self readTask:buffer length:bytesRead];
+        return;
+    }
+
+    // Read directly into the parser's input buffer to avoid copying it.
+    const int capacity = _readSize;
+    __block BOOL broken = NO;
+    [delegate threadedReadTaskWithMinimumCapacity:capacity
+                                           reader:^int(char *buffer, int available) {
+                                               const int bytesRead = [self readIntoBuffer:buffer
+                                                                                 capacity:MIN(available, capacity)
+                                                                               brokenPipe:&broken];
+                                               if (broken) {
+                                                   return 0;
+                                               }
+                                               hasOutput = YES;
+                                               [self didReadBytes:buffer length:bytesRead];
+                                               return bytesRead;
+                                           }];
+    if (broken) {
+        [self brokenPipe];
+    }
 }
 
 - (void)processWrite {
@@ -671,7 +793,7 @@ static void HandleSigChld(int n) {
 
         // Wake up the task notifier so the coprocess's output buffer will be sent to its file
         // descriptor.
-        [taskNotifier unblock];
+        [taskNotifier taskStateDidChange:self];
     }
 }
 
@@ -920,6 +1042,7 @@ static void HandleSigChld(int n) {
     if (autologPath) {
         [self startLoggingToFileWithPath:autologPath shouldAppend:[iTermAdvancedSettingsModel autologAppends]];
     }
+    [self startRecordingIfEnabledWithSize:VT100GridSizeMake(width, height)];
 
     iTermTTYState ttyState;
     setup_tty_param(&ttyState, width, height, isUTF8);
@@ -1023,7 +1146,11 @@ static void HandleSigChld(int n) {
 #pragma mark I/O
 
 - (BOOL)wantsRead {
-    return !self.paused;
+    if (self.paused) {
+        return NO;
+    }
+    id<PTYTaskDelegate> delegate = self.delegate;
+    return !delegate || [delegate threadedTaskCanAcceptOutput];
 }
 
 - (BOOL)wantsWrite {
@@ -1043,11 +1170,23 @@ static void HandleSigChld(int n) {
 // The bytes in data were just read from the fd.
 - (void)readTask:(char *)buffer length:(int)length {
     [self logData:buffer length:length];
+    [self.recorder recordOutput:buffer length:length];
 
     // The delegate is responsible for parsing VT100 tokens here and sending them off to the
     // main thread for execution. If its queues get too large, it can block.
     [self.delegate threadedReadTask:buffer length:length];
 
+    [self copyToCoprocess:buffer length:length];
+}
+
+// Called when bytes were read directly into the delegate's buffer, before the delegate parses them.
+- (void)didReadBytes:(char *)buffer length:(int)length {
+    [self logData:buffer length:length];
+    [self.recorder recordOutput:buffer length:length];
+    [self copyToCoprocess:buffer length:length];
+}
+
+- (void)copyToCoprocess:(char *)buffer length:(int)length {
     @synchronized (self) {
         if (coprocess_) {
             [coprocess_.outputBuffer appendData:[NSData dataWithBytes:buffer length:length]];
@@ -1094,6 +1233,7 @@ static void HandleSigChld(int n) {
         winsize.ws_col = _desiredSize.width;
         winsize.ws_row = _desiredSize.height;
         ioctl(fd, TIOCSWINSZ, &winsize);
+        [self.recorder recordSize:_desiredSize];
     }
 }
 
@@ -505,6 +505,10 @@ scrollToFirstResult:(BOOL)scrollToFirstResult;
 // on the next search.
 - (void)clearHighlights:(BOOL)resetContext;
 
+// Moves search results after lines from |lineNumber| on moved by |delta|, and the scroll position on
+// the next refresh.
+- (void)handleLinesMovedFrom:(int)lineNumber by:(int)delta;
+
 // Performs a find on the next chunk of text.
 - (BOOL)continueFind:(double *)progress;
 
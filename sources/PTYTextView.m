@@ -192,6 +192,8 @@ static const int kDragThreshold = 3;
     BOOL _showStripesWhenBroadcastingInput;
 
     iTermFindOnPageHelper *_findOnPageHelper;
+    // Lines the text at the top of the visible rect moved by since the last refresh.
+    int _visibleLinesMovedBy;
     iTermTextViewAccessibilityHelper *_accessibilityHelper;
     iTermBadgeLabel *_badgeLabel;
 
@@ -866,6 +868,31 @@ static const int kDragThreshold = 3;
     NSAccessibilityPostNotification(self, NSAccessibilityRowCountChangedNotification);
 }
 
+- (void)handleLinesMovedFrom:(int)lineNumber by:(int)delta {
+    [_oldSelection moveLinesFrom:lineNumber by:delta];
+    [_findOnPageHelper moveSearchResultsFromLine:lineNumber + [_dataSource totalScrollbackOverflow]
+                                              by:delta
+                                           width:[_dataSource width]];
+
+    // This may happen while drawing, so scroll on the next refresh.
+    if ([self visibleRect].origin.y / _lineHeight >= lineNumber) {
+        _visibleLinesMovedBy += delta;
+    }
+    [self setNeedsDisplay:YES];
+}
+
+// Keep the text the user scrolled to in view after lines above it moved.
+- (void)handleVisibleLinesMovedBy:(int)delta userScroll:(BOOL)userScroll {
+    if (userScroll) {
+        NSScrollView *scrollView = [self enclosingScrollView];
+        NSRect scrollRect = [self visibleRect];
+        scrollRect.origin.y = MAX(0, scrollRect.origin.y + [scrollView verticalLineScroll] * delta);
+        [self scrollRectToVisible:scrollRect];
+    }
+    [self setNeedsDisplay:YES];
+    [self updateNoteViewFrames];
+}
+
 // Update accessibility, to be called periodically.
 - (void)refreshAccessibility {
     NSAccessibilityPostNotification(self, NSAccessibilityValueChangedNotification);
@@ -915,6 +942,11 @@ static const int kDragThreshold = 3;
         [self handleScrollbackOverflow:scrollbackOverflow userScroll:userScroll];
         _inRefresh = NO;
     }
+    if (_visibleLinesMovedBy) {
+        const int visibleLinesMovedBy = _visibleLinesMovedBy;
+        _visibleLinesMovedBy = 0;
+        [self handleVisibleLinesMovedBy:visibleLinesMovedBy userScroll:userScroll];
+    }
 
     // Scroll to the bottom if needed.
     if (!userScroll) {
@@ -5739,8 +5771,16 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
                                                                lineEnd - lineStart)];
         [self setNeedsDisplayInRect:[self gridRect]];
     } else {
-        for (int y = lineStart; y < lineEnd; y++) {
-            VT100GridRange range = [_dataSource dirtyRangeForLine:y - lineStart];
+        // Only visit lines the grid says are dirty instead of asking about every line.
+        const int dirtyLineWords = MAX(1, (lineEnd - lineStart + 63) / 64);
+        uint64_t dirtyLines[dirtyLineWords];
+        const BOOL anyDirtyLine = [_dataSource getDirtyLineMask:dirtyLines capacity:dirtyLineWords];
+        for (int y = lineStart; anyDirtyLine && y < lineEnd; y++) {
+            const int i = y - lineStart;
+            if (!(dirtyLines[i / 64] & (1ULL << (i % 64)))) {
+                continue;
+            }
+            VT100GridRange range = [_dataSource dirtyRangeForLine:i];
             if (range.length > 0) {
                 foundDirty = YES;
                 [_findOnPageHelper removeHighlightsInRange:NSMakeRange(y + totalScrollbackOverflow, 1)];
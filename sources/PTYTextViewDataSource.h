@@ -99,6 +99,11 @@
 // NOTE: y is a grid index and cannot refer to scrollback history.
 - (VT100GridRange)dirtyRangeForLine:(int)y;
 
+// Sets bit y of |mask|, which has room for |capacity| words, if grid line y has any dirty chars.
+// The grid may be a saved one with a different height, so lines that don't fit are left out.
+// Returns YES if any line in the mask is dirty.
+- (BOOL)getDirtyLineMask:(uint64_t *)mask capacity:(int)capacity;
+
 // Returns the last modified date for a given line.
 - (NSDate *)timestampForLine:(int)y;
 
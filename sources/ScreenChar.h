@@ -344,6 +344,20 @@ static inline BOOL ScreenCharHasDefaultAttributesAndColors(const screen_char_t s
 NSString* ComplexCharToStr(int key);
 BOOL ComplexCharCodeIsSpacingCombiningMark(unichar code);
 
+// Complex char codes are recycled once nothing uses them. Containers that keep cells for a long
+// time take a reference on each code they hold and give it up when they're done.
+void ComplexCharRetain(unichar code);
+void ComplexCharRelease(unichar code);
+
+// Containers whose cells change too often to count references (like grids) register as roots
+// instead. When codes run out, |function| is called with the table locked and must add every
+// complex char the root holds to |marks|, typically with ComplexCharMarkCodesInScreenChars. Remove
+// the root before freeing its cells.
+typedef struct iTermComplexCharMarks ComplexCharMarks;
+void ComplexCharAddRoot(void *context, void (*function)(void *context, ComplexCharMarks *marks));
+void ComplexCharRemoveRoot(void *context);
+void ComplexCharMarkCodesInScreenChars(ComplexCharMarks *marks, const screen_char_t *chars, int length);
+
 // Return a string with the contents of a screen char, which may or may not
 // be complex.
 NSString* ScreenCharToStr(const screen_char_t *const sct);
@@ -419,6 +433,21 @@ void StringToScreenChars(NSString *s,
                          iTermUnicodeNormalization normalization,
                          NSInteger unicodeVersion);
 
+// A faster StringToScreenChars for text in which every code unit is a grapheme cluster by itself
+// and normalization would not change, which covers ASCII and most CJK. Converts UTF-16 directly
+// without creating any strings. Returns NO if |chars| needs the general conversion, in which case
+// the contents of |buf| are undefined. |buf| must have room for 2 * length cells.
+BOOL SimpleCharactersToScreenChars(const unichar *chars,
+                                   int length,
+                                   screen_char_t *buf,
+                                   screen_char_t fg,
+                                   screen_char_t bg,
+                                   int *len,
+                                   BOOL ambiguousIsDoubleWidth,
+                                   BOOL *foundDwc,
+                                   iTermUnicodeNormalization normalization,
+                                   NSInteger unicodeVersion);
+
 // Copy attributes from fg and bg, and zero out other fields. Text attributes like bold, italic, etc.
 // come from fg.
 void InitializeScreenChar(screen_char_t *s, screen_char_t fg, screen_char_t bg);
@@ -435,6 +464,7 @@ BOOL StringContainsCombiningMark(NSString *s);
 // is set then background-color bars will be added on the edges so the image is
 // not distorted. Insets should be specified as a fraction of cell size (all inset values should be
 // in [0, 1] and will be multiplied by cell width and height before rendering.).
+// If no code is available the return value has image == 0 and the image can't be placed.
 screen_char_t ImageCharForNewImage(NSString *name,
                                    int width,
                                    int height,
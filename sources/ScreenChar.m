@@ -33,7 +33,9 @@
 #import "DebugLogging.h"
 #import "charmaps.h"
 #import "iTermAdvancedSettingsModel.h"
+#import "iTermComplexCharTable.h"
 #import "iTermImageInfo.h"
+#import "iTermUnicodeProperties.h"
 #import "iTermMalloc.h"
 #import "NSCharacterSet+iTerm.h"
 
@@ -42,21 +44,12 @@ static NSString *const kScreenCharSpacingCombiningMarksKey = @"Spacing Combining
 static NSString *const kScreenCharInverseComplexCharMapKey = @"Inverse Complex Char Map";
 static NSString *const kScreenCharImageMapKey = @"Image Map";
 static NSString *const kScreenCharCCMNextKeyKey = @"Next Key";
-static NSString *const kScreenCharHasWrappedKey = @"Has Wrapped";
 
-// Maps codes to strings
-static NSMutableDictionary* complexCharMap;
-static NSMutableSet<NSNumber *> *spacingCombiningMarkCodeNumbers;
-// Maps strings to codes.
-static NSMutableDictionary* inverseComplexCharMap;
+// Complex chars live in iTermComplexCharTable. Image codes are reserved in it too so the two never
+// collide.
 // Image info. Maps a NSNumber with the image's code to an ImageInfo object.
 static NSMutableDictionary* gImages;
 static NSMutableDictionary* gEncodableImageMap;
-// Next available code.
-static int ccmNextKey = 1;
-// If ccmNextKey has wrapped then this is set to true and we have to delete old
-// strings before creating a new one with a recycled code.
-static BOOL hasWrapped = NO;
 
 typedef NS_ENUM(int, iTermTriState) {
     iTermTriStateFalse,
@@ -166,25 +159,40 @@ iTermTriState iTermTriStateFromBool(BOOL b) {
 
 @end
 
-static void CreateComplexCharMapIfNeeded() {
-    if (!complexCharMap) {
-        complexCharMap = [[NSMutableDictionary alloc] initWithCapacity:1000];
-        spacingCombiningMarkCodeNumbers = [[NSMutableSet alloc] initWithCapacity:1000];
-        inverseComplexCharMap = [[NSMutableDictionary alloc] initWithCapacity:1000];
-    }
-}
-
 NSString *ComplexCharToStr(int key) {
     if (key == UNICODE_REPLACEMENT_CHAR) {
         return ReplacementString();
     }
 
-    CreateComplexCharMapIfNeeded();
-    return [complexCharMap objectForKey:[NSNumber numberWithInt:key]];
+    return iTermComplexCharTableString(key);
 }
 
 BOOL ComplexCharCodeIsSpacingCombiningMark(unichar code) {
-    return [spacingCombiningMarkCodeNumbers containsObject:@(code)];
+    return iTermComplexCharTableIsSpacingCombiningMark(code);
+}
+
+void ComplexCharRetain(unichar code) {
+    iTermComplexCharTableRetain(code);
+}
+
+void ComplexCharRelease(unichar code) {
+    iTermComplexCharTableRelease(code);
+}
+
+void ComplexCharAddRoot(void *context, void (*function)(void *context, ComplexCharMarks *marks)) {
+    iTermComplexCharTableAddRoot(context, function);
+}
+
+void ComplexCharRemoveRoot(void *context) {
+    iTermComplexCharTableRemoveRoot(context);
+}
+
+void ComplexCharMarkCodesInScreenChars(ComplexCharMarks *marks, const screen_char_t *chars, int length) {
+    for (int i = 0; i < length; i++) {
+        if (chars[i].complexChar && !chars[i].image) {
+            iTermComplexCharMarksAdd((iTermComplexCharMarks *)marks, chars[i].code);
+        }
+    }
 }
 
 NSString *ScreenCharToStr(const screen_char_t *const sct) {
@@ -204,21 +212,16 @@ NSString *CharToStr(unichar code, BOOL isComplex) {
 }
 
 int ExpandScreenChar(screen_char_t* sct, unichar* dest) {
-    NSString* value = nil;
     if (sct->code == UNICODE_REPLACEMENT_CHAR) {
-        value = ReplacementString();
+        *dest = UNICODE_REPLACEMENT_CHAR;
+        return 1;
     } else if (sct->complexChar) {
-        value = ComplexCharToStr(sct->code);
+        // Returns 0 if there's no string, which can happen if state restoration goes awry.
+        return iTermComplexCharTableGetCharacters(sct->code, dest);
     } else {
         *dest = sct->code;
         return 1;
     }
-    if (!value) {
-        // This can happen if state restoration goes awry.
-        return 0;
-    }
-    [value getCharacters:dest];
-    return (int)[value length];
 }
 
 UTF32Char CharToLongChar(unichar code, BOOL isComplex)
@@ -233,10 +236,6 @@ UTF32Char CharToLongChar(unichar code, BOOL isComplex)
     }
 }
 
-static BOOL ComplexCharKeyIsReserved(int k) {
-    return k >= iTermBoxDrawingCodeMin && k <= iTermBoxDrawingCodeMax;
-}
-
 static void AllocateImageMapsIfNeeded(void) {
     if (!gImages) {
         gImages = [[NSMutableDictionary alloc] init];
@@ -250,13 +249,16 @@ screen_char_t ImageCharForNewImage(NSString *name,
                                    BOOL preserveAspectRatio,
                                    NSEdgeInsets inset) {
     AllocateImageMapsIfNeeded();
-    int newKey;
-    do {
-        newKey = ccmNextKey++;
-    } while (ComplexCharKeyIsReserved(newKey));
-
     screen_char_t c;
     memset(&c, 0, sizeof(c));
+    const int newKey = iTermComplexCharTableReserveCode();
+    if (newKey < 0) {
+        // Every code is in use by a live complex char or image. Sharing a code would make
+        // unrelated images render as each other.
+        ELog(@"No code available for new image %@", name);
+        return c;
+    }
+
     c.image = 1;
     c.code = newKey;
 
@@ -288,6 +290,7 @@ void ReleaseImage(unichar code) {
     DLog(@"ReleaseImage(%@)", @(code));
     [gImages removeObjectForKey:@(code)];
     [gEncodableImageMap removeObjectForKey:@(code)];
+    iTermComplexCharTableFreeReservedCode(code);
 }
 
 iTermImageInfo *GetImageInfo(unichar code) {
@@ -301,48 +304,38 @@ VT100GridCoord GetPositionOfImageInChar(screen_char_t c) {
 
 int GetOrSetComplexChar(NSString *str,
                         iTermTriState isSpacingCombiningMark) {
-    CreateComplexCharMapIfNeeded();
-    NSNumber *number = inverseComplexCharMap[str];
-    if (number) {
-        return [number intValue];
-    }
-
-    int newKey;
-    do {
-        newKey = ccmNextKey++;
-    } while (ComplexCharKeyIsReserved(newKey));
-
-    number = @(newKey);
-    if (hasWrapped) {
-        NSString* oldStr = complexCharMap[number];
-        if (oldStr) {
-            [inverseComplexCharMap removeObjectForKey:oldStr];
-            [spacingCombiningMarkCodeNumbers removeObject:number];
-        }
-    }
-    switch (isSpacingCombiningMark) {
-        case iTermTriStateTrue:
-            [spacingCombiningMarkCodeNumbers addObject:number];
-            break;
-        case iTermTriStateFalse:
-            break;
-        case iTermTriStateOther: {
-            NSCharacterSet *scmSet = [NSCharacterSet spacingCombiningMarksForUnicodeVersion:12];
-            if ([str rangeOfCharacterFromSet:scmSet].location != NSNotFound) {
-                [spacingCombiningMarkCodeNumbers addObject:number];
+    const int length = (int)str.length;
+    unichar stackBuffer[kMaxParts * 2];
+    unichar *chars = length <= kMaxParts * 2 ? stackBuffer : iTermMalloc(length * sizeof(unichar));
+    [str getCharacters:chars range:NSMakeRange(0, length)];
+
+    int key = iTermComplexCharTableLookup(chars, length);
+    if (key < 0) {
+        BOOL spacingCombiningMark = NO;
+        switch (isSpacingCombiningMark) {
+            case iTermTriStateTrue:
+                spacingCombiningMark = YES;
+                break;
+            case iTermTriStateFalse:
+                break;
+            case iTermTriStateOther: {
+                NSCharacterSet *scmSet = [NSCharacterSet spacingCombiningMarksForUnicodeVersion:12];
+                spacingCombiningMark = ([str rangeOfCharacterFromSet:scmSet].location != NSNotFound);
             }
         }
+        BOOL added = NO;
+        key = iTermComplexCharTableIntern(chars, length, spacingCombiningMark, &added);
+        if (key < 0) {
+            DLog(@"Complex char table is full of live codes");
+            key = UNICODE_REPLACEMENT_CHAR;
+        } else if (added && [iTermAdvancedSettingsModel restoreWindowContents]) {
+            [NSApp invalidateRestorableState];
+        }
     }
-    complexCharMap[number] = str;
-    inverseComplexCharMap[str] = number;
-    if ([iTermAdvancedSettingsModel restoreWindowContents]) {
-        [NSApp invalidateRestorableState];
-    }
-    if (ccmNextKey == 0xf000) {
-        ccmNextKey = 1;
-        hasWrapped = YES;
+    if (chars != stackBuffer) {
+        free(chars);
     }
-    return newKey;
+    return key;
 }
 
 int AppendToComplexChar(int key, unichar codePoint) {
@@ -350,7 +343,7 @@ int AppendToComplexChar(int key, unichar codePoint) {
         return UNICODE_REPLACEMENT_CHAR;
     }
 
-    NSString* str = [complexCharMap objectForKey:[NSNumber numberWithInt:key]];
+    NSString* str = ComplexCharToStr(key);
     if ([str length] == kMaxParts) {
         NSLog(@"Warning: char <<%@>> with key %d reached max length %d", str,
               key, kMaxParts);
@@ -578,8 +571,8 @@ void StringToScreenChars(NSString *s,
                          NSInteger unicodeVersion) {
     __block NSInteger j = 0;
     __block BOOL foundCursor = NO;
-    NSCharacterSet *zeroWidthSpaces = [NSCharacterSet zeroWidthSpaceCharacterSetForUnicodeVersion:unicodeVersion];
-    NSCharacterSet *spacingCombiningMarks = [NSCharacterSet spacingCombiningMarksForUnicodeVersion:12];
+    const iTermUnicodePropertyTable *properties = iTermUnicodePropertyTableForVersion(unicodeVersion);
+    const BOOL detectSpacingCombiningMarks = [iTermAdvancedSettingsModel aggressiveBaseCharacterDetection];
 
     [s enumerateComposedCharacters:^(NSRange range,
                                      unichar baseBmpChar,
@@ -597,10 +590,11 @@ void StringToScreenChars(NSString *s,
         // Set the code and the complex flag. Also return early if no cell should be used by this
         // grapheme cluster. Set the isDoubleWidth flag.
         if (!composedOrNonBmpChar) {
-            if ([zeroWidthSpaces characterIsMember:baseBmpChar]) {
+            const iTermUnicodeProperty baseProperties = iTermUnicodePropertiesOfCodePoint(properties, baseBmpChar);
+            if (baseProperties & iTermUnicodePropertyZeroWidthSpace) {
                 // Ignore zero-width spacers.
                 return;
-            } else if ([spacingCombiningMarks characterIsMember:baseBmpChar]) {
+            } else if (detectSpacingCombiningMarks && (baseProperties & iTermUnicodePropertySpacingCombiningMark)) {
                 composedOrNonBmpChar = [NSString stringWithLongCharacter:baseBmpChar];
                 baseBmpChar = 0;
                 spacingCombiningMark = YES;
@@ -618,9 +612,8 @@ void StringToScreenChars(NSString *s,
                 buf[j].code = baseBmpChar;
                 buf[j].complexChar = NO;
 
-                isDoubleWidth = [NSString isDoubleWidthCharacter:baseBmpChar
-                                          ambiguousIsDoubleWidth:ambiguousIsDoubleWidth
-                                                  unicodeVersion:unicodeVersion];
+                isDoubleWidth = iTermUnicodePropertiesAreDoubleWidth(iTermUnicodePropertiesOfCodePoint(properties, baseBmpChar),
+                                                                     ambiguousIsDoubleWidth);
             }
         }
         if (composedOrNonBmpChar) {
@@ -638,9 +631,8 @@ void StringToScreenChars(NSString *s,
             if (IsHighSurrogate(baseChar) && composedOrNonBmpChar.length > 1) {
                 baseChar = DecodeSurrogatePair(baseChar, [composedOrNonBmpChar characterAtIndex:1]);
             }
-            isDoubleWidth = [NSString isDoubleWidthCharacter:baseChar
-                                      ambiguousIsDoubleWidth:ambiguousIsDoubleWidth
-                                              unicodeVersion:unicodeVersion];
+            isDoubleWidth = iTermUnicodePropertiesAreDoubleWidth(iTermUnicodePropertiesOfCodePoint(properties, baseChar),
+                                                                 ambiguousIsDoubleWidth);
         }
 
         // Append a DWC_RIGHT if the base character is double-width.
@@ -664,6 +656,46 @@ void StringToScreenChars(NSString *s,
     }
 }
 
+BOOL SimpleCharactersToScreenChars(const unichar *chars,
+                                   int length,
+                                   screen_char_t *buf,
+                                   screen_char_t fg,
+                                   screen_char_t bg,
+                                   int *len,
+                                   BOOL ambiguousIsDoubleWidth,
+                                   BOOL *foundDwc,
+                                   iTermUnicodeNormalization normalization,
+                                   NSInteger unicodeVersion) {
+    const iTermUnicodePropertyTable *properties = iTermUnicodePropertyTableForVersion(unicodeVersion);
+    // Normalizing can decompose or replace characters without marks, but nothing below U+00C0.
+    const unichar limit = (normalization == iTermUnicodeNormalizationNone) ? 0xffff : 0xc0;
+    screen_char_t template = { 0 };
+    InitializeScreenChar(&template, fg, bg);
+    int j = 0;
+    BOOL dwc = NO;
+    for (int i = 0; i < length; i++) {
+        const unichar c = chars[i];
+        const iTermUnicodeProperty charProperties = iTermUnicodePropertiesOfCodePoint(properties, c);
+        if (c >= limit || (charProperties & iTermUnicodePropertyNeedsGraphemeHandling)) {
+            return NO;
+        }
+        buf[j] = template;
+        buf[j].code = c;
+        j++;
+        if (iTermUnicodePropertiesAreDoubleWidth(charProperties, ambiguousIsDoubleWidth)) {
+            buf[j] = template;
+            buf[j].code = DWC_RIGHT;
+            j++;
+            dwc = YES;
+        }
+    }
+    *len = j;
+    if (foundDwc && dwc) {
+        *foundDwc = YES;
+    }
+    return YES;
+}
+
 void InitializeScreenChar(screen_char_t *s, screen_char_t fg, screen_char_t bg) {
     s->code = 0;
     s->complexChar = NO;
@@ -702,43 +734,43 @@ void ConvertCharsToGraphicsCharset(screen_char_t *s, int len)
 }
 
 NSDictionary *ScreenCharEncodedRestorableState(void) {
-    return @{ kScreenCharComplexCharMapKey: complexCharMap ?: @{},
-              kScreenCharSpacingCombiningMarksKey: spacingCombiningMarkCodeNumbers.allObjects ?: @[],
-              kScreenCharInverseComplexCharMapKey: inverseComplexCharMap ?: @{},
+    NSMutableDictionary *complexCharMap = [NSMutableDictionary dictionary];
+    NSMutableDictionary *inverseComplexCharMap = [NSMutableDictionary dictionary];
+    NSMutableArray<NSNumber *> *spacingCombiningMarkCodeNumbers = [NSMutableArray array];
+    iTermComplexCharTableEnumerate(^(unichar code, NSString *string, BOOL spacingCombiningMark) {
+        complexCharMap[@(code)] = string;
+        inverseComplexCharMap[string] = @(code);
+        if (spacingCombiningMark) {
+            [spacingCombiningMarkCodeNumbers addObject:@(code)];
+        }
+    });
+    return @{ kScreenCharComplexCharMapKey: complexCharMap,
+              kScreenCharSpacingCombiningMarksKey: spacingCombiningMarkCodeNumbers,
+              kScreenCharInverseComplexCharMapKey: inverseComplexCharMap,
               kScreenCharImageMapKey: gEncodableImageMap ?: @{},
-              kScreenCharCCMNextKeyKey: @(ccmNextKey),
-              kScreenCharHasWrappedKey: @(hasWrapped) };
+              kScreenCharCCMNextKeyKey: @(iTermComplexCharTableNextCode()) };
 }
 
 void ScreenCharDecodeRestorableState(NSDictionary *state) {
+    // The inverse map is still saved for older versions but it's redundant.
     NSDictionary *stateComplexCharMap = state[kScreenCharComplexCharMapKey];
-    CreateComplexCharMapIfNeeded();
-    for (id key in stateComplexCharMap) {
-        if (!complexCharMap[key]) {
-            complexCharMap[key] = stateComplexCharMap[key];
-        }
-    }
-    NSArray<NSString *> *spacingCombiningMarksArray = state[kScreenCharSpacingCombiningMarksKey];
-    for (NSNumber *number in spacingCombiningMarksArray) {
-        [spacingCombiningMarkCodeNumbers addObject:number];
+    NSSet<NSNumber *> *spacingCombiningMarks = [NSSet setWithArray:state[kScreenCharSpacingCombiningMarksKey] ?: @[]];
+    for (NSNumber *key in stateComplexCharMap) {
+        iTermComplexCharTableRestore(key.unsignedShortValue,
+                                     stateComplexCharMap[key],
+                                     [spacingCombiningMarks containsObject:key]);
     }
 
-    NSDictionary *stateInverseMap = state[kScreenCharInverseComplexCharMapKey];
-    for (id key in stateInverseMap) {
-        if (!inverseComplexCharMap[key]) {
-            inverseComplexCharMap[key] = stateInverseMap[key];
-        }
-    }
     NSDictionary *imageMap = state[kScreenCharImageMapKey];
     AllocateImageMapsIfNeeded();
     for (id key in imageMap) {
         gEncodableImageMap[key] = imageMap[key];
+        iTermComplexCharTableRestore([key unsignedShortValue], nil, NO);
         iTermImageInfo *info = [[[iTermImageInfo alloc] initWithDictionary:imageMap[key]] autorelease];
         if (info) {
             gImages[key] = info;
             DLog(@"Decoded restorable state for image %@: %@", key, info);
         }
     }
-    ccmNextKey = [state[kScreenCharCCMNextKeyKey] intValue];
-    hasWrapped = [state[kScreenCharHasWrappedKey] boolValue];
+    iTermComplexCharTableSetNextCode([state[kScreenCharCCMNextKeyKey] intValue]);
 }
@@ -1,8 +1,10 @@
-// This implements a select loop that runs in a special thread.
+// This implements an event loop that runs in a special thread. File descriptors are registered
+// with an iTermReadinessMonitor (kqueue where available) when they change instead of on every
+// spin, so idle tasks cost nothing when another task has I/O.
 
 #import <Foundation/Foundation.h>
 
-// Posted just before select() is called.
+// Posted just before waiting for events.
 extern NSString *const kTaskNotifierDidSpin;
 
 @class PTYTask;
@@ -16,6 +18,11 @@ extern NSString *const kTaskNotifierDidSpin;
 - (void)deregisterTask:(PTYTask *)task;
 
 - (void)unblock;
+
+// Call when the values of a task's wantsRead or wantsWrite (or those of its coprocess) may have
+// changed. Wakes up the notifier to recompute them. Safe to call while holding the task's locks.
+- (void)taskStateDidChange:(PTYTask *)task;
+
 - (void)run;
 
 - (void)waitForPid:(pid_t)pid;
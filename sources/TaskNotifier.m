@@ -10,9 +10,9 @@
 #import "Coprocess.h"
 #import "DebugLogging.h"
 #import "PTYTask.h"
+#import "iTermReadinessMonitor.h"
 
-#include <sys/time.h>
-#include <sys/select.h>
+#import <os/lock.h>
 
 #define PtyTaskDebugLog(args...)
 
@@ -20,17 +20,70 @@ NSString *const kTaskNotifierDidSpin = @"kTaskNotifierDidSpin";
 static int unblockPipeR;
 static int unblockPipeW;
 
+// Maximum number of events handled per spin. More stay pending for the next spin.
+static const int kTaskNotifierEventCapacity = 256;
+
+// The file descriptors registered on behalf of one task. A descriptor is -1 when not registered.
+@interface iTermTaskNotifierEntry : NSObject
+@property(nonatomic, retain) PTYTask *task;
+// The coprocess whose descriptors are registered.
+@property(nonatomic, retain) Coprocess *coprocess;
+@property(nonatomic, assign) int taskFd;
+@property(nonatomic, assign) int coprocessReadFd;
+@property(nonatomic, assign) int coprocessWriteFd;
+// Set by -deregisterTask:. Events for a deregistered entry are ignored.
+@property(nonatomic, assign) BOOL deregistered;
+@end
+
+@implementation iTermTaskNotifierEntry
+
+- (instancetype)initWithTask:(PTYTask *)task {
+    self = [super init];
+    if (self) {
+        _task = [task retain];
+        _taskFd = -1;
+        _coprocessReadFd = -1;
+        _coprocessWriteFd = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_task release];
+    [_coprocess release];
+    [super dealloc];
+}
+
+@end
+
 @implementation TaskNotifier
 {
-    NSMutableArray *_tasks;
-    NSMutableArray *_coprocessOnlyTasks;
-    // Set to true when an element of '_tasks' was modified
-    BOOL tasksChanged;
-    // Protects '_tasks', '_coprocessOnlyTasks', and 'tasksChanged'.
+    // PTYTask -> iTermTaskNotifierEntry for every registered task.
+    NSMapTable<PTYTask *, iTermTaskNotifierEntry *> *_entries;
+    // Entries registered or deregistered since the last spin.
+    NSMutableArray<iTermTaskNotifierEntry *> *_addedEntries;
+    NSMutableArray<iTermTaskNotifierEntry *> *_removedEntries;
+    // Protects '_entries', '_addedEntries', '_removedEntries', entries'
+    // 'deregistered' flags, and 'deadpool'.
     NSRecursiveLock* tasksLock;
 
     // A set of NSNumber*s holding pids of tasks that need to be wait()ed on
     NSMutableSet* deadpool;
+
+    // Tasks whose interest in reading or writing may have changed. Protected by _dirtyLock, which
+    // is never held while taking another lock so it's safe to use while holding PTYTask's locks.
+    NSMutableSet<PTYTask *> *_dirtyTasks;
+    os_unfair_lock _dirtyLock;
+
+    // The rest is only used on the notifier thread.
+    iTermReadinessMonitor *_monitor;
+    // Registered file descriptor -> the entry that owns it.
+    NSMutableDictionary<NSNumber *, iTermTaskNotifierEntry *> *_entriesByFd;
+    // Entries with a coprocess. Their interests are recomputed every spin because coprocess state
+    // changes without notice. There are few of them.
+    NSMutableSet<iTermTaskNotifierEntry *> *_coprocessEntries;
+    // Entries that had events in the last spin, whose interests need to be recomputed.
+    NSMutableSet<iTermTaskNotifierEntry *> *_activeEntries;
 }
 
 
@@ -50,10 +103,18 @@ static int unblockPipeW;
     self = [super init];
     if (self) {
         deadpool = [[NSMutableSet alloc] init];
-        _tasks = [[NSMutableArray alloc] init];
-        _coprocessOnlyTasks = [[NSMutableArray alloc] init];
+        _entries = [[NSMapTable alloc] initWithKeyOptions:(NSPointerFunctionsStrongMemory |
+                                                           NSPointerFunctionsObjectPointerPersonality)
+                                             valueOptions:NSPointerFunctionsStrongMemory
+                                                 capacity:16];
+        _addedEntries = [[NSMutableArray alloc] init];
+        _removedEntries = [[NSMutableArray alloc] init];
         tasksLock = [[NSRecursiveLock alloc] init];
-        tasksChanged = NO;
+        _dirtyTasks = [[NSMutableSet alloc] init];
+        _dirtyLock = OS_UNFAIR_LOCK_INIT;
+        _entriesByFd = [[NSMutableDictionary alloc] init];
+        _coprocessEntries = [[NSMutableSet alloc] init];
+        _activeEntries = [[NSMutableSet alloc] init];
 
         int unblockPipe[2];
         if (pipe(unblockPipe) != 0) {
@@ -69,16 +130,26 @@ static int unblockPipeW;
         }
         unblockPipeR = unblockPipe[0];
         unblockPipeW = unblockPipe[1];
+
+        _monitor = [[iTermReadinessMonitor bestAvailableMonitor] retain];
+        [self setInterest:iTermReadinessEventsRead forFileDescriptor:unblockPipeR];
+        DLog(@"Task notifier using %@", _monitor.backendName);
     }
     return self;
 }
 
 - (void)dealloc
 {
-    [_tasks release];
-    [_coprocessOnlyTasks release];
+    [_entries release];
+    [_addedEntries release];
+    [_removedEntries release];
     [tasksLock release];
     [deadpool release];
+    [_dirtyTasks release];
+    [_monitor release];
+    [_entriesByFd release];
+    [_coprocessEntries release];
+    [_activeEntries release];
     close(unblockPipeR);
     close(unblockPipeW);
     [super dealloc];
@@ -88,13 +159,10 @@ static int unblockPipeW;
     PtyTaskDebugLog(@"registerTask: lock\n");
     [tasksLock lock];
     PtyTaskDebugLog(@"Add task at %p\n", (void*)task);
-    if (task.isCoprocessOnly) {
-        [_coprocessOnlyTasks addObject:task];
-    } else {
-        [_tasks addObject:task];
-    }
-    PtyTaskDebugLog(@"There are now %lu tasks\n", (unsigned long)_tasks.count);
-    tasksChanged = YES;
+    iTermTaskNotifierEntry *entry = [[[iTermTaskNotifierEntry alloc] initWithTask:task] autorelease];
+    [_entries setObject:entry forKey:task];
+    [_addedEntries addObject:entry];
+    PtyTaskDebugLog(@"There are now %lu tasks\n", (unsigned long)_entries.count);
     PtyTaskDebugLog(@"registerTask: unlock\n");
     [tasksLock unlock];
     [self unblock];
@@ -116,13 +184,15 @@ static int unblockPipeW;
     if ([task hasCoprocess]) {
         [deadpool addObject:@([[task coprocess] pid])];
     }
-    [_tasks removeObject:task];
-    [_coprocessOnlyTasks removeObject:task];
-    tasksChanged = YES;
-    PtyTaskDebugLog(@"End remove task %p. There are now %lu tasks and %ld coprocess-only tasks.\n",
+    iTermTaskNotifierEntry *entry = [_entries objectForKey:task];
+    if (entry) {
+        entry.deregistered = YES;
+        [_removedEntries addObject:entry];
+        [_entries removeObjectForKey:task];
+    }
+    PtyTaskDebugLog(@"End remove task %p. There are now %lu tasks.\n",
                     (void*)task,
-                    (unsigned long)[_tasks count],
-                    (unsigned long)_coprocessOnlyTasks.count);
+                    (unsigned long)_entries.count);
     PtyTaskDebugLog(@"deregisterTask: unlock\n");
     [tasksLock unlock];
     [self unblock];
@@ -148,42 +218,246 @@ void UnblockTaskNotifier(void) {
     write(unblockPipeW, &dummy, 1);
 }
 
-- (BOOL)handleReadOnFileDescriptor:(int)fd task:(PTYTask *)task fdSet:(fd_set *)fdSet {
-    if (FD_ISSET(fd, fdSet)) {
+- (void)taskStateDidChange:(PTYTask *)task {
+    if (!task) {
+        return;
+    }
+    os_unfair_lock_lock(&_dirtyLock);
+    const BOOL needsUnblock = (_dirtyTasks.count == 0);
+    [_dirtyTasks addObject:task];
+    os_unfair_lock_unlock(&_dirtyLock);
+    // If the set wasn't empty, whoever made it nonempty already woke up the notifier and it
+    // hasn't taken the set yet.
+    if (needsUnblock) {
+        [self unblock];
+    }
+}
+
+#pragma mark - Registration
+
+// Registers interest in |fd|, switching to select() if the preferred backend can't handle it.
+- (void)setInterest:(iTermReadinessEvents)interest forFileDescriptor:(int)fd {
+    if ([_monitor setInterest:interest forFileDescriptor:fd]) {
+        return;
+    }
+    if (errno == EBADF) {
+        // Closed by another thread. Its task will be cleaned up soon.
+        PtyTaskDebugLog(@"fd %d already closed", fd);
+        return;
+    }
+    if ([_monitor.backendName isEqualToString:@"select"]) {
+        DLog(@"Can't monitor fd %d: %s", fd, strerror(errno));
+        return;
+    }
+    // kqueue doesn't support every kind of file descriptor on every OS version.
+    DLog(@"%@ can't monitor fd %d (%s). Falling back to select.", _monitor, fd, strerror(errno));
+    iTermReadinessMonitor *selectMonitor = [iTermReadinessMonitor selectMonitor];
+    [selectMonitor adoptInterestsFromMonitor:_monitor];
+    [_monitor release];
+    _monitor = [selectMonitor retain];
+    [self setInterest:interest forFileDescriptor:fd];
+}
+
+// Makes |entry| the owner of |fd| and sets its interest. A descriptor that changes owners may have
+// been closed and reused, so whatever the monitor knew about it is discarded.
+- (void)claimFileDescriptor:(int)fd
+                   forEntry:(iTermTaskNotifierEntry *)entry
+                   interest:(iTermReadinessEvents)interest {
+    NSNumber *key = @(fd);
+    if (_entriesByFd[key] != entry) {
+        [_monitor forgetFileDescriptor:fd];
+        _entriesByFd[key] = entry;
+    }
+    [self setInterest:interest forFileDescriptor:fd];
+}
+
+- (void)releaseFileDescriptor:(int)fd fromEntry:(iTermTaskNotifierEntry *)entry {
+    if (fd < 0) {
+        return;
+    }
+    NSNumber *key = @(fd);
+    if (_entriesByFd[key] == entry) {
+        [_monitor forgetFileDescriptor:fd];
+        [_entriesByFd removeObjectForKey:key];
+    }
+}
+
+- (void)unregisterEntry:(iTermTaskNotifierEntry *)entry {
+    [self releaseFileDescriptor:entry.taskFd fromEntry:entry];
+    [self releaseFileDescriptor:entry.coprocessReadFd fromEntry:entry];
+    [self releaseFileDescriptor:entry.coprocessWriteFd fromEntry:entry];
+    entry.taskFd = -1;
+    entry.coprocessReadFd = -1;
+    entry.coprocessWriteFd = -1;
+    entry.coprocess = nil;
+    [_coprocessEntries removeObject:entry];
+    [_activeEntries removeObject:entry];
+}
+
+// Brings the registered file descriptors of |entry| and their interests up to date with the state
+// of its task. Must be called with tasksLock held.
+- (void)updateEntry:(iTermTaskNotifierEntry *)entry {
+    if (entry.deregistered) {
+        return;
+    }
+    PTYTask *task = entry.task;
+    if (task.isCoprocessOnly ? task.coprocessOnlyTaskIsDead : task.fd < 0) {
+        PtyTaskDebugLog(@"Deregister dead task %@\n", task);
+        [self deregisterTask:task];
+        [self unregisterEntry:entry];
+        return;
+    }
+
+    const int fd = task.isCoprocessOnly ? -1 : task.fd;
+    if (fd != entry.taskFd) {
+        [self releaseFileDescriptor:entry.taskFd fromEntry:entry];
+        entry.taskFd = -1;
+    }
+    if (fd >= 0) {
+        iTermReadinessEvents interest = iTermReadinessEventsNone;
+        if ([task wantsRead]) {
+            interest |= iTermReadinessEventsRead;
+        }
+        if ([task wantsWrite]) {
+            interest |= iTermReadinessEventsWrite;
+        }
+        [self claimFileDescriptor:fd forEntry:entry interest:interest];
+        entry.taskFd = fd;
+    }
+
+    @synchronized (task) {
+        Coprocess *coprocess = [task coprocess];
+        if (coprocess != entry.coprocess) {
+            // The old coprocess's descriptors are closed, and the numbers may be reused.
+            [self releaseFileDescriptor:entry.coprocessReadFd fromEntry:entry];
+            [self releaseFileDescriptor:entry.coprocessWriteFd fromEntry:entry];
+            entry.coprocessReadFd = -1;
+            entry.coprocessWriteFd = -1;
+            entry.coprocess = coprocess;
+        }
+        if (!coprocess) {
+            [_coprocessEntries removeObject:entry];
+            return;
+        }
+        [_coprocessEntries addObject:entry];
+
+        const int rfd = [coprocess readFileDescriptor];
+        if (rfd != entry.coprocessReadFd) {
+            [self releaseFileDescriptor:entry.coprocessReadFd fromEntry:entry];
+            entry.coprocessReadFd = -1;
+        }
+        if (rfd >= 0) {
+            const BOOL wantsRead = [coprocess wantToRead] && [task writeBufferHasRoom];
+            [self claimFileDescriptor:rfd
+                             forEntry:entry
+                             interest:wantsRead ? iTermReadinessEventsRead : iTermReadinessEventsNone];
+            entry.coprocessReadFd = rfd;
+        }
+
+        const int wfd = [coprocess writeFileDescriptor];
+        if (wfd != entry.coprocessWriteFd) {
+            [self releaseFileDescriptor:entry.coprocessWriteFd fromEntry:entry];
+            entry.coprocessWriteFd = -1;
+        }
+        if (wfd >= 0) {
+            [self claimFileDescriptor:wfd
+                             forEntry:entry
+                             interest:[coprocess wantToWrite] ? iTermReadinessEventsWrite : iTermReadinessEventsNone];
+            entry.coprocessWriteFd = wfd;
+        }
+    }
+}
+
+// Applies registrations, deregistrations, and state changes since the last spin. Only tasks that
+// changed, had events, or have a coprocess are examined, so idle tasks cost nothing.
+- (void)updateRegistrations {
+    os_unfair_lock_lock(&_dirtyLock);
+    NSSet<PTYTask *> *dirtyTasks = _dirtyTasks;
+    _dirtyTasks = [[NSMutableSet alloc] init];
+    os_unfair_lock_unlock(&_dirtyLock);
+
+    // Removals go first so a descriptor that was closed and reused by a new task isn't forgotten
+    // after the new task claims it.
+    NSArray<iTermTaskNotifierEntry *> *removedEntries = [[_removedEntries copy] autorelease];
+    [_removedEntries removeAllObjects];
+    for (iTermTaskNotifierEntry *entry in removedEntries) {
+        [self unregisterEntry:entry];
+    }
+
+    NSMutableSet<iTermTaskNotifierEntry *> *entriesToUpdate = [NSMutableSet setWithArray:_addedEntries];
+    [_addedEntries removeAllObjects];
+    for (PTYTask *task in dirtyTasks) {
+        iTermTaskNotifierEntry *entry = [_entries objectForKey:task];
+        if (entry) {
+            [entriesToUpdate addObject:entry];
+        }
+    }
+    [dirtyTasks release];
+    [entriesToUpdate unionSet:_activeEntries];
+    [entriesToUpdate unionSet:_coprocessEntries];
+    [_activeEntries removeAllObjects];
+
+    for (iTermTaskNotifierEntry *entry in entriesToUpdate) {
+        [self updateEntry:entry];
+    }
+}
+
+#pragma mark - Event Handling
+
+- (void)reapDeadpool {
+    if ([deadpool count] == 0) {
+        return;
+    }
+    // waitpid() on pids that we think are dead or will be dead soon.
+    NSMutableSet* newDeadpool = [NSMutableSet setWithCapacity:[deadpool count]];
+    for (NSNumber* pid in deadpool) {
+        if ([pid intValue] < 0) {
+            continue;
+        }
+        int statLoc;
+        PtyTaskDebugLog(@"wait on %d", [pid intValue]);
+        pid_t waitresult = waitpid([pid intValue], &statLoc, WNOHANG);
+        if (waitresult == 0) {
+            // the process is not yet dead, so put it back in the pool
+            [newDeadpool addObject:pid];
+        } else if (waitresult < 0) {
+            if (errno != ECHILD) {
+                PtyTaskDebugLog(@"  wait failed with %d (%s), adding back to deadpool", errno, strerror(errno));
+                [newDeadpool addObject:pid];
+            } else {
+                PtyTaskDebugLog(@"  wait failed with ECHILD, I guess we already waited on it.");
+            }
+        }
+    }
+    [deadpool release];
+    deadpool = [newDeadpool retain];
+}
+
+// Handles readiness of a task's own file descriptor. tasksLock is released while the task does
+// I/O. Returns early if the task is deregistered along the way.
+- (void)handleEvents:(iTermReadinessEvents)events onTaskOfEntry:(iTermTaskNotifierEntry *)entry {
+    PTYTask *task = [[entry.task retain] autorelease];
+    if (events & iTermReadinessEventsRead) {
         PtyTaskDebugLog(@"run/processRead: unlock");
         [tasksLock unlock];
         [task processRead];
         PtyTaskDebugLog(@"run/processRead: lock");
         [tasksLock lock];
-        if (tasksChanged) {
-            PtyTaskDebugLog(@"Restart iteration\n");
-            tasksChanged = NO;
-            return YES;
+        if (entry.deregistered) {
+            return;
         }
     }
-    return NO;
-}
-
-- (BOOL)handleWriteOnFileDescriptor:(int)fd task:(PTYTask *)task fdSet:(fd_set *)fdSet {
-    if (FD_ISSET(fd, fdSet)) {
+    if ((events & iTermReadinessEventsWrite) && ![task hasBrokenPipe]) {
         PtyTaskDebugLog(@"run/processWrite: unlock");
         [tasksLock unlock];
-        [task retain];
         [task processWrite];
-        [task release];
         PtyTaskDebugLog(@"run/processWrite: lock");
         [tasksLock lock];
-        if (tasksChanged) {
-            PtyTaskDebugLog(@"Restart iteration\n");
-            tasksChanged = NO;
-            return YES;
+        if (entry.deregistered) {
+            return;
         }
     }
-    return NO;
-}
-
-- (BOOL)handleErrorOnFileDescriptor:(int)fd task:(PTYTask *)task fdSet:(fd_set *)fdSet {
-    if (FD_ISSET(fd, fdSet)) {
+    if ((events & iTermReadinessEventsError) && ![task hasBrokenPipe]) {
         PtyTaskDebugLog(@"run/brokenPipe: unlock");
         [tasksLock unlock];
         // brokenPipe will call deregisterTask and add the pid to
@@ -191,163 +465,75 @@ void UnblockTaskNotifier(void) {
         [task brokenPipe];
         PtyTaskDebugLog(@"run/brokenPipe: lock");
         [tasksLock lock];
-        if (tasksChanged) {
-            PtyTaskDebugLog(@"Restart iteration\n");
-            tasksChanged = NO;
-            return YES;
-        }
     }
-    return NO;
 }
 
-- (void)handleReadOnFileDescriptor:(int)fd
-                              task:(PTYTask *)task
-                     withCoprocess:(Coprocess *)coprocess
-                             fdSet:(fd_set *)fdSet {
-    if (![coprocess eof] && FD_ISSET(fd, fdSet)) {
-        PtyTaskDebugLog(@"Reading from coprocess");
-        [coprocess read];
-        [task writeTask:coprocess.inputBuffer];
-        [coprocess.inputBuffer setLength:0];
+// Moves input around between a coprocess and its task.
+- (void)handleEvents:(iTermReadinessEvents)events
+    onFileDescriptor:(int)fd
+   ofCoprocessOfEntry:(iTermTaskNotifierEntry *)entry {
+    PTYTask *task = entry.task;
+    if (!task.isCoprocessOnly && ([task fd] < 0 || [task hasBrokenPipe])) {
+        // Make sure the pipe wasn't just broken.
+        return;
     }
-}
-
-- (void)handleErrorOnFileDescriptor:(int)fd
-                      withCoprocess:(Coprocess *)coprocess
-                              fdSet:(fd_set *)fdSet {
-    if (FD_ISSET(fd, fdSet)) {
-        PtyTaskDebugLog(@"EOF on coprocess %@", coprocess);
-        coprocess.eof = YES;
+    @synchronized (task) {
+        Coprocess *coprocess = [task coprocess];
+        if (coprocess != entry.coprocess) {
+            return;
+        }
+        if (fd == entry.coprocessReadFd) {
+            if ((events & iTermReadinessEventsRead) && ![coprocess eof]) {
+                PtyTaskDebugLog(@"Reading from coprocess");
+                [coprocess read];
+                [task writeTask:coprocess.inputBuffer];
+                [coprocess.inputBuffer setLength:0];
+            }
+            if ((events & iTermReadinessEventsError) && ![coprocess eof]) {
+                PtyTaskDebugLog(@"EOF on coprocess %@", coprocess);
+                coprocess.eof = YES;
+            }
+        } else if (fd == entry.coprocessWriteFd) {
+            if (![coprocess eof]) {
+                PtyTaskDebugLog(@"Write to coprocess %@", coprocess);
+                [coprocess write];
+            }
+        }
     }
 }
 
-- (void)handleWriteOnFileDescriptor:(int)coprocessWriteFd
-                      withCoprocess:(Coprocess *)coprocess
-                              fdSet:(fd_set *)fdSet {
-    if (FD_ISSET(coprocessWriteFd, fdSet)) {
-        if (![coprocess eof]) {
-            PtyTaskDebugLog(@"Write to coprocess %@", coprocess);
-            [coprocess write];
+// Terminates coprocesses that hit EOF. Returns YES if any did.
+- (BOOL)reapCoprocesses {
+    BOOL changed = NO;
+    for (iTermTaskNotifierEntry *entry in [[_coprocessEntries copy] autorelease]) {
+        PTYTask *task = entry.task;
+        if (entry.deregistered ||
+            (!task.isCoprocessOnly && ([task fd] < 0 || [task hasBrokenPipe]))) {
+            continue;
+        }
+        @synchronized (task) {
+            Coprocess *coprocess = [task coprocess];
+            if ([coprocess eof]) {
+                [deadpool addObject:@([coprocess pid])];
+                [coprocess terminate];
+                [task setCoprocess:nil];
+                changed = YES;
+            }
         }
     }
+    return changed;
 }
 
 - (void)run
 {
-    fd_set rfds;
-    fd_set wfds;
-    fd_set efds;
-    int highfd;
-    NSEnumerator* iter;
     NSAutoreleasePool* autoreleasePool = [[NSAutoreleasePool alloc] init];
+    iTermReadinessEvent *events = malloc(sizeof(iTermReadinessEvent) * kTaskNotifierEventCapacity);
 
-    // FIXME: replace this with something better...
     for(;;) {
-
-        FD_ZERO(&rfds);
-        FD_ZERO(&wfds);
-        FD_ZERO(&efds);
-
-        // Unblock pipe to interrupt select() whenever a PTYTask register/unregisters
-        highfd = unblockPipeR;
-        FD_SET(unblockPipeR, &rfds);
-        NSMutableSet* handledFds = [[NSMutableSet alloc] initWithCapacity:256];
-
-        // Add all the PTYTask pipes
         PtyTaskDebugLog(@"run1: lock");
         [tasksLock lock];
-        PtyTaskDebugLog(@"Begin cleaning out dead tasks");
-        for (PTYTask *theTask in _tasks) {
-            if ([theTask fd] < 0) {
-                PtyTaskDebugLog(@"Deregister dead task %@\n", theTask);
-                [self deregisterTask:theTask];
-            }
-        }
-        // Make a copy because -deregisterTask modifies _coprocessOnlyTasks
-        NSArray *coprocessOnlyTasks = [_coprocessOnlyTasks copy];
-        for (PTYTask *theTask in coprocessOnlyTasks) {
-            if ([theTask coprocessOnlyTaskIsDead]) {
-                [self deregisterTask:theTask];
-            }
-        }
-        [coprocessOnlyTasks release];
-
-        if ([deadpool count] > 0) {
-            // waitpid() on pids that we think are dead or will be dead soon.
-            NSMutableSet* newDeadpool = [NSMutableSet setWithCapacity:[deadpool count]];
-            for (NSNumber* pid in deadpool) {
-                if ([pid intValue] < 0) {
-                    continue;
-                }
-                int statLoc;
-                PtyTaskDebugLog(@"wait on %d", [pid intValue]);
-                pid_t waitresult = waitpid([pid intValue], &statLoc, WNOHANG);
-                if (waitresult == 0) {
-                    // the process is not yet dead, so put it back in the pool
-                    [newDeadpool addObject:pid];
-                } else if (waitresult < 0) {
-                    if (errno != ECHILD) {
-                        PtyTaskDebugLog(@"  wait failed with %d (%s), adding back to deadpool", errno, strerror(errno));
-                        [newDeadpool addObject:pid];
-                    } else {
-                        PtyTaskDebugLog(@"  wait failed with ECHILD, I guess we already waited on it.");
-                    }
-                }
-            }
-            [deadpool release];
-            deadpool = [newDeadpool retain];
-        }
-
-        // Figure out the file descriptors to select on.
-        PtyTaskDebugLog(@"Begin enumeration over %lu tasks\n", (unsigned long)[_tasks count]);
-        for (NSArray *taskArray in @[ _tasks, _coprocessOnlyTasks ]) {
-            for (PTYTask *task in taskArray) {
-                PtyTaskDebugLog(@"Got task %@\n", task);
-                int fd = [task fd];
-                if (fd < 0) {
-                    PtyTaskDebugLog(@"Task has fd of %d\n", fd);
-                } else {
-                    // PtyTaskDebugLog(@"Select on fd %d\n", fd);
-                    if (fd > highfd) {
-                        highfd = fd;
-                    }
-                    if ([task wantsRead]) {
-                        FD_SET(fd, &rfds);
-                    }
-                    if ([task wantsWrite]) {
-                        FD_SET(fd, &wfds);
-                    }
-                    FD_SET(fd, &efds);
-                }
-
-                @synchronized (task) {
-                    Coprocess *coprocess = [task coprocess];
-                    if (coprocess) {
-                        if ([coprocess wantToRead] && [task writeBufferHasRoom]) {
-                            int rfd = [coprocess readFileDescriptor];
-                            if (rfd > highfd) {
-                                highfd = rfd;
-                            }
-                            FD_SET(rfd, &rfds);
-                        }
-                        if ([coprocess wantToWrite]) {
-                            int wfd = [coprocess writeFileDescriptor];
-                            if (wfd > highfd) {
-                                highfd = wfd;
-                            }
-                            FD_SET(wfd, &wfds);
-                        }
-                        if (![coprocess eof]) {
-                            int rfd = [coprocess readFileDescriptor];
-                            if (rfd > highfd) {
-                                highfd = rfd;
-                            }
-                            FD_SET(rfd, &efds);
-                        }
-                    }
-                }
-            }
-        }
+        [self updateRegistrations];
+        [self reapDeadpool];
         PtyTaskDebugLog(@"run1: unlock");
         [tasksLock unlock];
 
@@ -357,130 +543,37 @@ void UnblockTaskNotifier(void) {
         autoreleasePool = [[NSAutoreleasePool alloc] init];
 
         // Poll...
-        if (select(highfd+1, &rfds, &wfds, &efds, NULL) <= 0) {
-            switch(errno) {
-                case EAGAIN:
-                case EINTR:
-                default:
-                    goto breakloop;
-                    // If the file descriptor is closed in the main thread there's a race where sometimes you'll get an EBADF.
-            }
+        const int count = [_monitor waitForEvents:events capacity:kTaskNotifierEventCapacity];
+        if (count < 0) {
+            DLog(@"%@ failed: %s", _monitor, strerror(errno));
         }
 
-        // Interrupted?
-        if (FD_ISSET(unblockPipeR, &rfds)) {
-            char dummy[32];
-            do {
-                read(unblockPipeR, dummy, sizeof(dummy));
-            } while (errno != EAGAIN);
-        }
-
-        // Check for read events on PTYTask pipes
         PtyTaskDebugLog(@"run2: lock");
         [tasksLock lock];
-        PtyTaskDebugLog(@"Iterating over %lu tasks\n", (unsigned long)_tasks.count);
-        iter = [_tasks objectEnumerator];
-        BOOL notifyOfCoprocessChange = NO;
-
-        PTYTask *task;
-        while ((task = [iter nextObject])) {
-            PtyTaskDebugLog(@"Got task %@\n", task);
-            int fd = [task fd];
-
-            if (fd >= 0) {
-                // This is mostly paranoia, but if two threads
-                // end up with the same fd (because one closed
-                // and there was a race condition) then trying
-                // to read twice would hang.
-
-                if ([handledFds containsObject:@(fd)]) {
-                    PtyTaskDebugLog(@"Duplicate fd %d", fd);
-                    continue;
-                }
-                [[task retain] autorelease];
-                [handledFds addObject:@(fd)];
-
-                if ([self handleReadOnFileDescriptor:fd task:task fdSet:&rfds]) {
-                    iter = [_tasks objectEnumerator];
-                }
-                if ([self handleWriteOnFileDescriptor:fd task:task fdSet:&wfds]) {
-                    iter = [_tasks objectEnumerator];
-                }
-                if ([self handleErrorOnFileDescriptor:fd task:task fdSet:&efds]) {
-                    iter = [_tasks objectEnumerator];
-                }
-                // Move input around between coprocess and main process.
-                if ([task fd] >= 0 && ![task hasBrokenPipe]) {  // Make sure the pipe wasn't just broken.
-                    @synchronized (task) {
-                        Coprocess *coprocess = [task coprocess];
-                        if (coprocess) {
-                            fd = [coprocess readFileDescriptor];
-                            if ([handledFds containsObject:@(fd)]) {
-                                NSLog(@"Duplicate fd %d", fd);
-                                continue;
-                            }
-                            [handledFds addObject:@(fd)];
-
-                            [self handleReadOnFileDescriptor:fd task:task withCoprocess:coprocess fdSet:&rfds];
-                            [self handleErrorOnFileDescriptor:fd withCoprocess:coprocess fdSet:&efds];
-
-                            // Handle writes
-                            int coprocessWriteFd = [coprocess writeFileDescriptor];
-                            if ([handledFds containsObject:@(coprocessWriteFd)]) {
-                                NSLog(@"Duplicate fd %d", coprocessWriteFd);
-                                continue;
-                            }
-                            [handledFds addObject:@(coprocessWriteFd)];
-                            [self handleWriteOnFileDescriptor:coprocessWriteFd withCoprocess:coprocess fdSet:&wfds];
-
-                            if ([coprocess eof]) {
-                                [deadpool addObject:@([coprocess pid])];
-                                [coprocess terminate];
-                                [task setCoprocess:nil];
-                                notifyOfCoprocessChange = YES;
-                            }
-                        }
-                    }
+        PtyTaskDebugLog(@"Handling %d events\n", count);
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].fd;
+            if (fd == unblockPipeR) {
+                // Interrupted.
+                char dummy[32];
+                while (read(unblockPipeR, dummy, sizeof(dummy)) > 0) {
                 }
+                continue;
             }
-        }
-
-        // Handle coprocess reads, writes, and deaths for coprocess-only tasks.
-          PtyTaskDebugLog(@"Iterating over %lu coprocess-only tasks\n", (unsigned long)_coprocessOnlyTasks.count);
-          for (PTYTask *coprocessOnlyTask in _coprocessOnlyTasks) {
-            @synchronized (coprocessOnlyTask) {
-                PtyTaskDebugLog(@"Checking coprocess olnly task %@", coprocessOnlyTask);
-                Coprocess *coprocess = [coprocessOnlyTask coprocess];
-                if (coprocess) {
-                    int fd = [coprocess readFileDescriptor];
-                    if ([handledFds containsObject:@(fd)]) {
-                        NSLog(@"Duplicate fd %d", fd);
-                        continue;
-                    }
-                    [handledFds addObject:@(fd)];
-
-                    [self handleReadOnFileDescriptor:fd task:coprocessOnlyTask withCoprocess:coprocess fdSet:&rfds];
-                    [self handleErrorOnFileDescriptor:fd withCoprocess:coprocess fdSet:&efds];
-
-                    // Handle writes
-                    int coprocessWriteFd = [coprocess writeFileDescriptor];
-                    if ([handledFds containsObject:@(coprocessWriteFd)]) {
-                        NSLog(@"Duplicate fd %d", coprocessWriteFd);
-                        continue;
-                    }
-                    [handledFds addObject:@(coprocessWriteFd)];
-                    [self handleWriteOnFileDescriptor:coprocessWriteFd withCoprocess:coprocess fdSet:&wfds];
-
-                    if ([coprocess eof]) {
-                        [deadpool addObject:@([coprocess pid])];
-                        [coprocess terminate];
-                        [coprocessOnlyTask setCoprocess:nil];
-                        notifyOfCoprocessChange = YES;
-                    }
-                }
+            iTermTaskNotifierEntry *entry = [[_entriesByFd[@(fd)] retain] autorelease];
+            if (!entry || entry.deregistered) {
+                PtyTaskDebugLog(@"Ignore event on unowned fd %d", fd);
+                continue;
+            }
+            [_activeEntries addObject:entry];
+            if (fd == entry.taskFd) {
+                [self handleEvents:events[i].events onTaskOfEntry:entry];
+            } else {
+                [self handleEvents:events[i].events onFileDescriptor:fd ofCoprocessOfEntry:entry];
             }
         }
 
+        const BOOL notifyOfCoprocessChange = [self reapCoprocesses];
         PtyTaskDebugLog(@"run3: unlock");
         [tasksLock unlock];
         if (notifyOfCoprocessChange) {
@@ -489,11 +582,10 @@ void UnblockTaskNotifier(void) {
                                 waitUntilDone:YES];
         }
 
-    breakloop:
-        [handledFds release];
         [autoreleasePool drain];
         autoreleasePool = [[NSAutoreleasePool alloc] init];
     }
+    free(events);
     assert(false);  // Must never get here or the autorelease pool would leak.
 }
 
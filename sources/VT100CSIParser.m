@@ -36,62 +36,171 @@ static int32_t SetPrefixByteInPackedCommand(int32_t command, unsigned char c) {
 
 @implementation VT100CSIParser
 
-// Advances past one character and then any following control characters.
-// If a control character is found that cancels a CSI sequence,
-// then NO is returned. If all is well, YES is returned and parsing can
-// continue. Non-canceling control characters are appended to |incidentals|
-static BOOL AdvanceAndEatControlChars(iTermParserContext *context,
-                                      BOOL support8BitControlCharacters,
-                                      CVector *incidentals) {
-    // First, advance if possible.
-    iTermParserTryAdvance(context);
-
-    // Now eat control characters.
-    unsigned char c;
-    while (iTermParserTryPeek(context, &c)) {
-        switch (c) {
-            case VT100CC_ENQ:
-            case VT100CC_BEL:
-            case VT100CC_BS:
-            case VT100CC_HT:
-            case VT100CC_LF:
-            case VT100CC_VT:
-            case VT100CC_FF:
-            case VT100CC_CR:
-            case VT100CC_SO:
-            case VT100CC_SI:
-            case VT100CC_DC1:
-            case VT100CC_DC3:
-            case VT100CC_DEL:
-                CVectorAppend(incidentals, [VT100Token tokenForControlCharacter:c]);
-                break;
-
-            case VT100CC_CAN:
-            case VT100CC_SUB:
-            case VT100CC_ESC:
-                return NO;
-
-            case VT100CC_C1_ST:
-            case VT100CC_C1_CSI:
-            case VT100CC_C1_SOS:
-            case VT100CC_C1_PM:
-            case VT100CC_C1_APC:
-            case VT100CC_C1_DCS:
-                if (support8BitControlCharacters) {
-                    return NO;
-                }
-                // fall through
-
-            default:
-                if (c >= 0x20) {
-                    return YES;
-                }
-                break;
-        }
-        iTermParserAdvance(context);
-    }
-    return YES;
-}
+#pragma mark - Tables
+
+// A CSI sequence is parsed by a single loop over its bytes. Each byte is mapped to a class, and the
+// (state, class) pair selects an action, the next state, and whether to consume the byte. Both
+// tables are constant data built by the compiler.
+
+// Classes of bytes that may follow the CSI introducer.
+typedef NS_ENUM(uint8_t, VT100CSIByteClass) {
+    // C0 control that is silently dropped. This must be zero since it's the default.
+    VT100CSIByteClassIgnore = 0,
+    // Control character that is executed immediately. It is appended to the incidentals.
+    VT100CSIByteClassIncidental,
+    // CAN, SUB, ESC: abort the sequence.
+    VT100CSIByteClassCancel,
+    // C1 control that aborts the sequence only when 8-bit controls are supported. Otherwise it is
+    // treated like VT100CSIByteClassOther.
+    VT100CSIByteClassC1Cancel,
+    VT100CSIByteClassDigit,
+    VT100CSIByteClassSemicolon,
+    VT100CSIByteClassColon,
+    // < = > ?
+    VT100CSIByteClassPrivate,
+    // 0x20-0x2f
+    VT100CSIByteClassIntermediate,
+    // 0x40-0x7e
+    VT100CSIByteClassFinal,
+    // Bytes with the high bit set.
+    VT100CSIByteClassOther,
+
+    VT100CSIByteClassCount
+};
+
+static const VT100CSIByteClass gCSIByteClasses[256] = {
+    [VT100CC_ENQ] = VT100CSIByteClassIncidental,
+    [VT100CC_BEL ... VT100CC_SI] = VT100CSIByteClassIncidental,
+    [VT100CC_DC1] = VT100CSIByteClassIncidental,
+    [VT100CC_DC3] = VT100CSIByteClassIncidental,
+    [VT100CC_CAN] = VT100CSIByteClassCancel,
+    [VT100CC_SUB ... VT100CC_ESC] = VT100CSIByteClassCancel,
+    [0x20 ... 0x2f] = VT100CSIByteClassIntermediate,
+    ['0' ... '9'] = VT100CSIByteClassDigit,
+    [':'] = VT100CSIByteClassColon,
+    [';'] = VT100CSIByteClassSemicolon,
+    ['<' ... '?'] = VT100CSIByteClassPrivate,
+    [0x40 ... 0x7e] = VT100CSIByteClassFinal,
+    [VT100CC_DEL] = VT100CSIByteClassIncidental,
+    [0x80 ... 0x8f] = VT100CSIByteClassOther,
+    [VT100CC_C1_DCS] = VT100CSIByteClassC1Cancel,
+    [0x91 ... 0x97] = VT100CSIByteClassOther,
+    [VT100CC_C1_SOS] = VT100CSIByteClassC1Cancel,
+    [0x99 ... 0x9a] = VT100CSIByteClassOther,
+    [VT100CC_C1_CSI ... VT100CC_C1_ST] = VT100CSIByteClassC1Cancel,
+    [VT100CC_C1_OSC] = VT100CSIByteClassOther,
+    [VT100CC_C1_PM ... VT100CC_C1_APC] = VT100CSIByteClassC1Cancel,
+    [0xa0 ... 0xff] = VT100CSIByteClassOther,
+};
+
+// CSI P...P I...I (G...G) F
+typedef NS_ENUM(uint8_t, VT100CSIState) {
+    // Just after the introducer. A private prefix byte may appear here.
+    VT100CSIStateStart,
+    // Between parameters.
+    VT100CSIStateParameter,
+    // In the digits of a parameter.
+    VT100CSIStateNumber,
+    VT100CSIStateIntermediate,
+    // Before the final byte. See VT100CSIActionUnrecognized.
+    VT100CSIStateGarbage,
+
+    VT100CSIStateCount,
+    VT100CSIStateDone = VT100CSIStateCount
+};
+
+typedef NS_ENUM(uint8_t, VT100CSIAction) {
+    VT100CSIActionNone,
+    VT100CSIActionIncidental,
+    VT100CSIActionCancel,
+    VT100CSIActionPrefix,
+    VT100CSIActionDigit,
+    VT100CSIActionEndNumber,
+    VT100CSIActionSemicolon,
+    VT100CSIActionColon,
+    VT100CSIActionIntermediate,
+    VT100CSIActionUnrecognized,
+    VT100CSIActionFinal
+};
+
+typedef struct {
+    VT100CSIAction action;
+    VT100CSIState next;
+    // If NO, the same byte is looked up again in |next|.
+    BOOL consume;
+} VT100CSITransition;
+
+// Control characters are handled the same in every state.
+#define CSI_CONTROL_TRANSITIONS(state) \
+    [VT100CSIByteClassIgnore] = { VT100CSIActionNone, state, YES }, \
+    [VT100CSIByteClassIncidental] = { VT100CSIActionIncidental, state, YES }, \
+    [VT100CSIByteClassCancel] = { VT100CSIActionCancel, state, NO }
+
+static const VT100CSITransition gCSITransitions[VT100CSIStateCount][VT100CSIByteClassCount] = {
+    [VT100CSIStateStart] = {
+        CSI_CONTROL_TRANSITIONS(VT100CSIStateStart),
+        // ECMA-48 5.4.2(d) reserves 03/12 to 03/15 except as the first byte of the parameter
+        // string. DEC uses them as a private prefix, e.g., '?' for DEC private modes,
+        // "CSI > Ps c" for DA2, and "CSI = Ps c" for DA3. Tera Term and RLogin use '<'.
+        // http://ttssh2.sourceforge.jp/manual/en/about/ctrlseq.html
+        [VT100CSIByteClassPrivate] = { VT100CSIActionPrefix, VT100CSIStateParameter, YES },
+        [VT100CSIByteClassDigit] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassSemicolon] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassColon] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassIntermediate] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassFinal] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassOther] = { VT100CSIActionNone, VT100CSIStateParameter, NO },
+    },
+    [VT100CSIStateParameter] = {
+        CSI_CONTROL_TRANSITIONS(VT100CSIStateParameter),
+        [VT100CSIByteClassDigit] = { VT100CSIActionDigit, VT100CSIStateNumber, YES },
+        [VT100CSIByteClassSemicolon] = { VT100CSIActionSemicolon, VT100CSIStateParameter, YES },
+        [VT100CSIByteClassColon] = { VT100CSIActionColon, VT100CSIStateParameter, YES },
+        // A private byte anywhere but first should be ignored, but the sequence is unrecognized.
+        [VT100CSIByteClassPrivate] = { VT100CSIActionUnrecognized, VT100CSIStateParameter, YES },
+        [VT100CSIByteClassIntermediate] = { VT100CSIActionNone, VT100CSIStateIntermediate, NO },
+        [VT100CSIByteClassFinal] = { VT100CSIActionNone, VT100CSIStateIntermediate, NO },
+        [VT100CSIByteClassOther] = { VT100CSIActionNone, VT100CSIStateIntermediate, NO },
+    },
+    [VT100CSIStateNumber] = {
+        CSI_CONTROL_TRANSITIONS(VT100CSIStateNumber),
+        [VT100CSIByteClassDigit] = { VT100CSIActionDigit, VT100CSIStateNumber, YES },
+        [VT100CSIByteClassSemicolon] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassColon] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassPrivate] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassIntermediate] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassFinal] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+        [VT100CSIByteClassOther] = { VT100CSIActionEndNumber, VT100CSIStateParameter, NO },
+    },
+    [VT100CSIStateIntermediate] = {
+        CSI_CONTROL_TRANSITIONS(VT100CSIStateIntermediate),
+        // Only the last intermediate byte is kept. No known CSI codes use more than one.
+        [VT100CSIByteClassIntermediate] = { VT100CSIActionIntermediate, VT100CSIStateIntermediate, YES },
+        [VT100CSIByteClassDigit] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+        [VT100CSIByteClassSemicolon] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+        [VT100CSIByteClassColon] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+        [VT100CSIByteClassPrivate] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+        [VT100CSIByteClassFinal] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+        [VT100CSIByteClassOther] = { VT100CSIActionNone, VT100CSIStateGarbage, NO },
+    },
+    [VT100CSIStateGarbage] = {
+        CSI_CONTROL_TRANSITIONS(VT100CSIStateGarbage),
+        // compatibility HACK: xterm allows "garbage bytes" before the final byte. rxvt, urxvt,
+        // PuTTY, MinTTY, mlterm, and TeraTerm also do. They are skipped, but the sequence is
+        // unrecognized.
+        [VT100CSIByteClassDigit] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassSemicolon] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassColon] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassPrivate] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassIntermediate] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassOther] = { VT100CSIActionUnrecognized, VT100CSIStateGarbage, YES },
+        [VT100CSIByteClassFinal] = { VT100CSIActionFinal, VT100CSIStateDone, YES },
+    },
+};
+
+#undef CSI_CONTROL_TRANSITIONS
+
+#pragma mark - Parsing
 
 static void CSIParamInitialize(CSIParam *param) {
     param->cmd = INCOMPLETE_CSI_CMD;
@@ -102,111 +211,91 @@ static void CSIParamInitialize(CSIParam *param) {
     }
 }
 
-static BOOL ParseCSIPrologue(iTermParserContext *context, BOOL support8BitControlCharacters, CVector *incidentals) {
-    if (support8BitControlCharacters && iTermParserPeek(context) == VT100CC_C1_CSI) {
-        // Do nothing, will advance on next statement after the if.
-    } else {
-        iTermParserConsumeOrDie(context, VT100CC_ESC);
-        assert(iTermParserCanAdvance(context));
-        assert(iTermParserPeek(context) == '[');
-    }
-    return AdvanceAndEatControlChars(context,
-                                     support8BitControlCharacters,
-                                     incidentals);
-}
-
-static BOOL ParseCSIPrefix(iTermParserContext *context,
-                           BOOL support8BitControlCharacters,
-                           CVector *incidentals,
-                           CSIParam *param) {
-    // Now we parse Parameter Bytes (ECMA-48, 5.4 - (b))
+static void ParseCSISequence(iTermParserContext *context,
+                             BOOL support8BitControlCharacters,
+                             CSIParam *param,
+                             CVector *incidentals) {
+    // A CSI sequence consists of a prefix byte, zero or more parameters (optionally with sub-
+    // parameters), zero or more intermediate bytes, and a final byte.
     //
-    // CSI P...P I...I F
-    //     ^
+    // The prefix, intermediate, and final bytes are packed into an integer and stored in
+    // param->cmd. The parameters and sub-parameters are stored in param->p and param->sub.
     //
-    // Parameter Bytes, which, if present, consist of bit combinations from \x30 to \x3f;
+    // - Parameter Prefix Byte (if present, range: \x3a-\x3f)
+    // - Intermediate Bytes (actually, just the last one) (if present, range: \x20-\x2f)
+    // - Final byte (range: \x40-\x3e)
     //
-    //     1. In DEC VT-series and some derived emulators,
-    //        the first 1 byte of P-bytes is sometimes treated as prefix.
+    // Example: DECRQM sequence
+    // http://www.vt100.net/docs/vt510-rm/DECRQM
     //
-    //        ECMA-48, 5.4.2 - (d) says that;
+    // ESC [ ? 3 6 $ p
     //
-    //          > Bit combinations 03/12 to 03/15 are reserved for future
-    //          > standardization except when used as the first bit combination
-    //          > of the parameter string.
+    // it can be parsed as...
     //
-    //          note: ECMA-48 is to write ascii codes as (decimal top nibble)/(decimal lower nibble),
-    //                and that a value like 03/15 = 0x3f (see ECMA-48, 4.1).
+    // Parameter Prefix Byte --> '?' (\x3c)
+    // Parameters            --> [ 36 ]
+    // Intermediate Bytes    --> '$' (\x24)
+    // Final Byte            --> 'p' (\x70)
     //
-    //        This description suggests that if the first byte of parameter bytes is one of
-    //        '<', '=', '>', '?' (\x3c-\x3f), it's well-formed and could be considered
-    //        as private CSI extension.
+    // The packed cmd value would be:
     //
-    //        Example:
+    // ((prefix << 16) | (intermediate << 8) | final) = 0x3c2470
     //
-    //          In the DEC VT-series, the '?' prefix is used, such as by DEC-specific private modes.
-    //          "CSI > Ps c" is interpreted as a Secondary Device attributes (DA2) request.
-    //          Higher versions of the DEC VT treat "CSI = Ps c" as a Tertiary Device attributes
-    //          (DA3) request. Tera Term and RLogin use '<'-prefixed extensions for IME support.
-    //          For example, "CSI < Ps t" means "change the IME open/close state".
-    //          http://ttssh2.sourceforge.jp/manual/en/about/ctrlseq.html
+    // Each (prefix, intermediate, final) 3-tuple has a unique packed representation.
     //
-    if (iTermParserCanAdvance(context)) {
-        unsigned char c = iTermParserPeek(context);
-        switch (c) {
-            case '<':
-            case '=':
-            case '>':
-            case '?':
-                param->cmd = SetPrefixByteInPackedCommand(param->cmd, c);
-                if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                    return NO;
-                }
-                break;
+    // Control characters may appear anywhere after the introducer. CAN, SUB, and ESC (and C1
+    // introducers when 8-bit controls are supported) cancel the sequence; others are executed as
+    // incidentals.
 
-            default:
-                break;
-        }
+    CSIParamInitialize(param);
+
+    if (support8BitControlCharacters && iTermParserPeek(context) == VT100CC_C1_CSI) {
+        iTermParserAdvance(context);
+    } else {
+        iTermParserConsumeOrDie(context, VT100CC_ESC);
+        assert(iTermParserCanAdvance(context));
+        iTermParserConsumeOrDie(context, '[');
     }
-    return YES;
-}
 
-static BOOL ParseCSIParameters(iTermParserContext *context,
-                               BOOL support8BitControlCharacters,
-                               CVector *incidentals,
-                               CSIParam *param,
-                               BOOL *unrecognized) {
-    //     2. parse parameters
-    //        Typically, it consists of '0'-'9' or ';'. If there are sub parameters, they'll
-    //        be colon-delimited. <parameter>:<sub 1>:<sub 2>:<sub 3>...:<sub N>
-    //        '<', '=', '>', '?' should be ignored, but if current sequence contains them,
-    //        this sequence should be mark as unrecognized.
+    VT100CSIState state = VT100CSIStateStart;
+    BOOL unrecognized = NO;
+    // Once a colon has been seen, all following numbers are sub-parameters of the last parameter.
     BOOL isSub = NO;
     BOOL readNumericParameter = NO;
+    int n = 0;
     unsigned char c;
-    while (iTermParserTryPeek(context, &c) && c >= 0x30 && c <= 0x3f) {
-        switch (c) {
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9': {
-                int n = 0;
-                while (iTermParserTryPeek(context, &c) && isdigit(c)) {
-                    if (n > (INT_MAX - 10) / 10) {
-                        *unrecognized = YES;
-                    }
+    while (iTermParserTryPeek(context, &c)) {
+        VT100CSIByteClass byteClass = gCSIByteClasses[c];
+        if (byteClass == VT100CSIByteClassC1Cancel) {
+            byteClass = support8BitControlCharacters ? VT100CSIByteClassCancel : VT100CSIByteClassOther;
+        }
+        const VT100CSITransition transition = gCSITransitions[state][byteClass];
+        switch (transition.action) {
+            case VT100CSIActionNone:
+                break;
+
+            case VT100CSIActionIncidental:
+                CVectorAppend(incidentals, [VT100Token tokenForControlCharacter:c]);
+                break;
+
+            case VT100CSIActionCancel:
+                param->cmd = INVALID_CSI_CMD;
+                return;
+
+            case VT100CSIActionPrefix:
+                param->cmd = SetPrefixByteInPackedCommand(param->cmd, c);
+                break;
+
+            case VT100CSIActionDigit:
+                if (n > (INT_MAX - 10) / 10) {
+                    // Too big. The sequence will be invalid so the value no longer matters.
+                    unrecognized = YES;
+                } else {
                     n = n * 10 + (c - '0');
-                    if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                        return NO;
-                    }
                 }
+                break;
 
+            case VT100CSIActionEndNumber:
                 if (isSub && param->count > 0) {
                     // This implementation is not really well aligned with the spec. In ECMA-48
                     // section 5.4, the format of a CSI code is described. The parameter string,
@@ -223,30 +312,21 @@ static BOOL ParseCSIParameters(iTermParserContext *context,
                     iTermParserAddCSISubparameter(param, paramNum, n);
                 } else if (param->count < VT100CSIPARAM_MAX) {
                     param->p[param->count] = n;
-                    // increment the parameter count
                     param->count++;
                 }
-
-                // set the numeric parameter flag
+                n = 0;
                 readNumericParameter = YES;
-
                 break;
-            }
 
-            case ';':
+            case VT100CSIActionSemicolon:
                 // If we got an implied (blank) parameter, increment the parameter count again
                 if (param->count < VT100CSIPARAM_MAX && readNumericParameter == NO) {
                     param->count++;
                 }
-                // reset the parameter flag
                 readNumericParameter = NO;
-
-                if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                    return NO;
-                }
                 break;
 
-            case ':':
+            case VT100CSIActionColon:
                 // 2013/1/10 H. Saito
                 // TODO: Now colon separator(":") used in SGR sequence by few terminals
                 // (xterm #282, TeraTerm, RLogin, mlterm, tanasinn).
@@ -272,423 +352,259 @@ static BOOL ParseCSIParameters(iTermParserContext *context,
                 //
                 // In this usage, ":" are certainly treated as sub-parameter separators.
                 isSub = YES;
-                if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                    return NO;
-                }
                 break;
 
-            default:
-                // '<', '=', '>', or '?'
-                *unrecognized = YES;
-                if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                    return NO;
-                }
+            case VT100CSIActionIntermediate:
+                param->cmd = SetIntermediateByteInPackedCommand(param->cmd, c);
                 break;
-        }
-    }
 
-    return YES;
-}
+            case VT100CSIActionUnrecognized:
+                unrecognized = YES;
+                break;
 
-static BOOL ParseCSIIntermediate(iTermParserContext *context,
-                                 BOOL support8BitControlCharacters,
-                                 CVector *incidentals,
-                                 CSIParam *param) {
-    // Now we parse intermediate bytes (ECMA-48, 5.4 - (c))
-    //
-    // CSI P...P I...I F
-    //           ^
-    // Intermediate Bytes, if present, consist of bit combinations from 02/00 to 02/15.
-    //
-    unsigned char c;
-    while (iTermParserTryPeek(context, &c) && c >= 0x20 && c <= 0x2f) {
-        param->cmd = SetIntermediateByteInPackedCommand(param->cmd, c);
-        if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-            return NO;
+            case VT100CSIActionFinal:
+                if (unrecognized) {
+                    param->cmd = INVALID_CSI_CMD;
+                } else {
+                    param->cmd = SetFinalByteInPackedCommand(param->cmd, c);
+                }
+                break;
+        }
+        if (transition.consume) {
+            iTermParserAdvance(context);
+        }
+        state = transition.next;
+        if (state == VT100CSIStateDone) {
+            return;
         }
     }
-    return YES;
+    param->cmd = INCOMPLETE_CSI_CMD;
 }
 
-static BOOL ParseCSIGarbage(iTermParserContext *context,
-                            BOOL support8BitControlCharacters,
-                            CVector *incidentals,
-                            BOOL *unrecognized) {
-    // compatibility HACK:
-    //
-    // CSI P...P I...I (G...G) F
-    //                  ^
-    // xterm allows "garbage bytes" before final byte.
-    // rxvt, urxvt, PuTTY, MinTTY, mlterm, TeraTerm also do.
-    // We skip them, too.
-    unsigned char c;
-    while (iTermParserTryPeek(context, &c)) {
-        if (c >= 0x40 && c <= 0x7e) { // final byte
-            break;
-        } else {
-            if (c > 0x1f && c != 0x7f) {
-                // if "garbage bytes" contains non-control character,
-                // mark current sequence as "unrecognized". The only way to get here is to have
-                // a character in the range [0x20,0x3f] occur after an 0x7f.
-                *unrecognized = YES;
-            }
-            if (!AdvanceAndEatControlChars(context, support8BitControlCharacters, incidentals)) {
-                return NO;
-            }
-        }
-    }
-    return YES;
+#pragma mark - Dispatch
+
+// How to fill in default parameter values once the command is known.
+typedef NS_ENUM(uint8_t, VT100CSIDefaultsRule) {
+    // Apply the |defaults| list of the descriptor.
+    VT100CSIDefaultsRuleList,
+    // Every parameter (at least one) defaults to 0.
+    VT100CSIDefaultsRuleSGR,
+    // The token type depends on the first parameter. See SetWindowOpsType().
+    VT100CSIDefaultsRuleWindowOps,
+    // Scroll down, only with fewer than two parameters.
+    VT100CSIDefaultsRuleSD,
+};
+
+typedef struct {
+    int32_t cmd;
+    VT100TerminalTokenType type;
+    VT100CSIDefaultsRule rule;
+    int numberOfDefaults;
+    struct {
+        int index;
+        int value;
+    } defaults[4];
+} VT100CSICommandDescriptor;
+
+#define CSI_COMMAND(__cmd, __type, __rule, __n, ...) \
+    { .cmd = (__cmd), .type = (__type), .rule = (__rule), .numberOfDefaults = (__n), .defaults = { __VA_ARGS__ } }
+#define CSI_SIMPLE_COMMAND(__cmd, __type) CSI_COMMAND(__cmd, __type, VT100CSIDefaultsRuleList, 0)
+#define CSI_COMMAND_DEFAULT(__cmd, __type, __value) \
+    CSI_COMMAND(__cmd, __type, VT100CSIDefaultsRuleList, 1, { 0, __value })
+
+static const VT100CSICommandDescriptor gCSICommands[] = {
+    CSI_COMMAND(PACKED_CSI_COMMAND(0, '#', '|'), VT100CSI_XTREPORTSGR, VT100CSIDefaultsRuleList, 4,
+                { 0, 1 }, { 1, 1 }, { 2, 1 }, { 3, 1 }),
+    CSI_COMMAND_DEFAULT('D', VT100CSI_CUB, 1),  // Cursor Backward
+    CSI_COMMAND_DEFAULT('b', VT100CSI_REP, 1),  // Repeat
+    CSI_COMMAND_DEFAULT('B', VT100CSI_CUD, 1),  // Cursor Down
+    CSI_COMMAND_DEFAULT('C', VT100CSI_CUF, 1),  // Cursor Forward
+    CSI_COMMAND_DEFAULT('A', VT100CSI_CUU, 1),  // Cursor Up
+    CSI_COMMAND_DEFAULT('E', VT100CSI_CNL, 1),  // Cursor Next Line
+    CSI_COMMAND_DEFAULT('F', VT100CSI_CPL, 1),  // Cursor Preceding Line
+    CSI_COMMAND('H', VT100CSI_CUP, VT100CSIDefaultsRuleList, 2, { 0, 1 }, { 1, 1 }),
+    CSI_COMMAND_DEFAULT('I', VT100CSI_CHT, 1),
+    CSI_COMMAND_DEFAULT('c', VT100CSI_DA, 0),
+    CSI_COMMAND_DEFAULT(PACKED_CSI_COMMAND('>', 0, 'c'), VT100CSI_DA2, 0),
+    CSI_SIMPLE_COMMAND('r', VT100CSI_DECSTBM),
+    CSI_COMMAND_DEFAULT('n', VT100CSI_DSR, 0),
+    CSI_COMMAND_DEFAULT(PACKED_CSI_COMMAND('?', 0, 'n'), VT100CSI_DECDSR, 0),
+    CSI_COMMAND_DEFAULT('J', VT100CSI_ED, 0),
+    CSI_COMMAND_DEFAULT('K', VT100CSI_EL, 0),
+    CSI_COMMAND('f', VT100CSI_HVP, VT100CSIDefaultsRuleList, 2, { 0, 1 }, { 1, 1 }),
+    CSI_SIMPLE_COMMAND('l', VT100CSI_RM),
+    CSI_SIMPLE_COMMAND(PACKED_CSI_COMMAND('>', 0, 'm'), VT100CSI_SET_MODIFIERS),
+    CSI_SIMPLE_COMMAND(PACKED_CSI_COMMAND('>', 0, 'n'), VT100CSI_RESET_MODIFIERS),
+    // TODO: Test codes like CSI 1 ; ; m
+    CSI_COMMAND('m', VT100CSI_SGR, VT100CSIDefaultsRuleSGR, 0),
+    CSI_SIMPLE_COMMAND('h', VT100CSI_SM),
+    CSI_COMMAND_DEFAULT('g', VT100CSI_TBC, 0),
+    CSI_COMMAND_DEFAULT(PACKED_CSI_COMMAND(0, ' ', 'q'), VT100CSI_DECSCUSR, 0),
+    CSI_SIMPLE_COMMAND(PACKED_CSI_COMMAND(0, '!', 'p'), VT100CSI_DECSTR),
+    CSI_COMMAND_DEFAULT(PACKED_CSI_COMMAND('?', '$', 'p'), VT100CSI_DECRQM_DEC, 0),
+    CSI_COMMAND_DEFAULT(PACKED_CSI_COMMAND(0, '$', 'p'), VT100CSI_DECRQM_ANSI, 0),
+    CSI_COMMAND(PACKED_CSI_COMMAND(0, '*', 'y'), VT100CSI_DECRQCRA, VT100CSIDefaultsRuleList, 1, { 2, 1 }),
+    CSI_COMMAND_DEFAULT('@', VT100CSI_ICH, 1),
+    CSI_COMMAND_DEFAULT('L', XTERMCC_INSLN, 1),
+    CSI_COMMAND_DEFAULT('P', XTERMCC_DELCH, 1),
+    CSI_COMMAND_DEFAULT('M', XTERMCC_DELLN, 1),
+    CSI_COMMAND('t', VT100_NOTSUPPORT, VT100CSIDefaultsRuleWindowOps, 0),
+    CSI_COMMAND_DEFAULT('S', XTERMCC_SU, 1),
+    CSI_COMMAND('T', XTERMCC_SD, VT100CSIDefaultsRuleSD, 0),
+
+    // ANSI:
+    CSI_COMMAND_DEFAULT('Z', ANSICSI_CBT, 1),
+    CSI_COMMAND_DEFAULT('G', ANSICSI_CHA, 1),
+    CSI_COMMAND_DEFAULT('d', ANSICSI_VPA, 1),
+    CSI_COMMAND_DEFAULT('e', ANSICSI_VPR, 1),
+    CSI_COMMAND_DEFAULT('X', ANSICSI_ECH, 1),
+    CSI_COMMAND_DEFAULT('i', ANSICSI_PRINT, 0),
+    CSI_SIMPLE_COMMAND('s', VT100CSI_DECSLRM_OR_ANSICSI_SCP),
+    CSI_SIMPLE_COMMAND('u', ANSICSI_RCP),
+    CSI_SIMPLE_COMMAND(PACKED_CSI_COMMAND('?', 0, 'h'), VT100CSI_DECSET),  // DEC private mode set
+    CSI_SIMPLE_COMMAND(PACKED_CSI_COMMAND('?', 0, 'l'), VT100CSI_DECRST),  // DEC private mode reset
+};
+
+#undef CSI_COMMAND_DEFAULT
+#undef CSI_SIMPLE_COMMAND
+#undef CSI_COMMAND
+
+// Commands are found with a multiplicative hash that has no collisions among the entries of
+// gCSICommands. If you add a command and the assertion in CSICommandIndex() fires, search for a
+// new odd multiplier that makes every slot unique.
+#define CSI_HASH_BITS 7
+static const uint32_t kCSIHashMultiplier = 0x8698a9bb;
+
+NS_INLINE uint32_t CSICommandHash(int32_t cmd) {
+    return ((uint32_t)cmd * kCSIHashMultiplier) >> (32 - CSI_HASH_BITS);
 }
 
-static void ParseCSIFinal(iTermParserContext *context, CSIParam *param, BOOL *unrecognized) {
-    // Now we parse final byte (ECMA-48, 5.4 - (d))
-    //
-    // CSI P...P I...I F
-    //                 ^
-    // Final Byte consists of a bit combination from 04/00 to 07/14.
-    unsigned char c;
-    if (iTermParserTryConsume(context, &c)) {
-        if (c >= 0x40 && c < 0x7f && !*unrecognized) {
-            param->cmd = SetFinalByteInPackedCommand(param->cmd, c);
-        } else {
-            param->cmd = INVALID_CSI_CMD;
+// Maps hash slot to 1 + index into gCSICommands, or 0 for an empty slot.
+static const uint8_t *CSICommandIndex(void) {
+    static uint8_t slots[1 << CSI_HASH_BITS];
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        const size_t count = sizeof(gCSICommands) / sizeof(*gCSICommands);
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t hash = CSICommandHash(gCSICommands[i].cmd);
+            assert(slots[hash] == 0);
+            slots[hash] = i + 1;
         }
-    } else {
-        param->cmd = INCOMPLETE_CSI_CMD;
-    }
+    });
+    return slots;
 }
 
-static void ParseCSISequence(iTermParserContext *context,
-                             BOOL support8BitControlCharacters,
-                             CSIParam *param,
-                             CVector *incidentals) {
-    // A CSI sequence consists of a prefix byte, zero or more parameters (optionally with sub-
-    // parameters), zero or more intermediate bytes, and a final byte.
-    //
-    // The prefix, intermediate, and final bytes are packed into an integer and stored in
-    // param->cmd. The parameters and sub-parameters are stored in param->p and param->sub.
-    //
-    // - Parameter Prefix Byte (if present, range: \x3a-\x3f)
-    // - Intermediate Bytes (actually, just the last one) (if present, range: \x20-\x2f)
-    // - Final byte (range: \x40-\x3e)
-    //
-    // Example: DECRQM sequence
-    // http://www.vt100.net/docs/vt510-rm/DECRQM
-    //
-    // ESC [ ? 3 6 $ p
-    //
-    // it can be parsed as...
-    //
-    // Parameter Prefix Byte --> '?' (\x3c)
-    // Parameters            --> [ 36 ]
-    // Intermediate Bytes    --> '$' (\x24)
-    // Final Byte            --> 'p' (\x70)
-    //
-    // The packed cmd value would be:
-    //
-    // ((prefix << 16) | (intermediate << 8) | final) = 0x3c2470
-    //
-    // Each (prefix, intermediate, final) 3-tuple has a unique packed representation.
-
-    BOOL unrecognized = NO;
-
-    CSIParamInitialize(param);
-
-    if (ParseCSIPrologue(context, support8BitControlCharacters, incidentals) &&
-        ParseCSIPrefix(context, support8BitControlCharacters, incidentals, param) &&
-        ParseCSIParameters(context, support8BitControlCharacters, incidentals, param, &unrecognized) &&
-        ParseCSIIntermediate(context, support8BitControlCharacters, incidentals, param) &&
-        ParseCSIGarbage(context, support8BitControlCharacters, incidentals, &unrecognized)) {
-        ParseCSIFinal(context, param, &unrecognized);
-    } else {
-        param->cmd = INVALID_CSI_CMD;
+static const VT100CSICommandDescriptor *CSICommandDescriptor(int32_t cmd) {
+    const uint8_t slot = CSICommandIndex()[CSICommandHash(cmd)];
+    if (slot == 0) {
+        return NULL;
+    }
+    const VT100CSICommandDescriptor *descriptor = &gCSICommands[slot - 1];
+    if (descriptor->cmd != cmd) {
+        return NULL;
     }
+    return descriptor;
 }
 
-static void SetCSITypeAndDefaultParameters(CSIParam *param, VT100Token *result) {
-    switch (param->cmd) {
-        case INVALID_CSI_CMD:
-            result->type = VT100_UNKNOWNCHAR;
-            break;
-
-        case INCOMPLETE_CSI_CMD:
-            result->type = VT100_WAIT;
+static void SetWindowOpsType(CSIParam *param, VT100Token *result) {
+    switch (param->p[0]) {
+        case 1:
+            result->type = XTERMCC_DEICONIFY;
             break;
-
-        case PACKED_CSI_COMMAND(0, '#', '|'):  // XTREPORTSGR
-            result->type = VT100CSI_XTREPORTSGR;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            iTermParserSetCSIParameterIfDefault(param, 1, 1);
-            iTermParserSetCSIParameterIfDefault(param, 2, 1);
-            iTermParserSetCSIParameterIfDefault(param, 3, 1);
+        case 2:
+            result->type = XTERMCC_ICONIFY;
             break;
-
-        case 'D':       // Cursor Backward
-            result->type = VT100CSI_CUB;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 3:
+            result->type = XTERMCC_WINDOWPOS;
+            iTermParserSetCSIParameterIfDefault(param, 1, 0);  // columns or Y
+            iTermParserSetCSIParameterIfDefault(param, 2, 0);  // rows or X
             break;
-
-        case 'b':       // Repeat
-            result->type = VT100CSI_REP;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 4:
+            result->type = XTERMCC_WINDOWSIZE_PIXEL;
             break;
-
-        case 'B':       // Cursor Down
-            result->type = VT100CSI_CUD;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 5:
+            result->type = XTERMCC_RAISE;
             break;
-
-        case 'C':       // Cursor Forward
-            result->type = VT100CSI_CUF;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 6:
+            result->type = XTERMCC_LOWER;
             break;
-
-        case 'A':       // Cursor Up
-            result->type = VT100CSI_CUU;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 8:
+            result->type = XTERMCC_WINDOWSIZE;
             break;
-
-        case 'E':       // Cursor Next Line
-            result->type = VT100CSI_CNL;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 11:
+            result->type = XTERMCC_REPORT_WIN_STATE;
             break;
-
-        case 'F':       // Cursor Preceding Line
-            result->type = VT100CSI_CPL;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 13:
+            result->type = XTERMCC_REPORT_WIN_POS;
             break;
-
-        case 'H':
-            result->type = VT100CSI_CUP;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            iTermParserSetCSIParameterIfDefault(param, 1, 1);
+        case 14:
+            result->type = XTERMCC_REPORT_WIN_PIX_SIZE;
             break;
-
-        case 'I':
-            result->type = VT100CSI_CHT;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
+        case 18:
+            result->type = XTERMCC_REPORT_WIN_SIZE;
             break;
-
-        case 'c':
-            result->type = VT100CSI_DA;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
+        case 19:
+            result->type = XTERMCC_REPORT_SCREEN_SIZE;
             break;
-
-        case PACKED_CSI_COMMAND('>', 0, 'c'):
-            result->type = VT100CSI_DA2;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
+        case 20:
+            result->type = XTERMCC_REPORT_ICON_TITLE;
             break;
-
-        case 'r':
-            result->type = VT100CSI_DECSTBM;
+        case 21:
+            result->type = XTERMCC_REPORT_WIN_TITLE;
             break;
-
-        case 'n':
-            result->type = VT100CSI_DSR;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
+        case 22:
+            result->type = XTERMCC_PUSH_TITLE;
             break;
-
-        case PACKED_CSI_COMMAND('?', 0, 'n'):
-            result->type = VT100CSI_DECDSR;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
+        case 23:
+            result->type = XTERMCC_POP_TITLE;
             break;
-
-        case 'J':
-            result->type = VT100CSI_ED;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case 'K':
-            result->type = VT100CSI_EL;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case 'f':
-            result->type = VT100CSI_HVP;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            iTermParserSetCSIParameterIfDefault(param, 1, 1);
-            break;
-
-        case 'l':
-            result->type = VT100CSI_RM;
-            break;
-
-        case PACKED_CSI_COMMAND('>', 0, 'm'):
-            result->type = VT100CSI_SET_MODIFIERS;
+        default:
+            result->type = VT100_NOTSUPPORT;
             break;
+    }
+}
 
-        case PACKED_CSI_COMMAND('>', 0, 'n'):
-            result->type = VT100CSI_RESET_MODIFIERS;
+static void SetCSITypeAndDefaultParameters(CSIParam *param, VT100Token *result) {
+    if (param->cmd == INVALID_CSI_CMD) {
+        result->type = VT100_UNKNOWNCHAR;
+        return;
+    }
+    if (param->cmd == INCOMPLETE_CSI_CMD) {
+        result->type = VT100_WAIT;
+        return;
+    }
+    const VT100CSICommandDescriptor *descriptor = CSICommandDescriptor(param->cmd);
+    if (!descriptor) {
+        result->type = VT100_NOTSUPPORT;
+        return;
+    }
+    result->type = descriptor->type;
+    switch (descriptor->rule) {
+        case VT100CSIDefaultsRuleList:
+            for (int i = 0; i < descriptor->numberOfDefaults; i++) {
+                iTermParserSetCSIParameterIfDefault(param,
+                                                    descriptor->defaults[i].index,
+                                                    descriptor->defaults[i].value);
+            }
             break;
 
-        case 'm':
-            result->type = VT100CSI_SGR;
-            // TODO: Test codes like CSI 1 ; ; m
+        case VT100CSIDefaultsRuleSGR:
             for (int i = 0; i < MAX(1, param->count); ++i) {
                 iTermParserSetCSIParameterIfDefault(param, i, 0);
             }
             break;
 
-        case 'h':
-            result->type = VT100CSI_SM;
+        case VT100CSIDefaultsRuleWindowOps:
+            SetWindowOpsType(param, result);
             break;
 
-        case 'g':
-            result->type = VT100CSI_TBC;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case PACKED_CSI_COMMAND(0, ' ', 'q'):
-            result->type = VT100CSI_DECSCUSR;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case PACKED_CSI_COMMAND(0, '!', 'p'):
-            result->type = VT100CSI_DECSTR;
-            break;
-
-        case PACKED_CSI_COMMAND('?', '$', 'p'):
-            result->type = VT100CSI_DECRQM_DEC;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case PACKED_CSI_COMMAND(0, '$', 'p'):
-            result->type = VT100CSI_DECRQM_ANSI;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-
-        case PACKED_CSI_COMMAND(0, '*', 'y'):
-            result->type = VT100CSI_DECRQCRA;
-            iTermParserSetCSIParameterIfDefault(param, 2, 1);
-            break;
-
-        case '@':
-            result->type = VT100CSI_ICH;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'L':
-            result->type = XTERMCC_INSLN;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'P':
-            result->type = XTERMCC_DELCH;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'M':
-            result->type = XTERMCC_DELLN;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 't':
-            switch (param->p[0]) {
-                case 1:
-                    result->type = XTERMCC_DEICONIFY;
-                    break;
-                case 2:
-                    result->type = XTERMCC_ICONIFY;
-                    break;
-                case 3:
-                    result->type = XTERMCC_WINDOWPOS;
-                    iTermParserSetCSIParameterIfDefault(param, 1, 0);  // columns or Y
-                    iTermParserSetCSIParameterIfDefault(param, 2, 0);  // rows or X
-                    break;
-                case 4:
-                    result->type = XTERMCC_WINDOWSIZE_PIXEL;
-                    break;
-                case 5:
-                    result->type = XTERMCC_RAISE;
-                    break;
-                case 6:
-                    result->type = XTERMCC_LOWER;
-                    break;
-                case 8:
-                    result->type = XTERMCC_WINDOWSIZE;
-                    break;
-                case 11:
-                    result->type = XTERMCC_REPORT_WIN_STATE;
-                    break;
-                case 13:
-                    result->type = XTERMCC_REPORT_WIN_POS;
-                    break;
-                case 14:
-                    result->type = XTERMCC_REPORT_WIN_PIX_SIZE;
-                    break;
-                case 18:
-                    result->type = XTERMCC_REPORT_WIN_SIZE;
-                    break;
-                case 19:
-                    result->type = XTERMCC_REPORT_SCREEN_SIZE;
-                    break;
-                case 20:
-                    result->type = XTERMCC_REPORT_ICON_TITLE;
-                    break;
-                case 21:
-                    result->type = XTERMCC_REPORT_WIN_TITLE;
-                    break;
-                case 22:
-                    result->type = XTERMCC_PUSH_TITLE;
-                    break;
-                case 23:
-                    result->type = XTERMCC_POP_TITLE;
-                    break;
-                default:
-                    result->type = VT100_NOTSUPPORT;
-                    break;
-            }
-            break;
-        case 'S':
-            result->type = XTERMCC_SU;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'T':
+        case VT100CSIDefaultsRuleSD:
             if (param->count < 2) {
-                result->type = XTERMCC_SD;
                 iTermParserSetCSIParameterIfDefault(param, 0, 1);
             } else {
                 result->type = VT100_NOTSUPPORT;
             }
             break;
-
-            // ANSI:
-        case 'Z':
-            result->type = ANSICSI_CBT;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'G':
-            result->type = ANSICSI_CHA;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'd':
-            result->type = ANSICSI_VPA;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'e':
-            result->type = ANSICSI_VPR;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'X':
-            result->type = ANSICSI_ECH;
-            iTermParserSetCSIParameterIfDefault(param, 0, 1);
-            break;
-        case 'i':
-            result->type = ANSICSI_PRINT;
-            iTermParserSetCSIParameterIfDefault(param, 0, 0);
-            break;
-        case 's':
-            result->type = VT100CSI_DECSLRM_OR_ANSICSI_SCP;
-            break;
-        case 'u':
-            result->type = ANSICSI_RCP;
-            break;
-        case PACKED_CSI_COMMAND('?', 0, 'h'):       // DEC private mode set
-            result->type = VT100CSI_DECSET;
-            break;
-        case PACKED_CSI_COMMAND('?', 0, 'l'):       // DEC private mode reset
-            result->type = VT100CSI_DECRST;
-            break;
-        default:
-            result->type = VT100_NOTSUPPORT;
-            break;
-
     }
 }
 
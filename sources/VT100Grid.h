@@ -63,6 +63,10 @@
 - (BOOL)isCharDirtyAt:(VT100GridCoord)coord;
 - (BOOL)isAnyCharDirty;
 - (VT100GridRange)dirtyRangeForLine:(int)y;
+// Fills the |capacity| words of |mask| with one bit per line, set if the line has any dirty chars.
+// Bit y is mask[y / 64] & (1 << (y % 64)). Lines past the end of the mask are left out. Returns YES
+// if any line in the mask is dirty.
+- (BOOL)getDirtyLineMask:(uint64_t *)mask capacity:(int)capacity;
 // Returns the set of dirty indexes on |line|.
 - (NSIndexSet *)dirtyIndexesOnLine:(int)line;
 
@@ -161,6 +165,17 @@
                       ansi:(BOOL)ansi
                     insert:(BOOL)insert;
 
+// Like appendCharsAtCursor:..., but |buffer| must not contain double-width characters. Faster when
+// there is no insert mode or column scroll region and wraparound is on.
+- (int)appendSingleWidthCharsAtCursor:(screen_char_t *)buffer
+                               length:(int)len
+              scrollingIntoLineBuffer:(LineBuffer *)lineBuffer
+                  unlimitedScrollback:(BOOL)unlimitedScrollback
+              useScrollbackWithRegion:(BOOL)useScrollbackWithRegion
+                           wraparound:(BOOL)wraparound
+                                 ansi:(BOOL)ansi
+                               insert:(BOOL)insert;
+
 // Delete some number of chars starting at a given location, moving chars to the right of them back.
 - (void)deleteChars:(int)num
          startingAt:(VT100GridCoord)startCoord;
@@ -249,7 +264,8 @@
 // TODO: write a test for this
 - (void)insertChar:(screen_char_t)c at:(VT100GridCoord)pos times:(int)num;
 
-// Returns an array of NSData for lines in order (corresponding with lines on screen).
+// Returns an array of NSData for lines in order (corresponding with lines on screen). They point
+// into the grid without copying, so they are only valid until the grid is next modified.
 - (NSArray *)orderedLines;
 
 // Restore saved state excluding screen contents.
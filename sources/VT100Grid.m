@@ -9,8 +9,10 @@
 #import "VT100Grid.h"
 
 #import "DebugLogging.h"
+#import "iTermMalloc.h"
 #import "LineBuffer.h"
 #import "NSDictionary+iTerm.h"
+#import "VT100GridDirtyMap.h"
 #import "VT100GridTypes.h"
 #import "VT100LineInfo.h"
 #import "VT100Terminal.h"
@@ -21,15 +23,44 @@ static NSString *const kGridScrollRegionColumnsKey = @"Scroll Region Columns";
 static NSString *const kGridUseScrollRegionColumnsKey = @"Use Scroll Region Columns";
 static NSString *const kGridSizeKey = @"Size";
 
-@interface VT100Grid ()
-@property(nonatomic, readonly) NSArray *lines;  // Warning: not in order found on screen!
-@end
+// Per-row metadata, kept in parallel arrays indexed like the rows of the grid's character storage.
+// The continuation mark isn't here; it lives in the extra cell at the end of each row. Dirty cells
+// are tracked separately in a VT100GridDirtyMap with the same row numbering.
+typedef struct {
+    NSTimeInterval *timestamps;
+
+    // Changes whenever the row's dirty region grows.
+    NSInteger *generations;
+} VT100GridLineTable;
+
+static NSInteger VT100GridNextGeneration = 1;
+
+static void VT100GridLineTableAllocate(VT100GridLineTable *table, int height) {
+    table->timestamps = calloc(height, sizeof(*table->timestamps));
+    table->generations = calloc(height, sizeof(*table->generations));
+}
+
+static void VT100GridLineTableFree(VT100GridLineTable *table) {
+    free(table->timestamps);
+    free(table->generations);
+    memset(table, 0, sizeof(*table));
+}
+
+static void VT100GridLineTableCopy(VT100GridLineTable *dest, const VT100GridLineTable *source, int height) {
+    memcpy(dest->timestamps, source->timestamps, height * sizeof(*dest->timestamps));
+    memcpy(dest->generations, source->generations, height * sizeof(*dest->generations));
+}
 
 @implementation VT100Grid {
     VT100GridSize size_;
-    int screenTop_;  // Index into lines_ and dirty_ of first line visible in the grid.
-    NSMutableArray *lines_;  // Array of NSMutableData. Each data has size_.width+1 screen_char_t's.
-    NSMutableArray *lineInfos_;  // Array of VT100LineInfo.
+    int screenTop_;  // Row of _screenChars, _lineTable, and _dirtyMap holding the first visible line.
+
+    // size_.height rows of size_.width+1 screen_char_t's each, in one block. The last cell of each
+    // row holds its continuation mark. Scrolling the whole screen just advances screenTop_.
+    screen_char_t *_screenChars;
+    VT100GridLineTable _lineTable;
+    VT100GridDirtyMap _dirtyMap;
+
     id<VT100GridDelegate> delegate_;
     VT100GridCoord cursor_;
     VT100GridRange scrollRegionRows_;
@@ -46,11 +77,19 @@ static NSString *const kGridSizeKey = @"Size";
 @synthesize scrollRegionCols = scrollRegionCols_;
 @synthesize useScrollRegionCols = useScrollRegionCols_;
 @synthesize allDirty = allDirty_;
-@synthesize lines = lines_;
 @synthesize savedDefaultChar = savedDefaultChar_;
 @synthesize cursor = cursor_;
 @synthesize delegate = delegate_;
 
+// Tells the complex char table which codes are on screen. Codes are only added from the main
+// thread, which is also the only thread that changes the grid, so the cells are stable here.
+static void VT100GridMarkComplexChars(void *context, ComplexCharMarks *marks) {
+    VT100Grid *grid = (VT100Grid *)context;
+    ComplexCharMarkCodesInScreenChars(marks,
+                                      grid->_screenChars,
+                                      (grid->size_.width + 1) * grid->size_.height);
+}
+
 - (instancetype)initWithSize:(VT100GridSize)size delegate:(id<VT100GridDelegate>)delegate {
     self = [super init];
     if (self) {
@@ -59,49 +98,86 @@ static NSString *const kGridSizeKey = @"Size";
         scrollRegionRows_ = VT100GridRangeMake(0, size_.height);
         scrollRegionCols_ = VT100GridRangeMake(0, size_.width);
         _preferredCursorPosition = VT100GridCoordMake(-1, -1);
+        ComplexCharAddRoot(self, VT100GridMarkComplexChars);
     }
     return self;
 }
 
 - (void)dealloc {
-    [lines_ release];
-    [lineInfos_ release];
+    ComplexCharRemoveRoot(self);
+    free(_screenChars);
+    VT100GridLineTableFree(&_lineTable);
+    VT100GridDirtyMapFree(&_dirtyMap);
     [cachedDefaultLine_ release];
     [resultLine_ release];
     [super dealloc];
 }
 
-- (NSMutableData *)lineDataAtLineNumber:(int)lineNumber {
-    if (lineNumber >= 0 && lineNumber < size_.height) {
-        return [lines_ objectAtIndex:(screenTop_ + lineNumber) % size_.height];
-    } else {
-        return nil;
-    }
+// Returns the row of storage holding |lineNumber|, which must be in [0, size_.height).
+NS_INLINE int VT100GridRowOfLineNumber(int screenTop, int height, int lineNumber) {
+    const int row = screenTop + lineNumber;
+    return row >= height ? row - height : row;
 }
 
 - (screen_char_t *)screenCharsAtLineNumber:(int)lineNumber {
     assert(lineNumber >= 0);
-    return [[lines_ objectAtIndex:(screenTop_ + lineNumber) % size_.height] mutableBytes];
+    const int row = (screenTop_ + lineNumber) % size_.height;
+    return _screenChars + (size_t)row * (size_.width + 1);
 }
 
 - (VT100LineInfo *)lineInfoAtLineNumber:(int)lineNumber {
     if (lineNumber >= 0 && lineNumber < size_.height) {
-        return [lineInfos_ objectAtIndex:(screenTop_ + lineNumber) % size_.height];
+        const int row = VT100GridRowOfLineNumber(screenTop_, size_.height, lineNumber);
+        return [[[VT100LineInfo alloc] initWithOwner:self
+                                           timestamp:&_lineTable.timestamps[row]
+                                          generation:&_lineTable.generations[row]] autorelease];
     } else {
         return nil;
     }
 }
 
+// |row| is a row of storage, not a line number. A |timestamp| of 0 leaves the timestamp alone.
+// The dirty cells of a row always form one range: marking cells dirty extends it to cover them, and
+// marking cells clean only trims it from either end.
+- (void)setDirty:(BOOL)dirty row:(int)row range:(VT100GridRange)range timestamp:(NSTimeInterval)timestamp {
+    const VT100GridRange existing = VT100GridDirtyMapRangeOnRow(&_dirtyMap, row);
+    const int existingBound = existing.location + existing.length;
+    const int rangeBound = range.location + range.length;
+    if (!dirty) {
+        if (existing.location < 0) {
+            return;
+        }
+        if (range.location <= existing.location) {
+            VT100GridDirtyMapClearRange(&_dirtyMap, row, existing.location, rangeBound - existing.location);
+        } else if (range.location < existingBound && rangeBound >= existingBound) {
+            VT100GridDirtyMapClearRange(&_dirtyMap, row, range.location, existingBound - range.location);
+        }
+        return;
+    }
+    if (timestamp > 0) {
+        _lineTable.timestamps[row] = timestamp;
+    }
+    const int start = existing.location < 0 ? range.location : MIN(existing.location, range.location);
+    const int bound = existing.location < 0 ? rangeBound : MAX(existingBound, rangeBound);
+    if (VT100GridDirtyMapSetRange(&_dirtyMap, row, start, bound - start)) {
+        // The generation only changes when the dirty region does.
+        _lineTable.generations[row] = VT100GridNextGeneration++;
+    }
+}
+
 - (void)markCharDirty:(BOOL)dirty at:(VT100GridCoord)coord updateTimestamp:(BOOL)updateTimestamp {
     DLog(@"Mark %@ dirty=%@ delegate=%@", VT100GridCoordDescription(coord), @(dirty), delegate_);
 
     if (!dirty) {
         allDirty_ = NO;
     }
-    VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:coord.y];
-    [lineInfo setDirty:dirty
-               inRange:VT100GridRangeMake(coord.x, 1)
-       updateTimestamp:updateTimestamp];
+    if (coord.y < 0 || coord.y >= size_.height) {
+        return;
+    }
+    [self setDirty:dirty
+               row:VT100GridRowOfLineNumber(screenTop_, size_.height, coord.y)
+             range:VT100GridRangeMake(coord.x, 1)
+         timestamp:updateTimestamp ? [NSDate timeIntervalSinceReferenceDate] : 0];
 }
 
 - (void)markCharsDirty:(BOOL)dirty inRectFrom:(VT100GridCoord)from to:(VT100GridCoord)to {
@@ -109,11 +185,13 @@ static NSString *const kGridSizeKey = @"Size";
     if (!dirty) {
         allDirty_ = NO;
     }
-    for (int y = from.y; y <= to.y; y++) {
-        VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:y];
-        [lineInfo setDirty:dirty
-                   inRange:VT100GridRangeMake(from.x, to.x - from.x + 1)
-           updateTimestamp:YES];
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    const VT100GridRange range = VT100GridRangeMake(from.x, to.x - from.x + 1);
+    for (int y = MAX(0, from.y); y <= to.y && y < size_.height; y++) {
+        [self setDirty:dirty
+                   row:VT100GridRowOfLineNumber(screenTop_, size_.height, y)
+                 range:range
+             timestamp:now];
     }
 }
 
@@ -121,6 +199,11 @@ static NSString *const kGridSizeKey = @"Size";
     DLog(@"Mark all chars dirty=%@ delegate=%@", @(dirty), delegate_);
 
     allDirty_ = dirty;
+    if (!dirty) {
+        // This happens after every redraw, so skip the per-row work.
+        VT100GridDirtyMapClearAll(&_dirtyMap);
+        return;
+    }
     [self markCharsDirty:dirty
               inRectFrom:VT100GridCoordMake(0, 0)
                       to:VT100GridCoordMake(size_.width - 1, size_.height - 1)];
@@ -138,38 +221,65 @@ static NSString *const kGridSizeKey = @"Size";
     }
 }
 
+// Returns the dirty range of a line, or a range with location -1 if it's clean.
+- (VT100GridRange)storedDirtyRangeForLine:(int)y {
+    if (y < 0 || y >= size_.height) {
+        return VT100GridRangeMake(-1, 0);
+    }
+    return VT100GridDirtyMapRangeOnRow(&_dirtyMap, VT100GridRowOfLineNumber(screenTop_, size_.height, y));
+}
+
 - (BOOL)isCharDirtyAt:(VT100GridCoord)coord {
     if (allDirty_) {
         return YES;
     }
-    VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:coord.y];
-    return [lineInfo isDirtyAtOffset:coord.x];
+    if (coord.y < 0 || coord.y >= size_.height) {
+        return NO;
+    }
+#if ITERM_DEBUG
+    assert(coord.x >= 0 && coord.x < size_.width);
+#endif
+    const int x = MIN(size_.width - 1, MAX(0, coord.x));
+    return VT100GridDirtyMapIsDirty(&_dirtyMap,
+                                    VT100GridRowOfLineNumber(screenTop_, size_.height, coord.y),
+                                    x);
 }
 
 - (NSIndexSet *)dirtyIndexesOnLine:(int)line {
     if (allDirty_) {
         return [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, self.size.width)];
     }
-    VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:line];
-    return [lineInfo dirtyIndexes];
+    if (line < 0 || line >= size_.height) {
+        return nil;
+    }
+    const VT100GridRange range = [self storedDirtyRangeForLine:line];
+    if (range.location < 0) {
+        return [NSIndexSet indexSet];
+    }
+    return [NSIndexSet indexSetWithIndexesInRange:NSMakeRange(range.location, range.length)];
 }
 
 - (BOOL)isAnyCharDirty {
+    return allDirty_ || VT100GridDirtyMapAnyDirty(&_dirtyMap);
+}
+
+- (BOOL)getDirtyLineMask:(uint64_t *)mask capacity:(int)capacity {
     if (allDirty_) {
-        return YES;
-    }
-    for (int y = 0; y < size_.height; y++) {
-        VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:y];
-        if ([lineInfo anyCharIsDirty]) {
-            return YES;
+        memset(mask, 0, capacity * sizeof(uint64_t));
+        const int height = MIN(size_.height, capacity * 64);
+        for (int y = 0; y < height; y++) {
+            mask[y / 64] |= 1ULL << (y % 64);
         }
+        return height > 0;
     }
-    return NO;
+    return VT100GridDirtyMapGetRowMask(&_dirtyMap, screenTop_, mask, capacity);
 }
 
 - (VT100GridRange)dirtyRangeForLine:(int)y {
-    VT100LineInfo *lineInfo = [self lineInfoAtLineNumber:y];
-    return [lineInfo dirtyRange];
+    if (y < 0 || y >= size_.height) {
+        return VT100GridRangeMake(0, 0);
+    }
+    return [self storedDirtyRangeForLine:y];
 }
 
 - (int)cursorX {
@@ -277,7 +387,7 @@ static NSString *const kGridSizeKey = @"Size";
                         length:currentLineLength
                        partial:isPartial
                          width:size_.width
-                     timestamp:[[self lineInfoAtLineNumber:i] timestamp]
+                     timestamp:[self timestampForLine:i]
                   continuation:line[size_.width]];
 #ifdef DEBUG_RESIZEDWIDTH
         NSLog(@"Appended a line. now have %d lines for width %d\n",
@@ -289,11 +399,17 @@ static NSString *const kGridSizeKey = @"Size";
 }
 
 - (NSTimeInterval)timestampForLine:(int)y {
-    return [[self lineInfoAtLineNumber:y] timestamp];
+    if (y < 0 || y >= size_.height) {
+        return 0;
+    }
+    return _lineTable.timestamps[VT100GridRowOfLineNumber(screenTop_, size_.height, y)];
 }
 
 - (NSInteger)generationForLine:(int)y {
-    return [[self lineInfoAtLineNumber:y] generation];
+    if (y < 0 || y >= size_.height) {
+        return 0;
+    }
+    return _lineTable.generations[VT100GridRowOfLineNumber(screenTop_, size_.height, y)];
 }
 
 - (int)lengthOfLineNumber:(int)lineNumber {
@@ -348,10 +464,7 @@ static NSString *const kGridSizeKey = @"Size";
     screenTop_ = (screenTop_ + 1) % size_.height;
 
     // Empty contents of last line on screen.
-    NSMutableData *lastLineData = [self lineDataAtLineNumber:(size_.height - 1)];
-    if (lastLineData) {  // This if statement is just to quiet the analyzer.
-        [self clearLineData:lastLineData];
-    }
+    [self clearLine:[self screenCharsAtLineNumber:size_.height - 1]];
 
     if (lineBuffer) {
         // Mark new line at bottom of screen dirty.
@@ -1000,6 +1113,91 @@ static NSString *const kGridSizeKey = @"Size";
     return numDropped;
 }
 
+- (int)appendSingleWidthCharsAtCursor:(screen_char_t *)buffer
+                               length:(int)len
+              scrollingIntoLineBuffer:(LineBuffer *)lineBuffer
+                  unlimitedScrollback:(BOOL)unlimitedScrollback
+              useScrollbackWithRegion:(BOOL)useScrollbackWithRegion
+                           wraparound:(BOOL)wraparound
+                                 ansi:(BOOL)ansi
+                               insert:(BOOL)insert {
+    if (insert ||
+        !wraparound ||
+        useScrollRegionCols_ ||
+        self.scrollRight != size_.width - 1 ||
+        cursor_.x >= size_.width) {
+        return [self appendCharsAtCursor:buffer
+                                  length:len
+                 scrollingIntoLineBuffer:lineBuffer
+                     unlimitedScrollback:unlimitedScrollback
+                 useScrollbackWithRegion:useScrollbackWithRegion
+                              wraparound:wraparound
+                                    ansi:ansi
+                                  insert:insert];
+    }
+
+    // This does the same thing as appendCharsAtCursor: but, since there are no double-width
+    // characters to keep together and no margins, it copies whole rows at a time and wraps
+    // whenever a row fills up.
+    int numDropped = 0;
+    const int width = size_.width;
+    for (int idx = 0; idx < len; ) {
+        if (cursor_.x >= width) {
+            screen_char_t *prevLine = [self screenCharsAtLineNumber:cursor_.y];
+            prevLine[width] = [self defaultChar];
+            prevLine[width].code = EOL_SOFT;
+            self.cursorX = 0;
+            numDropped += [self moveCursorDownOneLineScrollingIntoLineBuffer:lineBuffer
+                                                         unlimitedScrollback:unlimitedScrollback
+                                                     useScrollbackWithRegion:useScrollbackWithRegion
+                                                                  willScroll:nil];
+        }
+        const int x = cursor_.x;
+        const int lineNumber = cursor_.y;
+        const int n = MIN(width - x, len - idx);
+        screen_char_t *aLine = [self screenCharsAtLineNumber:lineNumber];
+        const BOOL mayStompSplitDwc = (x + n == width &&
+                                       aLine[width].code == EOL_DWC &&
+                                       aLine[width - 1].code == DWC_SKIP);
+
+        if (aLine[x].code == DWC_RIGHT && x > 0) {
+            // Overwriting the second half of a double-width character so turn the DWC into a space.
+            aLine[x - 1].code = 0;
+            aLine[x - 1].complexChar = NO;
+            [self markCharDirty:YES at:VT100GridCoordMake(x - 1, lineNumber) updateTimestamp:YES];
+        }
+        if (n > 1 || memcmp(aLine + x, buffer + idx, n * sizeof(screen_char_t))) {
+            memcpy(aLine + x, buffer + idx, n * sizeof(screen_char_t));
+            [self markCharsDirty:YES
+                      inRectFrom:VT100GridCoordMake(x, lineNumber)
+                              to:VT100GridCoordMake(x + n - 1, lineNumber)];
+        }
+        self.cursorX = x + n;
+        idx += n;
+
+        if (cursor_.x < width - 1 && aLine[cursor_.x].code == DWC_RIGHT) {
+            // Left behind the second half of a DWC.
+            aLine[cursor_.x].code = 0;
+            aLine[cursor_.x].complexChar = NO;
+        }
+        if (mayStompSplitDwc && aLine[width - 1].code != DWC_SKIP && aLine[width].code == EOL_DWC) {
+            aLine[width].code = EOL_SOFT;
+        }
+
+        // ANSI terminals wrap right after drawing in the last column.
+        if (cursor_.x >= width && ansi) {
+            aLine[width] = [self defaultChar];
+            aLine[width].code = EOL_SOFT;
+            self.cursorX = 0;
+            numDropped += [self moveCursorDownOneLineScrollingIntoLineBuffer:lineBuffer
+                                                         unlimitedScrollback:unlimitedScrollback
+                                                     useScrollbackWithRegion:useScrollbackWithRegion
+                                                                  willScroll:nil];
+        }
+    }
+    return numDropped;
+}
+
 - (void)deleteChars:(int)n
          startingAt:(VT100GridCoord)startCoord {
     DLog(@"deleteChars:%d startingAt:%d,%d", n, startCoord.x, startCoord.y);
@@ -1362,7 +1560,7 @@ static NSString *const kGridSizeKey = @"Size";
                                 includesEndOfLine:&cont
                                         timestamp:&timestamp
                                      continuation:&continuation]);
-        [[self lineInfoAtLineNumber:destLineNumber] setTimestamp:timestamp];
+        _lineTable.timestamps[VT100GridRowOfLineNumber(screenTop_, size_.height, destLineNumber)] = timestamp;
         if (cont && dest[size_.width - 1].code == 0 && prevLineStartsWithDoubleWidth) {
             // If you pop a soft-wrapped line that's a character short and the
             // line below it starts with a DWC, it's safe to conclude that a DWC
@@ -1496,7 +1694,7 @@ static NSString *const kGridSizeKey = @"Size";
             if (line[x].complexChar) c = 'U';
             [dump appendFormat:@"%c", c];
         }
-        NSDate* date = [NSDate dateWithTimeIntervalSinceReferenceDate:[[self lineInfoAtLineNumber:y] timestamp]];
+        NSDate* date = [NSDate dateWithTimeIntervalSinceReferenceDate:[self timestampForLine:y]];
         [dump appendFormat:@"  | %@", [fmt stringFromDate:date]];
         if (y != size_.height - 1) {
             [dump appendString:@"\n"];
@@ -1618,7 +1816,9 @@ static NSString *const kGridSizeKey = @"Size";
 - (NSArray *)orderedLines {
     NSMutableArray *array = [NSMutableArray array];
     for (int i = 0; i < size_.height; i++) {
-        [array addObject:[self lineDataAtLineNumber:i]];
+        [array addObject:[NSData dataWithBytesNoCopy:[self screenCharsAtLineNumber:i]
+                                              length:sizeof(screen_char_t) * (size_.width + 1)
+                                        freeWhenDone:NO]];
     }
     return array;
 }
@@ -1649,9 +1849,7 @@ static NSString *const kGridSizeKey = @"Size";
 }
 
 - (void)resetTimestamps {
-    for (VT100LineInfo *info in lineInfos_) {
-        info.timestamp = 0;
-    }
+    memset(_lineTable.timestamps, 0, size_.height * sizeof(*_lineTable.timestamps));
 }
 
 - (void)restorePreferredCursorPositionIfPossible {
@@ -1667,20 +1865,24 @@ static NSString *const kGridSizeKey = @"Size";
 
 #pragma mark - Private
 
-- (NSMutableArray *)linesWithSize:(VT100GridSize)size {
-    NSMutableArray *lines = [[[NSMutableArray alloc] init] autorelease];
-    for (int i = 0; i < size.height; i++) {
-        [lines addObject:[[[self defaultLineOfWidth:size.width] mutableCopy] autorelease]];
-    }
-    return lines;
-}
+// Replaces the contents with empty lines of size_.
+- (void)allocateStorage {
+    free(_screenChars);
+    VT100GridLineTableFree(&_lineTable);
+    VT100GridDirtyMapFree(&_dirtyMap);
 
-- (NSMutableArray *)lineInfosWithSize:(VT100GridSize)size {
-    NSMutableArray *dirty = [NSMutableArray array];
-    for (int i = 0; i < size.height; i++) {
-        [dirty addObject:[[[VT100LineInfo alloc] initWithWidth:size_.width] autorelease]];
+    const int stride = size_.width + 1;
+    _screenChars = iTermMalloc(sizeof(screen_char_t) * stride * MAX(1, size_.height));
+    if (size_.height > 0) {
+        // Fill the first line and copy it into the rest.
+        [self clearLine:_screenChars];
+        for (int y = 1; y < size_.height; y++) {
+            memcpy(_screenChars + (size_t)y * stride, _screenChars, sizeof(screen_char_t) * stride);
+        }
     }
-    return dirty;
+    VT100GridLineTableAllocate(&_lineTable, MAX(1, size_.height));
+    VT100GridDirtyMapInit(&_dirtyMap, size_.width, size_.height);
+    screenTop_ = 0;
 }
 
 - (screen_char_t)defaultChar {
@@ -1769,6 +1971,12 @@ static NSString *const kGridSizeKey = @"Size";
     chars[width].code = EOL_HARD;
 }
 
+// Clears a line of size_.width+1 chars, including its continuation mark.
+- (void)clearLine:(screen_char_t *)line {
+    [self clearScreenChars:line inRange:VT100GridRangeMake(0, size_.width + 1)];
+    line[size_.width].code = EOL_HARD;
+}
+
 // Returns number of lines dropped from line buffer because it exceeded its size (always 0 or 1).
 - (int)appendLineToLineBuffer:(LineBuffer *)lineBuffer
           unlimitedScrollback:(BOOL)unlimitedScrollback {
@@ -1785,7 +1993,7 @@ static NSString *const kGridSizeKey = @"Size";
                     length:len
                    partial:(continuationMark != EOL_HARD)
                      width:size_.width
-                 timestamp:[[self lineInfoAtLineNumber:0] timestamp]
+                 timestamp:[self timestampForLine:0]
               continuation:line[size_.width]];
     int dropped;
     if (!unlimitedScrollback) {
@@ -1832,10 +2040,7 @@ static NSString *const kGridSizeKey = @"Size";
 - (void)setSize:(VT100GridSize)newSize {
     if (newSize.width != size_.width || newSize.height != size_.height) {
         size_ = newSize;
-        [lines_ release];
-        [lineInfos_ release];
-        lines_ = [[self linesWithSize:newSize] retain];
-        lineInfos_ = [[self lineInfosWithSize:newSize] retain];
+        [self allocateStorage];
         scrollRegionRows_.location = MIN(scrollRegionRows_.location, size_.width - 1);
         scrollRegionRows_.length = MIN(scrollRegionRows_.length,
                                        size_.width - scrollRegionRows_.location);
@@ -2017,16 +2222,11 @@ static void DumpBuf(screen_char_t* p, int n) {
 - (id)copyWithZone:(NSZone *)zone {
     VT100Grid *theCopy = [[VT100Grid alloc] initWithSize:size_
                                                 delegate:delegate_];
-    [theCopy->lines_ release];
-    theCopy->lines_ = [[NSMutableArray alloc] init];
-    for (NSObject *line in lines_) {
-        [theCopy->lines_ addObject:[[line mutableCopy] autorelease]];
-    }
-    [theCopy->lineInfos_ release];
-    theCopy->lineInfos_ = [[NSMutableArray alloc] init];
-    for (VT100LineInfo *line in lineInfos_) {
-        [theCopy->lineInfos_ addObject:[[line copy] autorelease]];
-    }
+    memcpy(theCopy->_screenChars,
+           _screenChars,
+           sizeof(screen_char_t) * (size_.width + 1) * size_.height);
+    VT100GridLineTableCopy(&theCopy->_lineTable, &_lineTable, size_.height);
+    VT100GridDirtyMapCopy(&theCopy->_dirtyMap, &_dirtyMap);
     theCopy->screenTop_ = screenTop_;
     theCopy->cursor_ = cursor_;  // Don't use property to avoid delegate call
     theCopy.scrollRegionRows = scrollRegionRows_;
@@ -0,0 +1,61 @@
+//
+//  VT100GridDirtyMap.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "VT100GridTypes.h"
+
+// One dirty bit per cell of a grid plus a summary with one bit per row that is set when any cell
+// in the row is dirty. Queries about the whole grid only look at the summary, which is a handful
+// of words even for very tall grids.
+//
+// Rows are storage rows; VT100Grid maps them to screen lines.
+typedef struct {
+    int width;
+    int height;
+
+    // Number of words per row in |cells|.
+    int wordsPerRow;
+
+    // height * wordsPerRow words. Bit x % 64 of cells[row * wordsPerRow + x / 64] is cell x.
+    uint64_t *cells;
+
+    // VT100GridDirtyMapRowMaskWords(height) words. Bit row % 64 of rows[row / 64] is row.
+    uint64_t *rows;
+} VT100GridDirtyMap;
+
+// Number of words needed for a mask with one bit per row.
+NS_INLINE int VT100GridDirtyMapRowMaskWords(int height) {
+    return (height + 63) / 64;
+}
+
+NS_INLINE BOOL VT100GridDirtyMapRowMaskContains(const uint64_t *mask, int row) {
+    return (mask[row / 64] >> (row % 64)) & 1;
+}
+
+void VT100GridDirtyMapInit(VT100GridDirtyMap *map, int width, int height);
+void VT100GridDirtyMapFree(VT100GridDirtyMap *map);
+
+// Both maps must have the same dimensions.
+void VT100GridDirtyMapCopy(VT100GridDirtyMap *dest, const VT100GridDirtyMap *source);
+
+// Marks [location, location + length) of |row| dirty. The range is clipped to the row. Returns YES
+// if any cell wasn't dirty before.
+BOOL VT100GridDirtyMapSetRange(VT100GridDirtyMap *map, int row, int location, int length);
+
+// Marks [location, location + length) of |row| clean. The range is clipped to the row.
+void VT100GridDirtyMapClearRange(VT100GridDirtyMap *map, int row, int location, int length);
+
+void VT100GridDirtyMapClearAll(VT100GridDirtyMap *map);
+
+BOOL VT100GridDirtyMapIsDirty(const VT100GridDirtyMap *map, int row, int x);
+BOOL VT100GridDirtyMapAnyDirty(const VT100GridDirtyMap *map);
+
+// Returns the smallest range containing all the dirty cells of |row|, or (-1, 0) if it's clean.
+VT100GridRange VT100GridDirtyMapRangeOnRow(const VT100GridDirtyMap *map, int row);
+
+// Fills the |capacity| words of |mask| with the summary rotated so that bit y is set when row
+// (firstRow + y) % height is dirty. Rows that don't fit are left out. Returns YES if any row in the
+// mask is dirty.
+BOOL VT100GridDirtyMapGetRowMask(const VT100GridDirtyMap *map, int firstRow, uint64_t *mask, int capacity);
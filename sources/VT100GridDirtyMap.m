@@ -0,0 +1,145 @@
+//
+//  VT100GridDirtyMap.m
+//  iTerm2
+//
+
+#import "VT100GridDirtyMap.h"
+
+// Returns a word with bits [from, to) set. Requires 0 <= from < to <= 64.
+NS_INLINE uint64_t VT100GridDirtyMapBits(int from, int to) {
+    const uint64_t high = (to == 64) ? ~0ULL : ((1ULL << to) - 1);
+    return high & ~((1ULL << from) - 1);
+}
+
+NS_INLINE uint64_t *VT100GridDirtyMapRow(const VT100GridDirtyMap *map, int row) {
+    return map->cells + (size_t)row * map->wordsPerRow;
+}
+
+void VT100GridDirtyMapInit(VT100GridDirtyMap *map, int width, int height) {
+    map->width = MAX(0, width);
+    map->height = MAX(0, height);
+    map->wordsPerRow = MAX(1, (map->width + 63) / 64);
+    map->cells = calloc((size_t)MAX(1, map->height) * map->wordsPerRow, sizeof(uint64_t));
+    map->rows = calloc(MAX(1, VT100GridDirtyMapRowMaskWords(map->height)), sizeof(uint64_t));
+}
+
+void VT100GridDirtyMapFree(VT100GridDirtyMap *map) {
+    free(map->cells);
+    free(map->rows);
+    memset(map, 0, sizeof(*map));
+}
+
+void VT100GridDirtyMapCopy(VT100GridDirtyMap *dest, const VT100GridDirtyMap *source) {
+    assert(dest->width == source->width && dest->height == source->height);
+    memcpy(dest->cells, source->cells, (size_t)source->height * source->wordsPerRow * sizeof(uint64_t));
+    memcpy(dest->rows, source->rows, VT100GridDirtyMapRowMaskWords(source->height) * sizeof(uint64_t));
+}
+
+BOOL VT100GridDirtyMapSetRange(VT100GridDirtyMap *map, int row, int location, int length) {
+    const int start = MAX(0, location);
+    const int end = MIN(map->width, location + length);
+    if (row < 0 || row >= map->height || start >= end) {
+        return NO;
+    }
+    uint64_t *words = VT100GridDirtyMapRow(map, row);
+    uint64_t added = 0;
+    const int lastWord = (end - 1) / 64;
+    for (int i = start / 64; i <= lastWord; i++) {
+        const uint64_t bits = VT100GridDirtyMapBits(i == start / 64 ? start % 64 : 0,
+                                                    i == lastWord ? (end - 1) % 64 + 1 : 64);
+        added |= bits & ~words[i];
+        words[i] |= bits;
+    }
+    map->rows[row / 64] |= 1ULL << (row % 64);
+    return added != 0;
+}
+
+void VT100GridDirtyMapClearRange(VT100GridDirtyMap *map, int row, int location, int length) {
+    const int start = MAX(0, location);
+    const int end = MIN(map->width, location + length);
+    if (row < 0 || row >= map->height || start >= end) {
+        return;
+    }
+    if (!VT100GridDirtyMapRowMaskContains(map->rows, row)) {
+        return;
+    }
+    uint64_t *words = VT100GridDirtyMapRow(map, row);
+    const int lastWord = (end - 1) / 64;
+    for (int i = start / 64; i <= lastWord; i++) {
+        words[i] &= ~VT100GridDirtyMapBits(i == start / 64 ? start % 64 : 0,
+                                           i == lastWord ? (end - 1) % 64 + 1 : 64);
+    }
+    uint64_t remaining = 0;
+    for (int i = 0; i < map->wordsPerRow; i++) {
+        remaining |= words[i];
+    }
+    if (!remaining) {
+        map->rows[row / 64] &= ~(1ULL << (row % 64));
+    }
+}
+
+void VT100GridDirtyMapClearAll(VT100GridDirtyMap *map) {
+    memset(map->cells, 0, (size_t)map->height * map->wordsPerRow * sizeof(uint64_t));
+    memset(map->rows, 0, VT100GridDirtyMapRowMaskWords(map->height) * sizeof(uint64_t));
+}
+
+BOOL VT100GridDirtyMapIsDirty(const VT100GridDirtyMap *map, int row, int x) {
+    if (row < 0 || row >= map->height || x < 0 || x >= map->width) {
+        return NO;
+    }
+    return (VT100GridDirtyMapRow(map, row)[x / 64] >> (x % 64)) & 1;
+}
+
+BOOL VT100GridDirtyMapAnyDirty(const VT100GridDirtyMap *map) {
+    // Written as a reduction with no early exit so the compiler can vectorize it.
+    uint64_t any = 0;
+    const int count = VT100GridDirtyMapRowMaskWords(map->height);
+    for (int i = 0; i < count; i++) {
+        any |= map->rows[i];
+    }
+    return any != 0;
+}
+
+VT100GridRange VT100GridDirtyMapRangeOnRow(const VT100GridDirtyMap *map, int row) {
+    if (row < 0 || row >= map->height || !VT100GridDirtyMapRowMaskContains(map->rows, row)) {
+        return VT100GridRangeMake(-1, 0);
+    }
+    const uint64_t *words = VT100GridDirtyMapRow(map, row);
+    int first = -1;
+    int last = -1;
+    for (int i = 0; i < map->wordsPerRow; i++) {
+        if (words[i]) {
+            if (first < 0) {
+                first = i * 64 + __builtin_ctzll(words[i]);
+            }
+            last = i * 64 + 63 - __builtin_clzll(words[i]);
+        }
+    }
+    if (first < 0) {
+        return VT100GridRangeMake(-1, 0);
+    }
+    return VT100GridRangeMake(first, last - first + 1);
+}
+
+BOOL VT100GridDirtyMapGetRowMask(const VT100GridDirtyMap *map, int firstRow, uint64_t *mask, int capacity) {
+    const int count = VT100GridDirtyMapRowMaskWords(map->height);
+    memset(mask, 0, capacity * sizeof(uint64_t));
+    BOOL any = NO;
+    for (int i = 0; i < count; i++) {
+        uint64_t word = map->rows[i];
+        while (word) {
+            const int row = i * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            int y = row - firstRow;
+            if (y < 0) {
+                y += map->height;
+            }
+            if (y / 64 >= capacity) {
+                continue;
+            }
+            mask[y / 64] |= 1ULL << (y % 64);
+            any = YES;
+        }
+    }
+    return any;
+}
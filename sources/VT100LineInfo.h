@@ -9,16 +9,17 @@
 #import <Foundation/Foundation.h>
 #import "VT100GridTypes.h"
 
-@interface VT100LineInfo : NSObject <NSCopying>
+// A view of the metadata VT100Grid keeps for one line. The grid stores it in flat per-row arrays;
+// this object points into them, so it's only valid until the grid is resized.
+@interface VT100LineInfo : NSObject
 
 @property(nonatomic, assign) NSTimeInterval timestamp;
 @property(nonatomic, readonly) NSInteger generation;
 
-- (instancetype)initWithWidth:(int)width;
-- (void)setDirty:(BOOL)dirty inRange:(VT100GridRange)range updateTimestamp:(BOOL)updateTimestamp;
-- (BOOL)isDirtyAtOffset:(int)x;
-- (BOOL)anyCharIsDirty;
-- (VT100GridRange)dirtyRange;
-- (NSIndexSet *)dirtyIndexes;
+// |owner| is retained so the storage outlives this object.
+- (instancetype)initWithOwner:(id)owner
+                    timestamp:(NSTimeInterval *)timestamp
+                   generation:(const NSInteger *)generation NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
 
 @end
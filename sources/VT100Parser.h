@@ -9,6 +9,7 @@
 #import <Foundation/Foundation.h>
 #import "CVector.h"
 #import "VT100Token.h"
+#import "VT100TokenPool.h"
 
 @class VT100TmuxParser;
 
@@ -18,15 +19,26 @@
 @property(atomic, assign) NSStringEncoding encoding;
 @property(nonatomic, readonly) int streamLength;
 
+// Tokens added by -addParsedTokensToVector: come from here. Once a vector of tokens has been
+// executed, pass it to -recycleTokensInVector: so its tokens can be reused.
+@property(nonatomic, readonly) VT100TokenPool *tokenPool;
+
 - (void)putStreamData:(const char *)buffer length:(int)length;
+
+// Lets the caller write directly into the stream instead of copying from its own buffer with
+// -putStreamData:length:. |block| is called synchronously, under the parser's lock, with a buffer
+// that has room for at least |minimumCapacity| bytes. It returns how many bytes it wrote, which
+// this method also returns. The buffer is only valid for the duration of the block.
+- (int)appendStreamDataWithMinimumCapacity:(int)minimumCapacity
+                                     block:(int (^)(char *buffer, int capacity))block;
 - (void)clearStream;
 - (void)forceUnhookDCS:(NSString *)uniqueID;
 - (void)startTmuxRecoveryMode;
 
 // CVector was created for this method. Because so many VT100Token*s are created and destroyed,
-// too much time is spent adjusting their retain counts. Since an iTermObjectPool is used to avoid
+// too much time is spent adjusting their retain counts. Since tokenPool is used to avoid
 // alloc/dealloc calls, the retain counts aren't useful. Finally, NSMutableArray in OS 10.9 doesn't
-// respect initWithCapacity: for capacities over 16.
+// respect initWithCapacity: for capacities over 16. Each token in the vector is owned by it.
 - (void)addParsedTokensToVector:(CVector *)vector;
 
 // Reset all state.
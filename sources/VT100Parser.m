@@ -15,6 +15,10 @@
 
 #define kDefaultStreamSize 100000
 
+// A stream that grew past this is replaced with a default-sized one once it's fully parsed. It's
+// large enough that PTYTask's biggest reads don't cause a reallocation each time.
+#define kMaximumRetainedStreamSize (kDefaultStreamSize * 4)
+
 @implementation VT100Parser {
     unsigned char *_stream;
     int _currentStreamLength;
@@ -33,6 +37,7 @@
         _stream = iTermMalloc(_totalStreamLength);
         _savedStateForPartialParse = [[NSMutableDictionary alloc] init];
         _controlParser = [[VT100ControlParser alloc] init];
+        _tokenPool = [[VT100TokenPool alloc] init];
     }
     return self;
 }
@@ -41,6 +46,7 @@
     free(_stream);
     [_savedStateForPartialParse release];
     [_controlParser release];
+    [_tokenPool release];
     [super dealloc];
 }
 
@@ -55,8 +61,7 @@
     unsigned char *datap;
     int datalen;
 
-    VT100Token *token = [VT100Token token];
-    token.string = nil;
+    VT100Token *token = [_tokenPool newToken];
     // get our current position in the stream
     datap = _stream + _streamOffset;
     datalen = _currentStreamLength - _streamOffset;
@@ -69,7 +74,7 @@
         _streamOffset = 0;
         _currentStreamLength = 0;
 
-        if (_totalStreamLength >= kDefaultStreamSize * 2) {
+        if (_totalStreamLength > kMaximumRetainedStreamSize) {
             // We are done with this stream. Get rid of it and allocate a new one
             // to avoid allowing this to grow too big.
             free(_stream);
@@ -189,24 +194,42 @@
         // Don't append the outer wrapper to the output. Earlier, it was unwrapped and the inner
         // tokens were already added.
         if (token->type != DCS_TMUX_CODE_WRAP) {
-            [token retain];
             CVectorAppend(vector, token);
+        } else {
+            [_tokenPool recycleToken:token];
         }
         return YES;
     }
 
+    [_tokenPool recycleToken:token];
     return NO;
 }
 
+// Ensures at least |length| bytes are free at the end of the stream. The buffer is only reallocated
+// when the unparsed bytes plus |length| don't fit. Otherwise the unparsed tail, which is normally
+// empty or a partial escape sequence, slides to the front.
+- (void)reserveStreamCapacity:(int)length {
+    if (_totalStreamLength - _currentStreamLength >= length) {
+        return;
+    }
+    if (_streamOffset > 0) {
+        const int unparsed = _currentStreamLength - _streamOffset;
+        memmove(_stream, _stream + _streamOffset, unparsed);
+        _currentStreamLength = unparsed;
+        _streamOffset = 0;
+    }
+    if (_currentStreamLength + length > _totalStreamLength) {
+        // Grow the stream if needed.
+        int n = (length + _currentStreamLength) / kDefaultStreamSize;
+
+        _totalStreamLength += n * kDefaultStreamSize;
+        _stream = reallocf(_stream, _totalStreamLength);
+    }
+}
+
 - (void)putStreamData:(const char *)buffer length:(int)length {
     @synchronized(self) {
-        if (_currentStreamLength + length > _totalStreamLength) {
-            // Grow the stream if needed.
-            int n = (length + _currentStreamLength) / kDefaultStreamSize;
-
-            _totalStreamLength += n * kDefaultStreamSize;
-            _stream = reallocf(_stream, _totalStreamLength);
-        }
+        [self reserveStreamCapacity:length];
 
         memcpy(_stream + _currentStreamLength, buffer, length);
         _currentStreamLength += length;
@@ -217,6 +240,21 @@
     }
 }
 
+- (int)appendStreamDataWithMinimumCapacity:(int)minimumCapacity
+                                     block:(int (^)(char *buffer, int capacity))block {
+    @synchronized(self) {
+        [self reserveStreamCapacity:minimumCapacity];
+        const int length = block((char *)_stream + _currentStreamLength,
+                                 _totalStreamLength - _currentStreamLength);
+        if (length <= 0) {
+            return 0;
+        }
+        assert(_currentStreamLength + length <= _totalStreamLength);
+        _currentStreamLength += length;
+        return length;
+    }
+}
+
 - (int)streamLength {
     @synchronized(self) {
         return _currentStreamLength - _streamOffset;
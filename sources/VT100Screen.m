@@ -13,6 +13,7 @@
 #import "iTermImage.h"
 #import "iTermImageInfo.h"
 #import "iTermImageMark.h"
+#import "iTermMalloc.h"
 #import "iTermURLMark.h"
 #import "iTermPreferences.h"
 #import "iTermSelection.h"
@@ -75,7 +76,7 @@ static const double kInterBellQuietPeriod = 0.1;
 
 static const NSInteger VT100ScreenBigFileDownloadThreshold = 1024 * 1024 * 1024;
 
-@interface VT100Screen () <iTermTemporaryDoubleBufferedGridControllerDelegate, iTermMarkDelegate>
+@interface VT100Screen () <iTermTemporaryDoubleBufferedGridControllerDelegate, iTermMarkDelegate, LineBufferDelegate>
 @property(nonatomic, retain) VT100ScreenMark *lastCommandMark;
 @property(nonatomic, retain) iTermTemporaryDoubleBufferedGridController *temporaryDoubleBuffer;
 @end
@@ -208,6 +209,7 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
         tabStops_ = [[NSMutableSet alloc] init];
         [self setInitialTabStops];
         linebuffer_ = [[LineBuffer alloc] init];
+        linebuffer_.delegate = self;
 
         [iTermNotificationController sharedInstance];
 
@@ -237,6 +239,7 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
     [altGrid_ release];
     [tabStops_ release];
     [printBuffer_ release];
+    linebuffer_.delegate = nil;
     [linebuffer_ release];
     [dvr_ release];
     [terminal_ release];
@@ -1127,8 +1130,10 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
 
 - (void)clearScrollbackBuffer
 {
+    linebuffer_.delegate = nil;
     [linebuffer_ release];
     linebuffer_ = [[LineBuffer alloc] init];
+    linebuffer_.delegate = self;
     [linebuffer_ setMaxLines:maxScrollbackLines_];
     [delegate_ screenClearHighlights];
     [currentGrid_ markAllCharsDirty:YES];
@@ -1181,9 +1186,15 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
     screen_char_t zero = { 0 };
     if (memcmp(&fg, &zero, sizeof(fg)) || memcmp(&bg, &zero, sizeof(bg))) {
         STOPWATCH_START(setUpScreenCharArray);
+        // Build the attributes once and stamp them over the whole run with struct stores, rather
+        // than copying bitfields into each cell.
+        screen_char_t template = zero;
+        CopyForegroundColor(&template, fg);
+        CopyBackgroundColor(&template, bg);
+        const char *bytes = asciiData->buffer;
         for (int i = 0; i < len; i++) {
-            CopyForegroundColor(&buffer[i], fg);
-            CopyBackgroundColor(&buffer[i], bg);
+            buffer[i] = template;
+            buffer[i].code = (unsigned char)bytes[i];
         }
         STOPWATCH_LAP(setUpScreenCharArray);
     }
@@ -1196,7 +1207,8 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
 
     [self appendScreenCharArrayAtCursor:buffer
                                  length:len
-                             shouldFree:NO];
+                             shouldFree:NO
+                            singleWidth:YES];
     STOPWATCH_LAP(appendAsciiDataAtCursor);
 }
 
@@ -1215,6 +1227,10 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
          currentGrid_.cursorY,
          currentGrid_.cursorY + [linebuffer_ numLinesWithWidth:currentGrid_.size.width]);
 
+    if ([self appendSimpleStringAtCursor:string]) {
+        return;
+    }
+
     // Allocate a buffer of screen_char_t and place the new string in it.
     const int kStaticBufferElements = 1024;
     screen_char_t staticBuffer[kStaticBufferElements];
@@ -1291,9 +1307,78 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
     }
 }
 
+// Appends |string| without normalizing it or combining it with the predecessor if none of its
+// characters can form a grapheme cluster with a neighbor. Returns NO without doing anything
+// otherwise.
+- (BOOL)appendSimpleStringAtCursor:(NSString *)string {
+    const int len = string.length;
+    const int kStaticBufferElements = 512;
+    unichar staticChars[kStaticBufferElements];
+    screen_char_t staticBuffer[kStaticBufferElements * 2];
+    const BOOL useStaticBuffers = (len <= kStaticBufferElements);
+
+    const unichar *chars = CFStringGetCharactersPtr((CFStringRef)string);
+    unichar *dynamicChars = NULL;
+    if (!chars) {
+        dynamicChars = useStaticBuffers ? staticChars : iTermMalloc(sizeof(unichar) * len);
+        [string getCharacters:dynamicChars range:NSMakeRange(0, len)];
+        chars = dynamicChars;
+    }
+
+    // A character that's otherwise on its own can still join a preceding emoji ZWJ sequence.
+    BOOL simple = YES;
+    if (chars[0] >= 0x80) {
+        VT100GridCoord pred = [currentGrid_ coordinateBefore:currentGrid_.cursor
+                                    movedBackOverDoubleWidth:NULL];
+        if (pred.x >= 0 && [self getLineAtScreenIndex:pred.y][pred.x].complexChar) {
+            simple = NO;
+        }
+    }
+
+    screen_char_t *buffer = useStaticBuffers ? staticBuffer : iTermMalloc(sizeof(screen_char_t) * len * 2);
+    int bufferLength = 0;
+    BOOL dwc = NO;
+    if (simple) {
+        simple = SimpleCharactersToScreenChars(chars,
+                                               len,
+                                               buffer,
+                                               [terminal_ foregroundColorCode],
+                                               [terminal_ backgroundColorCode],
+                                               &bufferLength,
+                                               [delegate_ screenShouldTreatAmbiguousCharsAsDoubleWidth],
+                                               &dwc,
+                                               _normalization,
+                                               [delegate_ screenUnicodeVersion]);
+    }
+    if (simple) {
+        if (dwc) {
+            linebuffer_.mayHaveDoubleWidthCharacter = dwc;
+        }
+        [self appendScreenCharArrayAtCursor:buffer
+                                     length:bufferLength
+                                 shouldFree:NO
+                                singleWidth:!dwc];
+    }
+    if (dynamicChars && dynamicChars != staticChars) {
+        free(dynamicChars);
+    }
+    if (buffer != staticBuffer) {
+        free(buffer);
+    }
+    return simple;
+}
+
 - (void)appendScreenCharArrayAtCursor:(screen_char_t *)buffer
                                length:(int)len
                            shouldFree:(BOOL)shouldFree {
+    [self appendScreenCharArrayAtCursor:buffer length:len shouldFree:shouldFree singleWidth:NO];
+}
+
+// If |singleWidth| is set then |buffer| has no double-width characters.
+- (void)appendScreenCharArrayAtCursor:(screen_char_t *)buffer
+                               length:(int)len
+                           shouldFree:(BOOL)shouldFree
+                          singleWidth:(BOOL)singleWidth {
     if (len >= 1) {
         screen_char_t lastCharacter = buffer[len - 1];
         if (lastCharacter.code == DWC_RIGHT && !lastCharacter.complexChar) {
@@ -1312,14 +1397,25 @@ static NSString *const kInlineFilePreconfirmed = @"preconfirmed";  // NSNumber
             // Not in alt screen or it's ok to scroll into line buffer while in alt screen.k
             lineBuffer = linebuffer_;
         }
-        [self incrementOverflowBy:[currentGrid_ appendCharsAtCursor:buffer
-                                                             length:len
-                                            scrollingIntoLineBuffer:lineBuffer
-                                                unlimitedScrollback:unlimitedScrollback_
-                                            useScrollbackWithRegion:_appendToScrollbackWithStatusBar
-                                                         wraparound:_wraparoundMode
-                                                               ansi:_ansi
-                                                             insert:_insert]];
+        if (singleWidth) {
+            [self incrementOverflowBy:[currentGrid_ appendSingleWidthCharsAtCursor:buffer
+                                                                            length:len
+                                                           scrollingIntoLineBuffer:lineBuffer
+                                                               unlimitedScrollback:unlimitedScrollback_
+                                                           useScrollbackWithRegion:_appendToScrollbackWithStatusBar
+                                                                        wraparound:_wraparoundMode
+                                                                              ansi:_ansi
+                                                                            insert:_insert]];
+        } else {
+            [self incrementOverflowBy:[currentGrid_ appendCharsAtCursor:buffer
+                                                                 length:len
+                                                scrollingIntoLineBuffer:lineBuffer
+                                                    unlimitedScrollback:unlimitedScrollback_
+                                                useScrollbackWithRegion:_appendToScrollbackWithStatusBar
+                                                             wraparound:_wraparoundMode
+                                                                   ansi:_ansi
+                                                                 insert:_insert]];
+        }
     }
 
     if (shouldFree) {
@@ -2047,6 +2143,10 @@ basedAtAbsoluteLineNumber:(long long)absoluteLineNumber
     return [currentGrid_ dirtyRangeForLine:y];
 }
 
+- (BOOL)getDirtyLineMask:(uint64_t *)mask capacity:(int)capacity {
+    return [currentGrid_ getDirtyLineMask:mask capacity:capacity];
+}
+
 - (NSDate *)timestampForLine:(int)y {
     int numLinesInLineBuffer = [linebuffer_ numLinesWithWidth:currentGrid_.size.width];
     NSTimeInterval interval;
@@ -3945,6 +4045,9 @@ basedAtAbsoluteLineNumber:(long long)absoluteLineNumber
                                            height,
                                            preserveAspectRatio,
                                            fractionalInset);
+    if (!c.image) {
+        return;
+    }
     iTermImageInfo *imageInfo = GetImageInfo(c.code);
     imageInfo.broken = isBroken;
     DLog(@"Append %d rows of image characters with %d columns. The value of c.image is %@", height, width, @(c.image));
@@ -5437,6 +5540,38 @@ static void SwapInt(int *a, int *b) {
 - (void)gridCursorDidMove {
 }
 
+#pragma mark - LineBufferDelegate
+
+- (void)lineBuffer:(LineBuffer *)lineBuffer
+  didMoveLinesFrom:(int)lineNumber
+                by:(int)delta
+             width:(int)width {
+    if (lineBuffer != linebuffer_ || width != currentGrid_.size.width) {
+        return;
+    }
+    DLog(@"History lines from %d moved by %d", lineNumber, delta);
+    // Notes in savedIntervalTree_ are relative to the saved screen, which comes after all of history.
+    const long long w = width + 1;
+    const long long firstMovedLocation = ([self totalScrollbackOverflow] + lineNumber) * w;
+    for (id<IntervalTreeObject> obj in [intervalTree_ allObjects]) {
+        Interval *interval = [[obj.entry.interval retain] autorelease];
+        if (interval.limit < firstMovedLocation) {
+            continue;
+        }
+        [[obj retain] autorelease];
+        [intervalTree_ removeObject:obj];
+        if (interval.location >= firstMovedLocation) {
+            interval.location = interval.location + delta * w;
+        } else {
+            interval.length = MAX(0, interval.length + delta * w);
+        }
+        [intervalTree_ addObject:obj withInterval:interval];
+    }
+    [self reloadMarkCache];
+    [[delegate_ screenSelection] moveLinesFrom:lineNumber by:delta];
+    [delegate_ screenDidMoveLinesFrom:lineNumber by:delta];
+}
+
 #pragma mark - iTermMarkDelegate
 
 - (void)markDidBecomeCommandMark:(id<iTermMark>)mark {
@@ -5569,8 +5704,10 @@ static void SwapInt(int *a, int *b) {
     if (!unlimitedScrollback_) {
         [lineBuffer dropExcessLinesWithWidth:self.width];
     }
+    linebuffer_.delegate = nil;
     [linebuffer_ release];
     linebuffer_ = lineBuffer;
+    linebuffer_.delegate = self;
     int maxLinesToRestore;
     if ([iTermAdvancedSettingsModel runJobsInServers] && reattached) {
         maxLinesToRestore = currentGrid_.size.height;
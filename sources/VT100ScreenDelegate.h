@@ -160,6 +160,10 @@
 // Remove highlights of search results.
 - (void)screenClearHighlights;
 
+// Lines from |lineNumber| on moved by |delta| once the length of older history was measured after
+// resizing. Marks, notes, and the selection have already been moved.
+- (void)screenDidMoveLinesFrom:(int)lineNumber by:(int)delta;
+
 // Scrollback buffer deleted
 - (void)screenDidClearScrollbackBuffer:(VT100Screen *)screen;
 
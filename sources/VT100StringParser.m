@@ -9,50 +9,71 @@
 #import "VT100StringParser.h"
 
 #import "DebugLogging.h"
+#import "iTermASCIIScanner.h"
+#import "iTermMalloc.h"
+#import "iTermUTF8Transcoder.h"
 #import "NSStringITerm.h"
 #import "ScreenChar.h"
 
+// Decodes the run of non-ASCII characters at |datap| straight to UTF-16 and sets token.string, so
+// ParseString doesn't have to ask NSString to decode the same bytes a second time.
 static void DecodeUTF8Bytes(unsigned char *datap,
                             int datalen,
                             int *rmlen,
                             VT100Token *token)
 {
-    unsigned char *p = datap;
-    int len = datalen;
-    int utf8DecodeResult;
-    int theChar = 0;
+    const int kStackBufferLength = 1024;
+    unichar stackBuffer[kStackBufferLength];
 
-    while (true) {
-        utf8DecodeResult = decode_utf8_char(p, len, &theChar);
-        // Stop on error or end of stream.
-        if (utf8DecodeResult <= 0) {
-            break;
-        }
-        // Intentionally break out at ASCII characters. They are
-        // processed separately, e.g. they might get converted into
-        // line drawing characters.
-        if (theChar < 0x80) {
-            break;
+    // |datalen| is everything left in the stream, which can be far more than the run that gets
+    // decoded. Decode through the byte that ends the run so the transcoder still sees why it
+    // stopped, and size the buffer for that.
+    int length = datalen;
+    if (length > kStackBufferLength) {
+        int runLength = 0;
+        while (runLength < datalen && datap[runLength] >= 0x80) {
+            runLength++;
         }
-        p += utf8DecodeResult;
-        len -= utf8DecodeResult;
+        length = MIN(datalen, runLength + 1);
     }
+    unichar *buffer = length <= kStackBufferLength ? stackBuffer : iTermMalloc(length * sizeof(unichar));
 
-    if (p > datap) {
+    int utf16Length = 0;
+    int invalidLength = 0;
+    iTermUTF8TranscoderStop stop;
+    const int consumed = iTermUTF8TranscodeToUTF16(datap,
+                                                   length,
+                                                   buffer,
+                                                   &utf16Length,
+                                                   &stop,
+                                                   &invalidLength);
+    if (consumed > 0) {
         // If some characters were successfully decoded, just return them
         // and ignore the error or end of stream for now.
-        *rmlen = p - datap;
-        assert(p >= datap);
+        *rmlen = consumed;
         token->type = VT100_STRING;
+        token.string = [[[NSString alloc] initWithCharacters:buffer length:utf16Length] autorelease];
     } else {
         // Report error or waiting state.
-        if (utf8DecodeResult == 0) {
-            token->type = VT100_WAIT;
-        } else {
-            *rmlen = -utf8DecodeResult;
-            token->type = VT100_INVALID_SEQUENCE;
+        switch (stop) {
+            case iTermUTF8TranscoderStopTruncated:
+            case iTermUTF8TranscoderStopEndOfInput:
+                token->type = VT100_WAIT;
+                break;
+            case iTermUTF8TranscoderStopInvalid:
+                *rmlen = invalidLength;
+                token->type = VT100_INVALID_SEQUENCE;
+                break;
+            case iTermUTF8TranscoderStopASCII:
+                // Callers only get here with a byte >= 0x80, so this shouldn't happen.
+                *rmlen = 1;
+                token->type = VT100_INVALID_SEQUENCE;
+                break;
         }
     }
+    if (buffer != stackBuffer) {
+        free(buffer);
+    }
 }
 
 
@@ -284,28 +305,14 @@ static void DecodeASCIIBytes(unsigned char *datap,
                              int datalen,
                              int *rmlen,
                              VT100Token *token) {
-    unsigned char *p = datap;
-    int len = datalen;
-
-    // I tried the ideas mentioned here:
-    // http://stackoverflow.com/questions/22218605/is-this-function-a-good-candidate-for-simd-on-intel
-    // (using 8-bytes-at-a-time bit twiddling and SIMD)
-    // and although this while loop completed faster, the overall benchmark speed on spam.cc did
-    // not improve.
-    while (len > 0) {
-        if (*p >= 0x20 && *p <= 0x7f) {
-            p++;
-            len--;
-        } else {
-            break;
-        }
-    }
-    if (len == datalen) {
+    // The scan is vectorized because plain text spends most of its parsing time finding the end
+    // of the printable ASCII run.
+    const int length = iTermPrintableASCIIPrefixLength(datap, datalen);
+    if (length == 0) {
         *rmlen = 0;
         token->type = VT100_WAIT;
     } else {
-        *rmlen = datalen - len;
-        assert(datalen >= len);
+        *rmlen = length;
         token->type = VT100_ASCIISTRING;
     }
 }
@@ -351,7 +358,7 @@ void ParseString(unsigned char *datap,
         datap[0] = ONECHAR_UNKNOWN;
         result.string = ReplacementString();
         result->type = VT100_STRING;
-    } else if (result->type != VT100_WAIT && !isAscii) {
+    } else if (result->type != VT100_WAIT && !isAscii && result.string == nil) {
         result.string = [[[NSString alloc] initWithBytes:datap
                                                     length:*rmlen
                                                   encoding:encoding] autorelease];
@@ -254,6 +254,10 @@ typedef struct {
 // For VT100CSI_ codes that take parameters.
 @property(nonatomic, readonly) CSIParam *csi;
 
+// Set by whoever executes the token if it keeps a reference after the token's batch is done, e.g.
+// while the session is paused. VT100TokenPool never reuses such a token.
+@property(nonatomic, assign) BOOL retainedOutsideBatch;
+
 // Is this an ascii string?
 @property(nonatomic, readonly) BOOL isAscii;
 
@@ -268,6 +272,9 @@ typedef struct {
 
 - (void)setAsciiBytes:(char *)bytes length:(int)length;
 
+// Returns the token to the state it was in when freshly allocated so VT100TokenPool can reuse it.
+- (void)reset;
+
 // Returns a string for |asciiData|, for convenience (this is slow).
 - (NSString *)stringForAsciiData;
 
@@ -42,6 +42,12 @@
     [_kvpValue release];
     [_savedData release];
 
+    [self freeAsciiData];
+
+    [super dealloc];
+}
+
+- (void)freeAsciiData {
     if (_asciiData.buffer != _asciiData.staticBuffer) {
         free(_asciiData.buffer);
     }
@@ -49,8 +55,30 @@
         _asciiData.screenChars->buffer != _asciiData.screenChars->staticBuffer) {
         free(_asciiData.screenChars->buffer);
     }
+}
 
-    [super dealloc];
+- (void)reset {
+    type = VT100CC_NULL;
+    savingData = NO;
+    code = 0;
+
+    if (_csi) {
+        // Keep the allocation. A zeroed CSIParam is what -csi would have calloc()ed.
+        memset(_csi, 0, sizeof(*_csi));
+    }
+
+    self.string = nil;
+    self.kvpKey = nil;
+    self.kvpValue = nil;
+    self.savedData = nil;
+
+    [self freeAsciiData];
+    // The static buffers are initialized on demand, so only the bookkeeping needs to be cleared.
+    _asciiData.buffer = NULL;
+    _asciiData.length = 0;
+    _asciiData.screenChars = NULL;
+    _screenChars.buffer = NULL;
+    _screenChars.length = 0;
 }
 
 - (NSString *)codeName {
@@ -0,0 +1,34 @@
+//
+//  VT100TokenPool.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+#import "CVector.h"
+#import "VT100Token.h"
+
+// A free list of VT100Tokens. Escape-heavy output creates and destroys huge numbers of tokens, so
+// rather than paying for alloc/dealloc (and autorelease) each time, tokens whose batch has been
+// executed are reset and handed out again. Each parser owns one. Safe to use from any thread.
+@interface VT100TokenPool : NSObject
+
+// Number of tokens created because the free list was empty.
+@property(nonatomic, readonly) NSInteger numberOfTokensAllocated;
+
+// Number of tokens handed out from the free list.
+@property(nonatomic, readonly) NSInteger numberOfTokensReused;
+
+// Returns a token with a retain count of 1 that the caller owns. It is not autoreleased. Give it
+// back with -recycleToken: or -recycleTokensInVector:.
+- (VT100Token *)newToken NS_RETURNS_RETAINED;
+
+// Relinquishes the caller's reference, which must be the only one unless the token's
+// retainedOutsideBatch flag is set. Unflagged tokens are reset and kept for reuse; flagged ones
+// are just released.
+- (void)recycleToken:(VT100Token *)token;
+
+// Recycles each token in |vector| and destroys the vector.
+- (void)recycleTokensInVector:(const CVector *)vector;
+
+@end
@@ -0,0 +1,99 @@
+//
+//  VT100TokenPool.m
+//  iTerm2
+//
+
+#import "VT100TokenPool.h"
+
+#import <os/lock.h>
+
+// The free list never grows past this. It is large enough for a full batch of SGR-heavy output.
+static const int kMaximumFreeTokens = 4096;
+
+@implementation VT100TokenPool {
+    // Guards everything below.
+    os_unfair_lock _lock;
+    CVector _freeTokens;
+    NSInteger _numberOfTokensAllocated;
+    NSInteger _numberOfTokensReused;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        CVectorCreate(&_freeTokens, 256);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (int i = 0; i < CVectorCount(&_freeTokens); i++) {
+        [CVectorGetObject(&_freeTokens, i) release];
+    }
+    CVectorDestroy(&_freeTokens);
+    [super dealloc];
+}
+
+- (NSInteger)numberOfTokensAllocated {
+    os_unfair_lock_lock(&_lock);
+    const NSInteger result = _numberOfTokensAllocated;
+    os_unfair_lock_unlock(&_lock);
+    return result;
+}
+
+- (NSInteger)numberOfTokensReused {
+    os_unfair_lock_lock(&_lock);
+    const NSInteger result = _numberOfTokensReused;
+    os_unfair_lock_unlock(&_lock);
+    return result;
+}
+
+- (VT100Token *)newToken {
+    VT100Token *token = nil;
+    os_unfair_lock_lock(&_lock);
+    if (CVectorCount(&_freeTokens) > 0) {
+        token = CVectorRemoveLast(&_freeTokens);
+        _numberOfTokensReused++;
+    } else {
+        _numberOfTokensAllocated++;
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    if (!token) {
+        token = [[VT100Token alloc] init];
+    }
+    return token;
+}
+
+- (void)recycleToken:(VT100Token *)token {
+    // A token the executor kept (e.g., queued while the session is paused) can't be reset out from
+    // under it.
+    if (token.retainedOutsideBatch) {
+        [token release];
+        return;
+    }
+    // Reset outside the lock since it may release strings and data.
+    [token reset];
+
+    os_unfair_lock_lock(&_lock);
+    const BOOL keep = CVectorCount(&_freeTokens) < kMaximumFreeTokens;
+    if (keep) {
+        CVectorAppend(&_freeTokens, token);
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    if (!keep) {
+        [token release];
+    }
+}
+
+- (void)recycleTokensInVector:(const CVector *)vector {
+    const int n = CVectorCount(vector);
+    for (int i = 0; i < n; i++) {
+        [self recycleToken:CVectorGetObject(vector, i)];
+    }
+    CVectorDestroy(vector);
+}
+
+@end
@@ -0,0 +1,54 @@
+//
+//  iTermASCIIScanner.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Finds the length of the longest prefix of |bytes| consisting only of bytes in the range
+// [0x20, 0x7f]. That is the same set of bytes that isAsciiString() accepts, so a run found here
+// can be emitted as a single VT100_ASCIISTRING token and control parsing needs to begin only at
+// the returned offset.
+//
+// This is vectorized because most PTY output is long runs of printable ASCII. Sixteen bytes are
+// examined per iteration and a scalar loop handles the tail.
+NS_INLINE int iTermPrintableASCIIPrefixLength(const unsigned char *bytes, int length) {
+    int i = 0;
+#if defined(__SSE2__)
+    // Viewed as signed bytes, 0x20...0x7f are exactly the values >= 0x20. Everything else (C0
+    // controls and bytes with the high bit set) compares less than 0x20.
+    const __m128i threshold = _mm_set1_epi8(0x20);
+    while (i + 16 <= length) {
+        const __m128i chunk = _mm_loadu_si128((const __m128i *)(bytes + i));
+        const int mask = _mm_movemask_epi8(_mm_cmplt_epi8(chunk, threshold));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+        i += 16;
+    }
+#elif defined(__ARM_NEON)
+    const int8x16_t threshold = vdupq_n_s8(0x20);
+    while (i + 16 <= length) {
+        const int8x16_t chunk = vld1q_s8((const int8_t *)(bytes + i));
+        const uint8x16_t bad = vcltq_s8(chunk, threshold);
+        if (vmaxvq_u8(bad)) {
+            // Narrow each byte of the comparison to a nibble, giving a 64-bit mask with four bits
+            // per input byte.
+            const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(bad), 4);
+            const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+            return i + (__builtin_ctzll(mask) >> 2);
+        }
+        i += 16;
+    }
+#endif
+    while (i < length && bytes[i] >= 0x20 && bytes[i] <= 0x7f) {
+        i++;
+    }
+    return i;
+}
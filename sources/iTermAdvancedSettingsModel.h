@@ -62,6 +62,8 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (double)coloredSelectedTabOutlineStrength;
 + (double)coloredUnselectedTabTextProminence;
 + (double)compactMinimalTabBarHeight;
++ (BOOL)compactScrollbackStyles;
++ (BOOL)compressScrollback;
 + (BOOL)conservativeURLGuessing;
 + (BOOL)convertTabDragToWindowDragForSolitaryTabInCompactOrMinimalTheme;
 + (BOOL)copyWithStylesByDefault;
@@ -98,6 +100,7 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (BOOL)experimentalKeyHandling;
 + (double)extraSpaceBeforeCompactTopTabBar;
 + (NSString *)fallbackLCCType;
++ (BOOL)findAllUsesMultipleCores;
 + (double)findDelaySeconds;
 
 // Regular expression for finding URLs for Edit>Find>Find URLs
@@ -120,6 +123,7 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (double)idleTimeSeconds;
 + (BOOL)ignoreHardNewlinesInURLs;
 + (BOOL)includePasteHistoryInAdvancedPaste;
++ (BOOL)indexScrollbackForFind;
 + (BOOL)indicateBellsInDockBadgeLabel;
 + (double)indicatorFlashInitialAlpha;
 + (double)invalidateShadowTimesPerSecond;
@@ -191,8 +195,10 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (NSString *)pythonRuntimeDownloadURL;
 + (void)setPromptForPasteWhenNotAtPrompt:(BOOL)value;
 + (BOOL)proportionalScrollWheelReporting;
++ (NSString *)ptyRecordingDirectory;
 + (int)quickPasteBytesPerCall;
 + (double)quickPasteDelayBetweenCalls;
++ (BOOL)reflowHistoryLazily;
 + (BOOL)remapModifiersWithoutEventTap;
 
 // Remember window positions? If off, lets the OS pick the window position. Smart window placement takes precedence over this.
@@ -206,6 +212,7 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (BOOL)retinaInlineImages;
 + (BOOL)runJobsInServers;
 + (BOOL)saveToPasteHistoryWhenSecureInputEnabled;
++ (int)scrollbackMemoryBudget;
 + (NSString *)searchCommand;
 + (BOOL)sensitiveScrollWheel;
 + (BOOL)serializeOpeningMultipleFullScreenWindows;
@@ -231,6 +238,7 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (double)smartCursorColorFgThreshold;
 
 + (NSString *)spacelessApplicationSupport;
++ (BOOL)spillScrollbackToDisk;
 + (NSString *)sshSchemePath;
 + (BOOL)sshURLsSupportPath;
 + (BOOL)startDebugLoggingAutomatically;
@@ -263,6 +271,7 @@ extern NSString *const iTermAdvancedSettingsDidChange;
 + (int)triggerRadius;
 + (BOOL)trimWhitespaceOnCopy;
 + (BOOL)typingClearsSelection;
++ (int)uncompressedScrollbackBlocks;
 + (double)underlineCursorHeight;
 + (double)underlineCursorOffset;
 + (BOOL)underlineHyperlinks;
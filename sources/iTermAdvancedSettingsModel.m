@@ -275,6 +275,14 @@ DEFINE_BOOL(detectPasswordInput, YES, SECTION_TERMINAL @"Show key at cursor at p
 DEFINE_BOOL(tabsWrapAround, NO, SECTION_TERMINAL @"Tabs wrap around to the next line.\nThis is useful for preserving tabs for later copying to the pasteboard. It breaks backward compatibility and may cause layout problems with programs that don’t expect this behavior.");
 DEFINE_STRING(sshSchemePath, @"ssh", SECTION_TERMINAL @"Command to run when handling an ssh:// URL.");
 DEFINE_INT(defaultTabStopWidth, 8, SECTION_TERMINAL @"Default tab stop width for new sessions.");
+DEFINE_BOOL(compactScrollbackStyles, NO, SECTION_TERMINAL @"Store scrollback history compactly.\nEach character’s colors and attributes are kept in a table shared by the surrounding lines, which roughly halves the memory used by history. Old history is expanded again when you scroll back to it or search it, which takes a little time.");
+DEFINE_BOOL(compressScrollback, YES, SECTION_TERMINAL @"Compress old scrollback history.\nHistory more than a few screenfuls from the bottom is compressed in the background to save memory. It is decompressed when you scroll back to it or search it. Only takes effect when scrollback history is stored compactly.");
+DEFINE_INT(uncompressedScrollbackBlocks, 8, SECTION_TERMINAL @"Number of blocks of recent history to leave uncompressed.\nA block holds about 8,000 characters. Only takes effect when old scrollback history is compressed.");
+DEFINE_BOOL(spillScrollbackToDisk, NO, SECTION_TERMINAL @"Move old scrollback history to disk when scrollback is unlimited.\nOnce history takes more memory than the budget below, the oldest history is written to a temporary file that is deleted when iTerm2 quits. It is read back when you scroll back to it or search it.");
+DEFINE_INT(scrollbackMemoryBudget, 256, SECTION_TERMINAL @"Megabytes of memory each session’s history may use before it is moved to disk.\nOnly takes effect when old history is moved to disk.");
+DEFINE_BOOL(indexScrollbackForFind, YES, SECTION_TERMINAL @"Index scrollback history to speed up find.\nA small index of the text in history lets find skip lines that can’t contain what you’re looking for. It doesn’t help with regular expressions. Takes effect for new history.");
+DEFINE_BOOL(findAllUsesMultipleCores, YES, SECTION_TERMINAL @"Use all processor cores to highlight find results in scrollback history.");
+DEFINE_BOOL(reflowHistoryLazily, YES, SECTION_TERMINAL @"Estimate the length of old history when resizing a window.\nResizing is much faster with a lot of history. The exact length is measured shortly afterward.");
 
 #pragma mark Hotkey
 
@@ -385,6 +393,7 @@ DEFINE_BOOL(appendToExistingDebugLog, NO, SECTION_DEBUGGING @"Append to existing
 DEFINE_BOOL(logDrawingPerformance, NO, SECTION_DEBUGGING @"Log stats about text drawing performance to console.\nUsed for performance testing.");
 DEFINE_BOOL(logRestorableStateSize, NO, SECTION_DEBUGGING @"Log restorable state size info to /tmp/statesize.*.txt.");
 DEFINE_BOOL(showBlockBoundaries, NO, SECTION_DEBUGGING @"Show line buffer block boundaries (issue 6207)");
+DEFINE_STRING(ptyRecordingDirectory, @"", SECTION_DEBUGGING @"Folder for PTY recordings.\nIf set, new sessions save their raw output, with timing and window size changes, to a .itermpty file in this folder. Open a recording with iTerm2 to replay it in the current session. Hold Option while opening it to replay as fast as possible.");
 
 #pragma mark - Session
 
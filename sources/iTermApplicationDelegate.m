@@ -72,6 +72,7 @@
 #import "iTermPromptOnCloseReason.h"
 #import "iTermProfilePreferences.h"
 #import "iTermProfilesWindowController.h"
+#import "iTermPTYRecording.h"
 #import "iTermRecordingCodec.h"
 #import "iTermScriptConsole.h"
 #import "iTermScriptFunctionCall.h"
@@ -591,6 +592,15 @@ static BOOL hasBecomeActive = NO;
         [iTermRecordingCodec loadRecording:[NSURL fileURLWithPath:filename]];
         return YES;
     }
+    if ([filename.pathExtension isEqualToString:iTermPTYRecordingPathExtension]) {
+        PTYSession *session = [[[iTermController sharedInstance] currentTerminal] currentSession];
+        iTermPTYRecording *recording = [iTermPTYRecording recordingWithContentsOfFile:filename];
+        if (session && recording) {
+            const BOOL maximumSpeed = !!([NSEvent modifierFlags] & NSEventModifierFlagOption);
+            [session replayPTYRecording:recording atOriginalSpeed:!maximumSpeed];
+        }
+        return YES;
+    }
     NSLog(@"Quiet launch");
     quiet_ = YES;
     if ([filename isEqualToString:[[NSFileManager defaultManager] versionNumberFilename]]) {
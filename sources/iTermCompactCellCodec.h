@@ -0,0 +1,28 @@
+//
+//  iTermCompactCellCodec.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "ScreenChar.h"
+
+// A cell of a compact line block. |style| indexes the block's style table, which holds everything
+// in a screen_char_t except the code.
+typedef struct {
+    unichar code;
+    uint16_t style;
+} iTermCompactCell;
+
+// A lossless encoding of compact cells for history that is rarely read. Styles are stored as runs
+// and codes as one byte each for ASCII, with runs of a repeated code collapsed, so typical
+// terminal output takes a little over a byte per cell. Both functions are safe to call on any
+// thread.
+NSData *iTermCompactCellsEncode(const iTermCompactCell *cells, int length);
+
+// Decodes |length| cells, expanding each one's style from |styles|. Returns NO if |data| is not
+// the encoding of |length| cells with fewer than |numberOfStyles| styles.
+BOOL iTermCompactCellsDecode(NSData *data,
+                             const screen_char_t *styles,
+                             int numberOfStyles,
+                             screen_char_t *dest,
+                             int length);
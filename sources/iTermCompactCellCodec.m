@@ -0,0 +1,156 @@
+//
+//  iTermCompactCellCodec.m
+//  iTerm2
+//
+
+#import "iTermCompactCellCodec.h"
+
+// The encoding is the style runs, each a varint style index and a varint length, followed by the
+// codes. A code byte is one of:
+//   0x00-0x7f: The code itself.
+//   0x80-0xbf: Repeat the previous code 1-64 times (the low six bits plus one).
+//   0xc0-0xfe: A code below 0x3f00. The low six bits are its high byte and the next byte is its low
+//              byte.
+//   0xff:      Any code, in the next two bytes, high byte first.
+static const uint8_t iTermCompactCellCodecRepeat = 0x80;
+static const uint8_t iTermCompactCellCodecTwoByteCode = 0xc0;
+static const uint8_t iTermCompactCellCodecThreeByteCode = 0xff;
+static const int iTermCompactCellCodecMaximumRepeat = 64;
+
+static void iTermCompactCellCodecAppendVarint(NSMutableData *data, NSUInteger value) {
+    uint8_t bytes[10];
+    int n = 0;
+    do {
+        bytes[n] = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            bytes[n] |= 0x80;
+        }
+        n++;
+    } while (value);
+    [data appendBytes:bytes length:n];
+}
+
+static BOOL iTermCompactCellCodecReadVarint(const uint8_t **pp, const uint8_t *end, NSUInteger *value) {
+    NSUInteger result = 0;
+    int shift = 0;
+    const uint8_t *p = *pp;
+    while (p < end && shift < 64) {
+        const uint8_t byte = *p++;
+        result |= (NSUInteger)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *pp = p;
+            *value = result;
+            return YES;
+        }
+        shift += 7;
+    }
+    return NO;
+}
+
+NSData *iTermCompactCellsEncode(const iTermCompactCell *cells, int length) {
+    NSMutableData *data = [NSMutableData dataWithCapacity:length + length / 8 + 16];
+
+    int start = 0;
+    while (start < length) {
+        int end = start + 1;
+        while (end < length && cells[end].style == cells[start].style) {
+            end++;
+        }
+        iTermCompactCellCodecAppendVarint(data, cells[start].style);
+        iTermCompactCellCodecAppendVarint(data, end - start);
+        start = end;
+    }
+
+    unichar previous = 0;
+    int i = 0;
+    while (i < length) {
+        const unichar code = cells[i].code;
+        if (code == previous && i > 0) {
+            int repeats = 1;
+            while (i + repeats < length &&
+                   repeats < iTermCompactCellCodecMaximumRepeat &&
+                   cells[i + repeats].code == code) {
+                repeats++;
+            }
+            const uint8_t byte = iTermCompactCellCodecRepeat | (repeats - 1);
+            [data appendBytes:&byte length:1];
+            i += repeats;
+            continue;
+        }
+        if (code < 0x80) {
+            const uint8_t byte = code;
+            [data appendBytes:&byte length:1];
+        } else if (code < ((iTermCompactCellCodecThreeByteCode - iTermCompactCellCodecTwoByteCode) << 8)) {
+            const uint8_t bytes[2] = { (uint8_t)(iTermCompactCellCodecTwoByteCode | (code >> 8)), (uint8_t)code };
+            [data appendBytes:bytes length:2];
+        } else {
+            const uint8_t bytes[3] = { iTermCompactCellCodecThreeByteCode, (uint8_t)(code >> 8), (uint8_t)code };
+            [data appendBytes:bytes length:3];
+        }
+        previous = code;
+        i++;
+    }
+    return data;
+}
+
+BOOL iTermCompactCellsDecode(NSData *data,
+                             const screen_char_t *styles,
+                             int numberOfStyles,
+                             screen_char_t *dest,
+                             int length) {
+    const uint8_t *p = data.bytes;
+    const uint8_t *end = p + data.length;
+
+    int i = 0;
+    while (i < length) {
+        NSUInteger style;
+        NSUInteger count;
+        if (!iTermCompactCellCodecReadVarint(&p, end, &style) ||
+            !iTermCompactCellCodecReadVarint(&p, end, &count) ||
+            style >= numberOfStyles ||
+            count == 0 ||
+            count > length - i) {
+            return NO;
+        }
+        const screen_char_t styleChar = styles[style];
+        for (NSUInteger j = 0; j < count; j++) {
+            dest[i++] = styleChar;
+        }
+    }
+
+    unichar previous = 0;
+    i = 0;
+    while (i < length) {
+        if (p >= end) {
+            return NO;
+        }
+        const uint8_t byte = *p++;
+        if (byte < iTermCompactCellCodecRepeat) {
+            previous = byte;
+            dest[i++].code = previous;
+        } else if (byte < iTermCompactCellCodecTwoByteCode) {
+            const int repeats = (byte & 0x3f) + 1;
+            if (repeats > length - i) {
+                return NO;
+            }
+            for (int j = 0; j < repeats; j++) {
+                dest[i++].code = previous;
+            }
+        } else if (byte < iTermCompactCellCodecThreeByteCode) {
+            if (p >= end) {
+                return NO;
+            }
+            previous = ((byte & 0x3f) << 8) | *p++;
+            dest[i++].code = previous;
+        } else {
+            if (end - p < 2) {
+                return NO;
+            }
+            previous = (p[0] << 8) | p[1];
+            p += 2;
+            dest[i++].code = previous;
+        }
+    }
+    return p == end;
+}
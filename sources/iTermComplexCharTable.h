@@ -0,0 +1,71 @@
+//
+//  iTermComplexCharTable.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+// Interns strings that don't fit in a single unichar (surrogate pairs, combining marks, emoji
+// sequences) as codes that fit in screen_char_t.code. This is the storage behind the complex char
+// functions in ScreenChar.h, which most code should use instead.
+//
+// Looking up a string or a code never takes a lock: strings live in an arena in immutable records
+// and are published with atomic stores. Only adding and reclaiming codes are serialized.
+//
+// Codes are recycled rather than overwritten. When no code is free, a code is reclaimed if
+//   - nobody holds a counted reference to it (see iTermComplexCharTableRetain),
+//   - no root reports it in use, and
+//   - it isn't among the most recently created, so codes that have been handed out but not yet
+//     stored anywhere survive.
+// A reclaimed record's memory is reused only after a full epoch (at least a second) has passed,
+// which gives readers that loaded it just before it was reclaimed plenty of time to finish.
+
+// Codes are in [1, iTermComplexCharTableMaximumCode).
+#define iTermComplexCharTableMaximumCode 0xf000
+
+// A set of codes a root has in use.
+typedef struct iTermComplexCharMarks iTermComplexCharMarks;
+void iTermComplexCharMarksAdd(iTermComplexCharMarks *marks, unichar code);
+
+// Adds every code a root holds to |marks|. Called with the table locked, so it must not use the
+// table itself.
+typedef void (*iTermComplexCharTableMarkFunction)(void *context, iTermComplexCharMarks *marks);
+
+// Returns the code for a string or -1 if it hasn't been interned.
+int iTermComplexCharTableLookup(const unichar *chars, int length);
+
+// Returns the code for a string, adding it if needed. |added| is optional and set to YES if it was
+// added. Returns -1 if every code is in use.
+int iTermComplexCharTableIntern(const unichar *chars,
+                                int length,
+                                BOOL spacingCombiningMark,
+                                BOOL *added);
+
+// Returns a code that has no string and is never reclaimed, or -1 if every code is in use. Used
+// for images. Give it back with iTermComplexCharTableFreeReservedCode.
+int iTermComplexCharTableReserveCode(void);
+void iTermComplexCharTableFreeReservedCode(unichar code);
+
+// Returns the string for a code or nil.
+NSString *iTermComplexCharTableString(unichar code);
+
+// Copies the string for a code into |dest| and returns its length, or 0 if there is none.
+int iTermComplexCharTableGetCharacters(unichar code, unichar *dest);
+
+BOOL iTermComplexCharTableIsSpacingCombiningMark(unichar code);
+
+// Counted references, taken by containers that keep cells for a long time (LineBlock).
+void iTermComplexCharTableRetain(unichar code);
+void iTermComplexCharTableRelease(unichar code);
+
+// Roots hold cells without counting references (VT100Grid) and are asked for the codes they use
+// when reclaiming. A root must be removed before the memory it marks from is freed.
+void iTermComplexCharTableAddRoot(void *context, iTermComplexCharTableMarkFunction function);
+void iTermComplexCharTableRemoveRoot(void *context);
+
+// For saving and restoring state.
+void iTermComplexCharTableEnumerate(void (^block)(unichar code, NSString *string, BOOL spacingCombiningMark));
+// Assigns |string| to |code| unless the code is already taken. A nil string reserves the code.
+void iTermComplexCharTableRestore(unichar code, NSString *string, BOOL spacingCombiningMark);
+int iTermComplexCharTableNextCode(void);
+void iTermComplexCharTableSetNextCode(int code);
@@ -0,0 +1,524 @@
+//
+//  iTermComplexCharTable.m
+//  iTerm2
+//
+
+#import "iTermComplexCharTable.h"
+
+#import "charmaps.h"
+#import "DebugLogging.h"
+#import "iTermMalloc.h"
+
+#import <os/lock.h>
+#import <stdatomic.h>
+
+// Slots are allocated a page at a time as codes are first used.
+#define iTermComplexCharTablePageSize 256
+#define iTermComplexCharTableNumberOfPages (iTermComplexCharTableMaximumCode / iTermComplexCharTablePageSize)
+
+// Maps strings to codes with open addressing and linear probing. It has twice as many entries as
+// there are codes, and is rebuilt when tombstones push the load past three quarters.
+#define iTermComplexCharTableIndexSize (1 << 17)
+static const uint16_t iTermComplexCharTableIndexEmpty = 0;
+static const uint16_t iTermComplexCharTableIndexTombstone = 0xffff;
+
+// Records are allocated from arena chunks in size classes of 8 unichars. Longer strings than the
+// largest class are rare and get their own allocation.
+static const size_t iTermComplexCharTableArenaChunkSize = 64 * 1024;
+#define iTermComplexCharTableNumberOfSizeClasses 8
+
+// This many of the most recently created records are never reclaimed. Codes get handed out a
+// little before they're stored anywhere a root or reference count would see them.
+static const uint32_t iTermComplexCharTableYoungRecords = iTermComplexCharTableMaximumCode / 4;
+
+// Reclamation advances the epoch at most this often. A retired record is freed only after a whole
+// epoch has passed since it was retired, so a reader that loaded it just before is long done.
+static const NSTimeInterval iTermComplexCharTableEpochDuration = 1;
+
+typedef struct iTermComplexCharRecord {
+    // Links free and retired records. Unused while published.
+    struct iTermComplexCharRecord *next;
+    uint32_t hash;
+    // Value of gNumberOfRecordsCreated when it was created.
+    uint32_t serial;
+    // Value of gEpoch when it was retired.
+    uint32_t retiredEpoch;
+    uint16_t length;
+    // Number of unichars that fit in |chars|.
+    uint16_t capacity;
+    BOOL spacingCombiningMark;
+    unichar chars[];
+} iTermComplexCharRecord;
+
+typedef struct {
+    // NULL if the code has no string, or &gReservedRecord.
+    _Atomic(iTermComplexCharRecord *) record;
+    atomic_int referenceCount;
+} iTermComplexCharSlot;
+
+typedef struct {
+    void *context;
+    iTermComplexCharTableMarkFunction function;
+} iTermComplexCharRoot;
+
+struct iTermComplexCharMarks {
+    uint64_t bits[65536 / 64];
+};
+
+static _Atomic(iTermComplexCharSlot *) gPages[iTermComplexCharTableNumberOfPages];
+static _Atomic(uint16_t) gIndex[iTermComplexCharTableIndexSize];
+static iTermComplexCharRecord gReservedRecord;
+
+// Everything below is protected by gLock.
+static os_unfair_lock gLock = OS_UNFAIR_LOCK_INIT;
+static int gNextCode = 1;
+static int gNumberOfCodesInUse;
+static int gNumberOfTombstones;
+static uint32_t gNumberOfRecordsCreated;
+static iTermComplexCharRecord *gFreeRecords[iTermComplexCharTableNumberOfSizeClasses];
+static iTermComplexCharRecord *gRetiredRecords;
+static uint32_t gEpoch;
+static NSTimeInterval gEpochStart;
+static char *gArenaChunk;
+static size_t gArenaChunkUsed;
+static iTermComplexCharRoot *gRoots;
+static int gNumberOfRoots;
+static int gRootsCapacity;
+
+#pragma mark - Helpers
+
+static BOOL iTermComplexCharTableCodeIsUsable(int code) {
+    if (code <= 0 || code >= iTermComplexCharTableMaximumCode) {
+        return NO;
+    }
+    // These look like box-drawing characters to the renderer.
+    return !(code >= iTermBoxDrawingCodeMin && code <= iTermBoxDrawingCodeMax);
+}
+
+static uint32_t iTermComplexCharTableHash(const unichar *chars, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ chars[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Returns NULL if the page doesn't exist and |create| is NO.
+static iTermComplexCharSlot *iTermComplexCharTableSlot(int code, BOOL create) {
+    _Atomic(iTermComplexCharSlot *) *pagePointer = &gPages[code / iTermComplexCharTablePageSize];
+    iTermComplexCharSlot *page = atomic_load_explicit(pagePointer, memory_order_acquire);
+    if (!page) {
+        if (!create) {
+            return NULL;
+        }
+        iTermComplexCharSlot *newPage = calloc(iTermComplexCharTablePageSize, sizeof(iTermComplexCharSlot));
+        if (atomic_compare_exchange_strong_explicit(pagePointer,
+                                                    &page,
+                                                    newPage,
+                                                    memory_order_acq_rel,
+                                                    memory_order_acquire)) {
+            page = newPage;
+        } else {
+            // Another thread created it first. |page| now holds its page.
+            free(newPage);
+        }
+    }
+    return &page[code % iTermComplexCharTablePageSize];
+}
+
+static iTermComplexCharRecord *iTermComplexCharTableRecord(unichar code) {
+    if (code >= iTermComplexCharTableMaximumCode) {
+        return NULL;
+    }
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, NO);
+    if (!slot) {
+        return NULL;
+    }
+    iTermComplexCharRecord *record = atomic_load_explicit(&slot->record, memory_order_acquire);
+    return record == &gReservedRecord ? NULL : record;
+}
+
+static int iTermComplexCharTableFind(const unichar *chars, int length, uint32_t hash) {
+    const uint32_t mask = iTermComplexCharTableIndexSize - 1;
+    for (uint32_t i = hash & mask, n = 0; n < iTermComplexCharTableIndexSize; i = (i + 1) & mask, n++) {
+        const uint16_t code = atomic_load_explicit(&gIndex[i], memory_order_acquire);
+        if (code == iTermComplexCharTableIndexEmpty) {
+            return -1;
+        }
+        if (code == iTermComplexCharTableIndexTombstone) {
+            continue;
+        }
+        iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+        if (record &&
+            record->hash == hash &&
+            record->length == length &&
+            !memcmp(record->chars, chars, length * sizeof(unichar))) {
+            return code;
+        }
+    }
+    return -1;
+}
+
+#pragma mark - Records
+
+static iTermComplexCharRecord *iTermComplexCharTableNewRecord(const unichar *chars,
+                                                              int length,
+                                                              uint32_t hash,
+                                                              BOOL spacingCombiningMark) {
+    const int sizeClass = MAX(1, (length + 7) / 8);
+    const int capacity = sizeClass * 8;
+    iTermComplexCharRecord *record = NULL;
+    if (sizeClass < iTermComplexCharTableNumberOfSizeClasses) {
+        record = gFreeRecords[sizeClass];
+        if (record) {
+            gFreeRecords[sizeClass] = record->next;
+        } else {
+            const size_t size = (sizeof(iTermComplexCharRecord) + capacity * sizeof(unichar) + 7) & ~(size_t)7;
+            if (!gArenaChunk || gArenaChunkUsed + size > iTermComplexCharTableArenaChunkSize) {
+                // Chunks are never freed; their records go back on the free lists.
+                gArenaChunk = iTermMalloc(iTermComplexCharTableArenaChunkSize);
+                gArenaChunkUsed = 0;
+            }
+            record = (iTermComplexCharRecord *)(gArenaChunk + gArenaChunkUsed);
+            gArenaChunkUsed += size;
+        }
+    } else {
+        record = iTermMalloc(sizeof(iTermComplexCharRecord) + capacity * sizeof(unichar));
+    }
+    record->next = NULL;
+    record->retiredEpoch = 0;
+    record->hash = hash;
+    record->serial = gNumberOfRecordsCreated++;
+    record->length = length;
+    record->capacity = capacity;
+    record->spacingCombiningMark = spacingCombiningMark;
+    memcpy(record->chars, chars, length * sizeof(unichar));
+    return record;
+}
+
+static void iTermComplexCharTableFreeRecord(iTermComplexCharRecord *record) {
+    const int sizeClass = record->capacity / 8;
+    if (sizeClass < iTermComplexCharTableNumberOfSizeClasses) {
+        record->next = gFreeRecords[sizeClass];
+        gFreeRecords[sizeClass] = record;
+    } else {
+        free(record);
+    }
+}
+
+#pragma mark - Index
+
+static void iTermComplexCharTableIndexInsert(unichar code, uint32_t hash) {
+    const uint32_t mask = iTermComplexCharTableIndexSize - 1;
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        const uint16_t existing = atomic_load_explicit(&gIndex[i], memory_order_relaxed);
+        if (existing == iTermComplexCharTableIndexEmpty || existing == iTermComplexCharTableIndexTombstone) {
+            if (existing == iTermComplexCharTableIndexTombstone) {
+                gNumberOfTombstones--;
+            }
+            atomic_store_explicit(&gIndex[i], code, memory_order_release);
+            return;
+        }
+    }
+}
+
+static void iTermComplexCharTableIndexRemove(unichar code, uint32_t hash) {
+    const uint32_t mask = iTermComplexCharTableIndexSize - 1;
+    for (uint32_t i = hash & mask, n = 0; n < iTermComplexCharTableIndexSize; i = (i + 1) & mask, n++) {
+        const uint16_t existing = atomic_load_explicit(&gIndex[i], memory_order_relaxed);
+        if (existing == iTermComplexCharTableIndexEmpty) {
+            return;
+        }
+        if (existing == code) {
+            atomic_store_explicit(&gIndex[i], iTermComplexCharTableIndexTombstone, memory_order_release);
+            gNumberOfTombstones++;
+            return;
+        }
+    }
+}
+
+// Readers that run concurrently may miss entries. That's harmless because a miss is always retried
+// with the lock held before adding anything.
+static void iTermComplexCharTableRebuildIndex(void) {
+    DLog(@"Rebuild complex char index with %d codes and %d tombstones", gNumberOfCodesInUse, gNumberOfTombstones);
+    for (int i = 0; i < iTermComplexCharTableIndexSize; i++) {
+        atomic_store_explicit(&gIndex[i], iTermComplexCharTableIndexEmpty, memory_order_relaxed);
+    }
+    gNumberOfTombstones = 0;
+    for (int code = 1; code < iTermComplexCharTableMaximumCode; code++) {
+        iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+        if (record) {
+            iTermComplexCharTableIndexInsert(code, record->hash);
+        }
+    }
+}
+
+static void iTermComplexCharTablePublish(unichar code, iTermComplexCharRecord *record) {
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, YES);
+    atomic_store_explicit(&slot->record, record, memory_order_release);
+    gNumberOfCodesInUse++;
+    if (record != &gReservedRecord) {
+        iTermComplexCharTableIndexInsert(code, record->hash);
+        if ((gNumberOfCodesInUse + gNumberOfTombstones) * 4 > iTermComplexCharTableIndexSize * 3) {
+            iTermComplexCharTableRebuildIndex();
+        }
+    }
+}
+
+static void iTermComplexCharTableUnpublish(unichar code, iTermComplexCharSlot *slot) {
+    iTermComplexCharRecord *record = atomic_load_explicit(&slot->record, memory_order_relaxed);
+    atomic_store_explicit(&slot->record, NULL, memory_order_release);
+    gNumberOfCodesInUse--;
+    if (record != &gReservedRecord) {
+        iTermComplexCharTableIndexRemove(code, record->hash);
+        record->retiredEpoch = gEpoch;
+        record->next = gRetiredRecords;
+        gRetiredRecords = record;
+    }
+}
+
+#pragma mark - Allocating Codes
+
+static int iTermComplexCharTableTakeFreeCode(void) {
+    for (int n = 0; n < iTermComplexCharTableMaximumCode; n++) {
+        const int code = gNextCode;
+        gNextCode = (gNextCode + 1 < iTermComplexCharTableMaximumCode) ? gNextCode + 1 : 1;
+        if (!iTermComplexCharTableCodeIsUsable(code)) {
+            continue;
+        }
+        iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, YES);
+        if (!atomic_load_explicit(&slot->record, memory_order_relaxed) &&
+            !atomic_load_explicit(&slot->referenceCount, memory_order_relaxed)) {
+            return code;
+        }
+    }
+    return -1;
+}
+
+// Frees dead codes and returns how many were freed.
+static int iTermComplexCharTableReclaim(void) {
+    const NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    if (now - gEpochStart >= iTermComplexCharTableEpochDuration) {
+        gEpoch++;
+        gEpochStart = now;
+    }
+    // Free records retired before the previous epoch began. Near capacity reclamation can run
+    // again right away, so having been retired by an earlier pass isn't enough.
+    iTermComplexCharRecord **link = &gRetiredRecords;
+    while (*link) {
+        iTermComplexCharRecord *record = *link;
+        if (gEpoch - record->retiredEpoch < 2) {
+            link = &record->next;
+            continue;
+        }
+        *link = record->next;
+        iTermComplexCharTableFreeRecord(record);
+    }
+
+    iTermComplexCharMarks *marks = calloc(1, sizeof(*marks));
+    for (int i = 0; i < gNumberOfRoots; i++) {
+        gRoots[i].function(gRoots[i].context, marks);
+    }
+
+    int count = 0;
+    for (int code = 1; code < iTermComplexCharTableMaximumCode; code++) {
+        iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, NO);
+        if (!slot) {
+            code += iTermComplexCharTablePageSize - 1 - code % iTermComplexCharTablePageSize;
+            continue;
+        }
+        iTermComplexCharRecord *record = atomic_load_explicit(&slot->record, memory_order_relaxed);
+        if (!record ||
+            record == &gReservedRecord ||
+            gNumberOfRecordsCreated - record->serial < iTermComplexCharTableYoungRecords ||
+            atomic_load_explicit(&slot->referenceCount, memory_order_acquire) > 0 ||
+            ((marks->bits[code / 64] >> (code % 64)) & 1)) {
+            continue;
+        }
+        iTermComplexCharTableUnpublish(code, slot);
+        count++;
+    }
+    free(marks);
+    DLog(@"Reclaimed %d complex chars; %d remain in use", count, gNumberOfCodesInUse);
+    return count;
+}
+
+static int iTermComplexCharTableAllocateCode(void) {
+    int code = iTermComplexCharTableTakeFreeCode();
+    if (code < 0 && iTermComplexCharTableReclaim() > 0) {
+        code = iTermComplexCharTableTakeFreeCode();
+    }
+    return code;
+}
+
+#pragma mark - API
+
+void iTermComplexCharMarksAdd(iTermComplexCharMarks *marks, unichar code) {
+    marks->bits[code / 64] |= 1ULL << (code % 64);
+}
+
+int iTermComplexCharTableLookup(const unichar *chars, int length) {
+    return iTermComplexCharTableFind(chars, length, iTermComplexCharTableHash(chars, length));
+}
+
+int iTermComplexCharTableIntern(const unichar *chars,
+                                int length,
+                                BOOL spacingCombiningMark,
+                                BOOL *added) {
+    if (added) {
+        *added = NO;
+    }
+    const uint32_t hash = iTermComplexCharTableHash(chars, length);
+    int code = iTermComplexCharTableFind(chars, length, hash);
+    if (code >= 0) {
+        return code;
+    }
+    os_unfair_lock_lock(&gLock);
+    code = iTermComplexCharTableFind(chars, length, hash);
+    if (code < 0) {
+        code = iTermComplexCharTableAllocateCode();
+        if (code >= 0) {
+            iTermComplexCharTablePublish(code,
+                                         iTermComplexCharTableNewRecord(chars, length, hash, spacingCombiningMark));
+            if (added) {
+                *added = YES;
+            }
+        }
+    }
+    os_unfair_lock_unlock(&gLock);
+    return code;
+}
+
+int iTermComplexCharTableReserveCode(void) {
+    os_unfair_lock_lock(&gLock);
+    const int code = iTermComplexCharTableAllocateCode();
+    if (code >= 0) {
+        iTermComplexCharTablePublish(code, &gReservedRecord);
+    }
+    os_unfair_lock_unlock(&gLock);
+    return code;
+}
+
+void iTermComplexCharTableFreeReservedCode(unichar code) {
+    if (code >= iTermComplexCharTableMaximumCode) {
+        return;
+    }
+    os_unfair_lock_lock(&gLock);
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, NO);
+    if (slot && atomic_load_explicit(&slot->record, memory_order_relaxed) == &gReservedRecord) {
+        iTermComplexCharTableUnpublish(code, slot);
+    }
+    os_unfair_lock_unlock(&gLock);
+}
+
+NSString *iTermComplexCharTableString(unichar code) {
+    iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+    if (!record) {
+        return nil;
+    }
+    return [NSString stringWithCharacters:record->chars length:record->length];
+}
+
+int iTermComplexCharTableGetCharacters(unichar code, unichar *dest) {
+    iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+    if (!record) {
+        return 0;
+    }
+    memcpy(dest, record->chars, record->length * sizeof(unichar));
+    return record->length;
+}
+
+BOOL iTermComplexCharTableIsSpacingCombiningMark(unichar code) {
+    iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+    return record && record->spacingCombiningMark;
+}
+
+void iTermComplexCharTableRetain(unichar code) {
+    if (code >= iTermComplexCharTableMaximumCode) {
+        return;
+    }
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, YES);
+    atomic_fetch_add_explicit(&slot->referenceCount, 1, memory_order_relaxed);
+}
+
+void iTermComplexCharTableRelease(unichar code) {
+    if (code >= iTermComplexCharTableMaximumCode) {
+        return;
+    }
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, NO);
+    if (!slot) {
+        return;
+    }
+    const int previous = atomic_fetch_sub_explicit(&slot->referenceCount, 1, memory_order_release);
+    assert(previous > 0);
+}
+
+void iTermComplexCharTableAddRoot(void *context, iTermComplexCharTableMarkFunction function) {
+    os_unfair_lock_lock(&gLock);
+    if (gNumberOfRoots == gRootsCapacity) {
+        gRootsCapacity = MAX(16, gRootsCapacity * 2);
+        gRoots = realloc(gRoots, gRootsCapacity * sizeof(*gRoots));
+    }
+    gRoots[gNumberOfRoots++] = (iTermComplexCharRoot){ .context = context, .function = function };
+    os_unfair_lock_unlock(&gLock);
+}
+
+void iTermComplexCharTableRemoveRoot(void *context) {
+    os_unfair_lock_lock(&gLock);
+    for (int i = 0; i < gNumberOfRoots; i++) {
+        if (gRoots[i].context == context) {
+            gRoots[i] = gRoots[--gNumberOfRoots];
+            break;
+        }
+    }
+    os_unfair_lock_unlock(&gLock);
+}
+
+void iTermComplexCharTableEnumerate(void (^block)(unichar code, NSString *string, BOOL spacingCombiningMark)) {
+    for (int code = 1; code < iTermComplexCharTableMaximumCode; code++) {
+        iTermComplexCharRecord *record = iTermComplexCharTableRecord(code);
+        if (record) {
+            block(code,
+                  [NSString stringWithCharacters:record->chars length:record->length],
+                  record->spacingCombiningMark);
+        }
+    }
+}
+
+void iTermComplexCharTableRestore(unichar code, NSString *string, BOOL spacingCombiningMark) {
+    if (!iTermComplexCharTableCodeIsUsable(code)) {
+        return;
+    }
+    const int length = (int)string.length;
+    unichar *chars = iTermMalloc(MAX(1, length) * sizeof(unichar));
+    [string getCharacters:chars range:NSMakeRange(0, length)];
+
+    os_unfair_lock_lock(&gLock);
+    iTermComplexCharSlot *slot = iTermComplexCharTableSlot(code, YES);
+    if (!atomic_load_explicit(&slot->record, memory_order_relaxed)) {
+        if (!string) {
+            iTermComplexCharTablePublish(code, &gReservedRecord);
+        } else {
+            const uint32_t hash = iTermComplexCharTableHash(chars, length);
+            if (iTermComplexCharTableFind(chars, length, hash) < 0) {
+                iTermComplexCharTablePublish(code,
+                                             iTermComplexCharTableNewRecord(chars, length, hash, spacingCombiningMark));
+            }
+        }
+    }
+    os_unfair_lock_unlock(&gLock);
+    free(chars);
+}
+
+int iTermComplexCharTableNextCode(void) {
+    os_unfair_lock_lock(&gLock);
+    const int code = gNextCode;
+    os_unfair_lock_unlock(&gLock);
+    return code;
+}
+
+void iTermComplexCharTableSetNextCode(int code) {
+    os_unfair_lock_lock(&gLock);
+    gNextCode = (code > 0 && code < iTermComplexCharTableMaximumCode) ? code : 1;
+    os_unfair_lock_unlock(&gLock);
+}
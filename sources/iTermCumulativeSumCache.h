@@ -9,37 +9,42 @@
 
 NS_ASSUME_NONNULL_BEGIN
 
-// Stores an array of non-decreasing positive integer values. Provides access to quickly:
-// - Modify the first and last value
+// Stores an array of non-negative integer values. Provides access to quickly:
+// - Modify any value
 // - Append a value
 // - Remove the first or last value
 // - Locate the bucket whose range contains a value
 // - Sum a subrange of values
+// Each takes O(log(N)) time for N values or better.
 @interface iTermCumulativeSumCache : NSObject<NSCopying>
 
 @property (nonatomic) NSInteger offset;
 @property (nonatomic, readonly) NSInteger sumOfAllValues;
 @property (nonatomic, readonly) NSInteger count;
 
-// Returns NSNotFound if the value is largest than the maximum
+// Returns NSNotFound if the value is largest than the maximum. Empty buckets never contain a value.
 // Runs in O(log(N)) time for N=number of buckets.
 - (NSInteger)indexContainingValue:(NSInteger)value;
 
 // Debug version of the above
 - (NSInteger)verboseIndexContainingValue:(NSInteger)value;
 
-// Remove the first or last value in O(1) time.
+// Remove the first or last value in amortized O(log(N)) time.
 - (void)removeFirstValue;
 - (void)removeLastValue;
 
-// Update the first or last value in O(1) time.
+// Update the first or last value in O(log(N)) time.
 - (void)setLastValue:(NSInteger)value;
 - (void)setFirstValue:(NSInteger)value;
 
-// Add a value to the end in O(1) time.
+// Add a value to the end in O(log(N)) time.
 - (void)appendValue:(NSInteger)value;
 
-// Sum values in a range in O(1) time.
+// Replace the values in a range with those returned by the block in O(M*log(N)) time for M values
+// in the range.
+- (void)setValuesInRange:(NSRange)range withBlock:(NSInteger (^)(NSInteger index))block;
+
+// Sum values in a range in O(log(N)) time, or O(1) for all values.
 - (NSInteger)sumOfValuesInRange:(NSRange)range;
 
 - (NSInteger)valueAtIndex:(NSInteger)index;
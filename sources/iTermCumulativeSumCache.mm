@@ -10,23 +10,72 @@
 extern "C" {
 #import "DebugLogging.h"
 }
-#include <algorithm>
 #include <deque>
+#include <vector>
 
+// Values removed from the front stay in the tree as zeros. The tree is rebuilt once there are more
+// of them than values and at least this many.
+static const NSInteger iTermCumulativeSumCacheMinimumRemovedToRebuild = 1024;
+
+// Values are kept in a Fenwick tree, so prefix sums, searches, and updates all take O(log(N)).
+// Position p in the tree (1-based) holds the sum of values at positions (p - lowbit(p), p].
+// Removing a value from the front zeroes its position and advances _start rather than shifting.
 @implementation iTermCumulativeSumCache {
-    std::deque<NSInteger> _sums;
+    std::vector<NSInteger> _tree;  // _tree[0] is unused.
     std::deque<NSInteger> _values;
+    NSInteger _start;  // Number of removed positions before the value at index 0.
+    NSInteger _total;
+}
+
+static inline NSInteger iTermLowestBit(NSInteger i) {
+    return i & -i;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        _tree.push_back(0);
+    }
+    return self;
 }
 
 - (void)dump {
     int i = 0;
-    for (auto sum_i : _sums) {
-        DLog(@"_sums[%@] = %@", @(i++), @(sum_i));
+    for (auto value_i : _values) {
+        DLog(@"_values[%@] = %@ (sum=%@)", @(i), @(value_i), @([self sumOfValuesInRange:NSMakeRange(0, i + 1)]));
+        i++;
     }
+}
 
-    i = 0;
-    for (auto value_i : _values) {
-        DLog(@"_values[%@] = %@", @(i++), @(value_i));
+// Sum of the values at the first |position| positions.
+- (NSInteger)prefixSumAtPosition:(NSInteger)position {
+    NSInteger sum = 0;
+    for (NSInteger p = position; p > 0; p -= iTermLowestBit(p)) {
+        sum += _tree[p];
+    }
+    return sum;
+}
+
+- (void)addDelta:(NSInteger)delta atPosition:(NSInteger)position {
+    if (delta == 0) {
+        return;
+    }
+    const NSInteger size = _tree.size();
+    for (NSInteger p = position; p < size; p += iTermLowestBit(p)) {
+        _tree[p] += delta;
+    }
+}
+
+- (void)rebuild {
+    _start = 0;
+    _tree.assign(_values.size() + 1, 0);
+    const NSInteger size = _tree.size();
+    for (NSInteger p = 1; p < size; p++) {
+        _tree[p] += _values[p - 1];
+        const NSInteger parent = p + iTermLowestBit(p);
+        if (parent < size) {
+            _tree[parent] += _tree[p];
+        }
     }
 }
 
@@ -34,121 +83,144 @@ extern "C" {
     assert(range.location < NSIntegerMax);
     const NSInteger location = range.location;
     const NSInteger length = range.length;
-    const NSInteger limit = location + length;
     if (length == 0) {
         return 0;
     }
-
-    const int lowIndex = MAX(0, location);
-    const int highIndex = MAX(0, limit) - 1;
-    if (highIndex < lowIndex) {
+    const NSInteger count = _values.size();
+    const NSInteger low = MAX(0, MIN(count, location));
+    const NSInteger high = MAX(0, MIN(count, location + length));
+    if (high <= low) {
         return 0;
     }
-    return _sums[highIndex] - _sums[lowIndex] + _values[lowIndex];
+    if (low == 0 && high == count) {
+        return _total;
+    }
+    return [self prefixSumAtPosition:_start + high] - [self prefixSumAtPosition:_start + low];
 }
 
 - (NSInteger)sumOfAllValues {
-    return [self sumOfValuesInRange:NSMakeRange(0, _sums.size())];
-}
-
-- (NSInteger)maximumSum {
-    if (_sums.empty()) {
-        return 0;
-    }
-    return _sums.back();
+    return _total;
 }
 
 - (void)appendValue:(NSInteger)value {
-    _values.push_back(value);
-    if (_sums.empty()) {
+    if (_values.empty()) {
         _offset = 0;
-        _sums.push_back(value);
-    } else {
-        _sums.push_back(value + self.maximumSum);
+    }
+    _values.push_back(value);
+    _total += value;
+    const NSInteger p = _tree.size();
+    const NSInteger covered = [self prefixSumAtPosition:p - 1] - [self prefixSumAtPosition:p - iTermLowestBit(p)];
+    _tree.push_back(value + covered);
+}
+
+- (void)setValuesInRange:(NSRange)range withBlock:(NSInteger (^)(NSInteger index))block {
+    assert(NSMaxRange(range) <= _values.size());
+    for (NSInteger i = range.location; i < NSMaxRange(range); i++) {
+        const NSInteger value = block(i);
+        const NSInteger delta = value - _values[i];
+        _values[i] = value;
+        _total += delta;
+        [self addDelta:delta atPosition:_start + i + 1];
     }
 }
 
-- (NSInteger)indexContainingValue:(NSInteger)value {
-    // Subtract the offset because the offset is negative and our values are higher than what is exposed by the owner's interface.
-    const NSInteger adjustedValue = value - _offset;
-    auto it = std::lower_bound(_sums.begin(), _sums.end(), adjustedValue);
-    if (it == _sums.end()) {
-        return NSNotFound;
+// Returns the number of positions whose prefix sum doesn't exceed |value|. Values are never
+// negative, so this finds the position containing |value|.
+- (NSInteger)numberOfPositionsWithPrefixSumNotExceeding:(NSInteger)value {
+    const NSInteger size = _tree.size();
+    NSInteger step = 1;
+    while (step * 2 < size) {
+        step *= 2;
     }
-    // it refers to the first element in _sums greater or equal to value.
-    if (*it == adjustedValue) {
-        it++;
-        if (it == _sums.end()) {
-            return NSNotFound;
+    NSInteger position = 0;
+    NSInteger remaining = value;
+    for (; step > 0; step /= 2) {
+        if (position + step < size && _tree[position + step] <= remaining) {
+            position += step;
+            remaining -= _tree[position];
         }
     }
-    return it - _sums.begin();  // get index of iterator
+    return position;
 }
 
-- (NSInteger)verboseIndexContainingValue:(NSInteger)value {
-    DLog(@"Search for insertion index for value %@", @(value));
-    // Subtract the offset because the offset is negative and our values are higher than what is exposed by the owner's interface.
-    const NSInteger adjustedValue = value - _offset;
-    DLog(@"adjusted value is %@ because offset is %@", @(adjustedValue), @(_offset));
-    auto it = std::lower_bound(_sums.begin(), _sums.end(), adjustedValue);
-    if (it == _sums.end()) {
-        DLog(@"lower bound is past the end");
-        return NSNotFound;
+- (NSInteger)indexContainingValue:(NSInteger)value {
+    if (value < 0) {
+        return _values.empty() ? NSNotFound : 0;
     }
-    DLog(@"lower bound is %@", @(it - _sums.begin()));
-    // it refers to the first element in _sums greater or equal to value.
-    if (*it == adjustedValue) {
-        DLog(@"lower bound is exactly a bucket boundary");
-        it++;
-        if (it == _sums.end()) {
-            DLog(@"lower bound is past the end");
-            return NSNotFound;
-        }
+    const NSInteger index = [self numberOfPositionsWithPrefixSumNotExceeding:value] - _start;
+    if (index >= (NSInteger)_values.size()) {
+        return NSNotFound;
     }
-    const NSInteger index = it - _sums.begin();  // get index of iterator
+    return MAX(0, index);
+}
+
+- (NSInteger)verboseIndexContainingValue:(NSInteger)value {
+    DLog(@"Search for index containing value %@ among %@ values summing to %@",
+         @(value), @(_values.size()), @(_total));
+    const NSInteger index = [self indexContainingValue:value];
     DLog(@"Return %@", @(index));
     return index;
 }
 
 - (void)removeFirstValue {
-    _offset -= _values[0];
-    _sums.erase(_sums.begin());
-    _values.erase(_values.begin());
-    if (_sums.empty()) {
+    const NSInteger value = _values[0];
+    _offset -= value;
+    _total -= value;
+    [self addDelta:-value atPosition:_start + 1];
+    _values.pop_front();
+    _start++;
+    if (_values.empty()) {
         _offset = 0;
+        _total = 0;
+        _start = 0;
+        _tree.resize(1);
+    } else if (_start > iTermCumulativeSumCacheMinimumRemovedToRebuild &&
+               _start > (NSInteger)_values.size()) {
+        [self rebuild];
     }
 }
 
 - (void)removeLastValue {
-    _sums.pop_back();
+    _total -= _values.back();
+    // No other position's node includes the last position, so it can just be dropped.
+    _tree.pop_back();
     _values.pop_back();
-    if (_sums.empty()) {
+    if (_values.empty()) {
         _offset = 0;
+        _total = 0;
+        _start = 0;
+        _tree.resize(1);
     }
 }
 
 - (void)setLastValue:(NSInteger)value {
-    const NSInteger index = _sums.size() - 1;
+    const NSInteger index = _values.size() - 1;
     assert(index >= 1);
+    const NSInteger delta = value - _values[index];
     _values[index] = value;
-    _sums[index] = _sums[index - 1] + value;
+    _total += delta;
+    [self addDelta:delta atPosition:_start + index + 1];
 }
 
 - (void)setFirstValue:(NSInteger)value {
     const NSInteger cachedNumLines = _values[0];
     const NSInteger delta = value - cachedNumLines;
-    if (_sums.size() > 1) {
+    if (_values.size() > 1) {
         // Only ok to _drop_ lines from the first block when there are others after it.
         assert(delta <= 0);
     }
     _offset += delta;
+    _total += delta;
     _values[0] = value;
+    [self addDelta:delta atPosition:_start + 1];
 }
 
 - (id)copyWithZone:(NSZone *)zone {
     iTermCumulativeSumCache *theCopy = [[iTermCumulativeSumCache alloc] init];
-    theCopy->_sums = _sums;
+    theCopy->_tree = _tree;
     theCopy->_values = _values;
+    theCopy->_start = _start;
+    theCopy->_total = _total;
     theCopy->_offset = _offset;
     return theCopy;
 }
@@ -158,7 +230,7 @@ extern "C" {
 }
 
 - (NSInteger)sumAtIndex:(NSInteger)index {
-    return _sums[index];
+    return [self sumOfValuesInRange:NSMakeRange(0, index + 1)] - _offset;
 }
 
 - (NSInteger)count {
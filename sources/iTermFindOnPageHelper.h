@@ -103,6 +103,10 @@ scrollToFirstResult:(BOOL)scrollToFirstResult;
 - (void)removeSearchResultsInRange:(NSRange)range;
 - (void)removeAllSearchResults;
 
+// Moves search results, their highlights, and the find cursor on or after absolute line |absLine|
+// by |delta| lines.
+- (void)moveSearchResultsFromLine:(long long)absLine by:(int)delta width:(int)width;
+
 // Sets the location to start searching. TODO: Currently this only works for find next/prev.
 - (void)setStartPoint:(VT100GridAbsCoord)startPoint;
 
@@ -224,8 +224,10 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
                                                  }
                                              }];
     [_searchResults insertObject:searchResult atIndex:insertionIndex];
+    [self addHighlightsForSearchResult:searchResult width:width];
+}
 
-    // Update highlights.
+- (void)addHighlightsForSearchResult:(SearchResult *)searchResult width:(int)width {
     for (long long y = searchResult.absStartY; y <= searchResult.absEndY; y++) {
         NSNumber* key = [NSNumber numberWithLongLong:y];
         NSMutableData* data = _highlightMap[key];
@@ -433,6 +435,39 @@ scrollToFirstResult:(BOOL)scrollToFirstResult {
     }
 }
 
+- (void)moveSearchResultsFromLine:(long long)absLine by:(int)delta width:(int)width {
+    // Lines that results end up on after moving up may hold highlights of results that didn't move.
+    const long long firstChangedLine = MIN(absLine, absLine + delta);
+    for (NSNumber *key in _highlightMap.allKeys) {
+        if (key.longLongValue >= firstChangedLine) {
+            [_highlightMap removeObjectForKey:key];
+        }
+    }
+    // Results hash by position, so take them out of the set while they move.
+    NSArray<SearchResult *> *results = [[_searchResults.array copy] autorelease];
+    [_searchResults removeAllObjects];
+    for (SearchResult *result in results) {
+        if (result.absStartY >= absLine) {
+            result.absStartY = result.absStartY + delta;
+        }
+        if (result.absEndY >= absLine) {
+            result.absEndY = result.absEndY + delta;
+        }
+    }
+    [_searchResults addObjectsFromArray:results];
+    [_searchResults sortUsingComparator:^NSComparisonResult(SearchResult * _Nonnull obj1, SearchResult * _Nonnull obj2) {
+        return [obj2 compare:obj1];
+    }];
+    for (SearchResult *result in _searchResults) {
+        if (result.absEndY >= firstChangedLine) {
+            [self addHighlightsForSearchResult:result width:width];
+        }
+    }
+    if (_findCursor.y >= absLine) {
+        _findCursor.y += delta;
+    }
+}
+
 - (void)setStartPoint:(VT100GridAbsCoord)startPoint {
     _findCursor = startPoint;
 }
@@ -19,6 +19,22 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readonly) LineBlock *lastBlock;
 @property (nonatomic) BOOL resizing;
 
+// If set, line counts at a width first used while resizing are estimated for blocks that aren't
+// near the end, so resizing doesn't take time proportional to the length of history. Estimates are
+// settled as blocks are looked up or by -settleEstimatedLineCountsInBlocks:. Until then, the
+// number of wrapped lines and the line numbers of estimated blocks and those after them are
+// approximate.
+@property (nonatomic) BOOL estimatesLineCountsWhileResizing;
+@property (nonatomic, readonly) BOOL hasEstimatedLineCounts;
+
+// While set, compact blocks that get expanded stay expanded, so their cells can be read from other
+// threads. Clearing it compacts the least recently expanded blocks beyond the usual limit.
+@property (nonatomic) BOOL compactionDeferred;
+
+// Bytes used by the blocks, kept up to date as blocks are added, removed, compacted, compressed,
+// spilled, and expanded. Blocks shared with a copy of the array count in both.
+@property (nonatomic, readonly) NSInteger memoryUsage;
+
 // NOTE: Update -copyWithZone: if you add properties.
 
 - (LineBlock *)objectAtIndexedSubscript:(NSUInteger)index;
@@ -33,6 +49,15 @@ NS_ASSUME_NONNULL_BEGIN
                                             width:(int)width
                                         remainder:(out int *)remainderPtr;
 - (int)numberOfWrappedLinesForWidth:(int)width;
+// Replaces up to |maximumCount| estimated line counts with exact ones, starting from the end.
+// Returns YES if none remain.
+- (BOOL)settleEstimatedLineCountsInBlocks:(NSInteger)maximumCount;
+// Settling an estimate, however it happens, moves every line after its block. Calls |block| with
+// each move not yet removed, oldest first: the lines at |width| from |lineNumber| on moved by
+// |delta|. Line numbers are as of the move except that they account for lines since dropped from the
+// front, so moves must be applied in order.
+@property (nonatomic, readonly) BOOL hasLineMoves;
+- (void)removeLineMovesUsingBlock:(void (^)(int width, int lineNumber, int delta))block;
 - (void)enumerateLinesInRange:(NSRange)range
                         width:(int)width
                         block:(void (^)(screen_char_t *chars, int length, int eol, screen_char_t continuation, BOOL *stop))block;
@@ -28,10 +28,30 @@
 - (void)setFirstValueWithBlock:(NSInteger (^)(int width))block;
 - (void)setLastValueWithBlock:(NSInteger (^)(int width))block;
 - (void)appendValue:(NSInteger)value;
+
+// Estimated values are replaced with exact ones by settling them.
+@property (nonatomic, readonly) BOOL hasEstimatedValues;
+- (void)setEstimatedIndexes:(NSIndexSet *)indexes forWidth:(int)width;
+- (BOOL)valueAtIndexIsEstimated:(NSInteger)index forWidth:(int)width;
+- (void)settleValueAtIndex:(NSInteger)index
+                  forWidth:(int)width
+                 withBlock:(NSInteger (^)(int width))block;
+- (void)settleValuesAtIndex:(NSInteger)index withBlock:(NSInteger (^)(int width))block;
+// Settles up to |maximumCount| of the last estimated values of each width. Returns the number of
+// values settled.
+- (NSInteger)settleLastValues:(NSInteger)maximumCount
+                    withBlock:(NSInteger (^)(int width, NSInteger index))block;
+
+// Settling a value moves the lines after its block. Each move is a triple of width, the number the
+// first line after the block had before the move, and the number of lines it moved by. Oldest first.
+// Line numbers are kept current as values are removed from the front.
+@property (nonatomic, strong) NSMutableArray<iTermTriple<NSNumber *, NSNumber *, NSNumber *> *> *lineMoves;
 @end
 
 @implementation iTermLineBlockCacheCollection {
     NSMutableArray<iTermTuple<NSNumber *, iTermCumulativeSumCache *> *> *_caches;
+    // Width -> indexes of values in its cache that are estimates.
+    NSMutableDictionary<NSNumber *, NSMutableIndexSet *> *_estimatedIndexes;
 }
 
 - (instancetype)init {
@@ -39,6 +59,8 @@
     if (self) {
         _capacity = 1;
         _caches = [NSMutableArray array];
+        _estimatedIndexes = [NSMutableDictionary dictionary];
+        _lineMoves = [NSMutableArray array];
     }
     return self;
 }
@@ -49,6 +71,9 @@
     for (iTermTuple<NSNumber *, iTermCumulativeSumCache *> *tuple in _caches) {
         [theCopy->_caches addObject:[iTermTuple tupleWithObject:tuple.firstObject andObject:tuple.secondObject.copy]];
     }
+    [_estimatedIndexes enumerateKeysAndObjectsUsingBlock:^(NSNumber * _Nonnull width, NSMutableIndexSet * _Nonnull indexes, BOOL * _Nonnull stop) {
+        theCopy->_estimatedIndexes[width] = [indexes mutableCopy];
+    }];
     return theCopy;
 }
 
@@ -75,6 +100,16 @@
     return tuple.secondObject;
 }
 
+// Like -numLinesCacheForWidth: but doesn't count as a use.
+- (iTermCumulativeSumCache *)peekNumLinesCacheForWidth:(int)width {
+    for (iTermTuple<NSNumber *, iTermCumulativeSumCache *> *tuple in _caches) {
+        if (tuple.firstObject.intValue == width) {
+            return tuple.secondObject;
+        }
+    }
+    return nil;
+}
+
 - (void)setNumLinesCache:(iTermCumulativeSumCache *)numLinesCache forWidth:(int)width {
     iTermCumulativeSumCache *existing = [self numLinesCacheForWidth:width];
     assert(!existing);
@@ -85,25 +120,38 @@
 - (void)evictIfNeeded {
     while (_caches.count > _capacity) {
         DLog(@"Evicted cache of width %@", _caches.lastObject.firstObject);
+        [_estimatedIndexes removeObjectForKey:_caches.lastObject.firstObject];
+        [self removeLineMovesForWidth:_caches.lastObject.firstObject.intValue];
         [_caches removeLastObject];
     }
 }
 
 - (void)removeLastValue {
     for (iTermTuple<NSNumber *, iTermCumulativeSumCache *> *tuple in _caches) {
+        [_estimatedIndexes[tuple.firstObject] removeIndex:tuple.secondObject.count - 1];
         [tuple.secondObject removeLastValue];
     }
+    [self removeEmptyEstimatedIndexes];
 }
 
 - (void)removeFirstValue {
     for (iTermTuple<NSNumber *, iTermCumulativeSumCache *> *tuple in _caches) {
+        [self shiftLineMovesForWidth:tuple.firstObject.intValue by:-[tuple.secondObject valueAtIndex:0]];
         [tuple.secondObject removeFirstValue];
     }
+    for (NSMutableIndexSet *indexes in _estimatedIndexes.allValues) {
+        [indexes removeIndex:0];
+        [indexes shiftIndexesStartingAtIndex:1 by:-1];
+    }
+    [self removeEmptyEstimatedIndexes];
 }
 
 - (void)setFirstValueWithBlock:(NSInteger (^)(int width))block {
     for (iTermTuple<NSNumber *, iTermCumulativeSumCache *> *tuple in _caches) {
-        [tuple.secondObject setFirstValue:block(tuple.firstObject.intValue)];
+        const int width = tuple.firstObject.intValue;
+        const NSInteger value = block(width);
+        [self shiftLineMovesForWidth:width by:value - [tuple.secondObject valueAtIndex:0]];
+        [tuple.secondObject setFirstValue:value];
     }
 }
 
@@ -119,8 +167,130 @@
     }
 }
 
+#pragma mark Estimates
+
+- (BOOL)hasEstimatedValues {
+    return _estimatedIndexes.count > 0;
+}
+
+- (void)removeEmptyEstimatedIndexes {
+    for (NSNumber *width in _estimatedIndexes.allKeys) {
+        if (_estimatedIndexes[width].count == 0) {
+            [_estimatedIndexes removeObjectForKey:width];
+        }
+    }
+}
+
+- (void)setEstimatedIndexes:(NSIndexSet *)indexes forWidth:(int)width {
+    if (indexes.count == 0) {
+        [_estimatedIndexes removeObjectForKey:@(width)];
+    } else {
+        _estimatedIndexes[@(width)] = [indexes mutableCopy];
+    }
+}
+
+- (BOOL)valueAtIndexIsEstimated:(NSInteger)index forWidth:(int)width {
+    if (_estimatedIndexes.count == 0) {
+        return NO;
+    }
+    return [_estimatedIndexes[@(width)] containsIndex:index];
+}
+
+- (void)settleValueAtIndex:(NSInteger)index
+                  forWidth:(int)width
+                 withBlock:(NSInteger (^)(int width))block {
+    NSMutableIndexSet *indexes = _estimatedIndexes[@(width)];
+    if (![indexes containsIndex:index]) {
+        return;
+    }
+    [indexes removeIndex:index];
+    if (indexes.count == 0) {
+        [_estimatedIndexes removeObjectForKey:@(width)];
+    }
+    [self settleValuesInRange:NSMakeRange(index, 1)
+                     forWidth:width
+                    withBlock:^NSInteger(NSInteger i) {
+                        return block(width);
+                    }];
+}
+
+- (void)settleValuesAtIndex:(NSInteger)index withBlock:(NSInteger (^)(int width))block {
+    for (NSNumber *width in _estimatedIndexes.allKeys) {
+        [self settleValueAtIndex:index forWidth:width.intValue withBlock:block];
+    }
+}
+
+- (NSInteger)settleLastValues:(NSInteger)maximumCount
+                    withBlock:(NSInteger (^)(int width, NSInteger index))block {
+    NSInteger settled = 0;
+    for (NSNumber *width in _estimatedIndexes.allKeys) {
+        NSMutableIndexSet *indexes = _estimatedIndexes[width];
+        NSMutableIndexSet *indexesToSettle = [NSMutableIndexSet indexSet];
+        [indexes enumerateIndexesWithOptions:NSEnumerationReverse usingBlock:^(NSUInteger i, BOOL * _Nonnull stop) {
+            [indexesToSettle addIndex:i];
+            *stop = (indexesToSettle.count >= maximumCount);
+        }];
+        [indexes removeIndexes:indexesToSettle];
+        if (indexes.count == 0) {
+            [_estimatedIndexes removeObjectForKey:width];
+        }
+        [indexesToSettle enumerateRangesUsingBlock:^(NSRange range, BOOL * _Nonnull stop) {
+            [self settleValuesInRange:range forWidth:width.intValue withBlock:^NSInteger(NSInteger i) {
+                return block(width.intValue, i);
+            }];
+        }];
+        settled += indexesToSettle.count;
+    }
+    return settled;
+}
+
+- (void)settleValuesInRange:(NSRange)range
+                   forWidth:(int)width
+                  withBlock:(NSInteger (^)(NSInteger index))block {
+    iTermCumulativeSumCache *cache = [self peekNumLinesCacheForWidth:width];
+    [cache setValuesInRange:range withBlock:^NSInteger(NSInteger i) {
+        const NSInteger value = block(i);
+        const NSInteger delta = value - [cache valueAtIndex:i];
+        if (delta != 0) {
+            // The cache still has the old value, so this is where the next line was before the move.
+            const NSInteger lineNumber = [cache sumOfValuesInRange:NSMakeRange(0, i + 1)];
+            [self->_lineMoves addObject:[iTermTriple tripleWithObject:@(width)
+                                                            andObject:@(lineNumber)
+                                                               object:@(delta)]];
+        }
+        return value;
+    }];
+}
+
+#pragma mark Line Moves
+
+- (void)shiftLineMovesForWidth:(int)width by:(NSInteger)delta {
+    if (delta == 0) {
+        return;
+    }
+    for (iTermTriple<NSNumber *, NSNumber *, NSNumber *> *move in _lineMoves) {
+        if (move.firstObject.intValue == width) {
+            move.secondObject = @(MAX(0, move.secondObject.integerValue + delta));
+        }
+    }
+}
+
+- (void)removeLineMovesForWidth:(int)width {
+    [_lineMoves filterUsingPredicate:[NSPredicate predicateWithBlock:^BOOL(iTermTriple<NSNumber *, NSNumber *, NSNumber *> *move, NSDictionary *bindings) {
+        return move.firstObject.intValue != width;
+    }]];
+}
+
 @end
 
+// Compact blocks that were expanded to be read are compacted again once this many more recently
+// expanded blocks exist.
+static const NSUInteger iTermLineBlockArrayMaximumExpandedBlocks = 8;
+
+// When estimating line counts, blocks at the end are counted exactly until they hold this many
+// lines, which is more than any viewport. Only earlier blocks get estimates.
+static const int iTermLineBlockArrayMinimumExactLinesWhenEstimating = 1000;
+
 @implementation iTermLineBlockArray {
     NSMutableArray<LineBlock *> *_blocks;
     BOOL _mayHaveDoubleWidthCharacter;
@@ -133,6 +303,12 @@
     LineBlock *_tail;
     BOOL _headDirty;
     BOOL _tailDirty;
+
+    // Compact blocks whose cells are expanded, least recently expanded first.
+    NSMutableArray<LineBlock *> *_expandedBlocks;
+
+    // Sum of the blocks' reportedMemoryUsage.
+    NSInteger _memoryUsage;
     // NOTE: Update -copyWithZone: if you add member variables.
 }
 
@@ -140,6 +316,7 @@
     self = [super init];
     if (self) {
         _blocks = [NSMutableArray array];
+        _expandedBlocks = [NSMutableArray array];
         _numLinesCaches = [[iTermLineBlockCacheCollection alloc] init];
     }
     return self;
@@ -160,6 +337,17 @@
 
 #pragma mark - High level methods
 
+- (NSInteger)memoryUsage {
+    return _memoryUsage;
+}
+
+- (void)setCompactionDeferred:(BOOL)compactionDeferred {
+    _compactionDeferred = compactionDeferred;
+    if (!compactionDeferred) {
+        [self compactExpandedBlocksIfNeeded];
+    }
+}
+
 - (void)setResizing:(BOOL)resizing {
     _resizing = resizing;
     if (resizing) {
@@ -183,7 +371,9 @@
         block.mayHaveDoubleWidthCharacter = YES;
     }
     if (changed) {
+        NSMutableArray *lineMoves = _numLinesCaches.lineMoves;
         _numLinesCaches = [[iTermLineBlockCacheCollection alloc] init];
+        _numLinesCaches.lineMoves = lineMoves;
     }
 }
 
@@ -210,6 +400,10 @@
         return;
     }
 
+    if (_resizing && _estimatesLineCountsWhileResizing) {
+        [self buildEstimatedNumLinesCacheForWidth:width];
+        return;
+    }
     numLinesCache = [[iTermCumulativeSumCache alloc] init];
     for (LineBlock *block in _blocks) {
         const int block_lines = [block getNumLinesWithWrapWidth:width];
@@ -218,6 +412,74 @@
     [_numLinesCaches setNumLinesCache:numLinesCache forWidth:width];
 }
 
+// Counts lines exactly in the first block and in enough blocks at the end to lay out the screen.
+// The rest are estimated in constant time each and settled later.
+- (void)buildEstimatedNumLinesCacheForWidth:(int)width {
+    const NSInteger count = _blocks.count;
+    NSInteger firstExactTailIndex = count;
+    int exactLines = 0;
+    while (firstExactTailIndex > 1 && exactLines < iTermLineBlockArrayMinimumExactLinesWhenEstimating) {
+        firstExactTailIndex--;
+        exactLines += [_blocks[firstExactTailIndex] getNumLinesWithWrapWidth:width];
+    }
+
+    iTermCumulativeSumCache *numLinesCache = [[iTermCumulativeSumCache alloc] init];
+    NSMutableIndexSet *estimatedIndexes = [NSMutableIndexSet indexSet];
+    for (NSInteger i = 0; i < count; i++) {
+        LineBlock *block = _blocks[i];
+        if (i == 0 || i >= firstExactTailIndex || [block hasCachedNumLinesForWidth:width]) {
+            [numLinesCache appendValue:[block getNumLinesWithWrapWidth:width]];
+        } else {
+            [numLinesCache appendValue:[block estimatedNumLinesWithWrapWidth:width]];
+            [estimatedIndexes addIndex:i];
+        }
+    }
+    [_numLinesCaches setNumLinesCache:numLinesCache forWidth:width];
+    [_numLinesCaches setEstimatedIndexes:estimatedIndexes forWidth:width];
+    DLog(@"Estimated line counts of %@ of %@ blocks at width %@", @(estimatedIndexes.count), @(count), @(width));
+}
+
+- (BOOL)hasEstimatedLineCounts {
+    return _numLinesCaches.hasEstimatedValues;
+}
+
+- (BOOL)settleEstimatedLineCountsInBlocks:(NSInteger)maximumCount {
+    [self updateCacheIfNeeded];
+    [_numLinesCaches settleLastValues:maximumCount withBlock:^NSInteger(int width, NSInteger index) {
+        return [self->_blocks[index] getNumLinesWithWrapWidth:width];
+    }];
+    return !_numLinesCaches.hasEstimatedValues;
+}
+
+- (void)settleLineCountOfBlockAtIndex:(NSInteger)index width:(int)width {
+    if (![_numLinesCaches valueAtIndexIsEstimated:index forWidth:width]) {
+        return;
+    }
+    LineBlock *block = _blocks[index];
+    [_numLinesCaches settleValueAtIndex:index forWidth:width withBlock:^NSInteger(int width) {
+        return [block getNumLinesWithWrapWidth:width];
+    }];
+}
+
+- (void)settleLineCountsOfBlockAtIndex:(NSInteger)index {
+    LineBlock *block = _blocks[index];
+    [_numLinesCaches settleValuesAtIndex:index withBlock:^NSInteger(int width) {
+        return [block getNumLinesWithWrapWidth:width];
+    }];
+}
+
+- (BOOL)hasLineMoves {
+    return _numLinesCaches.lineMoves.count > 0;
+}
+
+- (void)removeLineMovesUsingBlock:(void (^)(int width, int lineNumber, int delta))block {
+    NSArray<iTermTriple<NSNumber *, NSNumber *, NSNumber *> *> *moves = [_numLinesCaches.lineMoves copy];
+    [_numLinesCaches.lineMoves removeAllObjects];
+    for (iTermTriple<NSNumber *, NSNumber *, NSNumber *> *move in moves) {
+        block(move.firstObject.intValue, move.secondObject.intValue, move.thirdObject.intValue);
+    }
+}
+
 - (void)oopsWithWidth:(int)width block:(void (^)(void))block {
     TurnOnDebugLoggingSilently();
 
@@ -258,7 +520,13 @@
     [self buildCacheForWidth:width];
     [self updateCacheIfNeeded];
     iTermCumulativeSumCache *numLinesCache = [_numLinesCaches numLinesCacheForWidth:width];
-    const NSInteger index = [numLinesCache indexContainingValue:lineNumber];
+    NSInteger index = [numLinesCache indexContainingValue:lineNumber];
+    // The remainder must be within the block's exact count. Settling a block moves the lines
+    // after it, so search again until the block found is exact.
+    while (index != NSNotFound && [_numLinesCaches valueAtIndexIsEstimated:index forWidth:width]) {
+        [self settleLineCountOfBlockAtIndex:index width:width];
+        index = [numLinesCache indexContainingValue:lineNumber];
+    }
 
     if (index == NSNotFound) {
         return NSNotFound;
@@ -311,6 +579,7 @@
     ITAssertWithMessage(numberLeft >= 0, @"Invalid length in range %@", NSStringFromRange(range));
     for (NSInteger i = startIndex; i < _blocks.count; i++) {
         LineBlock *block = _blocks[i];
+        [self settleLineCountOfBlockAtIndex:i width:width];
         // getNumLinesWithWrapWidth caches its result for the last-used width so
         // this is usually faster than calling getWrappedLineWithWrapWidth since
         // most calls to the latter will just decrement line and return NULL.
@@ -437,6 +706,7 @@
         *remainderPtr = position - [_rawSpaceCache sumOfValuesInRange:NSMakeRange(0, index)];
     }
     if (yoffsetPtr) {
+        [self settleLineCountOfBlockAtIndex:index width:width];
         *yoffsetPtr = [[_numLinesCaches numLinesCacheForWidth:width] sumOfValuesInRange:NSMakeRange(0, index)];
     }
     if (indexPtr) {
@@ -491,8 +761,11 @@
     }
     index--;
     [_blocks[index] removeObserver:self];
+    [_expandedBlocks removeObject:_blocks[index]];
+    _memoryUsage -= _blocks[index].reportedMemoryUsage;
     _blocks[index] = [_blocks[index] copy];
     [_blocks[index] addObserver:self];
+    _memoryUsage += _blocks[index].reportedMemoryUsage;
     _head = _blocks.firstObject;
     _tail = _blocks.lastObject;
 }
@@ -501,6 +774,7 @@
     [self updateCacheIfNeeded];
     [block addObserver:self];
     [_blocks addObject:block];
+    _memoryUsage += block.reportedMemoryUsage;
     if (_blocks.count == 1) {
         _head = block;
     }
@@ -517,12 +791,18 @@
 - (void)removeFirstBlock {
     [self updateCacheIfNeeded];
     [_blocks.firstObject removeObserver:self];
+    [_expandedBlocks removeObject:_blocks.firstObject];
+    _memoryUsage -= _blocks.firstObject.reportedMemoryUsage;
     [_numLinesCaches removeFirstValue];
     [_rawSpaceCache removeFirstValue];
     [_rawLinesCache removeFirstValue];
     [_blocks removeObjectAtIndex:0];
     _head = _blocks.firstObject;
     _tail = _blocks.lastObject;
+    if (_head) {
+        // The first value can only be updated by shrinking it, which needs it to be exact.
+        [self settleLineCountsOfBlockAtIndex:0];
+    }
 }
 
 - (void)removeFirstBlocks:(NSInteger)count {
@@ -534,12 +814,17 @@
 - (void)removeLastBlock {
     [self updateCacheIfNeeded];
     [_blocks.lastObject removeObserver:self];
+    [_expandedBlocks removeObject:_blocks.lastObject];
+    _memoryUsage -= _blocks.lastObject.reportedMemoryUsage;
     [_blocks removeLastObject];
     [_numLinesCaches removeLastValue];
     [_rawSpaceCache removeLastValue];
     [_rawLinesCache removeLastValue];
     _head = _blocks.firstObject;
     _tail = _blocks.lastObject;
+    if (_tail) {
+        [self settleLineCountsOfBlockAtIndex:_blocks.count - 1];
+    }
 }
 
 - (NSUInteger)count {
@@ -618,6 +903,9 @@
     theCopy->_tail = _tail;
     theCopy->_tailDirty = _tailDirty;
     theCopy->_resizing = _resizing;
+    theCopy->_estimatesLineCountsWhileResizing = _estimatesLineCountsWhileResizing;
+    theCopy->_memoryUsage = _memoryUsage;
+    // _expandedBlocks is not copied. The copy only compacts blocks that it caused to be expanded.
     for (LineBlock *block in _blocks) {
         [block addObserver:theCopy];
     }
@@ -635,4 +923,26 @@
     }
 }
 
+- (void)lineBlockDidExpand:(LineBlock *)lineBlock {
+    [_expandedBlocks removeObject:lineBlock];
+    [_expandedBlocks addObject:lineBlock];
+    if (!_compactionDeferred) {
+        [self compactExpandedBlocksIfNeeded];
+    }
+}
+
+- (void)lineBlock:(LineBlock *)lineBlock memoryUsageDidChangeBy:(NSInteger)delta {
+    _memoryUsage += delta;
+}
+
+#pragma mark - Private
+
+- (void)compactExpandedBlocksIfNeeded {
+    while (_expandedBlocks.count > iTermLineBlockArrayMaximumExpandedBlocks) {
+        LineBlock *oldest = _expandedBlocks.firstObject;
+        [_expandedBlocks removeObjectAtIndex:0];
+        [oldest discardExpandedCells];
+    }
+}
+
 @end
@@ -0,0 +1,50 @@
+//
+//  iTermLiteralSearch.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "iTermFindViewController.h"
+#import "ScreenChar.h"
+
+// A literal search that works on the codes of screen_char_t's rather than on an NSString made from
+// them. It applies only when both the search string and the line are ASCII, because that is the
+// only case where NSString's case-, diacritic-, and width-insensitive matching (and its canonical
+// equivalence in case-sensitive searches) reduces to comparing bytes. Lines with complex chars,
+// images, private codes (double-width character halves, tab fillers), or any other non-ASCII
+// character must be searched the regular way.
+//
+// Cells are first copied to a byte per cell, folded to lowercase for a case-insensitive search.
+// Indexes in the copy are then the same as indexes in the line. Candidates are found sixteen
+// positions at a time by comparing the first and last bytes of the search string, and only
+// candidates are compared in full.
+
+#define iTermLiteralSearchNeedleMaxLength 256
+
+typedef struct {
+    unsigned char bytes[iTermLiteralSearchNeedleMaxLength];
+    int length;
+    BOOL caseInsensitive;
+} iTermLiteralSearchNeedle;
+
+// Returns NO if |string| can't be searched for literally: it's a regex, empty, longer than
+// iTermLiteralSearchNeedleMaxLength, or not all printable ASCII.
+BOOL iTermLiteralSearchNeedleInit(iTermLiteralSearchNeedle *needle, NSString *string, iTermFindMode mode);
+
+// Copies the codes of |length| cells of |line| to |dest|, which must have room for |length| bytes.
+// Returns NO if any cell isn't ASCII, in which case |dest| is garbage.
+BOOL iTermLiteralSearchCopyHaystack(unsigned char *dest,
+                                    const screen_char_t *line,
+                                    int length,
+                                    const iTermLiteralSearchNeedle *needle);
+
+// Returns the first position at or after |from| where |needle| starts, or -1.
+int iTermLiteralSearchForward(const iTermLiteralSearchNeedle *needle,
+                              const unsigned char *haystack,
+                              int length,
+                              int from);
+
+// Returns the last position where |needle| starts and ends at or before |limit|, or -1.
+int iTermLiteralSearchBackward(const iTermLiteralSearchNeedle *needle,
+                               const unsigned char *haystack,
+                               int limit);
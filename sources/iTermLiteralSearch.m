@@ -0,0 +1,188 @@
+//
+//  iTermLiteralSearch.m
+//  iTerm2
+//
+
+#import "iTermLiteralSearch.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+BOOL iTermLiteralSearchNeedleInit(iTermLiteralSearchNeedle *needle, NSString *string, iTermFindMode mode) {
+    if (mode == iTermFindModeCaseSensitiveRegex || mode == iTermFindModeCaseInsensitiveRegex) {
+        return NO;
+    }
+    const NSUInteger length = string.length;
+    if (length == 0 || length > iTermLiteralSearchNeedleMaxLength) {
+        return NO;
+    }
+    unichar chars[iTermLiteralSearchNeedleMaxLength];
+    [string getCharacters:chars range:NSMakeRange(0, length)];
+    BOOL hasUppercase = NO;
+    for (NSUInteger i = 0; i < length; i++) {
+        if (chars[i] < ' ' || chars[i] >= 0x7f) {
+            return NO;
+        }
+        if (chars[i] >= 'A' && chars[i] <= 'Z') {
+            hasUppercase = YES;
+        }
+    }
+    needle->length = (int)length;
+    needle->caseInsensitive = (mode == iTermFindModeCaseInsensitiveSubstring ||
+                               (mode == iTermFindModeSmartCaseSensitivity && !hasUppercase));
+    for (NSUInteger i = 0; i < length; i++) {
+        unichar c = chars[i];
+        if (needle->caseInsensitive && c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        needle->bytes[i] = c;
+    }
+    return YES;
+}
+
+BOOL iTermLiteralSearchCopyHaystack(unsigned char *dest,
+                                    const screen_char_t *line,
+                                    int length,
+                                    const iTermLiteralSearchNeedle *needle) {
+    // Bits set in any of these reject the line. Checking once at the end keeps the loop free of
+    // branches.
+    unsigned int rejected = 0;
+    if (needle->caseInsensitive) {
+        for (int i = 0; i < length; i++) {
+            const unsigned int code = line[i].code;
+            rejected |= (code & ~0x7f) | line[i].complexChar | line[i].image;
+            dest[i] = code | ((code - 'A' < 26) << 5);
+        }
+    } else {
+        for (int i = 0; i < length; i++) {
+            const unsigned int code = line[i].code;
+            rejected |= (code & ~0x7f) | line[i].complexChar | line[i].image;
+            dest[i] = code;
+        }
+    }
+    return rejected == 0;
+}
+
+// Compares the bytes between the first and last, which the prefilter has already matched.
+NS_INLINE BOOL iTermLiteralSearchInteriorMatches(const iTermLiteralSearchNeedle *needle,
+                                                 const unsigned char *candidate) {
+    return needle->length <= 2 || memcmp(candidate + 1, needle->bytes + 1, needle->length - 2) == 0;
+}
+
+int iTermLiteralSearchForward(const iTermLiteralSearchNeedle *needle,
+                              const unsigned char *haystack,
+                              int length,
+                              int from) {
+    const int n = needle->length;
+    const unsigned char first = needle->bytes[0];
+    const unsigned char last = needle->bytes[n - 1];
+    // Positions in [from, end) can start a match.
+    const int end = length - n + 1;
+    int i = from;
+#if defined(__SSE2__)
+    const __m128i firsts = _mm_set1_epi8(first);
+    const __m128i lasts = _mm_set1_epi8(last);
+    while (i + 16 <= end) {
+        const __m128i starts = _mm_loadu_si128((const __m128i *)(haystack + i));
+        const __m128i ends = _mm_loadu_si128((const __m128i *)(haystack + i + n - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, firsts),
+                                                   _mm_cmpeq_epi8(ends, lasts)));
+        while (mask) {
+            const int candidate = i + __builtin_ctz(mask);
+            if (iTermLiteralSearchInteriorMatches(needle, haystack + candidate)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t firsts = vdupq_n_u8(first);
+    const uint8x16_t lasts = vdupq_n_u8(last);
+    while (i + 16 <= end) {
+        const uint8x16_t hits = vandq_u8(vceqq_u8(vld1q_u8(haystack + i), firsts),
+                                         vceqq_u8(vld1q_u8(haystack + i + n - 1), lasts));
+        if (vmaxvq_u8(hits)) {
+            // Four bits per position, as in iTermPrintableASCIIPrefixLength.
+            const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+            while (mask) {
+                const int candidate = i + (__builtin_ctzll(mask) >> 2);
+                if (iTermLiteralSearchInteriorMatches(needle, haystack + candidate)) {
+                    return candidate;
+                }
+                mask &= ~(0xfULL << (__builtin_ctzll(mask) & ~3));
+            }
+        }
+        i += 16;
+    }
+#endif
+    for (; i < end; i++) {
+        if (haystack[i] == first &&
+            haystack[i + n - 1] == last &&
+            iTermLiteralSearchInteriorMatches(needle, haystack + i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int iTermLiteralSearchBackward(const iTermLiteralSearchNeedle *needle,
+                               const unsigned char *haystack,
+                               int limit) {
+    const int n = needle->length;
+    const unsigned char first = needle->bytes[0];
+    const unsigned char last = needle->bytes[n - 1];
+    // Positions in [0, end) can start a match. Blocks of sixteen are examined from the right.
+    int end = limit - n + 1;
+#if defined(__SSE2__)
+    const __m128i firsts = _mm_set1_epi8(first);
+    const __m128i lasts = _mm_set1_epi8(last);
+    while (end >= 16) {
+        const int i = end - 16;
+        const __m128i starts = _mm_loadu_si128((const __m128i *)(haystack + i));
+        const __m128i ends = _mm_loadu_si128((const __m128i *)(haystack + i + n - 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, firsts),
+                                                   _mm_cmpeq_epi8(ends, lasts)));
+        while (mask) {
+            const int bit = 31 - __builtin_clz(mask);
+            if (iTermLiteralSearchInteriorMatches(needle, haystack + i + bit)) {
+                return i + bit;
+            }
+            mask &= ~(1 << bit);
+        }
+        end = i;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t firsts = vdupq_n_u8(first);
+    const uint8x16_t lasts = vdupq_n_u8(last);
+    while (end >= 16) {
+        const int i = end - 16;
+        const uint8x16_t hits = vandq_u8(vceqq_u8(vld1q_u8(haystack + i), firsts),
+                                         vceqq_u8(vld1q_u8(haystack + i + n - 1), lasts));
+        if (vmaxvq_u8(hits)) {
+            const uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(hits), 4);
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+            while (mask) {
+                const int bit = (63 - __builtin_clzll(mask)) >> 2;
+                if (iTermLiteralSearchInteriorMatches(needle, haystack + i + bit)) {
+                    return i + bit;
+                }
+                mask &= ~(0xfULL << (bit * 4));
+            }
+        }
+        end = i;
+    }
+#endif
+    for (int i = end - 1; i >= 0; i--) {
+        if (haystack[i] == first &&
+            haystack[i + n - 1] == last &&
+            iTermLiteralSearchInteriorMatches(needle, haystack + i)) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,95 @@
+//
+//  iTermPTYRecording.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "VT100GridTypes.h"
+
+// A PTY recording captures everything a session's job wrote, exactly as it was read, along with
+// when it arrived and when the window size changed. Feeding it back through a parser reproduces
+// the session's output offline.
+//
+// File format (all integers are unsigned LEB128 varints):
+//   Header:  the 8 bytes "iTermPTY", then one version byte (currently 1).
+//   Records: one type byte, the number of microseconds since the previous record (or since the
+//            recording began, for the first one), then a payload:
+//              iTermPTYRecordingEventTypeOutput: length, then that many bytes of output.
+//              iTermPTYRecordingEventTypeSize:   width, then height.
+// The file is only ever appended to. A record cut short by a crash is ignored by the reader.
+
+typedef NS_ENUM(uint8_t, iTermPTYRecordingEventType) {
+    iTermPTYRecordingEventTypeOutput = 1,
+    iTermPTYRecordingEventTypeSize = 2
+};
+
+extern NSString *const iTermPTYRecordingPathExtension;
+
+// Writes a recording. Records are buffered in memory and written when the buffer fills, when more
+// than a second has passed since the last write, or on -close, so a busy session doesn't make
+// a system call per read. Safe to use from any thread.
+@interface iTermPTYRecorder : NSObject
+
+@property(nonatomic, readonly) NSString *path;
+
+// Creates (or truncates) the file at |path| and writes the header. Returns nil on failure.
+- (instancetype)initWithPath:(NSString *)path NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+// Called with bytes just read from the PTY.
+- (void)recordOutput:(const char *)bytes length:(int)length;
+
+// Called when the size of the PTY changes, and once at the start with the initial size.
+- (void)recordSize:(VT100GridSize)size;
+
+// Writes out anything buffered and closes the file. Further records are ignored.
+- (void)close;
+
+@end
+
+// A recording read back from disk.
+@interface iTermPTYRecording : NSObject
+
+// Total number of output bytes.
+@property(nonatomic, readonly) long long outputLength;
+
+// Time from the first record to the last.
+@property(nonatomic, readonly) NSTimeInterval duration;
+
++ (instancetype)recordingWithContentsOfFile:(NSString *)path;
+
+// Returns nil if |data| doesn't have a recording header.
+- (instancetype)initWithData:(NSData *)data NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+// Calls |block| for each record in order. |timestamp| is relative to the start of the recording.
+// |output| is set only for output records and |size| only for size records. |output| points into
+// the recording's storage.
+- (void)enumerateEventsUsingBlock:(void (^)(iTermPTYRecordingEventType type,
+                                            NSTimeInterval timestamp,
+                                            NSData *output,
+                                            VT100GridSize size,
+                                            BOOL *stop))block;
+
+@end
+
+// Replays a recording by calling its handlers on the main queue, either with the original timing
+// or as fast as possible.
+@interface iTermPTYRecordingPlayer : NSObject
+
+@property(nonatomic, copy) void (^outputHandler)(NSData *output);
+@property(nonatomic, copy) void (^sizeHandler)(VT100GridSize size);
+@property(nonatomic, copy) void (^completion)(void);
+
+- (instancetype)initWithRecording:(iTermPTYRecording *)recording NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+// When |originalSpeed| is NO, every event is delivered synchronously before this returns.
+// Otherwise events are scheduled relative to now and this returns immediately. The player retains
+// itself until the last event has been delivered or it is canceled.
+- (void)playAtOriginalSpeed:(BOOL)originalSpeed;
+
+// Stops delivering events. The completion block is not called.
+- (void)cancel;
+
+@end
@@ -0,0 +1,436 @@
+//
+//  iTermPTYRecording.m
+//  iTerm2
+//
+
+#import "iTermPTYRecording.h"
+
+#import "DebugLogging.h"
+
+#import <mach/mach_time.h>
+#import <os/lock.h>
+
+NSString *const iTermPTYRecordingPathExtension = @"itermpty";
+
+static const char iTermPTYRecordingMagic[8] = { 'i', 'T', 'e', 'r', 'm', 'P', 'T', 'Y' };
+static const uint8_t iTermPTYRecordingVersion = 1;
+
+// Room for a type byte and three varints.
+static const int kMaximumRecordHeaderLength = 32;
+static const NSUInteger kRecorderBufferCapacity = 64 * 1024;
+static const uint64_t kRecorderFlushIntervalMicroseconds = 1000000;
+
+static uint64_t iTermPTYRecordingMicroseconds(void) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return mach_absolute_time() * timebase.numer / timebase.denom / 1000;
+}
+
+static int iTermPTYRecordingEncodeVarint(uint64_t value, unsigned char *output) {
+    int n = 0;
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            byte |= 0x80;
+        }
+        output[n++] = byte;
+    } while (value);
+    return n;
+}
+
+// Returns the number of bytes consumed, or 0 if the varint runs past |end|.
+static int iTermPTYRecordingDecodeVarint(const unsigned char *bytes,
+                                         const unsigned char *end,
+                                         uint64_t *valueOut) {
+    uint64_t value = 0;
+    int shift = 0;
+    const unsigned char *p = bytes;
+    while (p < end && shift < 64) {
+        const unsigned char byte = *p++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *valueOut = value;
+            return (int)(p - bytes);
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+@implementation iTermPTYRecorder {
+    os_unfair_lock _lock;
+    int _fd;
+    unsigned char *_buffer;
+    NSUInteger _used;
+    uint64_t _lastRecordTime;
+    uint64_t _lastWriteTime;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    self = [super init];
+    if (self) {
+        _fd = open(path.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (_fd < 0) {
+            DLog(@"Failed to open PTY recording at %@: %s", path, strerror(errno));
+            [self release];
+            return nil;
+        }
+        _path = [path copy];
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _buffer = malloc(kRecorderBufferCapacity);
+        memcpy(_buffer, iTermPTYRecordingMagic, sizeof(iTermPTYRecordingMagic));
+        _buffer[sizeof(iTermPTYRecordingMagic)] = iTermPTYRecordingVersion;
+        _used = sizeof(iTermPTYRecordingMagic) + 1;
+        _lastRecordTime = iTermPTYRecordingMicroseconds();
+        _lastWriteTime = _lastRecordTime;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+    free(_buffer);
+    [_path release];
+    [super dealloc];
+}
+
+- (void)recordOutput:(const char *)bytes length:(int)length {
+    if (length <= 0) {
+        return;
+    }
+    unsigned char header[kMaximumRecordHeaderLength];
+    os_unfair_lock_lock(&_lock);
+    const int headerLength = [self encodeHeaderOfType:iTermPTYRecordingEventTypeOutput
+                                                 into:header];
+    const int lengthLength = iTermPTYRecordingEncodeVarint(length, header + headerLength);
+    [self appendBytes:header length:headerLength + lengthLength];
+    [self appendBytes:(const unsigned char *)bytes length:length];
+    [self writeIfStale];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recordSize:(VT100GridSize)size {
+    unsigned char header[kMaximumRecordHeaderLength];
+    os_unfair_lock_lock(&_lock);
+    int n = [self encodeHeaderOfType:iTermPTYRecordingEventTypeSize into:header];
+    n += iTermPTYRecordingEncodeVarint(MAX(0, size.width), header + n);
+    n += iTermPTYRecordingEncodeVarint(MAX(0, size.height), header + n);
+    [self appendBytes:header length:n];
+    [self writeIfStale];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)close {
+    os_unfair_lock_lock(&_lock);
+    if (_fd >= 0) {
+        [self writeBuffer];
+        close(_fd);
+        _fd = -1;
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+#pragma mark - Private
+
+// Must hold _lock.
+- (int)encodeHeaderOfType:(iTermPTYRecordingEventType)type into:(unsigned char *)header {
+    const uint64_t now = iTermPTYRecordingMicroseconds();
+    const uint64_t delta = now - _lastRecordTime;
+    _lastRecordTime = now;
+    header[0] = type;
+    return 1 + iTermPTYRecordingEncodeVarint(delta, header + 1);
+}
+
+// Must hold _lock.
+- (void)appendBytes:(const unsigned char *)bytes length:(NSUInteger)length {
+    if (_fd < 0) {
+        return;
+    }
+    if (_used + length > kRecorderBufferCapacity) {
+        [self writeBuffer];
+    }
+    if (length > kRecorderBufferCapacity) {
+        // Too big to buffer. The buffer was just emptied so ordering is preserved.
+        [self writeBytes:bytes length:length];
+        return;
+    }
+    memcpy(_buffer + _used, bytes, length);
+    _used += length;
+}
+
+// Must hold _lock. Makes sure a recording left running during an incident is mostly on disk even
+// if iTerm2 never gets to close it.
+- (void)writeIfStale {
+    if (_used > 0 && _lastRecordTime - _lastWriteTime >= kRecorderFlushIntervalMicroseconds) {
+        [self writeBuffer];
+    }
+}
+
+// Must hold _lock.
+- (void)writeBuffer {
+    [self writeBytes:_buffer length:_used];
+    _used = 0;
+    _lastWriteTime = _lastRecordTime;
+}
+
+// Must hold _lock.
+- (void)writeBytes:(const unsigned char *)bytes length:(NSUInteger)length {
+    while (_fd >= 0 && length > 0) {
+        const ssize_t n = write(_fd, bytes, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            DLog(@"Stopping PTY recording to %@ after write failed: %s", _path, strerror(errno));
+            close(_fd);
+            _fd = -1;
+            return;
+        }
+        bytes += n;
+        length -= n;
+    }
+}
+
+@end
+
+@implementation iTermPTYRecording {
+    NSData *_data;
+}
+
++ (instancetype)recordingWithContentsOfFile:(NSString *)path {
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!data) {
+        return nil;
+    }
+    return [[[self alloc] initWithData:data] autorelease];
+}
+
+- (instancetype)initWithData:(NSData *)data {
+    const NSUInteger headerLength = sizeof(iTermPTYRecordingMagic) + 1;
+    if (data.length < headerLength ||
+        memcmp(data.bytes, iTermPTYRecordingMagic, sizeof(iTermPTYRecordingMagic)) ||
+        ((const unsigned char *)data.bytes)[sizeof(iTermPTYRecordingMagic)] != iTermPTYRecordingVersion) {
+        [self release];
+        return nil;
+    }
+    self = [super init];
+    if (self) {
+        _data = [data retain];
+        __block long long outputLength = 0;
+        __block NSTimeInterval duration = 0;
+        [self enumerateEventsUsingBlock:^(iTermPTYRecordingEventType type,
+                                          NSTimeInterval timestamp,
+                                          NSData *output,
+                                          VT100GridSize size,
+                                          BOOL *stop) {
+            outputLength += output.length;
+            duration = timestamp;
+        }];
+        _outputLength = outputLength;
+        _duration = duration;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_data release];
+    [super dealloc];
+}
+
+- (void)enumerateEventsUsingBlock:(void (^)(iTermPTYRecordingEventType type,
+                                            NSTimeInterval timestamp,
+                                            NSData *output,
+                                            VT100GridSize size,
+                                            BOOL *stop))block {
+    const unsigned char *bytes = _data.bytes;
+    const unsigned char *end = bytes + _data.length;
+    const unsigned char *p = bytes + sizeof(iTermPTYRecordingMagic) + 1;
+    uint64_t microseconds = 0;
+    BOOL stop = NO;
+    while (!stop && p < end) {
+        const iTermPTYRecordingEventType type = *p++;
+        uint64_t delta;
+        int n = iTermPTYRecordingDecodeVarint(p, end, &delta);
+        if (!n) {
+            return;
+        }
+        p += n;
+        microseconds += delta;
+        const NSTimeInterval timestamp = microseconds / 1000000.0;
+
+        switch (type) {
+            case iTermPTYRecordingEventTypeOutput: {
+                uint64_t length;
+                n = iTermPTYRecordingDecodeVarint(p, end, &length);
+                if (!n || length > (uint64_t)(end - p - n)) {
+                    return;
+                }
+                p += n;
+                @autoreleasepool {
+                    NSData *output = [NSData dataWithBytesNoCopy:(void *)p
+                                                          length:length
+                                                    freeWhenDone:NO];
+                    block(type, timestamp, output, VT100GridSizeMake(0, 0), &stop);
+                }
+                p += length;
+                break;
+            }
+
+            case iTermPTYRecordingEventTypeSize: {
+                uint64_t width, height;
+                n = iTermPTYRecordingDecodeVarint(p, end, &width);
+                if (!n) {
+                    return;
+                }
+                p += n;
+                n = iTermPTYRecordingDecodeVarint(p, end, &height);
+                if (!n) {
+                    return;
+                }
+                p += n;
+                block(type, timestamp, nil, VT100GridSizeMake((int)width, (int)height), &stop);
+                break;
+            }
+
+            default:
+                DLog(@"Unknown PTY recording event type %d", (int)type);
+                return;
+        }
+    }
+}
+
+@end
+
+@implementation iTermPTYRecordingPlayer {
+    iTermPTYRecording *_recording;
+    NSMutableArray<NSDictionary *> *_events;
+    NSInteger _nextEvent;
+    NSTimeInterval _startTime;
+    BOOL _canceled;
+}
+
+- (instancetype)initWithRecording:(iTermPTYRecording *)recording {
+    self = [super init];
+    if (self) {
+        _recording = [recording retain];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_recording release];
+    [_events release];
+    [_outputHandler release];
+    [_sizeHandler release];
+    [_completion release];
+    [super dealloc];
+}
+
+- (void)playAtOriginalSpeed:(BOOL)originalSpeed {
+    _canceled = NO;
+    if (!originalSpeed) {
+        [_recording enumerateEventsUsingBlock:^(iTermPTYRecordingEventType type,
+                                                NSTimeInterval timestamp,
+                                                NSData *output,
+                                                VT100GridSize size,
+                                                BOOL *stop) {
+            [self deliverEventOfType:type output:output size:size];
+            *stop = _canceled;
+        }];
+        if (!_canceled && _completion) {
+            _completion();
+        }
+        return;
+    }
+
+    // Index the events so each one can be scheduled on its own.
+    [_events release];
+    _events = [[NSMutableArray alloc] init];
+    [_recording enumerateEventsUsingBlock:^(iTermPTYRecordingEventType type,
+                                            NSTimeInterval timestamp,
+                                            NSData *output,
+                                            VT100GridSize size,
+                                            BOOL *stop) {
+        if (output) {
+            [_events addObject:@{ @"time": @(timestamp), @"output": output }];
+        } else {
+            [_events addObject:@{ @"time": @(timestamp), @"size": [NSValue valueWithGridSize:size] }];
+        }
+    }];
+    _nextEvent = 0;
+    _startTime = [NSDate timeIntervalSinceReferenceDate];
+    [self retain];
+    [self scheduleNextEvent];
+}
+
+- (void)cancel {
+    _canceled = YES;
+}
+
+#pragma mark - Private
+
+- (void)deliverEventOfType:(iTermPTYRecordingEventType)type
+                    output:(NSData *)output
+                      size:(VT100GridSize)size {
+    switch (type) {
+        case iTermPTYRecordingEventTypeOutput:
+            if (_outputHandler) {
+                _outputHandler(output);
+            }
+            break;
+        case iTermPTYRecordingEventTypeSize:
+            if (_sizeHandler) {
+                _sizeHandler(size);
+            }
+            break;
+    }
+}
+
+- (void)scheduleNextEvent {
+    if (_canceled) {
+        [self release];
+        return;
+    }
+    if (_nextEvent == _events.count) {
+        if (_completion) {
+            _completion();
+        }
+        [self release];
+        return;
+    }
+    const NSTimeInterval timestamp = [_events[_nextEvent][@"time"] doubleValue];
+    const NSTimeInterval delay = MAX(0, _startTime + timestamp - [NSDate timeIntervalSinceReferenceDate]);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                   dispatch_get_main_queue(), ^{
+                       [self deliverDueEvents];
+                   });
+}
+
+// Delivers every event whose time has come, so a burst of reads isn't spread over many runloop
+// iterations.
+- (void)deliverDueEvents {
+    const NSTimeInterval elapsed = [NSDate timeIntervalSinceReferenceDate] - _startTime;
+    while (!_canceled && _nextEvent < _events.count) {
+        NSDictionary *event = _events[_nextEvent];
+        if ([event[@"time"] doubleValue] > elapsed) {
+            break;
+        }
+        _nextEvent++;
+        if (event[@"output"]) {
+            [self deliverEventOfType:iTermPTYRecordingEventTypeOutput
+                              output:event[@"output"]
+                                size:VT100GridSizeMake(0, 0)];
+        } else {
+            [self deliverEventOfType:iTermPTYRecordingEventTypeSize
+                              output:nil
+                                size:[event[@"size"] gridSizeValue]];
+        }
+    }
+    [self scheduleNextEvent];
+}
+
+@end
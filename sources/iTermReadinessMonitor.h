@@ -0,0 +1,60 @@
+//
+//  iTermReadinessMonitor.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_OPTIONS(NSUInteger, iTermReadinessEvents) {
+    iTermReadinessEventsNone = 0,
+    iTermReadinessEventsRead = 1 << 0,
+    iTermReadinessEventsWrite = 1 << 1,
+
+    // Reported, never requested. The descriptor hung up with nothing left to read, or has a
+    // pending error.
+    iTermReadinessEventsError = 1 << 2,
+};
+
+typedef struct {
+    int fd;
+    iTermReadinessEvents events;
+} iTermReadinessEvent;
+
+// Waits for file descriptors to become readable or writable. Interest is registered once per
+// descriptor and persists across waits, so the cost of a wakeup depends on the number of ready
+// descriptors rather than the number of registered ones (except with the select backend, which is
+// only a fallback). Events are level-triggered.
+//
+// Not thread-safe: register descriptors and wait on the same thread.
+@interface iTermReadinessMonitor : NSObject
+
+// "kqueue", "epoll", or "select".
+@property(nonatomic, readonly) NSString *backendName;
+
+// kqueue on macOS and the BSDs, epoll on Linux, otherwise select. Returns a select monitor if the
+// preferred backend can't be created.
++ (instancetype)bestAvailableMonitor;
++ (instancetype)selectMonitor;
+
+- (instancetype)init NS_UNAVAILABLE;
+
+- (iTermReadinessEvents)interestForFileDescriptor:(int)fd;
+
+// Replaces the interest in |fd|. Makes no system call if it is unchanged. Passing
+// iTermReadinessEventsNone stops monitoring |fd| but it still counts as registered. Returns NO and
+// sets errno on failure, leaving the previous interest in place.
+- (BOOL)setInterest:(iTermReadinessEvents)interest forFileDescriptor:(int)fd;
+
+// Stops monitoring |fd|. Safe to call after |fd| has been closed, and for descriptors that were
+// never registered.
+- (void)forgetFileDescriptor:(int)fd;
+
+// Blocks until at least one event is ready. Fills in up to |capacity| events and returns how many
+// there were. Returns 0 if interrupted and -1 on a fatal error.
+- (int)waitForEvents:(iTermReadinessEvent *)events capacity:(int)capacity;
+
+// Registers every interest |monitor| has. Used to switch backends. Returns NO if any of them
+// couldn't be registered.
+- (BOOL)adoptInterestsFromMonitor:(iTermReadinessMonitor *)monitor;
+
+@end
@@ -0,0 +1,434 @@
+//
+//  iTermReadinessMonitor.m
+//  iTerm2
+//
+
+#import "iTermReadinessMonitor.h"
+
+#import "DebugLogging.h"
+
+#include <sys/select.h>
+
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define ITERM_READINESS_MONITOR_KQUEUE 1
+#include <sys/event.h>
+#elif defined(__linux__)
+#define ITERM_READINESS_MONITOR_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
+@interface iTermReadinessMonitor ()
+- (instancetype)initPrivate NS_DESIGNATED_INITIALIZER;
+
+// Subclasses implement this and -waitForEvents:capacity:.
+- (BOOL)applyInterest:(iTermReadinessEvents)interest
+     previousInterest:(iTermReadinessEvents)previousInterest
+    forFileDescriptor:(int)fd;
+@end
+
+@interface iTermSelectReadinessMonitor : iTermReadinessMonitor
+@end
+
+#if ITERM_READINESS_MONITOR_KQUEUE
+@interface iTermKqueueReadinessMonitor : iTermReadinessMonitor
+- (instancetype)initWithKqueue:(int)kq;
+@end
+#endif
+
+#if ITERM_READINESS_MONITOR_EPOLL
+@interface iTermEpollReadinessMonitor : iTermReadinessMonitor
+- (instancetype)initWithEpollFileDescriptor:(int)epfd;
+@end
+#endif
+
+@implementation iTermReadinessMonitor {
+  @protected
+    // Indexed by file descriptor. Grows as needed.
+    iTermReadinessEvents *_interests;
+    int _capacity;
+
+    // One more than the highest descriptor that has ever had an interest.
+    int _limit;
+}
+
++ (instancetype)bestAvailableMonitor {
+#if ITERM_READINESS_MONITOR_KQUEUE
+    const int kq = kqueue();
+    if (kq >= 0) {
+        return [[[iTermKqueueReadinessMonitor alloc] initWithKqueue:kq] autorelease];
+    }
+    DLog(@"kqueue failed: %s", strerror(errno));
+#elif ITERM_READINESS_MONITOR_EPOLL
+    const int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd >= 0) {
+        return [[[iTermEpollReadinessMonitor alloc] initWithEpollFileDescriptor:epfd] autorelease];
+    }
+    DLog(@"epoll_create1 failed: %s", strerror(errno));
+#endif
+    return [self selectMonitor];
+}
+
++ (instancetype)selectMonitor {
+    return [[[iTermSelectReadinessMonitor alloc] initPrivate] autorelease];
+}
+
+- (instancetype)initPrivate {
+    return [super init];
+}
+
+- (void)dealloc {
+    free(_interests);
+    [super dealloc];
+}
+
+- (NSString *)backendName {
+    return nil;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p %@>", self.class, self, self.backendName];
+}
+
+- (iTermReadinessEvents)interestForFileDescriptor:(int)fd {
+    if (fd < 0 || fd >= _limit) {
+        return iTermReadinessEventsNone;
+    }
+    return _interests[fd];
+}
+
+- (BOOL)setInterest:(iTermReadinessEvents)interest forFileDescriptor:(int)fd {
+    if (fd < 0) {
+        errno = EBADF;
+        return NO;
+    }
+    interest &= (iTermReadinessEventsRead | iTermReadinessEventsWrite);
+    const iTermReadinessEvents previousInterest = [self interestForFileDescriptor:fd];
+    if (interest == previousInterest) {
+        return YES;
+    }
+    if (![self applyInterest:interest previousInterest:previousInterest forFileDescriptor:fd]) {
+        return NO;
+    }
+    if (fd >= _capacity) {
+        const int newCapacity = MAX(fd + 1, _capacity * 2);
+        _interests = realloc(_interests, newCapacity * sizeof(*_interests));
+        memset(_interests + _capacity, 0, (newCapacity - _capacity) * sizeof(*_interests));
+        _capacity = newCapacity;
+    }
+    _interests[fd] = interest;
+    _limit = MAX(_limit, fd + 1);
+    return YES;
+}
+
+- (void)forgetFileDescriptor:(int)fd {
+    const iTermReadinessEvents previousInterest = [self interestForFileDescriptor:fd];
+    if (previousInterest == iTermReadinessEventsNone) {
+        return;
+    }
+    // Closing a descriptor removes it from kqueue and epoll on its own, so this may fail.
+    [self applyInterest:iTermReadinessEventsNone previousInterest:previousInterest forFileDescriptor:fd];
+    _interests[fd] = iTermReadinessEventsNone;
+}
+
+- (BOOL)adoptInterestsFromMonitor:(iTermReadinessMonitor *)monitor {
+    BOOL ok = YES;
+    for (int fd = 0; fd < monitor->_limit; fd++) {
+        const iTermReadinessEvents interest = monitor->_interests[fd];
+        if (interest != iTermReadinessEventsNone && ![self setInterest:interest forFileDescriptor:fd]) {
+            DLog(@"%@ could not adopt fd %d: %s", self, fd, strerror(errno));
+            ok = NO;
+        }
+    }
+    return ok;
+}
+
+- (BOOL)applyInterest:(iTermReadinessEvents)interest
+     previousInterest:(iTermReadinessEvents)previousInterest
+    forFileDescriptor:(int)fd {
+    [self doesNotRecognizeSelector:_cmd];
+    return NO;
+}
+
+- (int)waitForEvents:(iTermReadinessEvent *)events capacity:(int)capacity {
+    [self doesNotRecognizeSelector:_cmd];
+    return -1;
+}
+
+@end
+
+#pragma mark - select
+
+@implementation iTermSelectReadinessMonitor
+
+- (NSString *)backendName {
+    return @"select";
+}
+
+- (BOOL)applyInterest:(iTermReadinessEvents)interest
+     previousInterest:(iTermReadinessEvents)previousInterest
+    forFileDescriptor:(int)fd {
+    if (fd >= FD_SETSIZE) {
+        errno = EINVAL;
+        return NO;
+    }
+    return YES;
+}
+
+// Stops monitoring descriptors that were closed without being forgotten so select() doesn't keep
+// failing with EBADF.
+- (void)forgetClosedFileDescriptors {
+    for (int fd = 0; fd < _limit; fd++) {
+        if (_interests[fd] != iTermReadinessEventsNone && fcntl(fd, F_GETFD) < 0 && errno == EBADF) {
+            DLog(@"Forget closed fd %d", fd);
+            _interests[fd] = iTermReadinessEventsNone;
+        }
+    }
+}
+
+- (int)waitForEvents:(iTermReadinessEvent *)events capacity:(int)capacity {
+    fd_set rfds;
+    fd_set wfds;
+    fd_set efds;
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+    int highfd = -1;
+    for (int fd = 0; fd < _limit; fd++) {
+        const iTermReadinessEvents interest = _interests[fd];
+        if (interest == iTermReadinessEventsNone) {
+            continue;
+        }
+        if (interest & iTermReadinessEventsRead) {
+            FD_SET(fd, &rfds);
+        }
+        if (interest & iTermReadinessEventsWrite) {
+            FD_SET(fd, &wfds);
+        }
+        FD_SET(fd, &efds);
+        highfd = fd;
+    }
+
+    if (select(highfd + 1, &rfds, &wfds, &efds, NULL) < 0) {
+        if (errno == EBADF) {
+            // A descriptor was closed by another thread before it could be forgotten.
+            [self forgetClosedFileDescriptors];
+            return 0;
+        }
+        return errno == EINTR || errno == EAGAIN ? 0 : -1;
+    }
+
+    int count = 0;
+    for (int fd = 0; fd <= highfd && count < capacity; fd++) {
+        iTermReadinessEvents ready = iTermReadinessEventsNone;
+        if (FD_ISSET(fd, &rfds)) {
+            ready |= iTermReadinessEventsRead;
+        }
+        if (FD_ISSET(fd, &wfds)) {
+            ready |= iTermReadinessEventsWrite;
+        }
+        if (FD_ISSET(fd, &efds)) {
+            ready |= iTermReadinessEventsError;
+        }
+        if (ready != iTermReadinessEventsNone) {
+            events[count++] = (iTermReadinessEvent){ .fd = fd, .events = ready };
+        }
+    }
+    return count;
+}
+
+@end
+
+#pragma mark - kqueue
+
+#if ITERM_READINESS_MONITOR_KQUEUE
+
+@implementation iTermKqueueReadinessMonitor {
+    int _kq;
+}
+
+- (instancetype)initWithKqueue:(int)kq {
+    self = [super initPrivate];
+    if (self) {
+        _kq = kq;
+        fcntl(_kq, F_SETFD, FD_CLOEXEC);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    close(_kq);
+    [super dealloc];
+}
+
+- (NSString *)backendName {
+    return @"kqueue";
+}
+
+- (BOOL)applyInterest:(iTermReadinessEvents)interest
+     previousInterest:(iTermReadinessEvents)previousInterest
+    forFileDescriptor:(int)fd {
+    struct kevent changes[2];
+    int numberOfChanges = 0;
+    const struct {
+        iTermReadinessEvents event;
+        int16_t filter;
+    } filters[] = {
+        { iTermReadinessEventsRead, EVFILT_READ },
+        { iTermReadinessEventsWrite, EVFILT_WRITE }
+    };
+    for (size_t i = 0; i < sizeof(filters) / sizeof(*filters); i++) {
+        const BOOL wanted = !!(interest & filters[i].event);
+        if (wanted == !!(previousInterest & filters[i].event)) {
+            continue;
+        }
+        EV_SET(&changes[numberOfChanges++],
+               fd,
+               filters[i].filter,
+               (wanted ? EV_ADD : EV_DELETE) | EV_RECEIPT,
+               0,
+               0,
+               NULL);
+    }
+    if (numberOfChanges == 0) {
+        return YES;
+    }
+
+    // With EV_RECEIPT each change comes back with EV_ERROR set and its errno in data (0 for
+    // success), so one bad filter doesn't hide the result of the other.
+    struct kevent receipts[2];
+    const int n = kevent(_kq, changes, numberOfChanges, receipts, numberOfChanges, NULL);
+    if (n < 0) {
+        return NO;
+    }
+    BOOL ok = YES;
+    for (int i = 0; i < n; i++) {
+        if (!(receipts[i].flags & EV_ERROR) || receipts[i].data == 0) {
+            continue;
+        }
+        const int error = (int)receipts[i].data;
+        const BOOL deleted = (receipts[i].filter == EVFILT_READ ?
+                              !(interest & iTermReadinessEventsRead) :
+                              !(interest & iTermReadinessEventsWrite));
+        if (deleted && (error == ENOENT || error == EBADF)) {
+            // The kernel already dropped the filter, e.g., because the fd was closed.
+            continue;
+        }
+        errno = error;
+        ok = NO;
+    }
+    return ok;
+}
+
+- (int)waitForEvents:(iTermReadinessEvent *)events capacity:(int)capacity {
+    struct kevent kevents[capacity];
+    const int n = kevent(_kq, NULL, 0, kevents, capacity, NULL);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        iTermReadinessEvents ready = iTermReadinessEventsNone;
+        if (kevents[i].flags & EV_ERROR) {
+            ready = iTermReadinessEventsError;
+        } else if (kevents[i].filter == EVFILT_READ) {
+            ready = iTermReadinessEventsRead;
+            if ((kevents[i].flags & EV_EOF) && kevents[i].data == 0) {
+                ready |= iTermReadinessEventsError;
+            }
+        } else if (kevents[i].filter == EVFILT_WRITE) {
+            ready = iTermReadinessEventsWrite;
+            if (kevents[i].flags & EV_EOF) {
+                ready |= iTermReadinessEventsError;
+            }
+        }
+        events[i] = (iTermReadinessEvent){ .fd = (int)kevents[i].ident, .events = ready };
+    }
+    return n;
+}
+
+@end
+
+#endif  // ITERM_READINESS_MONITOR_KQUEUE
+
+#pragma mark - epoll
+
+#if ITERM_READINESS_MONITOR_EPOLL
+
+@implementation iTermEpollReadinessMonitor {
+    int _epfd;
+}
+
+- (instancetype)initWithEpollFileDescriptor:(int)epfd {
+    self = [super initPrivate];
+    if (self) {
+        _epfd = epfd;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    close(_epfd);
+    [super dealloc];
+}
+
+- (NSString *)backendName {
+    return @"epoll";
+}
+
+- (BOOL)applyInterest:(iTermReadinessEvents)interest
+     previousInterest:(iTermReadinessEvents)previousInterest
+    forFileDescriptor:(int)fd {
+    struct epoll_event event = { 0 };
+    event.data.fd = fd;
+    if (interest & iTermReadinessEventsRead) {
+        event.events |= EPOLLIN;
+    }
+    if (interest & iTermReadinessEventsWrite) {
+        event.events |= EPOLLOUT;
+    }
+    if (interest == iTermReadinessEventsNone) {
+        if (epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, &event) < 0 && errno != ENOENT && errno != EBADF) {
+            return NO;
+        }
+        return YES;
+    }
+    const int op = previousInterest == iTermReadinessEventsNone ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(_epfd, op, fd, &event) == 0) {
+        return YES;
+    }
+    // The kernel's registration can disagree with ours if the fd was closed and reused.
+    if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+        return epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &event) == 0;
+    }
+    if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+        return epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+    return NO;
+}
+
+- (int)waitForEvents:(iTermReadinessEvent *)events capacity:(int)capacity {
+    struct epoll_event epollEvents[capacity];
+    const int n = epoll_wait(_epfd, epollEvents, capacity, -1);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        iTermReadinessEvents ready = iTermReadinessEventsNone;
+        if (epollEvents[i].events & EPOLLIN) {
+            ready |= iTermReadinessEventsRead;
+        }
+        if (epollEvents[i].events & EPOLLOUT) {
+            ready |= iTermReadinessEventsWrite;
+        }
+        // Keep reporting a hangup as readable until the remaining input has been read.
+        if ((epollEvents[i].events & EPOLLERR) ||
+            (epollEvents[i].events & (EPOLLHUP | EPOLLIN)) == EPOLLHUP) {
+            ready |= iTermReadinessEventsError;
+        }
+        events[i] = (iTermReadinessEvent){ .fd = epollEvents[i].data.fd, .events = ready };
+    }
+    return n;
+}
+
+@end
+
+#endif  // ITERM_READINESS_MONITOR_EPOLL
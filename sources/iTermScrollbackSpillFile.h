@@ -0,0 +1,32 @@
+//
+//  iTermScrollbackSpillFile.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+// A temporary file that cold scrollback blocks are written to so they don't take memory. The file
+// is unlinked as soon as it's created, so it goes away with the process. Each piece of data starts
+// on a page boundary so it can be mapped back on its own, and freeing a piece deallocates its pages
+// (or truncates the file once nothing in it is live).
+//
+// Thread-safe. Blocks that own pieces are released on background queues.
+@interface iTermScrollbackSpillFile : NSObject
+
+// Bytes of data that haven't been freed.
+@property(nonatomic, readonly) long long liveBytes;
+
+// Returns nil if the file couldn't be created.
+- (instancetype)init;
+
+// Returns the offset of the data in the file, or -1 on failure.
+- (long long)appendData:(NSData *)data;
+
+// Maps data written by -appendData:. The mapping lasts as long as the returned object. Returns nil
+// on failure.
+- (NSData *)mappedDataAtOffset:(long long)offset length:(NSUInteger)length;
+
+// Frees data written by -appendData:.
+- (void)freeDataAtOffset:(long long)offset length:(NSUInteger)length;
+
+@end
@@ -0,0 +1,124 @@
+//
+//  iTermScrollbackSpillFile.m
+//  iTerm2
+//
+
+#import "iTermScrollbackSpillFile.h"
+
+#import "DebugLogging.h"
+
+#include <fcntl.h>
+#include <os/lock.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+@implementation iTermScrollbackSpillFile {
+    int _fd;
+    os_unfair_lock _lock;
+    // Where the next piece of data goes. Always a multiple of the page size.
+    long long _end;
+    long long _liveBytes;
+}
+
+static long long iTermScrollbackSpillFileRoundUpToPage(long long value) {
+    const long long pageSize = getpagesize();
+    return (value + pageSize - 1) / pageSize * pageSize;
+}
+
+- (instancetype)init {
+    self = [super init];
+    if (self) {
+        NSString *template = [NSTemporaryDirectory() stringByAppendingPathComponent:@"iTerm2-scrollback.XXXXXX"];
+        char *path = strdup(template.fileSystemRepresentation);
+        _fd = mkstemp(path);
+        if (_fd >= 0) {
+            unlink(path);
+        }
+        free(path);
+        if (_fd < 0) {
+            ELog(@"Failed to create scrollback spill file in %@: %s", NSTemporaryDirectory(), strerror(errno));
+            [self release];
+            return nil;
+        }
+        _lock = OS_UNFAIR_LOCK_INIT;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    close(_fd);
+    [super dealloc];
+}
+
+- (long long)liveBytes {
+    os_unfair_lock_lock(&_lock);
+    const long long result = _liveBytes;
+    os_unfair_lock_unlock(&_lock);
+    return result;
+}
+
+- (long long)appendData:(NSData *)data {
+    os_unfair_lock_lock(&_lock);
+    const long long offset = _end;
+    _end = iTermScrollbackSpillFileRoundUpToPage(offset + MAX(1, data.length));
+    _liveBytes += data.length;
+    os_unfair_lock_unlock(&_lock);
+
+    const uint8_t *bytes = data.bytes;
+    NSUInteger written = 0;
+    while (written < data.length) {
+        const ssize_t n = pwrite(_fd, bytes + written, data.length - written, offset + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ELog(@"Failed to write %@ bytes of scrollback at %@: %s", @(data.length), @(offset), strerror(errno));
+            [self freeDataAtOffset:offset length:data.length];
+            return -1;
+        }
+        written += n;
+    }
+    return offset;
+}
+
+- (NSData *)mappedDataAtOffset:(long long)offset length:(NSUInteger)length {
+    // offset is page aligned.
+    void *bytes = mmap(NULL, MAX(1, length), PROT_READ, MAP_PRIVATE, _fd, offset);
+    if (bytes == MAP_FAILED) {
+        ELog(@"Failed to map %@ bytes of scrollback at %@: %s", @(length), @(offset), strerror(errno));
+        return nil;
+    }
+    const size_t mappedLength = MAX(1, length);
+    return [[[NSData alloc] initWithBytesNoCopy:bytes
+                                         length:length
+                                    deallocator:^(void *mappedBytes, NSUInteger unused) {
+                                        munmap(mappedBytes, mappedLength);
+                                    }] autorelease];
+}
+
+- (void)freeDataAtOffset:(long long)offset length:(NSUInteger)length {
+    os_unfair_lock_lock(&_lock);
+    _liveBytes -= length;
+    if (_liveBytes == 0) {
+        // Start over with an empty file. This is how history dropped from the head finally goes
+        // away once everything after it was dropped too.
+        ftruncate(_fd, 0);
+        _end = 0;
+    } else {
+        // Give the pages back to the file system. Nothing else uses them because the next piece
+        // starts on the following page boundary. This is done with the lock held so the file can't
+        // be truncated and reused in the meantime.
+        fpunchhole_t punchhole = {
+            .fp_flags = 0,
+            .reserved = 0,
+            .fp_offset = offset,
+            .fp_length = iTermScrollbackSpillFileRoundUpToPage(offset + MAX(1, length)) - offset
+        };
+        if (fcntl(_fd, F_PUNCHHOLE, &punchhole) < 0) {
+            DLog(@"Failed to deallocate %@ bytes of scrollback at %@: %s", @(length), @(offset), strerror(errno));
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+@end
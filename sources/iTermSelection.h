@@ -148,6 +148,10 @@ typedef NS_ENUM(NSInteger, iTermSelectionMode) {
 // Subtract numLines from y coordinates.
 - (void)moveUpByLines:(int)numLines;
 
+// Add delta to y coordinates on or after line. The same text stays selected, so the delegate isn't
+// told.
+- (void)moveLinesFrom:(int)line by:(int)delta;
+
 // Indicates if the selection contains the coordinate.
 - (BOOL)containsCoord:(VT100GridCoord)coord;
 
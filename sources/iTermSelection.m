@@ -612,6 +612,29 @@ static VT100GridWindowedRange VT100GridWindowedRangeClampedToWidth(const VT100Gr
     }
 }
 
+static VT100GridCoord iTermSelectionCoordMovingLines(VT100GridCoord coord, int line, int delta) {
+    if (coord.y >= line) {
+        coord.y = MAX(0, coord.y + delta);
+    }
+    return coord;
+}
+
+- (void)moveLinesFrom:(int)line by:(int)delta {
+    if ([self haveLiveSelection]) {
+        _range.coordRange.start = iTermSelectionCoordMovingLines(_range.coordRange.start, line, delta);
+        _range.coordRange.end = iTermSelectionCoordMovingLines(_range.coordRange.end, line, delta);
+        _initialRange.coordRange.start = iTermSelectionCoordMovingLines(_initialRange.coordRange.start, line, delta);
+        _initialRange.coordRange.end = iTermSelectionCoordMovingLines(_initialRange.coordRange.end, line, delta);
+    }
+
+    for (iTermSubSelection *sub in _subSelections) {
+        VT100GridWindowedRange range = sub.range;
+        range.coordRange.start = iTermSelectionCoordMovingLines(range.coordRange.start, line, delta);
+        range.coordRange.end = iTermSelectionCoordMovingLines(range.coordRange.end, line, delta);
+        sub.range = range;
+    }
+}
+
 - (BOOL)rangeIsFlipped:(VT100GridWindowedRange)range {
     return VT100GridCoordOrder(range.coordRange.start, range.coordRange.end) == NSOrderedDescending;
 }
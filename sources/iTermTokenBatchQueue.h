@@ -0,0 +1,58 @@
+//
+//  iTermTokenBatchQueue.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "CVector.h"
+
+// A bounded, lock-free queue of parsed token batches with a single producer (the TaskNotifier
+// thread, which parses) and a single consumer (the main thread, which executes). Each batch is
+// the CVector of tokens from one read plus the number of bytes it came from.
+//
+// When the queue is full the producer should stop reading its file descriptor; the job then
+// blocks on write() until the main thread catches up. This replaces blocking the TaskNotifier
+// thread, which stalled every other session too.
+@interface iTermTokenBatchQueue : NSObject
+
+// Maximum number of batches.
+@property(nonatomic, readonly) int capacity;
+
+// Number of batches waiting. Safe to read from either thread.
+@property(nonatomic, readonly) int depth;
+@property(nonatomic, readonly) BOOL isFull;
+
+// Statistics. The latency of a batch is the time from when it was enqueued until it was dequeued.
+// Maintained by the consumer, except maximumDepth which is maintained by the producer.
+@property(nonatomic, readonly) long long numberOfBatchesDequeued;
+@property(nonatomic, readonly) int maximumDepth;
+@property(nonatomic, readonly) NSTimeInterval averageLatency;
+@property(nonatomic, readonly) NSTimeInterval maximumLatency;
+
+- (instancetype)initWithCapacity:(int)capacity NS_DESIGNATED_INITIALIZER;
+- (instancetype)init NS_UNAVAILABLE;
+
+// Producer only. Takes ownership of |vector| and its tokens on success. Returns NO if the queue
+// is full, in which case the caller still owns |vector|. Sets *wakeConsumer to YES if the consumer
+// isn't already scheduled to drain the queue, in which case the caller must make sure
+// -drainUsingBlock: gets called.
+- (BOOL)enqueueTokens:(const CVector *)vector
+               length:(int)length
+         wakeConsumer:(BOOL *)wakeConsumer;
+
+// Producer only. Like -enqueueTokens:length:wakeConsumer: but never fails: when the queue is full
+// the batch goes on an unbounded, locked overflow list that is drained after everything enqueued
+// before it. The queue reports itself full until the overflow is drained, so later batches can't
+// overtake it.
+- (void)enqueueOverflowTokens:(const CVector *)vector
+                       length:(int)length
+                 wakeConsumer:(BOOL *)wakeConsumer;
+
+// Consumer only. Calls |block| with each waiting batch in order. |block| takes ownership of the
+// vector. |block| may drain the queue again, e.g. from a nested run loop. Returns YES if the queue
+// was full before draining, meaning the producer may be waiting for room.
+- (BOOL)drainUsingBlock:(void (^)(CVector *vector, int length))block;
+
+- (void)resetStatistics;
+
+@end
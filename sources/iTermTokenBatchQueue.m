@@ -0,0 +1,210 @@
+//
+//  iTermTokenBatchQueue.m
+//  iTerm2
+//
+
+#import "iTermTokenBatchQueue.h"
+
+#import "VT100Token.h"
+
+#import <mach/mach_time.h>
+#import <os/lock.h>
+#import <stdatomic.h>
+
+typedef struct {
+    CVector vector;
+    int length;
+    uint64_t enqueueTime;
+} iTermTokenBatch;
+
+static NSTimeInterval iTermTokenBatchQueueSecondsFromMachTime(uint64_t elapsed) {
+    static mach_timebase_info_data_t timebase;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        mach_timebase_info(&timebase);
+    });
+    return (double)elapsed * timebase.numer / timebase.denom / NSEC_PER_SEC;
+}
+
+@implementation iTermTokenBatchQueue {
+    iTermTokenBatch *_batches;
+
+    // Only the consumer advances _head and only the producer advances _tail. They increase
+    // monotonically; the slot for a position is position % capacity.
+    _Atomic(uint64_t) _head;
+    _Atomic(uint64_t) _tail;
+
+    // Set by the producer when it asks for the consumer to be woken up; cleared by the consumer
+    // before it drains.
+    atomic_bool _consumerScheduled;
+
+    _Atomic(int) _maximumDepth;
+    NSTimeInterval _totalLatency;
+
+    // Batches that didn't fit, oldest first. The producer only appends while the ring is full or
+    // this is nonempty, so everything in it is newer than everything in the ring.
+    os_unfair_lock _overflowLock;
+    NSMutableData *_overflow;
+    _Atomic(int) _overflowCount;
+}
+
+- (instancetype)initWithCapacity:(int)capacity {
+    self = [super init];
+    if (self) {
+        _capacity = MAX(1, capacity);
+        _batches = calloc(_capacity, sizeof(iTermTokenBatch));
+        atomic_init(&_head, 0);
+        atomic_init(&_tail, 0);
+        atomic_init(&_consumerScheduled, false);
+        atomic_init(&_maximumDepth, 0);
+        _overflowLock = OS_UNFAIR_LOCK_INIT;
+        _overflow = [[NSMutableData alloc] init];
+        atomic_init(&_overflowCount, 0);
+    }
+    return self;
+}
+
+static void iTermTokenBatchQueueDestroyVector(CVector *vector) {
+    for (int j = 0; j < CVectorCount(vector); j++) {
+        [(VT100Token *)CVectorGetObject(vector, j) release];
+    }
+    CVectorDestroy(vector);
+}
+
+- (void)dealloc {
+    const uint64_t tail = atomic_load_explicit(&_tail, memory_order_acquire);
+    for (uint64_t i = atomic_load_explicit(&_head, memory_order_relaxed); i < tail; i++) {
+        iTermTokenBatchQueueDestroyVector(&_batches[i % _capacity].vector);
+    }
+    iTermTokenBatch *overflow = (iTermTokenBatch *)_overflow.mutableBytes;
+    for (int i = 0; i < atomic_load_explicit(&_overflowCount, memory_order_relaxed); i++) {
+        iTermTokenBatchQueueDestroyVector(&overflow[i].vector);
+    }
+    [_overflow release];
+    free(_batches);
+    [super dealloc];
+}
+
+- (int)depth {
+    const uint64_t tail = atomic_load_explicit(&_tail, memory_order_acquire);
+    const uint64_t head = atomic_load_explicit(&_head, memory_order_acquire);
+    return (int)(tail - head) + atomic_load_explicit(&_overflowCount, memory_order_acquire);
+}
+
+- (BOOL)isFull {
+    return self.depth >= _capacity;
+}
+
+- (int)maximumDepth {
+    return atomic_load_explicit(&_maximumDepth, memory_order_relaxed);
+}
+
+- (NSTimeInterval)averageLatency {
+    return _numberOfBatchesDequeued ? _totalLatency / _numberOfBatchesDequeued : 0;
+}
+
+- (BOOL)enqueueTokens:(const CVector *)vector
+               length:(int)length
+         wakeConsumer:(BOOL *)wakeConsumer {
+    const uint64_t tail = atomic_load_explicit(&_tail, memory_order_relaxed);
+    const uint64_t head = atomic_load_explicit(&_head, memory_order_acquire);
+    // Only the producer adds to the overflow, so if it's empty now it stays empty.
+    if (tail - head >= (uint64_t)_capacity ||
+        atomic_load_explicit(&_overflowCount, memory_order_acquire) > 0) {
+        *wakeConsumer = NO;
+        return NO;
+    }
+    iTermTokenBatch *batch = &_batches[tail % _capacity];
+    batch->vector = *vector;
+    batch->length = length;
+    batch->enqueueTime = mach_absolute_time();
+    // Publish the batch before the consumer can see the new tail.
+    atomic_store_explicit(&_tail, tail + 1, memory_order_release);
+
+    const int depth = (int)(tail + 1 - head);
+    if (depth > atomic_load_explicit(&_maximumDepth, memory_order_relaxed)) {
+        atomic_store_explicit(&_maximumDepth, depth, memory_order_relaxed);
+    }
+    *wakeConsumer = !atomic_exchange_explicit(&_consumerScheduled, true, memory_order_acq_rel);
+    return YES;
+}
+
+- (void)enqueueOverflowTokens:(const CVector *)vector
+                       length:(int)length
+                 wakeConsumer:(BOOL *)wakeConsumer {
+    if ([self enqueueTokens:vector length:length wakeConsumer:wakeConsumer]) {
+        return;
+    }
+    iTermTokenBatch batch = {
+        .vector = *vector,
+        .length = length,
+        .enqueueTime = mach_absolute_time()
+    };
+    os_unfair_lock_lock(&_overflowLock);
+    [_overflow appendBytes:&batch length:sizeof(batch)];
+    atomic_fetch_add_explicit(&_overflowCount, 1, memory_order_release);
+    os_unfair_lock_unlock(&_overflowLock);
+    *wakeConsumer = !atomic_exchange_explicit(&_consumerScheduled, true, memory_order_acq_rel);
+}
+
+// Removes the oldest overflow batch if the ring is still empty at |head|. The producer only appends
+// to the overflow under the lock after filling the ring, so checking the tail under the lock
+// guarantees no ring batch is older than the one returned. Returns NO if nothing was removed.
+- (BOOL)dequeueOverflowBatch:(iTermTokenBatch *)batch ifRingIsEmptyAtHead:(uint64_t)head {
+    os_unfair_lock_lock(&_overflowLock);
+    const BOOL found = (atomic_load_explicit(&_tail, memory_order_acquire) == head &&
+                        _overflow.length > 0);
+    if (found) {
+        memmove(batch, _overflow.bytes, sizeof(*batch));
+        [_overflow replaceBytesInRange:NSMakeRange(0, sizeof(*batch)) withBytes:NULL length:0];
+        atomic_fetch_sub_explicit(&_overflowCount, 1, memory_order_release);
+    }
+    os_unfair_lock_unlock(&_overflowLock);
+    return found;
+}
+
+- (BOOL)drainUsingBlock:(void (^)(CVector *vector, int length))block {
+    // Clear the flag first. A batch enqueued after this point either gets drained below or
+    // schedules another drain, so nothing is stranded.
+    atomic_store_explicit(&_consumerScheduled, false, memory_order_seq_cst);
+
+    BOOL wasFull = NO;
+    while (YES) {
+        // Reload the head each time: |block| may have drained batches itself.
+        const uint64_t head = atomic_load_explicit(&_head, memory_order_relaxed);
+        const uint64_t tail = atomic_load_explicit(&_tail, memory_order_acquire);
+        iTermTokenBatch batch;
+        if (head != tail) {
+            if (tail - head >= (uint64_t)_capacity) {
+                wasFull = YES;
+            }
+            batch = _batches[head % _capacity];
+            // Free the slot before executing so the producer can refill it in parallel.
+            atomic_store_explicit(&_head, head + 1, memory_order_release);
+        } else if ([self dequeueOverflowBatch:&batch ifRingIsEmptyAtHead:head]) {
+            wasFull = YES;
+        } else if (atomic_load_explicit(&_tail, memory_order_acquire) != head) {
+            // The producer refilled the ring.
+            continue;
+        } else {
+            break;
+        }
+        const NSTimeInterval latency =
+            iTermTokenBatchQueueSecondsFromMachTime(mach_absolute_time() - batch.enqueueTime);
+        _totalLatency += latency;
+        _maximumLatency = MAX(_maximumLatency, latency);
+        _numberOfBatchesDequeued++;
+
+        block(&batch.vector, batch.length);
+    }
+    return wasFull;
+}
+
+- (void)resetStatistics {
+    _numberOfBatchesDequeued = 0;
+    _totalLatency = 0;
+    _maximumLatency = 0;
+    atomic_store_explicit(&_maximumDepth, 0, memory_order_relaxed);
+}
+
+@end
@@ -0,0 +1,69 @@
+//
+//  iTermTrigramIndex.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+#import "iTermFindViewController.h"
+#import "ScreenChar.h"
+
+// Bloom filters of the trigrams in lines of scrollback, which let a literal search skip lines and
+// blocks that can't contain the search string. A filter never excludes text that could match, so
+// results are always verified by the regular search.
+//
+// Only printable ASCII is indexed, folded to lowercase. Case- and diacritic-insensitive searches can
+// match other characters in ways trigrams can't capture, so a line with any other character is
+// marked unindexable and always searched. Control characters break trigrams. iTerm2's private codes
+// (double-width character halves, tab fillers) don't appear in the strings that are searched, so
+// trigrams run across them.
+
+#define iTermTrigramLineFilterWords 4
+#define iTermTrigramBlockFilterWords 128
+
+typedef struct {
+    uint64_t words[iTermTrigramLineFilterWords];
+} iTermTrigramLineFilter;
+
+typedef struct {
+    uint64_t words[iTermTrigramBlockFilterWords];
+} iTermTrigramBlockFilter;
+
+// The trigrams of a search string.
+typedef struct {
+    iTermTrigramLineFilter line;
+    iTermTrigramBlockFilter block;
+} iTermTrigramQuery;
+
+// Returns NO if filters can't help find |needle|: it's a regex, shorter than three characters, or
+// not all printable ASCII.
+BOOL iTermTrigramQueryInit(iTermTrigramQuery *query, NSString *needle, iTermFindMode mode);
+
+// Adds the trigrams of cells [start, end) of |line| to the filters. Cells before |start| are the
+// earlier part of the same line, which was added before. Marks |lineFilter| unindexable and
+// returns NO if the cells have characters that aren't indexed. |blockFilter| only ever has trigrams
+// added, so the block must also remember whether any of its lines is unindexable.
+BOOL iTermTrigramFiltersAddCells(const screen_char_t *line,
+                                 int start,
+                                 int end,
+                                 iTermTrigramLineFilter *lineFilter,
+                                 iTermTrigramBlockFilter *blockFilter);
+
+NS_INLINE BOOL iTermTrigramLineFilterMayMatch(const iTermTrigramLineFilter *filter,
+                                              const iTermTrigramQuery *query) {
+    for (int i = 0; i < iTermTrigramLineFilterWords; i++) {
+        if ((filter->words[i] & query->line.words[i]) != query->line.words[i]) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+NS_INLINE BOOL iTermTrigramBlockFilterMayMatch(const iTermTrigramBlockFilter *filter,
+                                               const iTermTrigramQuery *query) {
+    for (int i = 0; i < iTermTrigramBlockFilterWords; i++) {
+        if ((filter->words[i] & query->block.words[i]) != query->block.words[i]) {
+            return NO;
+        }
+    }
+    return YES;
+}
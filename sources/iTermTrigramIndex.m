@@ -0,0 +1,127 @@
+//
+//  iTermTrigramIndex.m
+//  iTerm2
+//
+
+#import "iTermTrigramIndex.h"
+
+typedef NS_ENUM(int, iTermTrigramCharacterClass) {
+    iTermTrigramCharacterClassIndexed,
+    // Ends the current trigram without making the line unindexable.
+    iTermTrigramCharacterClassBreak,
+    // Doesn't appear in the searched string.
+    iTermTrigramCharacterClassSkipped,
+    iTermTrigramCharacterClassUnindexable,
+};
+
+NS_INLINE iTermTrigramCharacterClass iTermTrigramClassify(const screen_char_t *c, uint32_t *folded) {
+    if (c->complexChar || c->image) {
+        return iTermTrigramCharacterClassUnindexable;
+    }
+    const unichar code = c->code;
+    if (code >= ' ' && code < 0x7f) {
+        *folded = (code >= 'A' && code <= 'Z') ? code + ('a' - 'A') : code;
+        return iTermTrigramCharacterClassIndexed;
+    }
+    if (code < 0x80) {
+        return iTermTrigramCharacterClassBreak;
+    }
+    if (code >= ITERM2_PRIVATE_BEGIN && code <= ITERM2_PRIVATE_END) {
+        return iTermTrigramCharacterClassSkipped;
+    }
+    return iTermTrigramCharacterClassUnindexable;
+}
+
+NS_INLINE void iTermTrigramAdd(uint32_t trigram,
+                               iTermTrigramLineFilter *lineFilter,
+                               iTermTrigramBlockFilter *blockFilter) {
+    const uint32_t hash = trigram * 2654435761u;
+    const uint32_t lineBit = hash >> 24;
+    const uint32_t blockBit = (hash >> 3) & (iTermTrigramBlockFilterWords * 64 - 1);
+    lineFilter->words[lineBit / 64] |= 1ULL << (lineBit % 64);
+    blockFilter->words[blockBit / 64] |= 1ULL << (blockBit % 64);
+}
+
+BOOL iTermTrigramQueryInit(iTermTrigramQuery *query, NSString *needle, iTermFindMode mode) {
+    if (mode == iTermFindModeCaseSensitiveRegex || mode == iTermFindModeCaseInsensitiveRegex) {
+        return NO;
+    }
+    const NSUInteger length = needle.length;
+    if (length < 3) {
+        return NO;
+    }
+    memset(query, 0, sizeof(*query));
+    uint32_t trigram = 0;
+    for (NSUInteger i = 0; i < length; i++) {
+        screen_char_t c = { 0 };
+        c.code = [needle characterAtIndex:i];
+        uint32_t folded;
+        if (iTermTrigramClassify(&c, &folded) != iTermTrigramCharacterClassIndexed) {
+            return NO;
+        }
+        trigram = ((trigram << 7) | folded) & 0x1fffff;
+        if (i >= 2) {
+            iTermTrigramAdd(trigram, &query->line, &query->block);
+        }
+    }
+    return YES;
+}
+
+static BOOL iTermTrigramLineFilterIsUnindexable(const iTermTrigramLineFilter *filter) {
+    for (int i = 0; i < iTermTrigramLineFilterWords; i++) {
+        if (filter->words[i] != UINT64_MAX) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+BOOL iTermTrigramFiltersAddCells(const screen_char_t *line,
+                                 int start,
+                                 int end,
+                                 iTermTrigramLineFilter *lineFilter,
+                                 iTermTrigramBlockFilter *blockFilter) {
+    if (start > 0 && iTermTrigramLineFilterIsUnindexable(lineFilter)) {
+        return NO;
+    }
+    // Find the up to two characters before |start| that begin the first trigram.
+    uint32_t trigram = 0;
+    int count = 0;
+    uint32_t history[2];
+    for (int i = start - 1; i >= 0 && count < 2; i--) {
+        uint32_t folded;
+        const iTermTrigramCharacterClass characterClass = iTermTrigramClassify(&line[i], &folded);
+        if (characterClass == iTermTrigramCharacterClassSkipped) {
+            continue;
+        }
+        if (characterClass != iTermTrigramCharacterClassIndexed) {
+            break;
+        }
+        history[count++] = folded;
+    }
+    for (int i = count - 1; i >= 0; i--) {
+        trigram = (trigram << 7) | history[i];
+    }
+
+    for (int i = start; i < end; i++) {
+        uint32_t folded;
+        switch (iTermTrigramClassify(&line[i], &folded)) {
+            case iTermTrigramCharacterClassIndexed:
+                trigram = ((trigram << 7) | folded) & 0x1fffff;
+                if (++count >= 3) {
+                    iTermTrigramAdd(trigram, lineFilter, blockFilter);
+                }
+                break;
+            case iTermTrigramCharacterClassBreak:
+                trigram = 0;
+                count = 0;
+                break;
+            case iTermTrigramCharacterClassSkipped:
+                break;
+            case iTermTrigramCharacterClassUnindexable:
+                memset(lineFilter, 0xff, sizeof(*lineFilter));
+                return NO;
+        }
+    }
+    return YES;
+}
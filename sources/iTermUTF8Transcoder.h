@@ -0,0 +1,38 @@
+//
+//  iTermUTF8Transcoder.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(int, iTermUTF8TranscoderStop) {
+    // Stopped before a byte < 0x80. ASCII is parsed separately because it might be a control
+    // character or get translated into a line drawing character.
+    iTermUTF8TranscoderStopASCII,
+
+    // Consumed all the input.
+    iTermUTF8TranscoderStopEndOfInput,
+
+    // The input ends in the middle of a sequence that might yet become valid. The caller should
+    // wait for more bytes before trying again at the returned offset.
+    iTermUTF8TranscoderStopTruncated,
+
+    // An invalid sequence begins at the returned offset. Its length, as computed by
+    // decode_utf8_char (which gobbles the maximal subpart), is in *invalidLengthOut.
+    iTermUTF8TranscoderStopInvalid
+};
+
+// Decodes the run of non-ASCII UTF-8 at the start of |bytes| into UTF-16 in |output|, which must
+// have room for at least |length| code units (UTF-16 never needs more code units than UTF-8 needs
+// bytes). Returns the number of bytes consumed, which is the exact offset of whatever caused
+// decoding to stop. *outputLength receives the number of code units written.
+//
+// Results are identical to calling decode_utf8_char() in a loop and stopping at the first error,
+// partial sequence, or ASCII character. Runs of two- and three-byte sequences are validated
+// sixteen bytes at a time.
+int iTermUTF8TranscodeToUTF16(const unsigned char *bytes,
+                              int length,
+                              unichar *output,
+                              int *outputLength,
+                              iTermUTF8TranscoderStop *stopOut,
+                              int *invalidLengthOut);
@@ -0,0 +1,143 @@
+//
+//  iTermUTF8Transcoder.m
+//  iTerm2
+//
+
+#import "iTermUTF8Transcoder.h"
+
+#import "NSStringITerm.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// A block of sixteen bytes matches a pattern when (byte & mask) == value for every lane. Lanes
+// whose mask and value are both zero are don't-cares.
+typedef struct {
+    uint8_t mask[16];
+    uint8_t value[16];
+} iTermUTF8BlockPattern;
+
+// Five three-byte sequences (e.g., CJK) followed by one don't-care byte.
+static const iTermUTF8BlockPattern iTermUTF8ThreeByteBlock = {
+    .mask =  { 0xf0, 0xc0, 0xc0, 0xf0, 0xc0, 0xc0, 0xf0, 0xc0,
+               0xc0, 0xf0, 0xc0, 0xc0, 0xf0, 0xc0, 0xc0, 0x00 },
+    .value = { 0xe0, 0x80, 0x80, 0xe0, 0x80, 0x80, 0xe0, 0x80,
+               0x80, 0xe0, 0x80, 0x80, 0xe0, 0x80, 0x80, 0x00 }
+};
+
+// Eight two-byte sequences (e.g., Cyrillic, Greek, Hebrew).
+static const iTermUTF8BlockPattern iTermUTF8TwoByteBlock = {
+    .mask =  { 0xe0, 0xc0, 0xe0, 0xc0, 0xe0, 0xc0, 0xe0, 0xc0,
+               0xe0, 0xc0, 0xe0, 0xc0, 0xe0, 0xc0, 0xe0, 0xc0 },
+    .value = { 0xc0, 0x80, 0xc0, 0x80, 0xc0, 0x80, 0xc0, 0x80,
+               0xc0, 0x80, 0xc0, 0x80, 0xc0, 0x80, 0xc0, 0x80 }
+};
+
+static inline BOOL iTermUTF8BlockMatches(const unsigned char *bytes,
+                                         const iTermUTF8BlockPattern *pattern) {
+#if defined(__SSE2__)
+    const __m128i chunk = _mm_loadu_si128((const __m128i *)bytes);
+    const __m128i mask = _mm_loadu_si128((const __m128i *)pattern->mask);
+    const __m128i value = _mm_loadu_si128((const __m128i *)pattern->value);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(chunk, mask), value)) == 0xffff;
+#elif defined(__ARM_NEON)
+    const uint8x16_t chunk = vld1q_u8(bytes);
+    const uint8x16_t equal = vceqq_u8(vandq_u8(chunk, vld1q_u8(pattern->mask)),
+                                      vld1q_u8(pattern->value));
+    return vminvq_u8(equal) == 0xff;
+#else
+    uint64_t chunk[2], mask[2], value[2];
+    memcpy(chunk, bytes, sizeof(chunk));
+    memcpy(mask, pattern->mask, sizeof(mask));
+    memcpy(value, pattern->value, sizeof(value));
+    return ((chunk[0] & mask[0]) == value[0] &&
+            (chunk[1] & mask[1]) == value[1]);
+#endif
+}
+
+// The block patterns only check the shape of each sequence. These leading bytes also need their
+// second byte range-checked (overlong encodings and surrogates), so leave them to the slow path.
+static inline BOOL iTermUTF8ThreeByteLeadIsUnrestricted(unsigned char c) {
+    return c != 0xe0 && c != 0xed;
+}
+
+static inline BOOL iTermUTF8TwoByteLeadIsUnrestricted(unsigned char c) {
+    return c >= 0xc2;
+}
+
+int iTermUTF8TranscodeToUTF16(const unsigned char *bytes,
+                              int length,
+                              unichar *output,
+                              int *outputLength,
+                              iTermUTF8TranscoderStop *stopOut,
+                              int *invalidLengthOut) {
+    int i = 0;
+    int o = 0;
+    *invalidLengthOut = 0;
+    while (i < length) {
+        if (i + 16 <= length) {
+            const unsigned char *p = bytes + i;
+            if (iTermUTF8BlockMatches(p, &iTermUTF8ThreeByteBlock) &&
+                iTermUTF8ThreeByteLeadIsUnrestricted(p[0]) &&
+                iTermUTF8ThreeByteLeadIsUnrestricted(p[3]) &&
+                iTermUTF8ThreeByteLeadIsUnrestricted(p[6]) &&
+                iTermUTF8ThreeByteLeadIsUnrestricted(p[9]) &&
+                iTermUTF8ThreeByteLeadIsUnrestricted(p[12])) {
+                for (int j = 0; j < 15; j += 3) {
+                    output[o++] = (((p[j] & 0x0f) << 12) |
+                                   ((p[j + 1] & 0x3f) << 6) |
+                                   (p[j + 2] & 0x3f));
+                }
+                i += 15;
+                continue;
+            }
+            if (iTermUTF8BlockMatches(p, &iTermUTF8TwoByteBlock)) {
+                BOOL ok = YES;
+                for (int j = 0; j < 16; j += 2) {
+                    ok = ok && iTermUTF8TwoByteLeadIsUnrestricted(p[j]);
+                }
+                if (ok) {
+                    for (int j = 0; j < 16; j += 2) {
+                        output[o++] = ((p[j] & 0x1f) << 6) | (p[j + 1] & 0x3f);
+                    }
+                    i += 16;
+                    continue;
+                }
+            }
+        }
+
+        // Slow path: one code point at a time.
+        if (bytes[i] < 0x80) {
+            *outputLength = o;
+            *stopOut = iTermUTF8TranscoderStopASCII;
+            return i;
+        }
+        int theChar = 0;
+        const int result = decode_utf8_char(bytes + i, length - i, &theChar);
+        if (result == 0) {
+            *outputLength = o;
+            *stopOut = iTermUTF8TranscoderStopTruncated;
+            return i;
+        }
+        if (result < 0) {
+            *outputLength = o;
+            *stopOut = iTermUTF8TranscoderStopInvalid;
+            *invalidLengthOut = -result;
+            return i;
+        }
+        if (theChar >= 0x10000) {
+            const int offset = theChar - 0x10000;
+            output[o++] = 0xd800 + (offset >> 10);
+            output[o++] = 0xdc00 + (offset & 0x3ff);
+        } else {
+            output[o++] = theChar;
+        }
+        i += result;
+    }
+    *outputLength = o;
+    *stopOut = iTermUTF8TranscoderStopEndOfInput;
+    return i;
+}
@@ -0,0 +1,48 @@
+//
+//  iTermUnicodeProperties.h
+//  iTerm2
+//
+
+#import <Foundation/Foundation.h>
+
+// Per-code point properties that decide how many cells a character takes. They come from the
+// character sets in NSCharacterSet+iTerm but take one table lookup to query.
+typedef NS_OPTIONS(uint8_t, iTermUnicodeProperty) {
+    iTermUnicodePropertyFullWidth = 1 << 0,
+    iTermUnicodePropertyAmbiguousWidth = 1 << 1,
+    iTermUnicodePropertyZeroWidthSpace = 1 << 2,
+    // Regardless of the aggressiveBaseCharacterDetection setting.
+    iTermUnicodePropertySpacingCombiningMark = 1 << 3,
+    // The code unit may join a grapheme cluster with its neighbors or otherwise needs more than a
+    // one-to-one conversion to a cell: marks, joiners, controls and format characters, surrogates,
+    // Hangul jamo, and iTerm2's private codes. A string with none of these maps to cells directly.
+    iTermUnicodePropertyNeedsGraphemeHandling = 1 << 4,
+};
+
+#define iTermUnicodePropertyTableNumberOfBlocks (0x110000 >> 8)
+
+// A two-stage table. Code points are split into blocks of 256 and identical blocks are stored
+// once, so the whole table is a few tens of kilobytes.
+typedef struct {
+    // Index in |blocks| of each block of 256 code points.
+    uint16_t blockIndex[iTermUnicodePropertyTableNumberOfBlocks];
+    // 256 iTermUnicodeProperty's per block.
+    uint8_t *blocks;
+} iTermUnicodePropertyTable;
+
+// Tables are built on first use and never freed. Safe to call from any thread.
+const iTermUnicodePropertyTable *iTermUnicodePropertyTableForVersion(NSInteger version);
+
+NS_INLINE iTermUnicodeProperty iTermUnicodePropertiesOfCodePoint(const iTermUnicodePropertyTable *table,
+                                                                 UTF32Char codePoint) {
+    if (codePoint > 0x10ffff) {
+        return 0;
+    }
+    return table->blocks[((uint32_t)table->blockIndex[codePoint >> 8] << 8) | (codePoint & 0xff)];
+}
+
+NS_INLINE BOOL iTermUnicodePropertiesAreDoubleWidth(iTermUnicodeProperty properties,
+                                                    BOOL ambiguousIsDoubleWidth) {
+    return ((properties & iTermUnicodePropertyFullWidth) ||
+            (ambiguousIsDoubleWidth && (properties & iTermUnicodePropertyAmbiguousWidth)));
+}
@@ -0,0 +1,126 @@
+//
+//  iTermUnicodeProperties.m
+//  iTerm2
+//
+
+#import "iTermUnicodeProperties.h"
+
+#import "DebugLogging.h"
+#import "iTermMalloc.h"
+#import "NSCharacterSet+iTerm.h"
+#import "ScreenChar.h"
+
+static const int iTermUnicodePropertyBlockSize = 256;
+static const UTF32Char iTermUnicodePropertyNumberOfCodePoints = 0x110000;
+static const NSUInteger iTermUnicodePropertyPlaneBitmapSize = 8192;
+
+static void iTermUnicodePropertiesAddPlane(uint8_t *properties,
+                                           int plane,
+                                           const uint8_t *bitmap,
+                                           iTermUnicodeProperty property) {
+    if (plane > 16) {
+        return;
+    }
+    const UTF32Char base = (UTF32Char)plane << 16;
+    for (NSUInteger i = 0; i < iTermUnicodePropertyPlaneBitmapSize; i++) {
+        uint8_t byte = bitmap[i];
+        while (byte) {
+            const int bit = __builtin_ctz(byte);
+            byte &= byte - 1;
+            properties[base + i * 8 + bit] |= property;
+        }
+    }
+}
+
+// Sets |property| for each member of |characterSet|. The bitmap representation holds the basic
+// multilingual plane followed by a plane number and bitmap for each other nonempty plane.
+static void iTermUnicodePropertiesAddCharacterSet(uint8_t *properties,
+                                                  NSCharacterSet *characterSet,
+                                                  iTermUnicodeProperty property) {
+    NSData *data = [characterSet bitmapRepresentation];
+    const uint8_t *bytes = data.bytes;
+    const NSUInteger length = data.length;
+    if (length < iTermUnicodePropertyPlaneBitmapSize) {
+        return;
+    }
+    iTermUnicodePropertiesAddPlane(properties, 0, bytes, property);
+    for (NSUInteger offset = iTermUnicodePropertyPlaneBitmapSize;
+         offset + 1 + iTermUnicodePropertyPlaneBitmapSize <= length;
+         offset += 1 + iTermUnicodePropertyPlaneBitmapSize) {
+        iTermUnicodePropertiesAddPlane(properties, bytes[offset], bytes + offset + 1, property);
+    }
+}
+
+static void iTermUnicodePropertyTableInit(iTermUnicodePropertyTable *table, NSInteger version) {
+    uint8_t *properties = calloc(iTermUnicodePropertyNumberOfCodePoints, 1);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet fullWidthCharacterSetForUnicodeVersion:version],
+                                          iTermUnicodePropertyFullWidth);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet ambiguousWidthCharacterSetForUnicodeVersion:version],
+                                          iTermUnicodePropertyAmbiguousWidth);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet zeroWidthSpaceCharacterSetForUnicodeVersion:version],
+                                          iTermUnicodePropertyZeroWidthSpace);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet allSpacingCombiningMarksForUnicodeVersion:12],
+                                          iTermUnicodePropertySpacingCombiningMark);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet nonBaseCharacterSet],
+                                          iTermUnicodePropertyNeedsGraphemeHandling);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet controlCharacterSet],
+                                          iTermUnicodePropertyNeedsGraphemeHandling);
+    iTermUnicodePropertiesAddCharacterSet(properties,
+                                          [NSCharacterSet zeroWidthSpaceCharacterSetForUnicodeVersion:version],
+                                          iTermUnicodePropertyNeedsGraphemeHandling);
+    const NSRange graphemeRanges[] = {
+        NSMakeRange(0xd800, 0x800),  // Surrogates
+        NSMakeRange(0x1100, 0x100),  // Hangul jamo
+        NSMakeRange(0xa960, 0x20),  // Hangul jamo extended A
+        NSMakeRange(0xd7b0, 0x50),  // Hangul jamo extended B
+        NSMakeRange(0x0d4e, 1),  // Malayalam letter dot reph (prepended)
+        NSMakeRange(0x0e33, 1),  // Thai sara am (spacing mark)
+        NSMakeRange(0x0eb3, 1),  // Lao vowel sign am (spacing mark)
+        NSMakeRange(ITERM2_PRIVATE_BEGIN, ITERM2_PRIVATE_END - ITERM2_PRIVATE_BEGIN + 1),
+    };
+    for (size_t i = 0; i < sizeof(graphemeRanges) / sizeof(*graphemeRanges); i++) {
+        for (NSUInteger c = graphemeRanges[i].location; c < NSMaxRange(graphemeRanges[i]); c++) {
+            properties[c] |= iTermUnicodePropertyNeedsGraphemeHandling;
+        }
+    }
+
+    // Store each distinct block once.
+    NSMutableDictionary<NSData *, NSNumber *> *indexes = [NSMutableDictionary dictionary];
+    NSMutableData *blocks = [NSMutableData data];
+    for (int i = 0; i < iTermUnicodePropertyTableNumberOfBlocks; i++) {
+        NSData *block = [NSData dataWithBytesNoCopy:properties + i * iTermUnicodePropertyBlockSize
+                                             length:iTermUnicodePropertyBlockSize
+                                       freeWhenDone:NO];
+        NSNumber *index = indexes[block];
+        if (!index) {
+            index = @(indexes.count);
+            indexes[[[block copy] autorelease]] = index;
+            [blocks appendData:block];
+        }
+        table->blockIndex[i] = index.unsignedShortValue;
+    }
+    table->blocks = iTermMalloc(blocks.length);
+    memcpy(table->blocks, blocks.bytes, blocks.length);
+    free(properties);
+    DLog(@"Unicode %@ property table has %@ distinct blocks", @(version), @(indexes.count));
+}
+
+const iTermUnicodePropertyTable *iTermUnicodePropertyTableForVersion(NSInteger version) {
+    // Only the width tables differ between versions, and only 8 vs 9 and later.
+    static iTermUnicodePropertyTable sTable8;
+    static iTermUnicodePropertyTable sTable9;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        @autoreleasepool {
+            iTermUnicodePropertyTableInit(&sTable8, 8);
+            iTermUnicodePropertyTableInit(&sTable9, 9);
+        }
+    });
+    return version >= 9 ? &sTable9 : &sTable8;
+}